@@ -0,0 +1,49 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <algorithm>
+
+Arena::~Arena()
+{
+    for (Block& block : m_blocks)
+        free(block.m_data);
+}
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+    if (!size)
+        size = 1;
+    for (; m_block < m_blocks.size(); m_block++, m_offset = 0)
+    {
+        Block& block = m_blocks[m_block];
+        // Blocks come from malloc, which is aligned for any fundamental type, so aligning the offset is enough
+        size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+        if (offset + size <= block.m_size)
+        {
+            m_used += offset + size - m_offset;
+            m_peakUsed = std::max(m_peakUsed, m_used);
+            m_offset = offset + size;
+            return block.m_data + offset;
+        }
+    }
+
+    // Larger requests get a block of their own, which is reused after a reset like the others
+    Block block;
+    block.m_size = std::max(m_blockSize, size);
+    block.m_data = (uint8_t*)malloc(block.m_size);
+    if (!block.m_data)
+        throw std::bad_alloc();
+    m_blocks.push_back(block);
+    m_reserved += block.m_size;
+    m_block = m_blocks.size() - 1;
+    m_offset = size;
+    m_used += size;
+    m_peakUsed = std::max(m_peakUsed, m_used);
+    return block.m_data;
+}
+
+void Arena::reset()
+{
+    m_block = 0;
+    m_offset = 0;
+    m_used = 0;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <inttypes.h>
+#include <string.h>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Monotonic allocator for short-lived data. Allocations bump an offset through large blocks and are never freed one
+// by one; reset() makes all blocks reusable at once, so data that is rebuilt over and over (like the temporaries of
+// every parsed object) stops touching the heap once the blocks are large enough. Destructors are not run.
+class Arena
+{
+public:
+    explicit Arena(size_t blockSize = 256 * 1024) : m_blockSize(blockSize) {}
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment);
+    template<typename T>
+    T* allocateArray(size_t count)
+    {
+        return (T*)allocate(sizeof(T) * count, alignof(T));
+    }
+    // Everything allocated so far becomes invalid, the blocks are kept
+    void reset();
+
+    size_t bytesUsed() const { return m_used; }
+    size_t peakBytesUsed() const { return m_peakUsed; }
+    size_t bytesReserved() const { return m_reserved; }
+    size_t blockCount() const { return m_blocks.size(); }
+private:
+    struct Block
+    {
+        uint8_t* m_data;
+        size_t m_size;
+    };
+    std::vector<Block> m_blocks;
+    size_t m_blockSize;
+    // Block the next allocation is tried in and the offset into it
+    size_t m_block = 0;
+    size_t m_offset = 0;
+    size_t m_used = 0;
+    size_t m_peakUsed = 0;
+    size_t m_reserved = 0;
+};
+
+// Growable array of trivially copyable values inside an arena. Growing copies into a new allocation and leaves the
+// old one to the arena, so the final size should be reserved up front when it is known.
+template<typename T>
+class ArenaVector
+{
+public:
+    explicit ArenaVector(Arena& arena) : m_arena(&arena) {}
+
+    void reserve(size_t capacity)
+    {
+        if (capacity <= m_capacity)
+            return;
+        T* data = m_arena->allocateArray<T>(capacity);
+        if (m_size)
+            memcpy(data, m_data, m_size * sizeof(T));
+        m_data = data;
+        m_capacity = capacity;
+    }
+    void push_back(const T& value)
+    {
+        if (m_size == m_capacity)
+            reserve(m_capacity ? m_capacity * 2 : 64);
+        m_data[m_size++] = value;
+    }
+    // Forgets the contents without giving anything back, call it before the arena is reset
+    void clear()
+    {
+        m_data = nullptr;
+        m_size = 0;
+        m_capacity = 0;
+    }
+    size_t size() const { return m_size; }
+    T& operator[](size_t index) { return m_data[index]; }
+    const T& operator[](size_t index) const { return m_data[index]; }
+private:
+    Arena* m_arena;
+    T* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+};
+
+// Owns objects of one type, constructed in blocks of BlockSize and destroyed together with the pool. Pointers stay
+// valid until then. Pools filled on different threads can be merged with splice().
+template<typename T, size_t BlockSize = 64>
+class Pool
+{
+public:
+    Pool() {}
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+    ~Pool()
+    {
+        for (std::unique_ptr<Block>& block : m_blocks)
+        {
+            for (size_t i = 0; i < block->m_count; i++)
+                block->object(i)->~T();
+        }
+    }
+
+    template<typename... Args>
+    T* create(Args&&... args)
+    {
+        if (m_blocks.empty() || m_blocks.back()->m_count == BlockSize)
+            m_blocks.push_back(std::make_unique<Block>());
+        Block& block = *m_blocks.back();
+        T* object = new (block.object(block.m_count)) T(std::forward<Args>(args)...);
+        block.m_count++;
+        m_size++;
+        return object;
+    }
+    // Takes over the objects of other, which is empty afterwards
+    void splice(Pool& other)
+    {
+        for (std::unique_ptr<Block>& block : other.m_blocks)
+            m_blocks.push_back(std::move(block));
+        m_size += other.m_size;
+        other.m_blocks.clear();
+        other.m_size = 0;
+    }
+    size_t size() const { return m_size; }
+private:
+    struct Block
+    {
+        alignas(T) uint8_t m_storage[sizeof(T) * BlockSize];
+        size_t m_count = 0;
+        T* object(size_t index) { return (T*)(m_storage + sizeof(T) * index); }
+    };
+    std::vector<std::unique_ptr<Block>> m_blocks;
+    size_t m_size = 0;
+};
@@ -0,0 +1,610 @@
+#include "benchmark.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "util.h"
+#include "memorytracker.h"
+
+#ifdef _WIN32
+#include "GLFW/glfw3.h"
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+using namespace Benchmark;
+
+namespace
+{
+#ifdef _WIN32
+    GLFWwindow* s_offscreenWindow = nullptr;
+#else
+    EGLDisplay s_display = EGL_NO_DISPLAY;
+    EGLContext s_context = EGL_NO_CONTEXT;
+#endif
+
+    glm::vec3 lerp(const glm::vec3& a, const glm::vec3& b, float t)
+    {
+        return a + (b - a) * t;
+    }
+
+    double percentile(std::vector<double> values, double percent)
+    {
+        if (values.empty())
+            return 0.0;
+        size_t rank = (size_t)(percent / 100.0 * (double)(values.size() - 1) + 0.5);
+        rank = std::min(rank, values.size() - 1);
+        std::nth_element(values.begin(), values.begin() + rank, values.end());
+        return values[rank];
+    }
+}
+
+void CameraPath::addKey(const PathKey& key)
+{
+    m_keys.push_back(key);
+}
+
+bool CameraPath::sample(double time, PathKey& out) const
+{
+    if (m_keys.empty())
+        return false;
+    if (time <= m_keys.front().m_time)
+    {
+        out = m_keys.front();
+        return true;
+    }
+    if (time >= m_keys.back().m_time)
+    {
+        out = m_keys.back();
+        return true;
+    }
+
+    auto iter = std::upper_bound(m_keys.begin(), m_keys.end(), time, [](double t, const PathKey& key) { return t < key.m_time; });
+    const PathKey& b = *iter;
+    const PathKey& a = *(iter - 1);
+    double span = b.m_time - a.m_time;
+    float t = span > 0.0 ? (float)((time - a.m_time) / span) : 0.0f;
+
+    out = a;
+    out.m_time = time;
+    out.m_cameraPosition = lerp(a.m_cameraPosition, b.m_cameraPosition, t);
+    out.m_yaw = a.m_yaw + (b.m_yaw - a.m_yaw) * t;
+    out.m_pitch = a.m_pitch + (b.m_pitch - a.m_pitch) * t;
+    out.m_directionalLightDirection = lerp(a.m_directionalLightDirection, b.m_directionalLightDirection, t);
+    out.m_spotLightPosition = lerp(a.m_spotLightPosition, b.m_spotLightPosition, t);
+    out.m_spotLightDirection = lerp(a.m_spotLightDirection, b.m_spotLightDirection, t);
+    out.m_pointLightPosition = lerp(a.m_pointLightPosition, b.m_pointLightPosition, t);
+    return true;
+}
+
+double CameraPath::duration() const
+{
+    return m_keys.empty() ? 0.0 : m_keys.back().m_time - m_keys.front().m_time;
+}
+
+bool CameraPath::load(const char* filename, std::string* errString)
+{
+    std::vector<char> buffer;
+    if (!Util::loadFileToBuffer(filename, buffer, false, true))
+    {
+        if (errString)
+            *errString = std::string("Cannot open camera path: ") + filename;
+        return false;
+    }
+
+    m_keys.clear();
+    const char* line = &buffer[0];
+    while (*line)
+    {
+        const char* next = strchr(line, '\n');
+        if (line[0] != '#' && line[0] != '\n' && line[0] != '\r')
+        {
+            PathKey key;
+            int read = sscanf(line, "%lf %f %f %f %f %f %d %f %f %f %f %f %f %f %f %f %f %f %f",
+                &key.m_time,
+                &key.m_cameraPosition.x, &key.m_cameraPosition.y, &key.m_cameraPosition.z,
+                &key.m_yaw, &key.m_pitch, &key.m_lightType,
+                &key.m_directionalLightDirection.x, &key.m_directionalLightDirection.y, &key.m_directionalLightDirection.z,
+                &key.m_spotLightPosition.x, &key.m_spotLightPosition.y, &key.m_spotLightPosition.z,
+                &key.m_spotLightDirection.x, &key.m_spotLightDirection.y, &key.m_spotLightDirection.z,
+                &key.m_pointLightPosition.x, &key.m_pointLightPosition.y, &key.m_pointLightPosition.z);
+            if (read != 19)
+            {
+                if (errString)
+                    *errString = std::string("Malformed camera path key in ") + filename;
+                return false;
+            }
+            if (!m_keys.empty() && key.m_time < m_keys.back().m_time)
+            {
+                if (errString)
+                    *errString = std::string("Camera path keys are not sorted by time in ") + filename;
+                return false;
+            }
+            m_keys.push_back(key);
+        }
+        if (!next)
+            break;
+        line = next + 1;
+    }
+
+    if (m_keys.empty())
+    {
+        if (errString)
+            *errString = std::string("Camera path is empty: ") + filename;
+        return false;
+    }
+    return true;
+}
+
+bool CameraPath::save(const char* filename, std::string* errString) const
+{
+    FILE* f = fopen(filename, "wb");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot write camera path: ") + filename;
+        return false;
+    }
+
+    fprintf(f, "# time camPos.xyz yaw pitch lightType dirLightDir.xyz spotPos.xyz spotDir.xyz pointPos.xyz\n");
+    for (const PathKey& key : m_keys)
+    {
+        fprintf(f, "%.6f %.4f %.4f %.4f %.4f %.4f %d %.5f %.5f %.5f %.4f %.4f %.4f %.5f %.5f %.5f %.4f %.4f %.4f\n",
+            key.m_time,
+            key.m_cameraPosition.x, key.m_cameraPosition.y, key.m_cameraPosition.z,
+            key.m_yaw, key.m_pitch, key.m_lightType,
+            key.m_directionalLightDirection.x, key.m_directionalLightDirection.y, key.m_directionalLightDirection.z,
+            key.m_spotLightPosition.x, key.m_spotLightPosition.y, key.m_spotLightPosition.z,
+            key.m_spotLightDirection.x, key.m_spotLightDirection.y, key.m_spotLightDirection.z,
+            key.m_pointLightPosition.x, key.m_pointLightPosition.y, key.m_pointLightPosition.z);
+    }
+    fclose(f);
+    return true;
+}
+
+bool Benchmark::parseArguments(int argc, char** argv, Options& options, std::string* errString)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool hasValue = true;
+
+        if (!strcmp(arg, "--benchmark") && value)
+        {
+            options.m_enabled = true;
+            options.m_pathFile = value;
+        }
+        else if (!strcmp(arg, "--model") && value)
+            options.m_modelFile = value;
+        else if (!strcmp(arg, "--output") && value)
+            options.m_outputFile = value;
+        else if (!strcmp(arg, "--dump-frames") && value)
+            options.m_dumpDirectory = value;
+        else if (!strcmp(arg, "--dump-interval") && value)
+            options.m_dumpInterval = std::max(1, atoi(value));
+        else if (!strcmp(arg, "--baseline") && value)
+            options.m_baselineFile = value;
+        else if (!strcmp(arg, "--write-baseline") && value)
+            options.m_writeBaselineFile = value;
+        else if (!strcmp(arg, "--trace") && value)
+            options.m_traceFile = value;
+        else if (!strcmp(arg, "--memory-report") && value)
+            options.m_memoryReportFile = value;
+        else if (!strcmp(arg, "--memory-budget") && value && atoi(value) >= 0)
+            options.m_memoryBudgetMB = (uint32_t)atoi(value);
+        else if (!strcmp(arg, "--cpu-geometry") && value)
+        {
+            if (strcmp(value, "keep") && strcmp(value, "compact") && strcmp(value, "release"))
+            {
+                if (errString)
+                    *errString = std::string("Invalid CPU geometry residency, expected keep, compact or release: ") + value;
+                return false;
+            }
+            options.m_cpuGeometry = value;
+        }
+        else if (!strcmp(arg, "--tolerance") && value)
+            options.m_tolerance = atof(value);
+        else if (!strcmp(arg, "--warmup") && value)
+            options.m_warmupFrames = std::max(0, atoi(value));
+        else if (!strcmp(arg, "--fps") && value && atof(value) > 0.0)
+            options.m_timeStep = 1.0 / atof(value);
+        else if (!strcmp(arg, "--light-counts") && value)
+        {
+            std::vector<std::string> counts;
+            Util::split(value, ',', counts);
+            options.m_lightCounts.clear();
+            for (const std::string& count : counts)
+            {
+                int lights = atoi(count.c_str());
+                if (lights <= 0)
+                {
+                    if (errString)
+                        *errString = std::string("Invalid light counts, expected a comma separated list: ") + value;
+                    return false;
+                }
+                options.m_lightCounts.push_back((uint32_t)lights);
+            }
+        }
+        else if (!strcmp(arg, "--threads") && value && atoi(value) >= 0)
+            options.m_threads = (uint32_t)atoi(value);
+        else if (!strcmp(arg, "--pipeline-depth") && value && atoi(value) >= 0)
+            options.m_pipelineDepth = (uint32_t)atoi(value);
+        else if (!strcmp(arg, "--vt-budget") && value && atoi(value) > 0)
+            options.m_virtualTextureBudgetMB = (uint32_t)atoi(value);
+        else if (!strcmp(arg, "--texture-budget") && value && atoi(value) > 0)
+            options.m_textureBudgetMB = (uint32_t)atoi(value);
+        else if (!strcmp(arg, "--instance-spacing") && value)
+            options.m_instanceSpacing = (float)atof(value);
+        else if (!strcmp(arg, "--instance-transforms") && value)
+            options.m_instanceFile = value;
+        else if (!strcmp(arg, "--instances") && value)
+        {
+            int columns = 0, rows = 0;
+            if (sscanf(value, "%dx%d", &columns, &rows) != 2 || columns <= 0 || rows <= 0)
+            {
+                if (errString)
+                    *errString = std::string("Invalid instance grid, expected COLUMNSxROWS: ") + value;
+                return false;
+            }
+            options.m_instanceColumns = (uint32_t)columns;
+            options.m_instanceRows = (uint32_t)rows;
+        }
+        else if (!strcmp(arg, "--resolution") && value)
+        {
+            if (sscanf(value, "%dx%d", &options.m_width, &options.m_height) != 2 || options.m_width <= 0 || options.m_height <= 0)
+            {
+                if (errString)
+                    *errString = std::string("Invalid resolution, expected WIDTHxHEIGHT: ") + value;
+                return false;
+            }
+        }
+        else
+        {
+            hasValue = false;
+            if (!strcmp(arg, "--no-program-cache"))
+                options.m_programCache = false;
+            else if (!strcmp(arg, "--deferred"))
+                options.m_deferred = true;
+            else if (!strcmp(arg, "--no-shadows"))
+                options.m_shadows = false;
+            else if (!strcmp(arg, "--depth-prepass"))
+                options.m_depthPrepass = true;
+            else if (!strcmp(arg, "--validate-commands"))
+                options.m_validateCommands = true;
+            else if (!strcmp(arg, "--software"))
+                options.m_softwareRasterizer = true;
+            else if (!strcmp(arg, "--virtual-texturing"))
+                options.m_virtualTexturing = true;
+            else if (!strcmp(arg, "--texture-streaming"))
+                options.m_textureStreaming = true;
+            else if (!strncmp(arg, "--", 2))
+            {
+                if (errString)
+                    *errString = std::string("Unknown or incomplete argument: ") + arg;
+                return false;
+            }
+        }
+
+        if (hasValue)
+            i++;
+    }
+    if (options.m_softwareRasterizer && options.m_cpuGeometry.length() && options.m_cpuGeometry != "keep")
+    {
+        if (errString)
+            *errString = "The software rasterizer needs --cpu-geometry keep";
+        return false;
+    }
+    return true;
+}
+
+Summary Benchmark::summarize(const std::vector<FrameTiming>& timings)
+{
+    Summary summary;
+    if (timings.empty())
+        return summary;
+
+    std::vector<double> frameTimes;
+    double gpuSum = 0.0;
+    double overdrawSum = 0.0;
+    for (const FrameTiming& timing : timings)
+    {
+        frameTimes.push_back(timing.m_frameMs);
+        summary.m_avgMs += timing.m_frameMs;
+        summary.m_maxMs = std::max(summary.m_maxMs, timing.m_frameMs);
+        gpuSum += timing.m_gpuMs;
+        overdrawSum += timing.m_overdraw;
+        summary.m_avgRecordMs += timing.m_recordMs;
+        summary.m_avgReplayMs += timing.m_replayMs;
+        summary.m_avgLatencyMs += timing.m_latencyMs;
+    }
+    summary.m_frames = (uint32_t)timings.size();
+    summary.m_avgMs /= timings.size();
+    summary.m_avgGpuMs = gpuSum / timings.size();
+    summary.m_avgOverdraw = overdrawSum / timings.size();
+    summary.m_avgRecordMs /= timings.size();
+    summary.m_avgReplayMs /= timings.size();
+    summary.m_avgLatencyMs /= timings.size();
+    summary.m_p50Ms = percentile(frameTimes, 50.0);
+    summary.m_p95Ms = percentile(frameTimes, 95.0);
+    summary.m_p99Ms = percentile(frameTimes, 99.0);
+    return summary;
+}
+
+bool Benchmark::writeTimings(const char* filename, const std::vector<FrameTiming>& timings, const Summary& summary, std::string* errString)
+{
+    FILE* f = fopen(filename, "wb");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot write benchmark output: ") + filename;
+        return false;
+    }
+    fprintf(f, "frame,time,cpu_ms,gpu_ms,frame_ms,overdraw,record_ms,replay_ms,latency_ms\n");
+    for (const FrameTiming& timing : timings)
+        fprintf(f, "%u,%.6f,%.4f,%.4f,%.4f,%.3f,%.4f,%.4f,%.4f\n", timing.m_frame, timing.m_time, timing.m_cpuMs, timing.m_gpuMs, timing.m_frameMs,
+            timing.m_overdraw, timing.m_recordMs, timing.m_replayMs, timing.m_latencyMs);
+    fprintf(f, "# frames=%u avg_ms=%.4f p50_ms=%.4f p95_ms=%.4f p99_ms=%.4f max_ms=%.4f avg_gpu_ms=%.4f avg_overdraw=%.3f avg_record_ms=%.4f avg_replay_ms=%.4f avg_latency_ms=%.4f\n",
+        summary.m_frames, summary.m_avgMs, summary.m_p50Ms, summary.m_p95Ms, summary.m_p99Ms, summary.m_maxMs, summary.m_avgGpuMs, summary.m_avgOverdraw,
+        summary.m_avgRecordMs, summary.m_avgReplayMs, summary.m_avgLatencyMs);
+    fclose(f);
+    return true;
+}
+
+bool Benchmark::writeLightScaling(const char* filename, const std::vector<LightScalingResult>& results, std::string* errString)
+{
+    FILE* f = fopen(filename, "wb");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot write benchmark output: ") + filename;
+        return false;
+    }
+    fprintf(f, "lights,frames,avg_ms,p50_ms,p95_ms,avg_gpu_ms,assign_ms,upload_ms,avg_cluster_lights\n");
+    for (const LightScalingResult& result : results)
+    {
+        const Summary& summary = result.m_summary;
+        fprintf(f, "%u,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.3f\n", result.m_lights, summary.m_frames, summary.m_avgMs, summary.m_p50Ms,
+            summary.m_p95Ms, summary.m_avgGpuMs, result.m_avgAssignMs, result.m_avgUploadMs, result.m_avgClusterLights);
+    }
+    fclose(f);
+    return true;
+}
+
+bool Benchmark::writeBaseline(const char* filename, const Summary& summary, std::string* errString)
+{
+    FILE* f = fopen(filename, "wb");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot write baseline: ") + filename;
+        return false;
+    }
+    fprintf(f, "frames=%u\navg_ms=%.4f\np50_ms=%.4f\np95_ms=%.4f\np99_ms=%.4f\nmax_ms=%.4f\navg_gpu_ms=%.4f\n",
+        summary.m_frames, summary.m_avgMs, summary.m_p50Ms, summary.m_p95Ms, summary.m_p99Ms, summary.m_maxMs, summary.m_avgGpuMs);
+    fclose(f);
+    return true;
+}
+
+bool Benchmark::loadBaseline(const char* filename, Summary& summary, std::string* errString)
+{
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot open baseline: ") + filename;
+        return false;
+    }
+
+    char line[256];
+    int found = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        found += sscanf(line, "frames=%u", &summary.m_frames);
+        found += sscanf(line, "avg_ms=%lf", &summary.m_avgMs);
+        found += sscanf(line, "p50_ms=%lf", &summary.m_p50Ms);
+        found += sscanf(line, "p95_ms=%lf", &summary.m_p95Ms);
+        found += sscanf(line, "p99_ms=%lf", &summary.m_p99Ms);
+        found += sscanf(line, "max_ms=%lf", &summary.m_maxMs);
+        found += sscanf(line, "avg_gpu_ms=%lf", &summary.m_avgGpuMs);
+    }
+    fclose(f);
+
+    if (found < 7)
+    {
+        if (errString)
+            *errString = std::string("Incomplete baseline: ") + filename;
+        return false;
+    }
+    return true;
+}
+
+bool Benchmark::compareToBaseline(const Summary& current, const Summary& baseline, double tolerance, std::string& report)
+{
+    // Average and p95 are stable enough to gate on, p99 and max are too noisy on shared build machines
+    struct Metric { const char* m_name; double m_current; double m_baseline; };
+    Metric metrics[] = {
+        { "avg_ms", current.m_avgMs, baseline.m_avgMs },
+        { "p95_ms", current.m_p95Ms, baseline.m_p95Ms },
+    };
+
+    bool passed = true;
+    char buffer[256];
+    for (const Metric& metric : metrics)
+    {
+        double limit = metric.m_baseline * (1.0 + tolerance);
+        bool regressed = metric.m_current > limit;
+        snprintf(buffer, sizeof(buffer), "%s: %.4f (baseline %.4f, limit %.4f)%s\n",
+            metric.m_name, metric.m_current, metric.m_baseline, limit, regressed ? " REGRESSED" : "");
+        report += buffer;
+        passed = passed && !regressed;
+    }
+    return passed;
+}
+
+bool Benchmark::createOffscreenContext(std::string* errString)
+{
+#ifdef _WIN32
+    if (!glfwInit())
+    {
+        if (errString)
+            *errString = "Cannot initialize GLFW";
+        return false;
+    }
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    s_offscreenWindow = glfwCreateWindow(16, 16, "Benchmark", nullptr, nullptr);
+    if (!s_offscreenWindow)
+    {
+        if (errString)
+            *errString = "Cannot create hidden window";
+        return false;
+    }
+    glfwMakeContextCurrent(s_offscreenWindow);
+    glewExperimental = true;
+    if (glewInit() != GLEW_OK)
+    {
+        if (errString)
+            *errString = "Cannot initialize GLEW";
+        return false;
+    }
+    return true;
+#else
+    // Prefer the surfaceless platform so no X server or DRM device is needed
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        s_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (s_display == EGL_NO_DISPLAY)
+        s_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (s_display == EGL_NO_DISPLAY || !eglInitialize(s_display, &major, &minor))
+    {
+        if (errString)
+            *errString = "Cannot initialize EGL display";
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        if (errString)
+            *errString = "EGL does not support desktop OpenGL";
+        return false;
+    }
+
+    EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config = nullptr;
+    EGLint numConfigs = 0;
+    eglChooseConfig(s_display, configAttribs, &config, 1, &numConfigs);
+
+    EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 4,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    // We only render to our own framebuffer, so a config-less, surfaceless context is enough
+    s_context = eglCreateContext(s_display, numConfigs ? config : (EGLConfig)0, EGL_NO_CONTEXT, contextAttribs);
+    if (s_context == EGL_NO_CONTEXT || !eglMakeCurrent(s_display, EGL_NO_SURFACE, EGL_NO_SURFACE, s_context))
+    {
+        if (errString)
+            *errString = "Cannot create a surfaceless OpenGL 4.4 core context";
+        return false;
+    }
+
+    // glewInit() would try to query GLX, which doesn't exist for EGL contexts
+    glewExperimental = true;
+    if (glewContextInit() != GLEW_OK)
+    {
+        if (errString)
+            *errString = "Cannot initialize GLEW";
+        return false;
+    }
+    return true;
+#endif
+}
+
+void Benchmark::destroyOffscreenContext()
+{
+#ifdef _WIN32
+    if (s_offscreenWindow)
+        glfwDestroyWindow(s_offscreenWindow);
+    s_offscreenWindow = nullptr;
+    glfwTerminate();
+#else
+    if (s_display != EGL_NO_DISPLAY)
+    {
+        eglMakeCurrent(s_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (s_context != EGL_NO_CONTEXT)
+            eglDestroyContext(s_display, s_context);
+        eglTerminate(s_display);
+    }
+    s_context = EGL_NO_CONTEXT;
+    s_display = EGL_NO_DISPLAY;
+#endif
+}
+
+bool RenderTarget::create(int width, int height, std::string* errString)
+{
+    m_width = width;
+    m_height = height;
+
+    glGenRenderbuffers(1, &m_colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    MemoryTracker::trackRenderbuffer(m_colorBuffer, MemoryTracker::Category::RenderTargets, "Benchmark color", GL_RGBA8, width, height);
+    MemoryTracker::trackRenderbuffer(m_depthBuffer, MemoryTracker::Category::RenderTargets, "Benchmark depth",
+        GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        if (errString)
+            *errString = "Benchmark framebuffer is incomplete";
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+void RenderTarget::destroy()
+{
+    MemoryTracker::untrackRenderbuffer(m_colorBuffer);
+    MemoryTracker::untrackRenderbuffer(m_depthBuffer);
+    glDeleteFramebuffers(1, &m_framebuffer);
+    glDeleteRenderbuffers(1, &m_colorBuffer);
+    glDeleteRenderbuffers(1, &m_depthBuffer);
+    m_framebuffer = m_colorBuffer = m_depthBuffer = 0;
+}
+
+void RenderTarget::bind()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glViewport(0, 0, m_width, m_height);
+}
+
+bool RenderTarget::writePng(const char* filename, std::string* errString)
+{
+    std::vector<unsigned char> pixels((size_t)m_width * m_height * 4);
+    std::vector<unsigned char> flipped(pixels.size());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+    // GL rows start at the bottom, PNG rows at the top
+    size_t rowSize = (size_t)m_width * 4;
+    for (int y = 0; y < m_height; y++)
+        memcpy(&flipped[y * rowSize], &pixels[(m_height - 1 - y) * rowSize], rowSize);
+    return Util::writePng(filename, m_width, m_height, &flipped[0], errString);
+}
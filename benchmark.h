@@ -0,0 +1,177 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include "glm/glm.hpp"
+#include "GL/glew.h"
+
+// Deterministic benchmark support: recorded camera/light paths, an offscreen
+// context and render target, and per-frame timing reports with baseline checks.
+namespace Benchmark
+{
+    // One recorded sample of everything that drives a frame
+    struct PathKey
+    {
+        double m_time = 0.0;
+        glm::vec3 m_cameraPosition = glm::vec3(0.0f);
+        float m_yaw = 0.0f;
+        float m_pitch = 0.0f;
+        int m_lightType = 0;
+        glm::vec3 m_directionalLightDirection = glm::vec3(0.0f);
+        glm::vec3 m_spotLightPosition = glm::vec3(0.0f);
+        glm::vec3 m_spotLightDirection = glm::vec3(0.0f);
+        glm::vec3 m_pointLightPosition = glm::vec3(0.0f);
+    };
+
+    class CameraPath
+    {
+    public:
+        void clear() { m_keys.clear(); }
+        // Keys must be added in increasing time order
+        void addKey(const PathKey& key);
+        // Linearly interpolates between the keys around time, the light type is taken from the earlier key
+        bool sample(double time, PathKey& out) const;
+        double duration() const;
+        size_t keyCount() const { return m_keys.size(); }
+
+        bool load(const char* filename, std::string* errString);
+        bool save(const char* filename, std::string* errString) const;
+    private:
+        std::vector<PathKey> m_keys;
+    };
+
+    struct Options
+    {
+        bool m_enabled = false;
+        std::string m_pathFile;
+        std::string m_modelFile = "sponza.obj";
+        std::string m_outputFile;
+        std::string m_dumpDirectory;
+        std::string m_baselineFile;
+        std::string m_writeBaselineFile;
+        std::string m_traceFile;
+        // JSON dump of MemoryTracker written after the run
+        std::string m_memoryReportFile;
+        int m_width = 1280;
+        int m_height = 720;
+        double m_timeStep = 1.0 / 60.0;
+        int m_warmupFrames = 10;
+        int m_dumpInterval = 1;
+        // Cold start runs disable the program binary cache
+        bool m_programCache = true;
+        // Renders with the deferred path instead of forward shading
+        bool m_deferred = false;
+        // Shadow maps for the directional, spot and point light
+        bool m_shadows = true;
+        // Depth pre-pass before the main pass
+        bool m_depthPrepass = false;
+        // Copies of the model, a grid or one per line of the transform file, see Instancing
+        uint32_t m_instanceColumns = 1;
+        uint32_t m_instanceRows = 1;
+        float m_instanceSpacing = 200.0f;
+        std::string m_instanceFile;
+        // JobSystem threads including the render thread, 0 = one per hardware thread
+        uint32_t m_threads = 0;
+        // Frames the update thread runs ahead of the render thread, see FramePipeline. Also used by the window.
+        uint32_t m_pipelineDepth = 1;
+        // Validates every recorded command list before it is replayed
+        bool m_validateCommands = false;
+        // Draws with SoftRasterizer instead of GL
+        bool m_softwareRasterizer = false;
+        // Streams the material textures with VirtualTexturing, the physical cache gets m_virtualTextureBudgetMB. Also
+        // used by the window.
+        bool m_virtualTexturing = false;
+        uint32_t m_virtualTextureBudgetMB = 64;
+        // Streams the mip levels of the material textures with TextureStreaming within m_textureBudgetMB, unless
+        // virtual texturing is on. Also used by the window.
+        bool m_textureStreaming = false;
+        uint32_t m_textureBudgetMB = 128;
+        // GPU memory budget of MemoryTracker, 0 = no warning. Also used by the window.
+        uint32_t m_memoryBudgetMB = 0;
+        // keep, compact or release, what stays of the geometry in RAM after the upload, see
+        // ObjLoader::GeometryResidency. Empty picks release for runs without the software rasterizer, which needs the
+        // vertices, and keep otherwise and in the window. Also used by the window.
+        std::string m_cpuGeometry;
+        // Light counts of the clustered lighting scaling run, the path is replayed once per count with many lights
+        std::vector<uint32_t> m_lightCounts;
+        // Allowed slowdown against the baseline before the run fails, 0.1 = 10%
+        double m_tolerance = 0.1;
+    };
+
+    // Parses --benchmark and related arguments, returns false and fills errString on bad input
+    bool parseArguments(int argc, char** argv, Options& options, std::string* errString);
+
+    struct FrameTiming
+    {
+        uint32_t m_frame = 0;
+        double m_time = 0.0;
+        double m_cpuMs = 0.0;
+        double m_gpuMs = 0.0;
+        double m_frameMs = 0.0;
+        // Samples that passed the depth test in the main pass per viewport pixel
+        double m_overdraw = 0.0;
+        // Draw command recording on the worker threads and replay on the GL thread, summed over the passes
+        double m_recordMs = 0.0;
+        double m_replayMs = 0.0;
+        // From the update of the frame until its rendering finished
+        double m_latencyMs = 0.0;
+    };
+
+    struct Summary
+    {
+        uint32_t m_frames = 0;
+        double m_avgMs = 0.0;
+        double m_p50Ms = 0.0;
+        double m_p95Ms = 0.0;
+        double m_p99Ms = 0.0;
+        double m_maxMs = 0.0;
+        double m_avgGpuMs = 0.0;
+        double m_avgOverdraw = 0.0;
+        double m_avgRecordMs = 0.0;
+        double m_avgReplayMs = 0.0;
+        double m_avgLatencyMs = 0.0;
+    };
+
+    // One replay of the path in the light count scaling run
+    struct LightScalingResult
+    {
+        uint32_t m_lights = 0;
+        Summary m_summary;
+        double m_avgAssignMs = 0.0;
+        double m_avgUploadMs = 0.0;
+        // Average number of lights per cluster, a measure of the shading cost
+        double m_avgClusterLights = 0.0;
+    };
+
+    Summary summarize(const std::vector<FrameTiming>& timings);
+    bool writeTimings(const char* filename, const std::vector<FrameTiming>& timings, const Summary& summary, std::string* errString);
+    bool writeLightScaling(const char* filename, const std::vector<LightScalingResult>& results, std::string* errString);
+    bool writeBaseline(const char* filename, const Summary& summary, std::string* errString);
+    bool loadBaseline(const char* filename, Summary& summary, std::string* errString);
+    // Returns false if current is slower than baseline by more than tolerance, the reason is appended to report
+    bool compareToBaseline(const Summary& current, const Summary& baseline, double tolerance, std::string& report);
+
+    // Creates a GL 4.4 core context without a visible window. Uses EGL (works with Mesa llvmpipe)
+    // on Linux and a hidden GLFW window on Windows.
+    bool createOffscreenContext(std::string* errString);
+    void destroyOffscreenContext();
+
+    // Fixed size framebuffer the benchmark renders into, independent of any window
+    class RenderTarget
+    {
+    public:
+        bool create(int width, int height, std::string* errString);
+        void destroy();
+        void bind();
+        // Reads back the color buffer and writes it as a PNG file
+        bool writePng(const char* filename, std::string* errString);
+        int width() const { return m_width; }
+        int height() const { return m_height; }
+    private:
+        GLuint m_framebuffer = 0;
+        GLuint m_colorBuffer = 0;
+        GLuint m_depthBuffer = 0;
+        int m_width = 0;
+        int m_height = 0;
+    };
+}
@@ -0,0 +1,323 @@
+#include "clusteredlighting.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "profiler.h"
+#include "framestats.h"
+#include "ringbuffer.h"
+#include "jobsystem.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CLUSTER_SSE 1
+#endif
+
+using namespace ClusteredLighting;
+
+namespace
+{
+    // Four floats processed together, SSE2 where available and plain loops otherwise
+#ifdef CLUSTER_SSE
+    struct Float4
+    {
+        __m128 m_value;
+        static Float4 load(const float* p) { return { _mm_loadu_ps(p) }; }
+        static Float4 set(float v) { return { _mm_set1_ps(v) }; }
+    };
+    inline Float4 operator+(Float4 a, Float4 b) { return { _mm_add_ps(a.m_value, b.m_value) }; }
+    inline Float4 operator-(Float4 a, Float4 b) { return { _mm_sub_ps(a.m_value, b.m_value) }; }
+    inline Float4 operator*(Float4 a, Float4 b) { return { _mm_mul_ps(a.m_value, b.m_value) }; }
+    inline Float4 max(Float4 a, Float4 b) { return { _mm_max_ps(a.m_value, b.m_value) }; }
+    // Bit i is set if lane i of a is less than (or equal to) lane i of b
+    inline int lessMask(Float4 a, Float4 b) { return _mm_movemask_ps(_mm_cmplt_ps(a.m_value, b.m_value)); }
+    inline int lessEqualMask(Float4 a, Float4 b) { return _mm_movemask_ps(_mm_cmple_ps(a.m_value, b.m_value)); }
+#else
+    struct Float4
+    {
+        float m_value[4];
+        static Float4 load(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+        static Float4 set(float v) { return { { v, v, v, v } }; }
+    };
+#define FLOAT4_OP(name, expr) inline Float4 name(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.m_value[i] = expr; return r; }
+    FLOAT4_OP(operator+, a.m_value[i] + b.m_value[i])
+    FLOAT4_OP(operator-, a.m_value[i] - b.m_value[i])
+    FLOAT4_OP(operator*, a.m_value[i] * b.m_value[i])
+    FLOAT4_OP(max, a.m_value[i] > b.m_value[i] ? a.m_value[i] : b.m_value[i])
+#undef FLOAT4_OP
+    inline int lessMask(Float4 a, Float4 b) { int m = 0; for (int i = 0; i < 4; i++) m |= (a.m_value[i] < b.m_value[i]) << i; return m; }
+    inline int lessEqualMask(Float4 a, Float4 b) { int m = 0; for (int i = 0; i < 4; i++) m |= (a.m_value[i] <= b.m_value[i]) << i; return m; }
+#endif
+
+    // Bounding spheres in view space with the depth as a positive distance, structure of arrays padded
+    // to a multiple of four. Padding lanes sit far away with a negative squared radius so they never pass.
+    struct SphereList
+    {
+        std::vector<float> m_x, m_y, m_depth, m_radius, m_radiusSq;
+        std::vector<uint32_t> m_lights;
+
+        size_t size() const { return m_lights.size(); }
+        void clear()
+        {
+            m_x.clear(); m_y.clear(); m_depth.clear(); m_radius.clear(); m_radiusSq.clear(); m_lights.clear();
+        }
+        void add(const SphereList& from, size_t i)
+        {
+            m_x.push_back(from.m_x[i]);
+            m_y.push_back(from.m_y[i]);
+            m_depth.push_back(from.m_depth[i]);
+            m_radius.push_back(from.m_radius[i]);
+            m_radiusSq.push_back(from.m_radiusSq[i]);
+            m_lights.push_back(from.m_lights[i]);
+        }
+        void pad()
+        {
+            while (m_x.size() % 4)
+            {
+                m_x.push_back(1e30f); m_y.push_back(1e30f); m_depth.push_back(1e30f);
+                m_radius.push_back(0.0f); m_radiusSq.push_back(-1.0f);
+            }
+        }
+    };
+
+    struct Box
+    {
+        float m_minX, m_maxX, m_minY, m_maxY, m_minDepth, m_maxDepth;
+    };
+
+    // Returns a bit per sphere of group (the four spheres starting at first) that touches the box
+    int touchesBox(const SphereList& spheres, size_t first, const Box& box)
+    {
+        Float4 zero = Float4::set(0.0f);
+        Float4 x = Float4::load(&spheres.m_x[first]);
+        Float4 y = Float4::load(&spheres.m_y[first]);
+        Float4 depth = Float4::load(&spheres.m_depth[first]);
+        Float4 dx = max(max(Float4::set(box.m_minX) - x, x - Float4::set(box.m_maxX)), zero);
+        Float4 dy = max(max(Float4::set(box.m_minY) - y, y - Float4::set(box.m_maxY)), zero);
+        Float4 dz = max(max(Float4::set(box.m_minDepth) - depth, depth - Float4::set(box.m_maxDepth)), zero);
+        return lessEqualMask(dx * dx + dy * dy + dz * dz, Float4::load(&spheres.m_radiusSq[first]));
+    }
+
+    // Results of one depth slice, owned by the slice so worker threads never share output
+    struct SliceData
+    {
+        SphereList m_sliceLights;
+        SphereList m_rowLights;
+        std::vector<uint32_t> m_counts;
+        std::vector<uint32_t> m_indices;
+    };
+
+    // Matches the header of the ClusterGrid buffer in lighting.glsl, followed by one (offset, count) pair per cluster
+    struct GridHeader
+    {
+        uint32_t m_gridSize[4];
+        float m_depthParams[4];
+    };
+
+    // Streamed through the ring buffer every frame, indexed by the buffer bindings
+    RingBuffer::Allocation s_allocations[3];
+    SphereList s_lights;
+    SliceData s_slices[DepthSlices];
+    std::vector<uint32_t> s_gridData;
+    std::vector<uint32_t> s_indexData;
+    Statistics s_statistics;
+
+    // Grid of the current update
+    uint32_t s_tilesX = 0;
+    uint32_t s_tilesY = 0;
+    float s_sliceDepths[DepthSlices + 1];
+    std::vector<float> s_tileNdcX;
+    std::vector<float> s_tileNdcY;
+    float s_ndcToViewX = 1.0f;
+    float s_ndcToViewY = 1.0f;
+
+    // View space extent of the screen interval [ndcMin, ndcMax] between the depths of a slice
+    void sliceExtent(float ndcMin, float ndcMax, float ndcToView, float minDepth, float maxDepth, float& outMin, float& outMax)
+    {
+        float a = ndcMin * ndcToView * minDepth;
+        float b = ndcMin * ndcToView * maxDepth;
+        float c = ndcMax * ndcToView * minDepth;
+        float d = ndcMax * ndcToView * maxDepth;
+        outMin = std::min(std::min(a, b), std::min(c, d));
+        outMax = std::max(std::max(a, b), std::max(c, d));
+    }
+
+    void assignSlice(uint32_t slice)
+    {
+        PROFILE_SCOPE("Assign Light Slice");
+        SliceData& data = s_slices[slice];
+        data.m_counts.assign(s_tilesX * s_tilesY, 0);
+        data.m_indices.clear();
+
+        // Lights overlapping the depth range of the slice
+        float minDepth = s_sliceDepths[slice];
+        float maxDepth = s_sliceDepths[slice + 1];
+        Float4 sliceMin = Float4::set(minDepth);
+        Float4 sliceMax = Float4::set(maxDepth);
+        data.m_sliceLights.clear();
+        for (size_t i = 0; i < s_lights.size(); i += 4)
+        {
+            Float4 depth = Float4::load(&s_lights.m_depth[i]);
+            Float4 radius = Float4::load(&s_lights.m_radius[i]);
+            int mask = lessMask(depth - radius, sliceMax) & lessMask(sliceMin, depth + radius);
+            for (int lane = 0; lane < 4; lane++)
+            {
+                if (mask & (1 << lane))
+                    data.m_sliceLights.add(s_lights, i + lane);
+            }
+        }
+        if (!data.m_sliceLights.size())
+            return;
+        data.m_sliceLights.pad();
+
+        Box sliceBox;
+        sliceBox.m_minDepth = minDepth;
+        sliceBox.m_maxDepth = maxDepth;
+        sliceExtent(-1.0f, 1.0f, s_ndcToViewX, minDepth, maxDepth, sliceBox.m_minX, sliceBox.m_maxX);
+        for (uint32_t row = 0; row < s_tilesY; row++)
+        {
+            // Lights touching the whole row first, the clusters of the row then only test those
+            Box rowBox = sliceBox;
+            sliceExtent(s_tileNdcY[row], s_tileNdcY[row + 1], s_ndcToViewY, minDepth, maxDepth, rowBox.m_minY, rowBox.m_maxY);
+            data.m_rowLights.clear();
+            for (size_t i = 0; i < data.m_sliceLights.size(); i += 4)
+            {
+                int mask = touchesBox(data.m_sliceLights, i, rowBox);
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if (mask & (1 << lane))
+                        data.m_rowLights.add(data.m_sliceLights, i + lane);
+                }
+            }
+            if (!data.m_rowLights.size())
+                continue;
+            data.m_rowLights.pad();
+
+            for (uint32_t column = 0; column < s_tilesX; column++)
+            {
+                Box clusterBox = rowBox;
+                sliceExtent(s_tileNdcX[column], s_tileNdcX[column + 1], s_ndcToViewX, minDepth, maxDepth, clusterBox.m_minX, clusterBox.m_maxX);
+                uint32_t& count = data.m_counts[row * s_tilesX + column];
+                for (size_t i = 0; i < data.m_rowLights.size(); i += 4)
+                {
+                    int mask = touchesBox(data.m_rowLights, i, clusterBox);
+                    for (int lane = 0; lane < 4; lane++)
+                    {
+                        if (mask & (1 << lane))
+                        {
+                            data.m_indices.push_back(data.m_rowLights.m_lights[i + lane]);
+                            count++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void uploadBuffer(GLuint binding, size_t size, const void* data)
+    {
+        RingBuffer::upload(data, (GLsizeiptr)size, s_allocations[binding]);
+        FrameStats::add(FrameStats::Counter::BufferBytes, size);
+    }
+}
+
+void ClusteredLighting::destroy()
+{
+    for (RingBuffer::Allocation& allocation : s_allocations)
+        allocation = RingBuffer::Allocation();
+}
+
+void ClusteredLighting::update(const std::vector<Light>& lights, const glm::mat4x4& view, const glm::mat4x4& projection,
+    float nearPlane, float farPlane, int vpWidth, int vpHeight)
+{
+    PROFILE_SCOPE("ClusteredLighting::update");
+    uint64_t start = Profiler::nowNs();
+
+    // Screen tiles in normalized device coordinates, the last tile is clipped at the screen edge
+    s_tilesX = (std::max(vpWidth, 1) + TileSize - 1) / TileSize;
+    s_tilesY = (std::max(vpHeight, 1) + TileSize - 1) / TileSize;
+    s_tileNdcX.resize(s_tilesX + 1);
+    s_tileNdcY.resize(s_tilesY + 1);
+    for (uint32_t i = 0; i <= s_tilesX; i++)
+        s_tileNdcX[i] = std::min(1.0f, (float)(i * TileSize) / vpWidth * 2.0f - 1.0f);
+    for (uint32_t i = 0; i <= s_tilesY; i++)
+        s_tileNdcY[i] = std::min(1.0f, (float)(i * TileSize) / vpHeight * 2.0f - 1.0f);
+    s_ndcToViewX = 1.0f / projection[0][0];
+    s_ndcToViewY = 1.0f / projection[1][1];
+
+    // Logarithmic slices keep the clusters roughly cubic, near slices are thin and far ones deep
+    float logDepthRange = logf(farPlane / nearPlane);
+    for (uint32_t i = 0; i <= DepthSlices; i++)
+        s_sliceDepths[i] = nearPlane * expf(logDepthRange * i / DepthSlices);
+
+    s_lights.clear();
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const Light& light = lights[i];
+        glm::vec4 viewPos = view * glm::vec4(light.m_position, 1.0f);
+        s_lights.m_x.push_back(viewPos.x);
+        s_lights.m_y.push_back(viewPos.y);
+        s_lights.m_depth.push_back(-viewPos.z);
+        s_lights.m_radius.push_back(light.m_radius);
+        s_lights.m_radiusSq.push_back(light.m_radius * light.m_radius);
+        s_lights.m_lights.push_back((uint32_t)i);
+    }
+    s_lights.pad();
+
+    // Slices are the unit of work, more threads than slices would only wait
+    JobSystem::parallelFor("Assign light slices", DepthSlices, 1, [](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t slice = begin; slice < end; slice++)
+            assignSlice(slice);
+    });
+    s_statistics.m_threads = std::min(JobSystem::threadCount(), DepthSlices);
+
+    // Concatenates the slice results into the (offset, count) grid and the index list
+    uint32_t tilesPerSlice = s_tilesX * s_tilesY;
+    uint32_t clusterCount = tilesPerSlice * DepthSlices;
+    const uint32_t headerWords = sizeof(GridHeader) / sizeof(uint32_t);
+    s_gridData.resize(headerWords + clusterCount * 2);
+    GridHeader header = { { s_tilesX, s_tilesY, DepthSlices, TileSize },
+        { nearPlane, farPlane, DepthSlices / logDepthRange, -(float)DepthSlices * logf(nearPlane) / logDepthRange } };
+    memcpy(&s_gridData[0], &header, sizeof(header));
+    s_indexData.clear();
+    uint32_t maxClusterLights = 0;
+    for (uint32_t slice = 0; slice < DepthSlices; slice++)
+    {
+        const SliceData& data = s_slices[slice];
+        uint32_t* clusters = &s_gridData[headerWords + slice * tilesPerSlice * 2];
+        uint32_t offset = (uint32_t)s_indexData.size();
+        for (uint32_t tile = 0; tile < tilesPerSlice; tile++)
+        {
+            uint32_t count = data.m_counts.empty() ? 0 : data.m_counts[tile];
+            clusters[tile * 2] = offset;
+            clusters[tile * 2 + 1] = count;
+            offset += count;
+            maxClusterLights = std::max(maxClusterLights, count);
+        }
+        s_indexData.insert(s_indexData.end(), data.m_indices.begin(), data.m_indices.end());
+    }
+    uint64_t assigned = Profiler::nowNs();
+
+    uploadBuffer(LightBufferBinding, lights.size() * sizeof(Light), lights.empty() ? nullptr : &lights[0]);
+    uploadBuffer(IndexBufferBinding, s_indexData.size() * sizeof(uint32_t), s_indexData.empty() ? nullptr : &s_indexData[0]);
+    uploadBuffer(GridBufferBinding, s_gridData.size() * sizeof(uint32_t), &s_gridData[0]);
+
+    s_statistics.m_lights = (uint32_t)lights.size();
+    s_statistics.m_clusters = clusterCount;
+    s_statistics.m_lightIndices = (uint32_t)s_indexData.size();
+    s_statistics.m_maxClusterLights = maxClusterLights;
+    s_statistics.m_assignMs = (assigned - start) / 1000000.0;
+    s_statistics.m_uploadMs = (Profiler::nowNs() - assigned) / 1000000.0;
+}
+
+void ClusteredLighting::bindBuffers()
+{
+    RingBuffer::bind(GL_SHADER_STORAGE_BUFFER, LightBufferBinding, s_allocations[LightBufferBinding]);
+    RingBuffer::bind(GL_SHADER_STORAGE_BUFFER, IndexBufferBinding, s_allocations[IndexBufferBinding]);
+    RingBuffer::bind(GL_SHADER_STORAGE_BUFFER, GridBufferBinding, s_allocations[GridBufferBinding]);
+}
+
+const Statistics& ClusteredLighting::statistics()
+{
+    return s_statistics;
+}
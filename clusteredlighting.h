@@ -0,0 +1,65 @@
+#pragma once
+#include <inttypes.h>
+#include <vector>
+#include "glm/glm.hpp"
+#include "GL/glew.h"
+
+// Clustered forward lighting. The view frustum is split into a grid of clusters (screen tiles times
+// logarithmic depth slices) and every light is assigned to the clusters its bounding sphere touches.
+// The assignment runs as JobSystem jobs, one depth slice at a time, testing four lights per SIMD
+// instruction. Lights, per-cluster index lists and the grid are streamed to shader storage buffers
+// through the RingBuffer every frame, so the pixel shader only loops over the lights of its own cluster.
+namespace ClusteredLighting
+{
+    const uint32_t TileSize = 64;
+    const uint32_t DepthSlices = 24;
+
+    // Shader storage buffer bindings used by the LIGHT_CLUSTERED permutation of lighting.glsl
+    const GLuint LightBufferBinding = 0;
+    const GLuint IndexBufferBinding = 1;
+    const GLuint GridBufferBinding = 2;
+
+    enum class LightKind : uint32_t
+    {
+        Point,
+        Spot
+    };
+
+    // std430 layout, matches ClusterLight in lighting.glsl
+    struct Light
+    {
+        glm::vec3 m_position = glm::vec3(0.0f);
+        float m_radius = 100.0f;
+        glm::vec3 m_color = glm::vec3(1.0f);
+        LightKind m_kind = LightKind::Point;
+        glm::vec3 m_direction = glm::vec3(0.0f, -1.0f, 0.0f);
+        float m_cosOuterCone = 0.0f;
+        float m_cosInnerCone = 0.0f;
+        float m_padding[3] = {};
+    };
+    static_assert(sizeof(Light) == 64, "Light must match the std430 layout in lighting.glsl");
+
+    struct Statistics
+    {
+        uint32_t m_lights = 0;
+        uint32_t m_clusters = 0;
+        // Sum of the light counts of all clusters
+        uint32_t m_lightIndices = 0;
+        uint32_t m_maxClusterLights = 0;
+        uint32_t m_threads = 0;
+        double m_assignMs = 0.0;
+        double m_uploadMs = 0.0;
+    };
+
+    // Forgets the RingBuffer allocations of the last update
+    void destroy();
+
+    // Assigns the lights to the clusters of the given view and uploads the results. projection must be a
+    // symmetric perspective projection with the given near and far planes.
+    void update(const std::vector<Light>& lights, const glm::mat4x4& view, const glm::mat4x4& projection,
+        float nearPlane, float farPlane, int vpWidth, int vpHeight);
+    // Binds the light, index and grid buffers to their shader storage binding points
+    void bindBuffers();
+
+    const Statistics& statistics();
+}
@@ -0,0 +1,142 @@
+#include "deferredshading.h"
+#include <algorithm>
+#include "framestats.h"
+#include "memorytracker.h"
+
+using namespace DeferredShading;
+
+namespace
+{
+    GLuint s_framebuffer = 0;
+    GLuint s_albedoTexture = 0;
+    GLuint s_normalTexture = 0;
+    GLuint s_depthTexture = 0;
+    // The full-screen triangle has no attributes, but the core profile needs a vertex array to draw
+    GLuint s_emptyVao = 0;
+    int s_width = 0;
+    int s_height = 0;
+
+    GLuint createTexture(GLenum internalFormat, int width, int height, const char* name)
+    {
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+        MemoryTracker::trackTexture(texture, MemoryTracker::Category::RenderTargets, name, internalFormat, width, height, 1, 1);
+        // Read with texelFetch, the filters only keep the texture complete
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void destroyTextures()
+    {
+        GLuint textures[] = { s_albedoTexture, s_normalTexture, s_depthTexture };
+        for (GLuint texture : textures)
+            MemoryTracker::untrackTexture(texture);
+        glDeleteTextures(3, textures);
+        s_albedoTexture = s_normalTexture = s_depthTexture = 0;
+        s_width = s_height = 0;
+    }
+}
+
+bool DeferredShading::init(std::string* errString)
+{
+    glGenFramebuffers(1, &s_framebuffer);
+    glGenVertexArrays(1, &s_emptyVao);
+    if (!s_framebuffer || !s_emptyVao)
+    {
+        if (errString)
+            *errString = "Cannot create the G-buffer";
+        return false;
+    }
+    return true;
+}
+
+void DeferredShading::destroy()
+{
+    destroyTextures();
+    glDeleteFramebuffers(1, &s_framebuffer);
+    glDeleteVertexArrays(1, &s_emptyVao);
+    s_framebuffer = s_emptyVao = 0;
+}
+
+bool DeferredShading::resize(int width, int height, std::string* errString)
+{
+    width = std::max(width, 1);
+    height = std::max(height, 1);
+    if (width == s_width && height == s_height)
+        return true;
+
+    destroyTextures();
+    s_albedoTexture = createTexture(GL_RGBA8, width, height, "G-buffer albedo");
+    s_normalTexture = createTexture(GL_RGBA8, width, height, "G-buffer normal");
+    s_depthTexture = createTexture(GL_DEPTH_COMPONENT32F, width, height, "G-buffer depth");
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s_albedoTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, s_normalTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, s_depthTexture, 0);
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        if (errString)
+            *errString = "G-buffer framebuffer is incomplete";
+        destroyTextures();
+        return false;
+    }
+
+    s_width = width;
+    s_height = height;
+    FrameStats::add(FrameStats::Counter::TextureBytes, (uint64_t)width * height * bytesPerPixel());
+    return true;
+}
+
+void DeferredShading::beginGeometryPass()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, s_framebuffer);
+    glViewport(0, 0, s_width, s_height);
+    // Only depth needs clearing, the lighting pass skips the pixels nothing was drawn to
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void DeferredShading::bindTextures()
+{
+    glActiveTexture(GL_TEXTURE0 + AlbedoTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, s_albedoTexture);
+    glActiveTexture(GL_TEXTURE0 + NormalTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, s_normalTexture);
+    glActiveTexture(GL_TEXTURE0 + DepthTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, s_depthTexture);
+    FrameStats::add(FrameStats::Counter::TextureBinds, 3);
+}
+
+void DeferredShading::drawFullscreenTriangle()
+{
+    glBindVertexArray(s_emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    FrameStats::add(FrameStats::Counter::DrawCalls);
+    FrameStats::add(FrameStats::Counter::Triangles);
+}
+
+uint32_t DeferredShading::bytesPerPixel()
+{
+    return 4 + 4 + 4;
+}
+
+int DeferredShading::width()
+{
+    return s_width;
+}
+
+int DeferredShading::height()
+{
+    return s_height;
+}
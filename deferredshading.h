@@ -0,0 +1,35 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include "GL/glew.h"
+
+// Deferred shading. The scene is rendered once into a G-buffer, then a full-screen pass reads the surfaces back
+// and applies the lights, so texture fetches and normal mapping run once per pixel instead of once per light.
+// The layout packs everything into 12 bytes per pixel:
+//   albedo  RGBA8               albedo, specular power
+//   normal  RGBA8               octahedral normal with 12 bits per component in rgb, specular intensity
+//   depth   DEPTH_COMPONENT32F  the lighting pass reconstructs world positions from it
+namespace DeferredShading
+{
+    // Texture units the G-buffer is bound to for the lighting pass
+    const GLuint AlbedoTextureUnit = 0;
+    const GLuint NormalTextureUnit = 1;
+    const GLuint DepthTextureUnit = 2;
+
+    // Needs a current GL context. The G-buffer textures are created by resize().
+    bool init(std::string* errString);
+    void destroy();
+
+    // Recreates the G-buffer textures if the size changed
+    bool resize(int width, int height, std::string* errString);
+    // Binds and clears the G-buffer as the draw framebuffer
+    void beginGeometryPass();
+    // Binds the G-buffer textures to their units
+    void bindTextures();
+    // Draws one triangle covering the viewport with the bound pipeline
+    void drawFullscreenTriangle();
+
+    uint32_t bytesPerPixel();
+    int width();
+    int height();
+}
@@ -0,0 +1,242 @@
+#include "drawcommands.h"
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include "jobsystem.h"
+
+using namespace DrawCommands;
+
+namespace
+{
+    // Only the first s_listCount lists belong to the last record(), the others keep their memory for later passes
+    std::vector<CommandList> s_lists;
+    std::vector<uint8_t> s_listInvalid;
+    uint32_t s_listCount = 0;
+    Statistics s_frame;
+    Statistics s_statistics;
+
+    bool sameCommand(const Command& a, const Command& b)
+    {
+        return a.m_type == b.m_type && a.m_count == b.m_count && !memcmp(a.m_handles, b.m_handles, sizeof(a.m_handles));
+    }
+
+    double elapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    Command makeCommand(CommandType type, uint32_t count, uint32_t a, uint32_t b = 0, uint32_t c = 0)
+    {
+        Command command;
+        command.m_type = type;
+        command.m_count = count;
+        command.m_handles[0] = a;
+        command.m_handles[1] = b;
+        command.m_handles[2] = c;
+        return command;
+    }
+}
+
+void CommandList::clear()
+{
+    m_commands.clear();
+    m_pipelineSet = m_geometrySet = m_texturesSet = false;
+}
+
+void CommandList::bind(const Command& command, Command& current, bool& isSet)
+{
+    if (isSet && sameCommand(command, current))
+        return;
+    current = command;
+    isSet = true;
+    m_commands.push_back(command);
+}
+
+void CommandList::bindPipeline(uint32_t pipeline)
+{
+    bind(makeCommand(CommandType::BindPipeline, 0, pipeline), m_pipeline, m_pipelineSet);
+}
+
+void CommandList::bindGeometry(uint32_t vertexArray, uint32_t vertexBuffer)
+{
+    bind(makeCommand(CommandType::BindGeometry, 0, vertexArray, vertexBuffer), m_geometry, m_geometrySet);
+}
+
+void CommandList::bindTextures(const uint32_t* textures, uint32_t count)
+{
+    Command command;
+    command.m_type = CommandType::BindTextures;
+    command.m_count = std::min(count, MaxTextures);
+    memcpy(command.m_handles, textures, command.m_count * sizeof(uint32_t));
+    bind(command, m_textures, m_texturesSet);
+}
+
+void CommandList::draw(uint32_t indexBuffer, uint32_t indexCount, uint32_t instanceCount)
+{
+    m_commands.push_back(makeCommand(CommandType::Draw, 0, indexBuffer, indexCount, instanceCount));
+}
+
+void DrawCommands::destroy()
+{
+    s_lists.clear();
+    s_listInvalid.clear();
+    s_listCount = 0;
+    s_frame = Statistics();
+    s_statistics = Statistics();
+}
+
+void DrawCommands::record(uint32_t itemCount, const RecordCallback& recordSlice)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint32_t sliceCount = std::max(1u, std::min(JobSystem::threadCount(), itemCount / MinSliceItems));
+    if (s_lists.size() < sliceCount)
+        s_lists.resize(sliceCount);
+    s_listInvalid.assign(sliceCount, 0);
+    s_listCount = sliceCount;
+
+    JobSystem::parallelFor("Record draw commands", sliceCount, 1, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t slice = begin; slice < end; slice++)
+        {
+            CommandList& list = s_lists[slice];
+            list.clear();
+            uint32_t first = (uint32_t)((uint64_t)itemCount * slice / sliceCount);
+            uint32_t last = (uint32_t)((uint64_t)itemCount * (slice + 1) / sliceCount);
+            recordSlice(first, last, list);
+        }
+    });
+
+    s_frame.m_passes++;
+    s_frame.m_lists += sliceCount;
+    for (uint32_t i = 0; i < sliceCount; i++)
+        s_frame.m_commands += s_lists[i].commands().size();
+    s_frame.m_recordMs += elapsedMs(start);
+}
+
+uint32_t DrawCommands::listCount()
+{
+    return s_listCount;
+}
+
+const CommandList& DrawCommands::list(uint32_t index)
+{
+    return s_lists[index];
+}
+
+bool DrawCommands::validate(const CommandList& list, std::string* errString)
+{
+    bool pipelineBound = false, geometryBound = false;
+    const std::vector<Command>& commands = list.commands();
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        const Command& command = commands[i];
+        const char* error = nullptr;
+        switch (command.m_type)
+        {
+        case CommandType::BindPipeline:
+            pipelineBound = true;
+            break;
+        case CommandType::BindGeometry:
+            geometryBound = true;
+            break;
+        case CommandType::BindTextures:
+            if (command.m_count > MaxTextures)
+                error = "too many textures";
+            break;
+        case CommandType::Draw:
+            if (!pipelineBound)
+                error = "draw without a pipeline";
+            else if (!geometryBound)
+                error = "draw without geometry";
+            else if (!command.m_handles[1] || command.m_handles[1] % 3)
+                error = "index count is not a positive multiple of 3";
+            else if (!command.m_handles[2])
+                error = "draw without instances";
+            break;
+        default:
+            error = "unknown command";
+            break;
+        }
+        if (error)
+        {
+            if (errString)
+                *errString = "Command " + std::to_string(i) + ": " + error;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DrawCommands::validateLists(std::string* errString)
+{
+    bool valid = true;
+    for (uint32_t i = 0; i < s_listCount; i++)
+    {
+        std::string listError;
+        if (validate(s_lists[i], &listError))
+            continue;
+        if (valid && errString)
+            *errString = "Invalid command list " + std::to_string(i) + ": " + listError;
+        s_listInvalid[i] = 1;
+        s_frame.m_invalidLists++;
+        valid = false;
+    }
+    return valid;
+}
+
+void DrawCommands::replay(Backend& backend)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // Every list binds its own state, the binds that match what the previous list left are redundant
+    Command pipeline, geometry, textures;
+    bool pipelineSet = false, geometrySet = false, texturesSet = false;
+    for (uint32_t i = 0; i < s_listCount; i++)
+    {
+        if (s_listInvalid[i])
+            continue;
+        for (const Command& command : s_lists[i].commands())
+        {
+            switch (command.m_type)
+            {
+            case CommandType::BindPipeline:
+                if (pipelineSet && sameCommand(command, pipeline))
+                    break;
+                pipeline = command;
+                pipelineSet = true;
+                backend.bindPipeline(command.m_handles[0]);
+                break;
+            case CommandType::BindGeometry:
+                if (geometrySet && sameCommand(command, geometry))
+                    break;
+                geometry = command;
+                geometrySet = true;
+                backend.bindGeometry(command.m_handles[0], command.m_handles[1]);
+                break;
+            case CommandType::BindTextures:
+                if (texturesSet && sameCommand(command, textures))
+                    break;
+                textures = command;
+                texturesSet = true;
+                backend.bindTextures(command.m_handles, command.m_count);
+                break;
+            case CommandType::Draw:
+                backend.draw(command.m_handles[0], command.m_handles[1], command.m_handles[2]);
+                break;
+            }
+        }
+    }
+    s_frame.m_replayMs += elapsedMs(start);
+}
+
+void DrawCommands::endFrame()
+{
+    s_frame.m_threads = JobSystem::threadCount();
+    s_statistics = s_frame;
+    s_frame = Statistics();
+    s_frame.m_invalidLists = s_statistics.m_invalidLists;
+}
+
+const Statistics& DrawCommands::statistics()
+{
+    return s_statistics;
+}
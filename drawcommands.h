@@ -0,0 +1,98 @@
+#pragma once
+#include <inttypes.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Draw commands recorded as JobSystem jobs and replayed in order on the GL thread. A command only holds opaque
+// handles and counts, so lists can be recorded and validated without a GL context; the renderer turns them into
+// API calls with a Backend. record() splits the items of a pass into contiguous slices, one list per slice.
+namespace DrawCommands
+{
+    const uint32_t MaxTextures = 4;
+    // Smaller passes are recorded on the calling thread, waking the workers would cost more than the recording
+    const uint32_t MinSliceItems = 64;
+
+    enum class CommandType : uint32_t
+    {
+        BindPipeline,
+        BindGeometry,
+        BindTextures,
+        Draw
+    };
+
+    struct Command
+    {
+        CommandType m_type = CommandType::Draw;
+        // Texture count of BindTextures
+        uint32_t m_count = 0;
+        // BindPipeline: pipeline. BindGeometry: vertex array, vertex buffer. BindTextures: the textures of units 0 to
+        // m_count - 1. Draw: index buffer, index count, instance count.
+        uint32_t m_handles[MaxTextures] = {};
+    };
+
+    // Binds that don't change the state set earlier in the same list are dropped while recording
+    class CommandList
+    {
+    public:
+        void clear();
+        void bindPipeline(uint32_t pipeline);
+        void bindGeometry(uint32_t vertexArray, uint32_t vertexBuffer);
+        void bindTextures(const uint32_t* textures, uint32_t count);
+        void draw(uint32_t indexBuffer, uint32_t indexCount, uint32_t instanceCount);
+
+        const std::vector<Command>& commands() const { return m_commands; }
+    private:
+        // Appends command unless it equals the last one of its type
+        void bind(const Command& command, Command& current, bool& isSet);
+
+        std::vector<Command> m_commands;
+        Command m_pipeline, m_geometry, m_textures;
+        bool m_pipelineSet = false, m_geometrySet = false, m_texturesSet = false;
+    };
+
+    // Executes replayed commands, implemented by the renderer
+    class Backend
+    {
+    public:
+        virtual ~Backend() {}
+        virtual void bindPipeline(uint32_t pipeline) = 0;
+        virtual void bindGeometry(uint32_t vertexArray, uint32_t vertexBuffer) = 0;
+        virtual void bindTextures(const uint32_t* textures, uint32_t count) = 0;
+        virtual void draw(uint32_t indexBuffer, uint32_t indexCount, uint32_t instanceCount) = 0;
+    };
+
+    // Records items [first, end) of the pass into list, called on the JobSystem threads
+    typedef std::function<void(uint32_t first, uint32_t end, CommandList& list)> RecordCallback;
+
+    struct Statistics
+    {
+        uint32_t m_threads = 0;
+        // Lists that failed validateLists() since init
+        uint64_t m_invalidLists = 0;
+        // Totals of the last finished frame
+        uint32_t m_passes = 0;
+        uint32_t m_lists = 0;
+        uint64_t m_commands = 0;
+        double m_recordMs = 0.0;
+        double m_replayMs = 0.0;
+    };
+
+    // Frees the lists, they are recorded with the JobSystem threads
+    void destroy();
+
+    // Records itemCount items into one list per slice, replacing the lists of the previous record()
+    void record(uint32_t itemCount, const RecordCallback& recordSlice);
+    uint32_t listCount();
+    const CommandList& list(uint32_t index);
+    // Checks that every draw has a pipeline and geometry bound before it and sane counts. Needs no GL context.
+    bool validate(const CommandList& list, std::string* errString);
+    // Checks every recorded list, invalid ones are counted and left out of replay()
+    bool validateLists(std::string* errString);
+    // Passes the recorded lists to backend in order, binds repeating the state left by the previous list are dropped
+    void replay(Backend& backend);
+    // Moves the totals of the current frame into the statistics
+    void endFrame();
+
+    const Statistics& statistics();
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "drawcommands.h"
+#include "jobsystem.h"
+
+// Records, validates and replays draw command lists without a GL context. Returns non-zero if a check fails.
+namespace
+{
+    int s_failures = 0;
+
+    void check(bool condition, const char* what)
+    {
+        if (condition)
+            return;
+        fprintf(stderr, "FAILED: %s\n", what);
+        s_failures++;
+    }
+
+    // Logs the replayed calls as text
+    class LogBackend : public DrawCommands::Backend
+    {
+    public:
+        void bindPipeline(uint32_t pipeline) override
+        {
+            m_calls.push_back("pipeline " + std::to_string(pipeline));
+        }
+
+        void bindGeometry(uint32_t vertexArray, uint32_t vertexBuffer) override
+        {
+            m_calls.push_back("geometry " + std::to_string(vertexArray) + " " + std::to_string(vertexBuffer));
+        }
+
+        void bindTextures(const uint32_t* textures, uint32_t count) override
+        {
+            std::string call = "textures";
+            for (uint32_t i = 0; i < count; i++)
+                call += " " + std::to_string(textures[i]);
+            m_calls.push_back(call);
+        }
+
+        void draw(uint32_t indexBuffer, uint32_t indexCount, uint32_t instanceCount) override
+        {
+            m_calls.push_back("draw " + std::to_string(indexBuffer) + " " + std::to_string(indexCount) + " " +
+                std::to_string(instanceCount));
+        }
+
+        std::vector<std::string> m_calls;
+    };
+
+    // Item i uses pipeline i / 100, geometry 1 and texture i / 10
+    void recordItems(uint32_t first, uint32_t end, DrawCommands::CommandList& list)
+    {
+        for (uint32_t i = first; i < end; i++)
+        {
+            uint32_t texture = i / 10;
+            list.bindPipeline(i / 100 + 1);
+            list.bindGeometry(1, 2);
+            list.bindTextures(&texture, 1);
+            list.draw(3, 6, 1);
+        }
+    }
+
+    void testRedundantBinds()
+    {
+        DrawCommands::CommandList list;
+        uint32_t textures[] = { 5, 6 };
+        list.bindPipeline(1);
+        list.bindPipeline(1);
+        list.bindGeometry(1, 2);
+        list.bindTextures(textures, 2);
+        list.bindTextures(textures, 2);
+        list.draw(3, 36, 1);
+        list.bindGeometry(1, 2);
+        list.draw(4, 12, 2);
+        check(list.commands().size() == 5, "repeated binds are dropped while recording");
+        check(DrawCommands::validate(list, nullptr), "a complete list validates");
+    }
+
+    void testInvalidLists()
+    {
+        std::string errString;
+        DrawCommands::CommandList list;
+        list.bindGeometry(1, 2);
+        list.draw(3, 6, 1);
+        check(!DrawCommands::validate(list, &errString), "draw without a pipeline fails");
+        check(errString == "Command 1: draw without a pipeline", "draw without a pipeline is reported");
+
+        list.clear();
+        list.bindPipeline(1);
+        list.draw(3, 6, 1);
+        check(!DrawCommands::validate(list, nullptr), "draw without geometry fails");
+
+        list.clear();
+        list.bindPipeline(1);
+        list.bindGeometry(1, 2);
+        list.draw(3, 7, 1);
+        check(!DrawCommands::validate(list, nullptr), "index count that is not a multiple of 3 fails");
+
+        list.clear();
+        list.bindPipeline(1);
+        list.bindGeometry(1, 2);
+        list.draw(3, 6, 0);
+        check(!DrawCommands::validate(list, nullptr), "draw without instances fails");
+    }
+
+    // Replaying the lists of a multithreaded record() must call the backend like a single list would
+    void testReplay()
+    {
+        const uint32_t itemCount = 1000;
+        DrawCommands::CommandList single;
+        recordItems(0, itemCount, single);
+        LogBackend expected;
+        for (const DrawCommands::Command& command : single.commands())
+        {
+            switch (command.m_type)
+            {
+            case DrawCommands::CommandType::BindPipeline:
+                expected.bindPipeline(command.m_handles[0]);
+                break;
+            case DrawCommands::CommandType::BindGeometry:
+                expected.bindGeometry(command.m_handles[0], command.m_handles[1]);
+                break;
+            case DrawCommands::CommandType::BindTextures:
+                expected.bindTextures(command.m_handles, command.m_count);
+                break;
+            case DrawCommands::CommandType::Draw:
+                expected.draw(command.m_handles[0], command.m_handles[1], command.m_handles[2]);
+                break;
+            }
+        }
+
+        DrawCommands::record(itemCount, recordItems);
+        check(DrawCommands::listCount() > 1, "record() splits a large pass into several lists");
+        check(DrawCommands::validateLists(nullptr), "recorded lists validate");
+        LogBackend backend;
+        DrawCommands::replay(backend);
+        check(backend.m_calls == expected.m_calls, "replayed lists match a single list");
+
+        // An invalid list is left out of the replay
+        DrawCommands::record(itemCount, [](uint32_t first, uint32_t end, DrawCommands::CommandList& list)
+        {
+            if (first == 0)
+                list.draw(3, 6, 1);
+            recordItems(first, end, list);
+        });
+        std::string errString;
+        check(!DrawCommands::validateLists(&errString), "a list with a draw before its binds fails");
+        check(errString == "Invalid command list 0: Command 0: draw without a pipeline", "the invalid list is reported");
+        LogBackend skipped;
+        DrawCommands::replay(skipped);
+        check(skipped.m_calls.size() < expected.m_calls.size() && skipped.m_calls.back() == expected.m_calls.back(),
+            "the invalid list is skipped and the others are replayed");
+        DrawCommands::endFrame();
+        check(DrawCommands::statistics().m_invalidLists == 1, "the invalid list is counted");
+    }
+}
+
+int main()
+{
+    JobSystem::init(4);
+    testRedundantBinds();
+    testInvalidLists();
+    testReplay();
+    DrawCommands::destroy();
+    JobSystem::destroy();
+
+    if (s_failures)
+    {
+        fprintf(stderr, "%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("All draw command checks passed\n");
+    return 0;
+}
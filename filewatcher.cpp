@@ -0,0 +1,165 @@
+#include "filewatcher.h"
+#include "util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+namespace
+{
+    // How often the watcher thread checks whether it should exit
+    const int WaitTimeoutMs = 100;
+}
+
+FileWatcher::~FileWatcher()
+{
+    stop();
+}
+
+bool FileWatcher::start(const char* directory, std::string* errString)
+{
+    stop();
+    m_directory = directory;
+#ifdef _WIN32
+    HANDLE dir = CreateFileA(directory, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (dir == INVALID_HANDLE_VALUE)
+    {
+        if (errString)
+            *errString = std::string("Cannot watch directory: ") + directory;
+        return false;
+    }
+    m_directoryHandle = dir;
+    m_event = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+#else
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify < 0 ||
+        inotify_add_watch(m_inotify, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        if (m_inotify >= 0)
+            close(m_inotify);
+        m_inotify = -1;
+        if (errString)
+            *errString = std::string("Cannot watch directory: ") + directory;
+        return false;
+    }
+#endif
+    m_running = true;
+    m_thread = std::thread(&FileWatcher::run, this);
+    return true;
+}
+
+void FileWatcher::stop()
+{
+    if (m_running)
+    {
+        m_running = false;
+        m_thread.join();
+    }
+#ifdef _WIN32
+    if (m_directoryHandle)
+    {
+        // run() cancelled and waited for its read, no I/O is left on the handle
+        CloseHandle((HANDLE)m_directoryHandle);
+        CloseHandle((HANDLE)m_event);
+        m_directoryHandle = nullptr;
+        m_event = nullptr;
+    }
+#else
+    if (m_inotify >= 0)
+    {
+        close(m_inotify);
+        m_inotify = -1;
+    }
+#endif
+}
+
+bool FileWatcher::poll(std::vector<std::string>& changedFiles)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_changes.empty())
+        return false;
+    for (const std::string& name : m_changes)
+        changedFiles.push_back(Util::combinePath(m_directory.c_str(), name.c_str()));
+    m_changes.clear();
+    return true;
+}
+
+void FileWatcher::addChange(const char* filename)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_changes.insert(filename);
+}
+
+#ifdef _WIN32
+void FileWatcher::run()
+{
+    alignas(DWORD) char buffer[16 * 1024];
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = (HANDLE)m_event;
+    const DWORD filter = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE;
+    bool pending = false;
+    while (m_running)
+    {
+        if (!pending)
+        {
+            ResetEvent(overlapped.hEvent);
+            if (!ReadDirectoryChangesW((HANDLE)m_directoryHandle, buffer, sizeof(buffer), FALSE, filter, nullptr, &overlapped, nullptr))
+                break;
+            pending = true;
+        }
+        if (WaitForSingleObject(overlapped.hEvent, WaitTimeoutMs) != WAIT_OBJECT_0)
+            continue;
+        pending = false;
+
+        DWORD bytes = 0;
+        if (!GetOverlappedResult((HANDLE)m_directoryHandle, &overlapped, &bytes, FALSE) || bytes == 0)
+            continue;
+        const char* cur = buffer;
+        for (;;)
+        {
+            const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)cur;
+            if (info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+            {
+                char name[MAX_PATH];
+                int len = WideCharToMultiByte(CP_UTF8, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), name, sizeof(name) - 1, nullptr, nullptr);
+                name[len] = 0;
+                addChange(name);
+            }
+            if (!info->NextEntryOffset)
+                break;
+            cur += info->NextEntryOffset;
+        }
+    }
+    // The read would complete into buffer after this thread exited, and only its issuer can wait for it
+    if (pending)
+    {
+        DWORD bytes = 0;
+        CancelIoEx((HANDLE)m_directoryHandle, &overlapped);
+        GetOverlappedResult((HANDLE)m_directoryHandle, &overlapped, &bytes, TRUE);
+    }
+}
+#else
+void FileWatcher::run()
+{
+    alignas(inotify_event) char buffer[16 * 1024];
+    pollfd fd = { m_inotify, POLLIN, 0 };
+    while (m_running)
+    {
+        if (::poll(&fd, 1, WaitTimeoutMs) <= 0)
+            continue;
+        ssize_t bytes = read(m_inotify, buffer, sizeof(buffer));
+        for (ssize_t offset = 0; offset < bytes;)
+        {
+            const inotify_event* event = (const inotify_event*)(buffer + offset);
+            if (event->len)
+                addChange(event->name);
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+}
+#endif
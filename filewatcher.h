@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+// Watches a single directory on a background thread (inotify on Linux,
+// ReadDirectoryChangesW on Windows) and collects the names of files that were
+// written or renamed into it. On Linux a file is reported once it is closed after
+// writing, so a new file is never seen half written. The owner polls the collected
+// names once per frame, so several events for one save show up as a single change.
+class FileWatcher
+{
+public:
+    ~FileWatcher();
+
+    bool start(const char* directory, std::string* errString);
+    void stop();
+    bool isRunning() const { return m_running; }
+    const std::string& directory() const { return m_directory; }
+
+    // Moves the changed files since the last call into changedFiles, as paths combined with the directory.
+    // Returns false if nothing changed.
+    bool poll(std::vector<std::string>& changedFiles);
+private:
+    void run();
+    void addChange(const char* filename);
+
+    std::string m_directory;
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+    std::mutex m_mutex;
+    std::set<std::string> m_changes;
+#ifdef _WIN32
+    void* m_directoryHandle = nullptr;
+    void* m_event = nullptr;
+#else
+    int m_inotify = -1;
+#endif
+};
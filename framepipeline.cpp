@@ -0,0 +1,168 @@
+#include "framepipeline.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "profiler.h"
+
+using namespace FramePipeline;
+
+namespace
+{
+    // The published slot in the low bits, FreshBit while the render thread hasn't taken it
+    const uint32_t SlotMask = 0x3;
+    const uint32_t FreshBit = 0x4;
+
+    std::atomic<uint32_t> s_published{ 1 };
+    // Only touched by the writing and the rendering thread respectively
+    uint32_t s_writeSlot = 2;
+    uint32_t s_renderSlot = 0;
+
+    // Last frame published by the update and taken by the render thread
+    std::atomic<uint64_t> s_publishedFrame{ 0 };
+    std::atomic<uint64_t> s_renderedFrame{ 0 };
+    // Written by the update thread, copied into the statistics by the render thread
+    std::atomic<uint64_t> s_updateNs{ 0 };
+    std::atomic<uint64_t> s_updateWaitNs{ 0 };
+
+    // Only for sleeping, the hand-over itself doesn't lock
+    std::mutex s_mutex;
+    std::condition_variable s_wake;
+    bool s_stop = false;
+    std::thread s_thread;
+    UpdateFunction s_update;
+    uint32_t s_depth = 0;
+    uint64_t s_latencySamples = 0;
+    Statistics s_statistics;
+
+    // Wakes the other thread, the lock orders the counter change before its check
+    void notify()
+    {
+        { std::lock_guard<std::mutex> lock(s_mutex); }
+        s_wake.notify_all();
+    }
+
+    // Returns false if the pipeline is stopping
+    template<typename Predicate>
+    bool waitFor(Predicate predicate)
+    {
+        if (predicate())
+            return true;
+        std::unique_lock<std::mutex> lock(s_mutex);
+        s_wake.wait(lock, [&predicate] { return s_stop || predicate(); });
+        return !s_stop;
+    }
+
+    void update(uint64_t frame)
+    {
+        uint64_t start = Profiler::nowNs();
+        s_update(frame, s_writeSlot);
+        s_updateNs = Profiler::nowNs() - start;
+    }
+
+    // The written slot becomes the published one and the previous published slot is written next
+    void publish(uint64_t frame)
+    {
+        s_writeSlot = s_published.exchange(s_writeSlot | FreshBit, std::memory_order_acq_rel) & SlotMask;
+        s_publishedFrame = frame;
+    }
+
+    void updateMain()
+    {
+        for (uint64_t frame = 1;; frame++)
+        {
+            // Starts once the frame depth frames earlier is rendering, and publishes once the previous snapshot
+            // was taken, so a published snapshot is never replaced before it is rendered
+            uint64_t waitStart = Profiler::nowNs();
+            if (!waitFor([frame] { return s_renderedFrame + s_depth >= frame; }))
+                return;
+            uint64_t waitNs = Profiler::nowNs() - waitStart;
+            update(frame);
+            waitStart = Profiler::nowNs();
+            if (!waitFor([frame] { return s_renderedFrame + 1 >= frame; }))
+                return;
+            s_updateWaitNs = waitNs + Profiler::nowNs() - waitStart;
+            publish(frame);
+            notify();
+        }
+    }
+}
+
+void FramePipeline::start(uint32_t depth, const UpdateFunction& update)
+{
+    s_depth = std::min(depth, MaxDepth);
+    s_update = update;
+    s_published = 1;
+    s_writeSlot = 2;
+    s_renderSlot = 0;
+    s_publishedFrame = 0;
+    s_renderedFrame = 0;
+    s_updateNs = 0;
+    s_updateWaitNs = 0;
+    s_stop = false;
+    s_latencySamples = 0;
+    s_statistics = Statistics();
+    s_statistics.m_depth = s_depth;
+    if (s_depth)
+        s_thread = std::thread(updateMain);
+}
+
+void FramePipeline::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_stop = true;
+    }
+    s_wake.notify_all();
+    if (s_thread.joinable())
+        s_thread.join();
+    s_update = nullptr;
+}
+
+uint32_t FramePipeline::depth()
+{
+    return s_depth;
+}
+
+uint32_t FramePipeline::beginFrame()
+{
+    PROFILE_SCOPE("FramePipeline::beginFrame");
+    uint64_t frame = s_renderedFrame + 1;
+    uint64_t waitStart = Profiler::nowNs();
+    if (!s_depth)
+    {
+        update(frame);
+        publish(frame);
+    }
+    else if (!waitFor([frame] { return s_publishedFrame >= frame; }))
+    {
+        return s_renderSlot;
+    }
+    s_statistics.m_renderWaitMs = s_depth ? (Profiler::nowNs() - waitStart) / 1000000.0 : 0.0;
+
+    // Always fresh here, the update thread doesn't publish again before s_renderedFrame moves on
+    s_renderSlot = s_published.exchange(s_renderSlot, std::memory_order_acq_rel) & SlotMask;
+    s_renderedFrame = frame;
+    if (s_depth)
+        notify();
+
+    s_statistics.m_frames = frame;
+    s_statistics.m_lastUpdateMs = s_updateNs / 1000000.0;
+    s_statistics.m_updateWaitMs = s_updateWaitNs / 1000000.0;
+    return s_renderSlot;
+}
+
+void FramePipeline::endFrame(uint64_t inputTimeNs)
+{
+    double latencyMs = (Profiler::nowNs() - inputTimeNs) / 1000000.0;
+    s_latencySamples++;
+    s_statistics.m_lastLatencyMs = latencyMs;
+    s_statistics.m_avgLatencyMs += (latencyMs - s_statistics.m_avgLatencyMs) / s_latencySamples;
+    s_statistics.m_maxLatencyMs = std::max(s_statistics.m_maxLatencyMs, latencyMs);
+}
+
+const Statistics& FramePipeline::statistics()
+{
+    return s_statistics;
+}
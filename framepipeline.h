@@ -0,0 +1,47 @@
+#pragma once
+#include <inttypes.h>
+#include <functional>
+
+// Runs the per-frame update (camera, input, light animation) on its own thread while the render thread draws the
+// previous frame. Every update fills an immutable snapshot, the two threads hand the snapshots over through a
+// lock-free triple buffer: one slot being written, one published and one being rendered. The caller owns the
+// SlotCount snapshots, the pipeline only passes slot indices. Frames are rendered in order, none is skipped.
+namespace FramePipeline
+{
+    const uint32_t SlotCount = 3;
+    // Frames the update may run ahead of the render thread. 0 runs the update on the render thread, 2 is the most
+    // the triple buffer holds: one frame rendering, one published and one being updated.
+    const uint32_t MaxDepth = 2;
+
+    // Fills snapshot slot for frame, frames count from 1 after every start(). Runs on the update thread, or on the
+    // render thread in beginFrame() with depth 0.
+    typedef std::function<void(uint64_t frame, uint32_t slot)> UpdateFunction;
+
+    struct Statistics
+    {
+        uint32_t m_depth = 0;
+        uint64_t m_frames = 0;
+        double m_lastUpdateMs = 0.0;
+        // Time the render thread waited for a snapshot and the update thread for a free slot, last frame
+        double m_renderWaitMs = 0.0;
+        double m_updateWaitMs = 0.0;
+        // From sampling the input a frame was updated with until the frame was presented
+        double m_lastLatencyMs = 0.0;
+        double m_avgLatencyMs = 0.0;
+        double m_maxLatencyMs = 0.0;
+    };
+
+    // Starts the update thread for depth 1 and 2, depth is clamped to MaxDepth
+    void start(uint32_t depth, const UpdateFunction& update);
+    // Joins the update thread, the snapshots are not touched afterwards
+    void stop();
+    uint32_t depth();
+
+    // Returns the slot of the next frame, valid until the next beginFrame(). Waits for the update thread if the
+    // frame isn't published yet.
+    uint32_t beginFrame();
+    // Once the frame is presented, inputTimeNs is the Profiler::nowNs() of its input
+    void endFrame(uint64_t inputTimeNs);
+
+    const Statistics& statistics();
+}
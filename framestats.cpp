@@ -0,0 +1,241 @@
+#include "framestats.h"
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "imgui.h"
+
+using namespace FrameStats;
+
+namespace
+{
+    // Number of frames used for rolling averages, percentiles and graphs
+    const size_t HistorySize = 512;
+
+    std::atomic<uint64_t> s_counters[(int)Counter::NumCounters];
+    uint64_t s_frameIndex = 0;
+
+    std::vector<FrameSample> s_history(HistorySize);
+    size_t s_historyCount = 0;
+    size_t s_historyHead = 0;
+
+    FILE* s_logFile = nullptr;
+    LogFormat s_logFormat = LogFormat::Csv;
+
+    const char* s_counterNames[] = {
+        "draw_calls",
+        "triangles",
+        "texture_binds",
+        "uniform_updates",
+        "buffer_bytes",
+        "texture_bytes",
+        "shadow_passes",
+        "shadow_passes_skipped",
+        "shaded_samples",
+        "virtual_tile_requests",
+        "virtual_page_faults"
+    };
+    static_assert(sizeof(s_counterNames) / sizeof(s_counterNames[0]) == (size_t)Counter::NumCounters, "Missing counter name");
+
+    const FrameSample& historyAt(size_t age)
+    {
+        // age 0 is the most recent frame
+        return s_history[(s_historyHead + HistorySize - 1 - age) % HistorySize];
+    }
+
+    void writeLogLine(const FrameSample& sample)
+    {
+        if (s_logFormat == LogFormat::Csv)
+        {
+            fprintf(s_logFile, "%llu,%.4f", (unsigned long long)sample.m_frameIndex, sample.m_frameTime * 1000.0);
+            for (int i = 0; i < (int)Counter::NumCounters; i++)
+                fprintf(s_logFile, ",%llu", (unsigned long long)sample.m_counters[i]);
+            fprintf(s_logFile, "\n");
+        }
+        else
+        {
+            fprintf(s_logFile, "{\"frame\":%llu,\"frame_ms\":%.4f", (unsigned long long)sample.m_frameIndex, sample.m_frameTime * 1000.0);
+            for (int i = 0; i < (int)Counter::NumCounters; i++)
+                fprintf(s_logFile, ",\"%s\":%llu", s_counterNames[i], (unsigned long long)sample.m_counters[i]);
+            fprintf(s_logFile, "}\n");
+        }
+    }
+}
+
+const char* FrameStats::counterName(Counter counter)
+{
+    return s_counterNames[(int)counter];
+}
+
+void FrameStats::add(Counter counter, uint64_t value)
+{
+    s_counters[(int)counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t FrameStats::current(Counter counter)
+{
+    return s_counters[(int)counter].load(std::memory_order_relaxed);
+}
+
+void FrameStats::endFrame(double frameTime)
+{
+    FrameSample& sample = s_history[s_historyHead];
+    sample.m_frameIndex = s_frameIndex++;
+    sample.m_frameTime = frameTime;
+    for (int i = 0; i < (int)Counter::NumCounters; i++)
+        sample.m_counters[i] = s_counters[i].exchange(0, std::memory_order_relaxed);
+
+    s_historyHead = (s_historyHead + 1) % HistorySize;
+    s_historyCount = std::min(s_historyCount + 1, HistorySize);
+
+    if (s_logFile)
+        writeLogLine(sample);
+}
+
+const FrameSample& FrameStats::lastFrame()
+{
+    return historyAt(0);
+}
+
+double FrameStats::average(Counter counter)
+{
+    if (s_historyCount == 0)
+        return 0.0;
+    double sum = 0.0;
+    for (size_t i = 0; i < s_historyCount; i++)
+        sum += (double)historyAt(i).m_counters[(int)counter];
+    return sum / s_historyCount;
+}
+
+double FrameStats::averageFrameTime()
+{
+    if (s_historyCount == 0)
+        return 0.0;
+    double sum = 0.0;
+    for (size_t i = 0; i < s_historyCount; i++)
+        sum += historyAt(i).m_frameTime;
+    return sum / s_historyCount;
+}
+
+double FrameStats::frameTimePercentile(double percentile)
+{
+    if (s_historyCount == 0)
+        return 0.0;
+    std::vector<double> times(s_historyCount);
+    for (size_t i = 0; i < s_historyCount; i++)
+        times[i] = historyAt(i).m_frameTime;
+
+    // Nearest rank percentile
+    size_t rank = (size_t)(percentile / 100.0 * (double)(s_historyCount - 1) + 0.5);
+    rank = std::min(rank, s_historyCount - 1);
+    std::nth_element(times.begin(), times.begin() + rank, times.end());
+    return times[rank];
+}
+
+bool FrameStats::startLogging(const char* filename, LogFormat format, std::string* errString)
+{
+    stopLogging();
+    s_logFile = fopen(filename, "wb");
+    if (!s_logFile)
+    {
+        if (errString)
+            *errString = std::string("Cannot open statistics log: ") + filename;
+        return false;
+    }
+    s_logFormat = format;
+    if (format == LogFormat::Csv)
+    {
+        fprintf(s_logFile, "frame,frame_ms");
+        for (int i = 0; i < (int)Counter::NumCounters; i++)
+            fprintf(s_logFile, ",%s", s_counterNames[i]);
+        fprintf(s_logFile, "\n");
+    }
+    return true;
+}
+
+void FrameStats::stopLogging()
+{
+    if (s_logFile)
+    {
+        fclose(s_logFile);
+        s_logFile = nullptr;
+    }
+}
+
+bool FrameStats::isLogging()
+{
+    return s_logFile != nullptr;
+}
+
+void FrameStats::renderUI()
+{
+    static char logFile[256] = "frame_stats.csv";
+    static int logFormat = (int)LogFormat::Csv;
+    static std::string logError;
+
+    double avgFrameTime = averageFrameTime();
+    ImGui::Text("%.2f ms/frame (%d frames/second)", avgFrameTime * 1000.0, avgFrameTime > 0.0 ? (int)(1.0 / avgFrameTime) : 0);
+
+    if (!ImGui::CollapsingHeader("Statistics"))
+        return;
+
+    ImGui::Text("Frame time p50 %.2f ms  p95 %.2f ms  p99 %.2f ms",
+        frameTimePercentile(50.0) * 1000.0, frameTimePercentile(95.0) * 1000.0, frameTimePercentile(99.0) * 1000.0);
+
+    const FrameSample& last = lastFrame();
+    if (ImGui::BeginTable("##framestats", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("Counter");
+        ImGui::TableSetupColumn("Last Frame");
+        ImGui::TableSetupColumn("Average");
+        ImGui::TableHeadersRow();
+        for (int i = 0; i < (int)Counter::NumCounters; i++)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(s_counterNames[i]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", (unsigned long long)last.m_counters[i]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", average((Counter)i));
+        }
+        ImGui::EndTable();
+    }
+
+    // History graphs, oldest frame first
+    std::vector<float> frameTimes(s_historyCount);
+    std::vector<float> drawCalls(s_historyCount);
+    std::vector<float> triangles(s_historyCount);
+    for (size_t i = 0; i < s_historyCount; i++)
+    {
+        const FrameSample& sample = historyAt(s_historyCount - 1 - i);
+        frameTimes[i] = (float)(sample.m_frameTime * 1000.0);
+        drawCalls[i] = (float)sample.m_counters[(int)Counter::DrawCalls];
+        triangles[i] = (float)sample.m_counters[(int)Counter::Triangles];
+    }
+    if (s_historyCount)
+    {
+        ImGui::PlotLines("Frame ms##statsframetime", &frameTimes[0], (int)frameTimes.size(), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+        ImGui::PlotLines("Draw Calls##statsdrawcalls", &drawCalls[0], (int)drawCalls.size(), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 40));
+        ImGui::PlotLines("Triangles##statstriangles", &triangles[0], (int)triangles.size(), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 40));
+    }
+
+    // Logging
+    const char* formats[] = { "CSV", "JSON Lines" };
+    ImGui::InputText("Log File##statslogfile", logFile, sizeof(logFile));
+    ImGui::Combo("Format##statslogformat", &logFormat, formats, IM_ARRAYSIZE(formats));
+    if (!isLogging())
+    {
+        if (ImGui::Button("Start Logging##statsstartlog"))
+        {
+            logError = "";
+            startLogging(logFile, (LogFormat)logFormat, &logError);
+        }
+    }
+    else if (ImGui::Button("Stop Logging##statsstoplog"))
+    {
+        stopLogging();
+    }
+    if (logError.length())
+        ImGui::TextWrapped("%s", logError.c_str());
+}
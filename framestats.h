@@ -0,0 +1,60 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+
+// Per-frame rendering counters. The render loop and GL upload paths add to the
+// counters of the current frame, endFrame() closes the frame and moves it into the
+// history used for rolling averages, percentiles and the optional log file.
+namespace FrameStats
+{
+    enum class Counter : int
+    {
+        DrawCalls,
+        Triangles,
+        TextureBinds,
+        UniformUpdates,
+        BufferBytes,
+        TextureBytes,
+        // Shadow map passes rendered and reused from earlier frames, one per cascade, spot map or cube face
+        ShadowPasses,
+        ShadowPassesSkipped,
+        // Samples that passed the depth test in the main pass, arrives a few frames late from GPU queries
+        ShadedSamples,
+        // Distinct virtual texture tiles asked for by the processed feedback and the ones that weren't resident
+        VirtualTileRequests,
+        VirtualPageFaults,
+        NumCounters // Always at the last position
+    };
+
+    enum class LogFormat : int
+    {
+        Csv,
+        JsonLines
+    };
+
+    struct FrameSample
+    {
+        uint64_t m_frameIndex = 0;
+        double m_frameTime = 0.0;
+        uint64_t m_counters[(int)Counter::NumCounters] = {};
+    };
+
+    const char* counterName(Counter counter);
+
+    void add(Counter counter, uint64_t value = 1);
+    uint64_t current(Counter counter);
+    void endFrame(double frameTime);
+
+    const FrameSample& lastFrame();
+    double average(Counter counter);
+    double averageFrameTime();
+    // percentile in [0, 100] over the frame time history
+    double frameTimePercentile(double percentile);
+
+    bool startLogging(const char* filename, LogFormat format, std::string* errString);
+    void stopLogging();
+    bool isLogging();
+
+    // Draws the statistics section, meant to be called inside an existing ImGui window
+    void renderUI();
+}
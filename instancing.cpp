@@ -0,0 +1,281 @@
+#include "instancing.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include "framestats.h"
+#include "jobsystem.h"
+#include "memorytracker.h"
+#include "profiler.h"
+#include "ringbuffer.h"
+#include "util.h"
+
+using namespace Instancing;
+
+namespace
+{
+    struct Bounds
+    {
+        glm::vec3 m_min = glm::vec3(0.0f);
+        glm::vec3 m_max = glm::vec3(0.0f);
+    };
+
+    GLuint s_allBuffer = 0;
+    // Rewritten every frame, streamed through the ring buffer
+    RingBuffer::Allocation s_visibleAllocation;
+    glm::vec3 s_modelMin = glm::vec3(0.0f);
+    glm::vec3 s_modelMax = glm::vec3(0.0f);
+    std::vector<glm::mat4x4> s_transforms;
+    // World space bounds of every copy, in the order of s_transforms
+    std::vector<Bounds> s_bounds;
+    Bounds s_sceneBounds;
+    std::vector<glm::mat4x4> s_visibleTransforms;
+    // Result of the frustum test of every copy, written by the culling jobs
+    std::vector<uint8_t> s_visible;
+    Statistics s_statistics;
+
+    // Only changes with the transforms, orphaned so the draws still reading the previous contents don't stall it
+    void uploadAll()
+    {
+        GLsizeiptr size = (GLsizeiptr)(s_transforms.size() * sizeof(glm::mat4x4));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_allBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+        MemoryTracker::trackBuffer(s_allBuffer, MemoryTracker::Category::DynamicBuffers, "Instance transforms", (uint64_t)size);
+        if (size)
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, s_transforms.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        FrameStats::add(FrameStats::Counter::BufferBytes, size);
+    }
+
+    void uploadVisible()
+    {
+        GLsizeiptr size = (GLsizeiptr)(s_visibleTransforms.size() * sizeof(glm::mat4x4));
+        RingBuffer::upload(s_visibleTransforms.data(), size, s_visibleAllocation);
+        FrameStats::add(FrameStats::Counter::BufferBytes, size);
+    }
+
+    // Bounding box of the model box after the transform
+    Bounds transformBounds(const glm::mat4x4& transform)
+    {
+        glm::vec3 center = (s_modelMin + s_modelMax) * 0.5f;
+        glm::vec3 extent = (s_modelMax - s_modelMin) * 0.5f;
+        glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+        glm::vec3 worldExtent(0.0f);
+        for (int axis = 0; axis < 3; axis++)
+            worldExtent += glm::abs(glm::vec3(transform[axis])) * extent[axis];
+        Bounds bounds;
+        bounds.m_min = worldCenter - worldExtent;
+        bounds.m_max = worldCenter + worldExtent;
+        return bounds;
+    }
+
+    void updateBounds()
+    {
+        s_bounds.resize(s_transforms.size());
+        s_sceneBounds = Bounds();
+        for (size_t i = 0; i < s_transforms.size(); i++)
+        {
+            s_bounds[i] = transformBounds(s_transforms[i]);
+            s_sceneBounds.m_min = i ? glm::min(s_sceneBounds.m_min, s_bounds[i].m_min) : s_bounds[i].m_min;
+            s_sceneBounds.m_max = i ? glm::max(s_sceneBounds.m_max, s_bounds[i].m_max) : s_bounds[i].m_max;
+        }
+    }
+
+    // Planes of the frustum with their normals pointing inside, from the rows of the view-projection matrix
+    void frustumPlanes(const glm::mat4x4& viewProjection, glm::vec4 planes[6])
+    {
+        glm::vec4 rows[4];
+        for (int row = 0; row < 4; row++)
+            rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            planes[axis * 2] = rows[3] + rows[axis];
+            planes[axis * 2 + 1] = rows[3] - rows[axis];
+        }
+    }
+
+    // Conservative, boxes near the corners of the frustum may be kept although they're outside
+    bool isVisible(const Bounds& bounds, const glm::vec4 planes[6])
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            // The corner of the box furthest along the plane normal
+            glm::vec3 corner(planes[i].x >= 0.0f ? bounds.m_max.x : bounds.m_min.x,
+                planes[i].y >= 0.0f ? bounds.m_max.y : bounds.m_min.y,
+                planes[i].z >= 0.0f ? bounds.m_max.z : bounds.m_min.z);
+            if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    glm::mat4x4 placement(const glm::vec3& position, float yaw, float scale)
+    {
+        float c = cosf(yaw) * scale;
+        float s = sinf(yaw) * scale;
+        return glm::mat4x4(glm::vec4(c, 0.0f, -s, 0.0f),
+            glm::vec4(0.0f, scale, 0.0f, 0.0f),
+            glm::vec4(s, 0.0f, c, 0.0f),
+            glm::vec4(position, 1.0f));
+    }
+}
+
+bool Instancing::init(std::string* errString)
+{
+    glGenBuffers(1, &s_allBuffer);
+    if (!s_allBuffer)
+    {
+        if (errString)
+            *errString = "Cannot create the instance transform buffers";
+        return false;
+    }
+    setTransforms(std::vector<glm::mat4x4>(1, glm::mat4x4(1.0f)));
+    return true;
+}
+
+void Instancing::destroy()
+{
+    MemoryTracker::untrackBuffer(s_allBuffer);
+    glDeleteBuffers(1, &s_allBuffer);
+    s_allBuffer = 0;
+    s_visibleAllocation = RingBuffer::Allocation();
+    s_transforms.clear();
+    s_bounds.clear();
+    s_visibleTransforms.clear();
+    s_visible.clear();
+    s_statistics = Statistics();
+}
+
+void Instancing::setModelBounds(const glm::vec3& modelMin, const glm::vec3& modelMax)
+{
+    s_modelMin = modelMin;
+    s_modelMax = modelMax;
+    updateBounds();
+}
+
+void Instancing::setTransforms(const std::vector<glm::mat4x4>& transforms)
+{
+    s_transforms = transforms;
+    updateBounds();
+    uploadAll();
+    // Visible until the first cull
+    s_visibleTransforms = s_transforms;
+    uploadVisible();
+    s_statistics.m_instances = (uint32_t)s_transforms.size();
+    s_statistics.m_visibleInstances = (uint32_t)s_visibleTransforms.size();
+}
+
+void Instancing::setGrid(uint32_t columns, uint32_t rows, float spacing)
+{
+    columns = std::max(columns, 1u);
+    rows = std::max(rows, 1u);
+    glm::vec3 step = s_modelMax - s_modelMin + glm::vec3(spacing);
+    std::vector<glm::mat4x4> transforms;
+    transforms.reserve(columns * rows);
+    for (uint32_t row = 0; row < rows; row++)
+    {
+        for (uint32_t column = 0; column < columns; column++)
+        {
+            // Centered on the original, a 1x1 grid is the identity
+            glm::vec3 offset((column - (columns - 1) * 0.5f) * step.x, 0.0f, (row - (rows - 1) * 0.5f) * step.z);
+            transforms.push_back(placement(offset, 0.0f, 1.0f));
+        }
+    }
+    setTransforms(transforms);
+}
+
+bool Instancing::loadTransforms(const char* filename, std::string* errString)
+{
+    std::vector<char> buffer;
+    if (!Util::loadFileToBuffer(filename, buffer, false, true))
+    {
+        if (errString)
+            *errString = std::string("Cannot open instance transforms: ") + filename;
+        return false;
+    }
+
+    std::vector<glm::mat4x4> transforms;
+    const char* line = &buffer[0];
+    while (*line)
+    {
+        const char* next = strchr(line, '\n');
+        if (line[0] != '#' && line[0] != '\n' && line[0] != '\r')
+        {
+            glm::vec3 position(0.0f);
+            float yaw = 0.0f;
+            float scale = 1.0f;
+            // Copied so the optional values can't be read from the next line
+            std::string text(line, next ? next : line + strlen(line));
+            int read = sscanf(text.c_str(), "%f %f %f %f %f", &position.x, &position.y, &position.z, &yaw, &scale);
+            if (read < 3 || scale <= 0.0f)
+            {
+                if (errString)
+                    *errString = std::string("Malformed instance transform in ") + filename;
+                return false;
+            }
+            transforms.push_back(placement(position, yaw * 0.0174533f, scale));
+        }
+        if (!next)
+            break;
+        line = next + 1;
+    }
+
+    if (transforms.empty())
+    {
+        if (errString)
+            *errString = std::string("No instance transforms in ") + filename;
+        return false;
+    }
+    setTransforms(transforms);
+    return true;
+}
+
+glm::vec3 Instancing::sceneMin()
+{
+    return s_sceneBounds.m_min;
+}
+
+glm::vec3 Instancing::sceneMax()
+{
+    return s_sceneBounds.m_max;
+}
+
+void Instancing::cull(const glm::mat4x4& viewProjection)
+{
+    PROFILE_SCOPE("Instancing::cull");
+    uint64_t start = Profiler::nowNs();
+    glm::vec4 planes[6];
+    frustumPlanes(viewProjection, planes);
+    s_visible.resize(s_transforms.size());
+    JobSystem::parallelFor("Cull instances", (uint32_t)s_transforms.size(), 256, [&planes](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+            s_visible[i] = isVisible(s_bounds[i], planes);
+    });
+    // Compacted in order, so the draw order doesn't depend on the threads
+    s_visibleTransforms.clear();
+    for (size_t i = 0; i < s_transforms.size(); i++)
+    {
+        if (s_visible[i])
+            s_visibleTransforms.push_back(s_transforms[i]);
+    }
+    uploadVisible();
+    s_statistics.m_visibleInstances = (uint32_t)s_visibleTransforms.size();
+    s_statistics.m_cullMs = (double)(Profiler::nowNs() - start) / 1000000.0;
+}
+
+uint32_t Instancing::bindAll()
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TransformBufferBinding, s_allBuffer);
+    return (uint32_t)s_transforms.size();
+}
+
+uint32_t Instancing::bindVisible()
+{
+    RingBuffer::bind(GL_SHADER_STORAGE_BUFFER, TransformBufferBinding, s_visibleAllocation);
+    return (uint32_t)s_visibleTransforms.size();
+}
+
+const Statistics& Instancing::statistics()
+{
+    return s_statistics;
+}
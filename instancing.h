@@ -0,0 +1,49 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include "glm/glm.hpp"
+#include "GL/glew.h"
+
+// Replicates the loaded model for stress tests. Every copy has its own transform, the copies are drawn with
+// instanced draw calls and vertex.glsl reads the transform of each instance from a shader storage buffer.
+// The copies are frustum culled on the CPU every frame and only the visible transforms are streamed through the
+// RingBuffer; shadow passes use a second buffer holding all of them. The default is one copy with the identity
+// transform.
+namespace Instancing
+{
+    // Shader storage buffer binding of InstanceTransforms in vertex.glsl
+    const GLuint TransformBufferBinding = 3;
+
+    struct Statistics
+    {
+        uint32_t m_instances = 0;
+        uint32_t m_visibleInstances = 0;
+        double m_cullMs = 0.0;
+    };
+
+    // Needs a current GL context and an initialized RingBuffer
+    bool init(std::string* errString);
+    void destroy();
+
+    // Bounds of one copy in model space, used for culling and the bounds of the whole scene
+    void setModelBounds(const glm::vec3& modelMin, const glm::vec3& modelMax);
+    // Transforms may rotate, translate and scale uniformly, the normals aren't corrected for other scales
+    void setTransforms(const std::vector<glm::mat4x4>& transforms);
+    // columns x rows copies on the xz plane centered on the model, spacing is the gap between neighbors
+    void setGrid(uint32_t columns, uint32_t rows, float spacing);
+    // One copy per line: "x y z [yaw [scale]]", yaw in degrees around the y axis. Lines starting with # are comments.
+    bool loadTransforms(const char* filename, std::string* errString);
+
+    // Bounds of all copies
+    glm::vec3 sceneMin();
+    glm::vec3 sceneMax();
+
+    // Culls the copies against the frustum of viewProjection and uploads the transforms of the visible ones
+    void cull(const glm::mat4x4& viewProjection);
+    // Bind the transforms of all copies or of the ones visible in the last cull, return the instance count
+    uint32_t bindAll();
+    uint32_t bindVisible();
+
+    const Statistics& statistics();
+}
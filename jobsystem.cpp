@@ -0,0 +1,307 @@
+#include "jobsystem.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+
+using namespace JobSystem;
+
+namespace
+{
+    const uint32_t NoThread = UINT32_MAX;
+
+    struct ThreadQueue
+    {
+        std::mutex m_mutex;
+        std::deque<Job> m_jobs;
+        std::atomic<uint64_t> m_executed{ 0 };
+        std::atomic<uint64_t> m_steals{ 0 };
+        std::atomic<uint64_t> m_busyNs{ 0 };
+    };
+
+    std::vector<std::unique_ptr<ThreadQueue>> s_queues;
+    std::vector<std::thread> s_threads;
+    // Jobs sitting in any deque, idle workers sleep while it is zero
+    std::atomic<uint32_t> s_queuedJobs{ 0 };
+    std::mutex s_sleepMutex;
+    std::condition_variable s_wake;
+    bool s_stop = false;
+    TaskHook s_taskHook;
+    ZoneBeginHook s_zoneBegin;
+    ZoneEndHook s_zoneEnd;
+    thread_local uint32_t t_threadIndex = NoThread;
+
+    // Error paths may leave without destroy(), joinable threads would terminate the process at exit
+    struct ExitGuard
+    {
+        ~ExitGuard()
+        {
+            if (!s_threads.empty())
+                JobSystem::destroy();
+        }
+    } s_exitGuard;
+
+    uint64_t nowNs()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Threads outside the pool queue their jobs on thread 0
+    uint32_t currentQueue()
+    {
+        return t_threadIndex < s_queues.size() ? t_threadIndex : 0;
+    }
+
+    void push(Job&& job)
+    {
+        ThreadQueue& queue = *s_queues[currentQueue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            queue.m_jobs.push_back(std::move(job));
+        }
+        s_queuedJobs++;
+        if (!s_threads.empty())
+        {
+            // Taking the lock orders the increment before the check of a worker about to sleep
+            { std::lock_guard<std::mutex> lock(s_sleepMutex); }
+            s_wake.notify_one();
+        }
+    }
+
+    // The newest job of the own deque first, it is most likely to find its data in the cache, then the oldest
+    // job of another deque, which tends to be the largest piece of work left
+    bool takeJob(uint32_t thread, Job& job, bool& stolen)
+    {
+        uint32_t queueCount = (uint32_t)s_queues.size();
+        for (uint32_t i = 0; i < queueCount; i++)
+        {
+            ThreadQueue& queue = *s_queues[(thread + i) % queueCount];
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            if (queue.m_jobs.empty())
+                continue;
+            if (i == 0)
+            {
+                job = std::move(queue.m_jobs.back());
+                queue.m_jobs.pop_back();
+            }
+            else
+            {
+                job = std::move(queue.m_jobs.front());
+                queue.m_jobs.pop_front();
+            }
+            s_queuedJobs--;
+            stolen = i != 0;
+            return true;
+        }
+        return false;
+    }
+
+    void finish(Counter* counter)
+    {
+        if (!counter)
+            return;
+        std::vector<Job> continuations;
+        {
+            // The counter may be destroyed as soon as the lock is released after the last job
+            std::lock_guard<std::mutex> lock(counter->m_mutex);
+            if (--counter->m_pending == 0)
+                continuations.swap(counter->m_continuations);
+        }
+        for (Job& job : continuations)
+            push(std::move(job));
+    }
+
+    void execute(Job& job, uint32_t thread, bool stolen)
+    {
+        uint64_t start = nowNs();
+        if (s_zoneBegin)
+            s_zoneBegin(job.m_name);
+        job.m_function();
+        if (s_zoneEnd)
+            s_zoneEnd();
+        uint64_t end = nowNs();
+        if (thread < s_queues.size())
+        {
+            ThreadQueue& queue = *s_queues[thread];
+            queue.m_executed++;
+            queue.m_busyNs += end - start;
+            if (stolen)
+                queue.m_steals++;
+        }
+        if (s_taskHook)
+        {
+            TaskRecord record;
+            record.m_name = job.m_name;
+            record.m_thread = thread;
+            record.m_startNs = start;
+            record.m_endNs = end;
+            record.m_stolen = stolen;
+            s_taskHook(record);
+        }
+        finish(job.m_counter);
+    }
+
+    void workerMain(uint32_t thread)
+    {
+        t_threadIndex = thread;
+        for (;;)
+        {
+            Job job;
+            bool stolen = false;
+            if (takeJob(thread, job, stolen))
+            {
+                execute(job, thread, stolen);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(s_sleepMutex);
+            s_wake.wait(lock, [] { return s_stop || s_queuedJobs > 0; });
+            if (s_stop)
+                return;
+        }
+    }
+}
+
+void JobSystem::init(uint32_t threadCount)
+{
+    if (!threadCount)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    s_stop = false;
+    for (uint32_t i = 0; i < threadCount; i++)
+        s_queues.push_back(std::make_unique<ThreadQueue>());
+    t_threadIndex = 0;
+    for (uint32_t i = 1; i < threadCount; i++)
+        s_threads.emplace_back(workerMain, i);
+}
+
+void JobSystem::destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_sleepMutex);
+        s_stop = true;
+    }
+    s_wake.notify_all();
+    for (std::thread& thread : s_threads)
+        thread.join();
+    s_threads.clear();
+    s_queues.clear();
+    s_queuedJobs = 0;
+    t_threadIndex = NoThread;
+}
+
+uint32_t JobSystem::threadCount()
+{
+    return std::max(1u, (uint32_t)s_queues.size());
+}
+
+void JobSystem::run(const char* name, JobFunction function, Counter* counter)
+{
+    Job job;
+    job.m_name = name;
+    job.m_function = std::move(function);
+    job.m_counter = counter;
+    if (counter)
+        counter->m_pending++;
+    if (s_queues.empty())
+    {
+        execute(job, NoThread, false);
+        return;
+    }
+    push(std::move(job));
+}
+
+void JobSystem::runAfter(Counter& dependency, const char* name, JobFunction function, Counter* counter)
+{
+    Job job;
+    job.m_name = name;
+    job.m_function = std::move(function);
+    job.m_counter = counter;
+    if (counter)
+        counter->m_pending++;
+    {
+        std::lock_guard<std::mutex> lock(dependency.m_mutex);
+        if (dependency.m_pending > 0)
+        {
+            dependency.m_continuations.push_back(std::move(job));
+            return;
+        }
+    }
+    if (s_queues.empty())
+        execute(job, NoThread, false);
+    else
+        push(std::move(job));
+}
+
+void JobSystem::wait(Counter& counter)
+{
+    uint32_t thread = currentQueue();
+    while (counter.m_pending > 0)
+    {
+        Job job;
+        bool stolen = false;
+        if (!s_queues.empty() && takeJob(thread, job, stolen))
+            execute(job, t_threadIndex, stolen);
+        else
+            std::this_thread::yield();
+    }
+    // Lets the thread that finished the last job release the counter before it goes away
+    std::lock_guard<std::mutex> lock(counter.m_mutex);
+}
+
+void JobSystem::parallelFor(const char* name, uint32_t count, uint32_t batchSize, const RangeFunction& function)
+{
+    if (!count)
+        return;
+    if (!batchSize)
+        batchSize = std::max(1u, count / (threadCount() * 4));
+    if (batchSize >= count || threadCount() == 1)
+    {
+        function(0, count);
+        return;
+    }
+    Counter counter;
+    for (uint32_t begin = 0; begin < count; begin += batchSize)
+    {
+        uint32_t end = std::min(count, begin + batchSize);
+        run(name, [&function, begin, end] { function(begin, end); }, &counter);
+    }
+    wait(counter);
+}
+
+void JobSystem::setTaskHook(const TaskHook& hook)
+{
+    s_taskHook = hook;
+}
+
+void JobSystem::setZoneHooks(const ZoneBeginHook& begin, const ZoneEndHook& end)
+{
+    s_zoneBegin = begin;
+    s_zoneEnd = end;
+}
+
+Statistics JobSystem::statistics()
+{
+    Statistics statistics;
+    for (const std::unique_ptr<ThreadQueue>& queue : s_queues)
+    {
+        ThreadStatistics thread;
+        thread.m_jobs = queue->m_executed;
+        thread.m_steals = queue->m_steals;
+        thread.m_busyNs = queue->m_busyNs;
+        statistics.m_jobs += thread.m_jobs;
+        statistics.m_steals += thread.m_steals;
+        statistics.m_threads.push_back(thread);
+    }
+    return statistics;
+}
+
+void JobSystem::resetStatistics()
+{
+    for (const std::unique_ptr<ThreadQueue>& queue : s_queues)
+    {
+        queue->m_executed = 0;
+        queue->m_steals = 0;
+        queue->m_busyNs = 0;
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <inttypes.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Work-stealing job scheduler shared by loading and the per-frame work. Every thread owns a deque, pushes and pops
+// its own jobs at the back and steals from the front of the other deques when it runs dry. The thread that calls
+// init() is thread 0; it runs jobs while it waits for a counter, so with one thread everything runs inline.
+namespace JobSystem
+{
+    typedef std::function<void()> JobFunction;
+    // Runs items [begin, end) of a parallelFor()
+    typedef std::function<void(uint32_t begin, uint32_t end)> RangeFunction;
+
+    struct Counter;
+
+    struct Job
+    {
+        // Shown in the profiler and passed to the task hook, must outlive the job
+        const char* m_name = nullptr;
+        JobFunction m_function;
+        // Decremented when the job finishes, may be null
+        Counter* m_counter = nullptr;
+    };
+
+    // Counts the unfinished jobs started with it. Must outlive them, wait() returns once they have all finished.
+    struct Counter
+    {
+        std::atomic<uint32_t> m_pending{ 0 };
+        // Jobs started with runAfter() on this counter, queued once it reaches zero
+        std::mutex m_mutex;
+        std::vector<Job> m_continuations;
+    };
+
+    // Passed to the task hook after every job
+    struct TaskRecord
+    {
+        const char* m_name = nullptr;
+        uint32_t m_thread = 0;
+        uint64_t m_startNs = 0;
+        uint64_t m_endNs = 0;
+        // Taken from the deque of another thread
+        bool m_stolen = false;
+    };
+    // Called on the thread that ran the job, must be thread safe
+    typedef std::function<void(const TaskRecord&)> TaskHook;
+    // Called on the thread of a job right before and after it runs, the profiler uses them to show jobs as zones
+    typedef std::function<void(const char* name)> ZoneBeginHook;
+    typedef std::function<void()> ZoneEndHook;
+
+    struct ThreadStatistics
+    {
+        uint64_t m_jobs = 0;
+        uint64_t m_steals = 0;
+        uint64_t m_busyNs = 0;
+    };
+
+    struct Statistics
+    {
+        uint64_t m_jobs = 0;
+        uint64_t m_steals = 0;
+        std::vector<ThreadStatistics> m_threads;
+    };
+
+    // threadCount 0 uses one thread per hardware thread, including the calling thread. Jobs started before init()
+    // or after destroy() run inline.
+    void init(uint32_t threadCount);
+    // Must not be called while jobs are pending
+    void destroy();
+    uint32_t threadCount();
+
+    void run(const char* name, JobFunction function, Counter* counter = nullptr);
+    // Starts the job once dependency reaches zero, counter counts it from now on
+    void runAfter(Counter& dependency, const char* name, JobFunction function, Counter* counter = nullptr);
+    // Runs queued jobs until counter reaches zero
+    void wait(Counter& counter);
+    // Splits [0, count) into batches of batchSize items (0 picks a size giving every thread a few batches), runs them
+    // as jobs and returns when all have finished. May be called from inside a job.
+    void parallelFor(const char* name, uint32_t count, uint32_t batchSize, const RangeFunction& function);
+
+    // Set while no jobs are running, null disables it
+    void setTaskHook(const TaskHook& hook);
+    // Set while no jobs are running, null hooks are skipped
+    void setZoneHooks(const ZoneBeginHook& begin, const ZoneEndHook& end);
+    Statistics statistics();
+    void resetStatistics();
+}
@@ -0,0 +1,684 @@
+// Loader benchmark: generates synthetic scenes with SceneGen, sweeps one parameter
+// at a time away from a default configuration and reports where ObjectFile::loadFile
+// and PNG decoding spend their time. The threads sweep loads the default scene with
+// 1..N JobSystem threads. Runs without a GL context. Heap allocations are counted
+// by replacing every form of the global operator new and delete. --png-decode compares PngDecoder
+// against libpng on the PNG files of a directory instead.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <thread>
+#include "jobsystem.h"
+#include "objloader.h"
+#include "pngdecoder.h"
+#include "scenegen.h"
+#include "profiler.h"
+#include "util.h"
+
+using namespace ObjLoader;
+
+namespace
+{
+    // Every allocation is preceded by a header pointing back to its malloc block, the block is padded so that the
+    // returned pointer has the alignment that was asked for
+    struct HeapHeader
+    {
+        void* m_block;
+        size_t m_size;
+    };
+
+    std::atomic<uint64_t> s_heapAllocations{ 0 };
+    std::atomic<uint64_t> s_heapBytes{ 0 };
+    std::atomic<uint64_t> s_heapPeakBytes{ 0 };
+
+    // Starts counting allocations and the peak from the current heap use
+    void resetHeapCounters()
+    {
+        s_heapAllocations = 0;
+        s_heapPeakBytes = s_heapBytes.load();
+    }
+
+    // Shared by every form of operator new, returns null when out of memory
+    void* heapAllocate(size_t size, size_t alignment) noexcept
+    {
+        alignment = std::max(alignment, alignof(HeapHeader));
+        uint8_t* block = (uint8_t*)malloc(size + sizeof(HeapHeader) + alignment);
+        if (!block)
+            return nullptr;
+        uintptr_t address = ((uintptr_t)block + sizeof(HeapHeader) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        HeapHeader* header = (HeapHeader*)address - 1;
+        header->m_block = block;
+        header->m_size = size;
+        s_heapAllocations++;
+        uint64_t bytes = s_heapBytes += size;
+        uint64_t peak = s_heapPeakBytes;
+        while (bytes > peak && !s_heapPeakBytes.compare_exchange_weak(peak, bytes))
+            ;
+        return (void*)address;
+    }
+
+    // Shared by every form of operator delete
+    void heapFree(void* p) noexcept
+    {
+        if (!p)
+            return;
+        HeapHeader* header = (HeapHeader*)p - 1;
+        s_heapBytes -= header->m_size;
+        free(header->m_block);
+    }
+
+    void* heapAllocateOrThrow(size_t size, size_t alignment)
+    {
+        void* p = heapAllocate(size, alignment);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+}
+
+void* operator new(size_t size) { return heapAllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size) { return heapAllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, std::align_val_t alignment) { return heapAllocateOrThrow(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return heapAllocateOrThrow(size, (size_t)alignment); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return heapAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return heapAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return heapAllocate(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return heapAllocate(size, (size_t)alignment); }
+
+void operator delete(void* p) noexcept { heapFree(p); }
+void operator delete[](void* p) noexcept { heapFree(p); }
+void operator delete(void* p, size_t) noexcept { heapFree(p); }
+void operator delete[](void* p, size_t) noexcept { heapFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { heapFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { heapFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { heapFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { heapFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { heapFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { heapFree(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { heapFree(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { heapFree(p); }
+
+namespace
+{
+    enum class OutputFormat
+    {
+        Csv,
+        JsonLines
+    };
+
+    struct Options
+    {
+        std::string m_dataDirectory = "loaderbench_data";
+        std::string m_outputFile;
+        std::string m_sweep;
+        OutputFormat m_format = OutputFormat::Csv;
+        int m_iterations = 3;
+        // Threads of the sweeps other than threads, and the largest count of the threads sweep (0 = hardware)
+        uint32_t m_threads = 1;
+        uint32_t m_maxThreads = 0;
+        bool m_quick = false;
+        bool m_generateOnly = false;
+        // Directory of PNG files for the decode comparison
+        std::string m_pngDirectory;
+        SceneGen::Params m_defaults;
+    };
+
+    struct Config
+    {
+        std::string m_sweep;
+        std::string m_value;
+        SceneGen::Params m_params;
+        uint32_t m_threads = 1;
+    };
+
+    struct Measurement
+    {
+        SceneGen::Result m_scene;
+        double m_loadMs = 0.0;
+        double m_stageMs[(int)LoadStage::NumStages] = {};
+        uint64_t m_meshVertices = 0;
+        uint64_t m_texturePixels = 0;
+        uint64_t m_jobs = 0;
+        uint64_t m_steals = 0;
+        // Heap allocations of one loadFile() and the most heap it used on top of what was in use before
+        uint64_t m_allocations = 0;
+        uint64_t m_peakHeapBytes = 0;
+    };
+
+    double median(std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        return values.empty() ? 0.0 : values[values.size() / 2];
+    }
+
+    double toMs(uint64_t ns)
+    {
+        return (double)ns / 1000000.0;
+    }
+
+    void printUsage()
+    {
+        printf("Usage: LoaderBenchmark [options]\n"
+            "  --data-dir DIR       Directory for the generated scenes (default loaderbench_data)\n"
+            "  --output FILE        Write results to FILE instead of stdout\n"
+            "  --format csv|json    Output format, json writes one object per line (default csv)\n"
+            "  --iterations N       Timed loads per configuration, the median is reported (default 3)\n"
+            "  --sweep NAME         Only run one sweep: vertices, faces, attributes, objects, groups, materials, texture_size,\n"
+            "                       threads\n"
+            "  --threads N          JobSystem threads of the other sweeps (default 1)\n"
+            "  --max-threads N      Largest thread count of the threads sweep (default hardware threads, at least 4)\n"
+            "  --quick              Smaller scenes, for smoke testing\n"
+            "  --generate-only      Write the default scene and exit\n"
+            "  --png-decode DIR     Decode every PNG in DIR with PngDecoder and libpng, check that they match and report\n"
+            "                       the throughput of both\n"
+            "Default scene overrides:\n"
+            "  --vertices N --faces triangles|quads|mixed --no-uv --no-normals\n"
+            "  --objects N --groups N --materials N --texture-size N --seed N\n");
+    }
+
+    bool parseArguments(int argc, char** argv, Options& options, std::string* errString)
+    {
+        SceneGen::Params& params = options.m_defaults;
+        for (int i = 1; i < argc; i++)
+        {
+            const char* arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+            bool hasValue = true;
+
+            if (!strcmp(arg, "--data-dir") && value)
+                options.m_dataDirectory = value;
+            else if (!strcmp(arg, "--output") && value)
+                options.m_outputFile = value;
+            else if (!strcmp(arg, "--format") && value)
+            {
+                if (!strcmp(value, "csv"))
+                    options.m_format = OutputFormat::Csv;
+                else if (!strcmp(value, "json"))
+                    options.m_format = OutputFormat::JsonLines;
+                else
+                {
+                    if (errString)
+                        *errString = std::string("Unknown output format: ") + value;
+                    return false;
+                }
+            }
+            else if (!strcmp(arg, "--iterations") && value)
+                options.m_iterations = std::max(1, atoi(value));
+            else if (!strcmp(arg, "--sweep") && value)
+                options.m_sweep = value;
+            else if (!strcmp(arg, "--threads") && value)
+                options.m_threads = (uint32_t)std::max(1, atoi(value));
+            else if (!strcmp(arg, "--max-threads") && value)
+                options.m_maxThreads = (uint32_t)std::max(1, atoi(value));
+            else if (!strcmp(arg, "--vertices") && value)
+                params.m_vertexCount = (uint32_t)std::max(4, atoi(value));
+            else if (!strcmp(arg, "--faces") && value)
+            {
+                if (!SceneGen::parseFaceMix(value, params.m_faceMix))
+                {
+                    if (errString)
+                        *errString = std::string("Unknown face mix: ") + value;
+                    return false;
+                }
+            }
+            else if (!strcmp(arg, "--objects") && value)
+                params.m_objectCount = (uint32_t)std::max(1, atoi(value));
+            else if (!strcmp(arg, "--groups") && value)
+                params.m_groupsPerObject = (uint32_t)std::max(1, atoi(value));
+            else if (!strcmp(arg, "--materials") && value)
+                params.m_materialCount = (uint32_t)std::max(1, atoi(value));
+            else if (!strcmp(arg, "--texture-size") && value)
+                params.m_textureSize = (uint32_t)std::max(0, atoi(value));
+            else if (!strcmp(arg, "--seed") && value)
+                params.m_seed = (uint32_t)atoi(value);
+            else if (!strcmp(arg, "--png-decode") && value)
+                options.m_pngDirectory = value;
+            else
+            {
+                hasValue = false;
+                if (!strcmp(arg, "--no-uv"))
+                    params.m_texCoords = false;
+                else if (!strcmp(arg, "--no-normals"))
+                    params.m_normals = false;
+                else if (!strcmp(arg, "--quick"))
+                    options.m_quick = true;
+                else if (!strcmp(arg, "--generate-only"))
+                    options.m_generateOnly = true;
+                else
+                {
+                    if (errString)
+                        *errString = std::string("Unknown or incomplete argument: ") + arg;
+                    return false;
+                }
+            }
+
+            if (hasValue)
+                i++;
+        }
+        return true;
+    }
+
+    // Every sweep varies a single parameter of the default scene
+    std::vector<Config> buildConfigs(const Options& options)
+    {
+        std::vector<Config> configs;
+        const SceneGen::Params& defaults = options.m_defaults;
+        uint32_t scale = options.m_quick ? 10 : 1;
+        auto add = [&](const char* sweep, const std::string& value, const SceneGen::Params& params) -> Config*
+        {
+            if (!options.m_sweep.empty() && options.m_sweep != sweep)
+                return nullptr;
+            Config config;
+            config.m_sweep = sweep;
+            config.m_value = value;
+            config.m_params = params;
+            config.m_params.m_name = std::string(sweep) + "_" + value;
+            config.m_threads = options.m_threads;
+            configs.push_back(config);
+            return &configs.back();
+        };
+
+        for (uint32_t vertices : { 50000u, 200000u, 800000u })
+        {
+            SceneGen::Params params = defaults;
+            params.m_vertexCount = vertices / scale;
+            params.m_textureSize = 0;
+            add("vertices", std::to_string(params.m_vertexCount), params);
+        }
+        for (SceneGen::FaceMix mix : { SceneGen::FaceMix::Triangles, SceneGen::FaceMix::Quads, SceneGen::FaceMix::Mixed })
+        {
+            SceneGen::Params params = defaults;
+            params.m_vertexCount /= scale;
+            params.m_faceMix = mix;
+            params.m_textureSize = 0;
+            add("faces", SceneGen::faceMixName(mix), params);
+        }
+        const char* attributeNames[] = { "p", "p_uv", "p_n", "p_uv_n" };
+        for (int attributes = 0; attributes < 4; attributes++)
+        {
+            SceneGen::Params params = defaults;
+            params.m_vertexCount /= scale;
+            params.m_texCoords = (attributes & 1) != 0;
+            params.m_normals = (attributes & 2) != 0;
+            params.m_textureSize = 0;
+            add("attributes", attributeNames[attributes], params);
+        }
+        for (uint32_t objects : { 1u, 16u, 128u })
+        {
+            SceneGen::Params params = defaults;
+            params.m_vertexCount /= scale;
+            params.m_objectCount = objects;
+            params.m_textureSize = 0;
+            add("objects", std::to_string(objects), params);
+        }
+        for (uint32_t groups : { 1u, 8u, 64u })
+        {
+            SceneGen::Params params = defaults;
+            params.m_vertexCount /= scale;
+            params.m_groupsPerObject = groups;
+            params.m_textureSize = 0;
+            add("groups", std::to_string(groups), params);
+        }
+        for (uint32_t materials : { 1u, 16u, 128u })
+        {
+            SceneGen::Params params = defaults;
+            params.m_vertexCount /= scale;
+            params.m_materialCount = materials;
+            params.m_textureSetCount = 4;
+            params.m_textureSize = 64;
+            add("materials", std::to_string(materials), params);
+        }
+        for (uint32_t size : { 64u, 256u, 1024u })
+        {
+            SceneGen::Params params = defaults;
+            params.m_vertexCount = 1000;
+            params.m_materialCount = 4;
+            params.m_textureSize = options.m_quick ? size / 4 : size;
+            add("texture_size", std::to_string(params.m_textureSize), params);
+        }
+        // Enough objects that every thread gets a chunk of the file to parse
+        uint32_t maxThreads = options.m_maxThreads ? options.m_maxThreads : std::max(4u, std::thread::hardware_concurrency());
+        for (uint32_t threads = 1; threads <= maxThreads; threads = threads < maxThreads ? std::min(threads * 2, maxThreads) : threads + 1)
+        {
+            SceneGen::Params params = defaults;
+            params.m_vertexCount = 800000 / scale;
+            params.m_objectCount = 64;
+            params.m_textureSize = options.m_quick ? 64 : 256;
+            if (Config* config = add("threads", std::to_string(threads), params))
+            {
+                // Every thread count loads the same scene
+                config->m_params.m_name = "threads";
+                config->m_threads = threads;
+            }
+        }
+        return configs;
+    }
+
+    bool measure(const Options& options, const Config& config, Measurement& result, std::string* errString)
+    {
+        if (!SceneGen::generate(options.m_dataDirectory.c_str(), config.m_params, &result.m_scene, errString))
+            return false;
+
+        std::string loadError;
+        auto errorHandler = [&loadError](int id, const char* msg)
+        {
+            loadError = std::string("Loader error ") + std::to_string(id) + ": " + msg;
+        };
+
+        // Total load time without the per-stage clock reads
+        std::vector<double> loadTimes;
+        for (int i = 0; i < options.m_iterations; i++)
+        {
+            ObjectFile object(options.m_dataDirectory.c_str());
+            object.setErrorCallback(errorHandler);
+            uint64_t start = Profiler::nowNs();
+            if (!object.loadFile(result.m_scene.m_objFile.c_str()))
+            {
+                if (errString)
+                    *errString = loadError;
+                return false;
+            }
+            loadTimes.push_back(toMs(Profiler::nowNs() - start));
+        }
+        result.m_loadMs = median(loadTimes);
+
+        // Stage breakdown, one extra load with statistics enabled. The job counts cover it and the texture decode.
+        JobSystem::resetStatistics();
+        ObjectFile object(options.m_dataDirectory.c_str());
+        object.setErrorCallback(errorHandler);
+        object.setCollectStatistics(true);
+        uint64_t heapBytes = s_heapBytes;
+        resetHeapCounters();
+        if (!object.loadFile(result.m_scene.m_objFile.c_str()))
+        {
+            if (errString)
+                *errString = loadError;
+            return false;
+        }
+        result.m_allocations = s_heapAllocations;
+        result.m_peakHeapBytes = s_heapPeakBytes - heapBytes;
+        const LoadStatistics& stats = object.statistics();
+        for (int i = 0; i < (int)LoadStage::NumStages; i++)
+            result.m_stageMs[i] = toMs(stats.m_stageNs[i]);
+        result.m_meshVertices = stats.m_vertices;
+
+        // PNG decode of every referenced texture, initGraphics() would need a GL context
+        std::vector<std::string> textures;
+        for (auto& iter : object.materials())
+        {
+            const Material& material = *iter.second;
+            for (const std::string* map : { &material.m_diffuseMap, &material.m_specularMap, &material.m_bumpMap })
+            {
+                if (map->length() && std::find(textures.begin(), textures.end(), *map) == textures.end())
+                    textures.push_back(*map);
+            }
+        }
+        // Decoded in parallel like initGraphics() does, the time is the wall clock time of all of them
+        std::vector<uint64_t> pixels(textures.size(), 0);
+        uint64_t start = Profiler::nowNs();
+        JobSystem::parallelFor("Decode texture", (uint32_t)textures.size(), 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                Image image;
+                if (loadPngImage(Util::combinePath(options.m_dataDirectory.c_str(), textures[i].c_str()).c_str(), image))
+                    pixels[i] = (uint64_t)image.m_width * image.m_height;
+            }
+        });
+        result.m_stageMs[(int)LoadStage::PngDecode] = toMs(Profiler::nowNs() - start);
+        for (size_t i = 0; i < textures.size(); i++)
+        {
+            if (!pixels[i])
+            {
+                if (errString)
+                    *errString = "Cannot decode texture: " + textures[i];
+                return false;
+            }
+            result.m_texturePixels += pixels[i];
+        }
+        JobSystem::Statistics jobStats = JobSystem::statistics();
+        result.m_jobs = jobStats.m_jobs;
+        result.m_steals = jobStats.m_steals;
+        return true;
+    }
+
+    void writeHeader(FILE* f, OutputFormat format)
+    {
+        if (format != OutputFormat::Csv)
+            return;
+        fprintf(f, "sweep,value,vertices,faces,objects,groups,materials,texture_size,texcoords,normals,face_mix,obj_bytes,load_ms,mb_per_s");
+        for (int i = 0; i < (int)LoadStage::NumStages; i++)
+            fprintf(f, ",%s_ms", loadStageName((LoadStage)i));
+        fprintf(f, ",textures,texture_mpix,threads,jobs,steals,allocations,peak_heap_mb\n");
+    }
+
+    void writeResult(FILE* f, OutputFormat format, const Config& config, const Measurement& m)
+    {
+        const SceneGen::Params& p = config.m_params;
+        double mbPerSecond = m.m_loadMs > 0.0 ? (double)m.m_scene.m_objBytes / (1024.0 * 1024.0) / (m.m_loadMs / 1000.0) : 0.0;
+        double texturePixels = (double)m.m_texturePixels / 1000000.0;
+        double peakHeap = (double)m.m_peakHeapBytes / (1024.0 * 1024.0);
+        if (format == OutputFormat::Csv)
+        {
+            fprintf(f, "%s,%s,%llu,%llu,%u,%u,%u,%u,%d,%d,%s,%llu,%.3f,%.2f",
+                config.m_sweep.c_str(), config.m_value.c_str(), (unsigned long long)m.m_meshVertices, (unsigned long long)m.m_scene.m_faces,
+                p.m_objectCount, p.m_groupsPerObject, p.m_materialCount, p.m_textureSize, p.m_texCoords ? 1 : 0, p.m_normals ? 1 : 0,
+                SceneGen::faceMixName(p.m_faceMix), (unsigned long long)m.m_scene.m_objBytes, m.m_loadMs, mbPerSecond);
+            for (int i = 0; i < (int)LoadStage::NumStages; i++)
+                fprintf(f, ",%.3f", m.m_stageMs[i]);
+            fprintf(f, ",%llu,%.3f,%u,%llu,%llu,%llu,%.3f\n", (unsigned long long)m.m_scene.m_textures, texturePixels, config.m_threads,
+                (unsigned long long)m.m_jobs, (unsigned long long)m.m_steals, (unsigned long long)m.m_allocations, peakHeap);
+        }
+        else
+        {
+            fprintf(f, "{\"sweep\":\"%s\",\"value\":\"%s\",\"vertices\":%llu,\"faces\":%llu,\"objects\":%u,\"groups\":%u,\"materials\":%u,"
+                "\"texture_size\":%u,\"texcoords\":%s,\"normals\":%s,\"face_mix\":\"%s\",\"obj_bytes\":%llu,\"load_ms\":%.3f,\"mb_per_s\":%.2f",
+                config.m_sweep.c_str(), config.m_value.c_str(), (unsigned long long)m.m_meshVertices, (unsigned long long)m.m_scene.m_faces,
+                p.m_objectCount, p.m_groupsPerObject, p.m_materialCount, p.m_textureSize, p.m_texCoords ? "true" : "false",
+                p.m_normals ? "true" : "false", SceneGen::faceMixName(p.m_faceMix), (unsigned long long)m.m_scene.m_objBytes, m.m_loadMs, mbPerSecond);
+            for (int i = 0; i < (int)LoadStage::NumStages; i++)
+                fprintf(f, ",\"%s_ms\":%.3f", loadStageName((LoadStage)i), m.m_stageMs[i]);
+            fprintf(f, ",\"textures\":%llu,\"texture_mpix\":%.3f,\"threads\":%u,\"jobs\":%llu,\"steals\":%llu,\"allocations\":%llu,"
+                "\"peak_heap_mb\":%.3f}\n", (unsigned long long)m.m_scene.m_textures, texturePixels, config.m_threads, (unsigned long long)m.m_jobs,
+                (unsigned long long)m.m_steals, (unsigned long long)m.m_allocations, peakHeap);
+        }
+        fflush(f);
+    }
+
+    // stdout unless an output file was given, null if it can't be opened
+    FILE* openOutput(const Options& options)
+    {
+        if (options.m_outputFile.empty())
+            return stdout;
+        FILE* out = fopen(options.m_outputFile.c_str(), "wb");
+        if (!out)
+            fprintf(stderr, "Cannot open output file: %s\n", options.m_outputFile.c_str());
+        return out;
+    }
+
+    struct PngMeasurement
+    {
+        std::string m_file;
+        PngDecoder::Header m_header;
+        uint64_t m_fileBytes = 0;
+        double m_libpngMs = 0.0;
+        double m_fastMs = 0.0;
+        bool m_match = false;
+    };
+
+    void writePngHeader(FILE* f, OutputFormat format)
+    {
+        if (format == OutputFormat::Csv)
+            fprintf(f, "file,width,height,color_type,bit_depth,file_kb,libpng_ms,fast_ms,libpng_mpix_s,fast_mpix_s,speedup,match\n");
+    }
+
+    void writePngResult(FILE* f, OutputFormat format, const PngMeasurement& m)
+    {
+        double megapixels = (double)m.m_header.m_width * m.m_header.m_height / 1000000.0;
+        double libpngRate = m.m_libpngMs > 0.0 ? megapixels / (m.m_libpngMs / 1000.0) : 0.0;
+        double fastRate = m.m_fastMs > 0.0 ? megapixels / (m.m_fastMs / 1000.0) : 0.0;
+        double speedup = m.m_fastMs > 0.0 ? m.m_libpngMs / m.m_fastMs : 0.0;
+        if (format == OutputFormat::Csv)
+        {
+            fprintf(f, "%s,%u,%u,%u,%u,%.1f,%.3f,%.3f,%.2f,%.2f,%.2f,%d\n", m.m_file.c_str(), m.m_header.m_width, m.m_header.m_height,
+                m.m_header.m_colorType, m.m_header.m_bitDepth, m.m_fileBytes / 1024.0, m.m_libpngMs, m.m_fastMs, libpngRate, fastRate,
+                speedup, m.m_match ? 1 : 0);
+        }
+        else
+        {
+            fprintf(f, "{\"file\":\"%s\",\"width\":%u,\"height\":%u,\"color_type\":%u,\"bit_depth\":%u,\"file_kb\":%.1f,"
+                "\"libpng_ms\":%.3f,\"fast_ms\":%.3f,\"libpng_mpix_s\":%.2f,\"fast_mpix_s\":%.2f,\"speedup\":%.2f,\"match\":%s}\n",
+                m.m_file.c_str(), m.m_header.m_width, m.m_header.m_height, m.m_header.m_colorType, m.m_header.m_bitDepth,
+                m.m_fileBytes / 1024.0, m.m_libpngMs, m.m_fastMs, libpngRate, fastRate, speedup, m.m_match ? "true" : "false");
+        }
+        fflush(f);
+    }
+
+    // Both decoders start from the file, like ObjectFile's texture loads. Returns 2 if any image differs from libpng.
+    int runPngDecode(const Options& options, FILE* out)
+    {
+        std::vector<std::string> files;
+        if (!Util::listFiles(options.m_pngDirectory.c_str(), ".png", files) || files.empty())
+        {
+            fprintf(stderr, "No PNG files in %s\n", options.m_pngDirectory.c_str());
+            return 1;
+        }
+
+        int exitCode = 0;
+        PngMeasurement total;
+        total.m_file = "total";
+        total.m_match = true;
+        writePngHeader(out, options.m_format);
+        for (const std::string& name : files)
+        {
+            PngMeasurement m;
+            m.m_file = name;
+            std::string path = Util::combinePath(options.m_pngDirectory.c_str(), name.c_str());
+            std::vector<char> buffer;
+            std::string errString;
+            if (!Util::loadFileToBuffer(path.c_str(), buffer) || buffer.empty() ||
+                !PngDecoder::readHeader((const uint8_t*)buffer.data(), buffer.size(), m.m_header, &errString))
+            {
+                fprintf(stderr, "%s: %s\n", name.c_str(), errString.length() ? errString.c_str() : "Cannot read file");
+                exitCode = 1;
+                continue;
+            }
+            m.m_fileBytes = buffer.size();
+
+            Image reference;
+            Image decoded;
+            std::vector<double> libpngTimes;
+            std::vector<double> fastTimes;
+            bool referenceOk = true;
+            bool decodedOk = true;
+            for (int i = 0; i < options.m_iterations; i++)
+            {
+                uint64_t start = Profiler::nowNs();
+                referenceOk = loadPngImageLibpng(path.c_str(), reference);
+                uint64_t middle = Profiler::nowNs();
+                std::vector<char> data;
+                decodedOk = Util::loadFileToBuffer(path.c_str(), data) &&
+                    PngDecoder::decode((const uint8_t*)data.data(), data.size(), decoded.m_width, decoded.m_height, decoded.m_pixels, &errString);
+                uint64_t end = Profiler::nowNs();
+                libpngTimes.push_back(toMs(middle - start));
+                fastTimes.push_back(toMs(end - middle));
+            }
+            if (!decodedOk)
+                fprintf(stderr, "%s: PngDecoder failed: %s\n", name.c_str(), errString.c_str());
+            m.m_libpngMs = median(libpngTimes);
+            m.m_fastMs = median(fastTimes);
+            m.m_match = referenceOk && decodedOk && reference.m_width == decoded.m_width && reference.m_height == decoded.m_height &&
+                reference.m_pixels == decoded.m_pixels;
+            // Interlaced files are expected to fail over to libpng
+            if (!m.m_match && !(m.m_header.m_interlace && !decodedOk))
+                exitCode = 2;
+            writePngResult(out, options.m_format, m);
+
+            total.m_header.m_width = 1;
+            total.m_header.m_height += m.m_header.m_width * m.m_header.m_height;
+            total.m_fileBytes += m.m_fileBytes;
+            total.m_libpngMs += m.m_libpngMs;
+            total.m_fastMs += m.m_fastMs;
+            total.m_match = total.m_match && m.m_match;
+        }
+        writePngResult(out, options.m_format, total);
+        return exitCode;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    std::string errString;
+    if (!parseArguments(argc, argv, options, &errString))
+    {
+        fprintf(stderr, "%s\n", errString.c_str());
+        printUsage();
+        return 1;
+    }
+    if (options.m_pngDirectory.length())
+    {
+        FILE* out = openOutput(options);
+        if (!out)
+            return 1;
+        int exitCode = runPngDecode(options, out);
+        if (out != stdout)
+            fclose(out);
+        return exitCode;
+    }
+
+    if (!Util::createDirectory(options.m_dataDirectory.c_str()))
+    {
+        fprintf(stderr, "Cannot create data directory: %s\n", options.m_dataDirectory.c_str());
+        return 1;
+    }
+
+    if (options.m_generateOnly)
+    {
+        SceneGen::Result scene;
+        if (!SceneGen::generate(options.m_dataDirectory.c_str(), options.m_defaults, &scene, &errString))
+        {
+            fprintf(stderr, "%s\n", errString.c_str());
+            return 1;
+        }
+        printf("Wrote %s: %llu vertices, %llu faces, %llu textures\n", scene.m_objFile.c_str(),
+            (unsigned long long)scene.m_vertices, (unsigned long long)scene.m_faces, (unsigned long long)scene.m_textures);
+        return 0;
+    }
+
+    std::vector<Config> configs = buildConfigs(options);
+    if (configs.empty())
+    {
+        fprintf(stderr, "Unknown sweep: %s\n", options.m_sweep.c_str());
+        return 1;
+    }
+
+    FILE* out = openOutput(options);
+    if (!out)
+        return 1;
+    int exitCode = 0;
+    writeHeader(out, options.m_format);
+    for (const Config& config : configs)
+    {
+        Measurement measurement;
+        JobSystem::init(config.m_threads);
+        bool measured = measure(options, config, measurement, &errString);
+        JobSystem::destroy();
+        if (!measured)
+        {
+            fprintf(stderr, "%s=%s failed: %s\n", config.m_sweep.c_str(), config.m_value.c_str(), errString.c_str());
+            exitCode = 2;
+            continue;
+        }
+        writeResult(out, options.m_format, config, measurement);
+    }
+
+    if (out != stdout)
+        fclose(out);
+    return exitCode;
+}
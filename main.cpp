@@ -1,18 +1,44 @@
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #undef WIN32_LEAN_AND_MEAN
+#endif
+#include <algorithm>
 #include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <stdio.h>
 
 #include "GL/glew.h"
 #include "GLFW/glfw3.h"
 #include "glm/gtc/matrix_transform.hpp"
 #include "objloader.h"
 #include "util.h"
+#include "profiler.h"
+#include "framestats.h"
+#include "benchmark.h"
+#include "filewatcher.h"
+#include "programcache.h"
+#include "clusteredlighting.h"
+#include "deferredshading.h"
+#include "shadowmaps.h"
+#include "instancing.h"
+#include "drawcommands.h"
+#include "jobsystem.h"
+#include "framepipeline.h"
+#include "ringbuffer.h"
+#include "softrasterizer.h"
+#include "virtualtexturing.h"
+#include "texturestreaming.h"
+#include "memorytracker.h"
 #include "imgui.h"
 #include "imgui_internal.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#ifdef _WIN32
 #include "imgui_impl_win32.h"
+#endif
 
 const float degToRad = 3.1416f / 180.0f;
 ObjLoader::ObjectFile g_sponza("../data");
@@ -20,28 +46,55 @@ ObjLoader::ObjectFile g_sponza("../data");
 GLuint g_blackTexture;
 GLuint g_whiteTexture;
 GLuint g_flatNormalTexture;
+// Stand in for missing material textures while virtual texturing is enabled
+uint32_t g_blackVirtualTexture = 0;
+uint32_t g_whiteVirtualTexture = 0;
+uint32_t g_flatNormalVirtualTexture = 0;
+
+// Bounds of a material's triangles and the uv area they map per world area, the streamed texture requests are
+// estimated from them
+struct MaterialExtent
+{
+    const ObjLoader::Material* m_material = nullptr;
+    glm::vec3 m_min = glm::vec3(FLT_MAX);
+    glm::vec3 m_max = glm::vec3(-FLT_MAX);
+    float m_uvAreaPerArea = 0.0f;
+};
+std::vector<MaterialExtent> g_materialExtents;
 
 ImFont* g_uiFont = nullptr;
 ImFont* g_codeFont = nullptr;
 
-void update(GLFWwindow* window); 
-void render(GLFWwindow* window);
+Benchmark::CameraPath g_cameraPath;
+FileWatcher g_shaderWatcher;
+
+void sampleInput(GLFWwindow* window);
+void update(uint64_t frame, uint32_t slot);
+void updateCameraVectors(float yaw, float pitch, glm::vec3& camDir, glm::vec3& camUp);
+void computeSceneBounds();
+void computeMaterialExtents();
+void resolveSamplesQueries();
+void destroySamplesQueries();
+void render(int vpWidth, int vpHeight);
 void renderUI();
 
-void errorHandler(int errCode, const char* errMessage)
+void showError(const char* errMessage)
 {
+#ifdef _WIN32
     MessageBoxA(0, errMessage, "Error", MB_OK);
+#else
+    fprintf(stderr, "Error: %s\n", errMessage);
+#endif
+}
+
+void errorHandler(int errCode, const char* errMessage)
+{
+    showError(errMessage);
 }
 
 const unsigned int windowWidth = 1920;
 const unsigned int windowHeight = 1080;
 
-struct InputState
-{
-    glm::dvec2 m_lastMousePosition = { 0, 0 };
-};
-InputState g_inputState;
-
 enum class LightType : int
 {
     Unlit,
@@ -49,6 +102,7 @@ enum class LightType : int
     Directional,
     Spot,
     Point,
+    Clustered,
     NumLightTypes // Always at the last position
 };
 
@@ -58,9 +112,22 @@ enum class ShaderType : int
     Directional,
     Spot,
     Point,
+    Clustered,
+    // Writes the G-buffer of the deferred render path, lit by one of the other types afterwards
+    GBuffer,
+    // Shadow map passes and the depth pre-pass, only alpha tests
+    DepthOnly,
+    // Page requests of the virtual textures, see VirtualTexturing
+    Feedback,
     NumShaderTypes // Always at the last position
 };
 
+enum class RenderPath : int
+{
+    Forward,
+    Deferred
+};
+
 struct DirectionalLight
 {
     glm::vec3 m_lightDirection;
@@ -83,18 +150,66 @@ struct PointLight
     float m_outerRadius;
 };
 
-const size_t MaxShaderLength = 8192;
+// Pixel shader permutations of lighting.glsl: the ShaderType in the low bits plus one bit per optional feature.
+// Every set bit adds a #define, so a permutation only contains the code its materials need.
+const uint32_t PermutationShaderTypeMask = 0x7;
+const uint32_t PermutationAlphaTest = 1u << 3;
+const uint32_t PermutationNormalMap = 1u << 4;
+const uint32_t PermutationSpecular = 1u << 5;
+// Full-screen lighting pass of the deferred render path, reads the surface from the G-buffer
+const uint32_t PermutationDeferred = 1u << 6;
+const uint32_t PermutationShadows = 1u << 7;
+// Material textures read through the page tables of VirtualTexturing
+const uint32_t PermutationVirtualTexture = 1u << 8;
+const uint32_t NumPermutations = 1u << 9;
+// Renders every material of its light type correctly, used while a specialized permutation is still compiling
+const uint32_t PermutationFallbackFeatures = PermutationAlphaTest | PermutationNormalMap | PermutationSpecular;
+// Opaque depth-only geometry, drawn with the position-only pipeline instead of a permutation
+const uint32_t PermutationPositionOnly = (uint32_t)ShaderType::DepthOnly;
+static_assert((uint32_t)ShaderType::NumShaderTypes <= PermutationShaderTypeMask + 1, "Shader type doesn't fit the permutation");
+
+// Fixed size so the shader editor can grow the code in place
+const size_t MaxShaderLength = 32768;
+// Per-frame streaming memory, grows if a frame needs more
+const GLsizeiptr RingBufferCapacity = 16 * 1024 * 1024;
+
 struct ShaderState
 {
     std::string m_shaderFile;
     std::vector<char> m_shaderCode;
-    GLuint m_shaderId = 0;
     ShaderState()
     {
         m_shaderCode.resize(MaxShaderLength);
     }
 };
 
+// Permutations of vertex.glsl, the scene transform and the full-screen triangle of the deferred lighting pass
+const uint32_t VertexProgramScene = 0;
+const uint32_t VertexProgramFullscreen = 1;
+const uint32_t NumVertexPrograms = 2;
+
+// Separable single stage program, combined with the other stage in a program pipeline
+struct StageProgram
+{
+    GLuint m_shaderId = 0;
+    Util::ProgramBuild m_build;
+    // Source keys of m_shaderId and of the pending build, unchanged sources are not rebuilt
+    uint64_t m_cacheKey = 0;
+    uint64_t m_buildKey = 0;
+    uint64_t m_buildStartNs = 0;
+    // Pixel shader permutations are built on first use
+    bool m_requested = false;
+};
+
+// Placement of one of the many lights, they circle around their anchor when animated
+struct ClusteredLightAnchor
+{
+    glm::vec3 m_center;
+    float m_orbitRadius;
+    float m_orbitSpeed;
+    float m_phase;
+};
+
 struct DemoState
 {
     glm::vec3 m_cameraPosition = glm::vec3(-900.0f, 200.0f, 0);
@@ -105,12 +220,46 @@ struct DemoState
     SpotLight m_spotLight;
     PointLight m_pointLight;
     LightType m_lightType = LightType::Unlit;
+    RenderPath m_renderPath = RenderPath::Forward;
+    bool m_shadows = true;
+    // Lays down depth first so the lighting shaders run once per pixel
+    bool m_depthPrepass = false;
+
+    // Copies of the model on a grid, see Instancing
+    int m_instanceColumns = 1;
+    int m_instanceRows = 1;
+    float m_instanceSpacing = 200.0f;
+    // Checks the recorded draw command lists before replaying them
+    bool m_validateCommands = false;
+    // Error of the first invalid list found, shown in the UI
+    std::string m_commandError;
+    // Many lights, shaded with clustered forward lighting
+    int m_clusteredLightCount = 512;
+    float m_clusteredLightRadius = 250.0f;
+    bool m_animateClusteredLights = true;
+    // Copied from the frame snapshot
+    std::vector<ClusteredLighting::Light> m_clusteredLights;
+    glm::vec3 m_sceneMin = glm::vec3(0.0f);
+    glm::vec3 m_sceneMax = glm::vec3(0.0f);
     float m_specularMultiplier = 0.0f;
     float m_specPowerMultiplier = 32.0f;
     float m_camFov = 60.0f;
     double m_appTime = 0.0f;
     double m_dt = 0.0f;
     bool m_lightFollowsCamera = false;
+    bool m_showProfiler = false;
+    // Frames the update thread runs ahead, see FramePipeline
+    int m_pipelineDepth = 1;
+    // Draws on the CPU with SoftRasterizer instead of GL
+    bool m_softwareRasterizer = false;
+    // Size of the physical page cache while virtual texturing is enabled
+    int m_virtualTextureBudgetMB = 0;
+    // Memory budget of the streamed mip levels while texture streaming is enabled
+    int m_textureBudgetMB = 0;
+
+    // Camera path recording
+    bool m_recordingPath = false;
+    double m_recordStartTime = 0.0;
 
     // Player Movement
     float m_yaw = 0.0f;
@@ -119,15 +268,24 @@ struct DemoState
     float m_sensitivity = 0.1f;
 
     // Shader editing
-    ShaderState m_pixelShaders[(int)ShaderType::NumShaderTypes];
+    ShaderState m_pixelShader;
     ShaderState m_vertexShader;
+    StageProgram m_vertexPrograms[NumVertexPrograms];
+    StageProgram m_pixelPrograms[NumPermutations];
+    // One pipeline per pixel shader permutation, sharing the vertex program of their pass
+    GLuint m_pipelines[NumPermutations] = {};
+    // Scene vertex program without a fragment stage, for opaque depth-only geometry
+    GLuint m_positionOnlyPipeline = 0;
     bool m_recompileShaders = false;
     bool m_reloadShaders = false;
+    bool m_watchShaders = true;
     bool m_isEditing = false;
     std::string m_shaderErrors;
 
     DemoState()
     {
+        m_vertexPrograms[VertexProgramScene].m_requested = true;
+
         m_directionalLight.m_lightColor = glm::vec3(1.0f, 1.0f, 1.0f);
         m_directionalLight.m_lightDirection = glm::vec3(-0.859f, -0.399f, -0.319f);
 
@@ -144,53 +302,848 @@ struct DemoState
 };
 DemoState g_demoState;
 
+// What the update needs from the render thread: the input and the UI settings, sampled once per frame
+struct UpdateInput
+{
+    uint64_t m_timeNs = 0;
+    glm::dvec2 m_mousePosition = { 0, 0 };
+    bool m_moveForward = false;
+    bool m_moveBack = false;
+    bool m_moveLeft = false;
+    bool m_moveRight = false;
+    bool m_rotate = false;
+    float m_moveSpeed = 0.0f;
+    float m_sensitivity = 0.0f;
+    bool m_lightFollowsCamera = false;
+    bool m_clusteredLights = false;
+    int m_clusteredLightCount = 0;
+    float m_clusteredLightRadius = 0.0f;
+    bool m_animateClusteredLights = false;
+};
+// Small and copied whole, so a lock is cheaper than another triple buffer
+std::mutex g_updateInputMutex;
+UpdateInput g_updateInput;
+
+// Only touched by the thread running the update
+struct UpdateState
+{
+    glm::vec3 m_cameraPosition = glm::vec3(0.0f);
+    float m_yaw = 0.0f;
+    float m_pitch = 0.0f;
+    glm::dvec2 m_lastMousePosition = { 0, 0 };
+    uint64_t m_lastUpdateNs = 0;
+    double m_appTime = 0.0;
+    std::vector<ClusteredLightAnchor> m_clusteredLightAnchors;
+    std::vector<ClusteredLighting::Light> m_clusteredLights;
+};
+UpdateState g_updateState;
+
+// Everything one update produced, not changed after FramePipeline hands it to the render thread
+struct FrameSnapshot
+{
+    uint64_t m_inputTimeNs = 0;
+    double m_appTime = 0.0;
+    double m_dt = 0.0;
+    glm::vec3 m_cameraPosition = glm::vec3(0.0f);
+    glm::vec3 m_cameraDirection = glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 m_cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+    float m_yaw = 0.0f;
+    float m_pitch = 0.0f;
+    // The lights follow the camera or a camera path, otherwise the UI places them
+    bool m_overrideLights = false;
+    // -1 keeps the light type of the UI
+    int m_lightType = -1;
+    glm::vec3 m_directionalLightDirection = glm::vec3(0.0f);
+    glm::vec3 m_spotLightPosition = glm::vec3(0.0f);
+    glm::vec3 m_spotLightDirection = glm::vec3(0.0f);
+    glm::vec3 m_pointLightPosition = glm::vec3(0.0f);
+    std::vector<ClusteredLighting::Light> m_clusteredLights;
+};
+FrameSnapshot g_frameSnapshots[FramePipeline::SlotCount];
+
 bool readShaderFromFile(const char* filename, ShaderState& output)
 {
     output.m_shaderFile = filename;
     return Util::loadFileToBuffer(filename, output.m_shaderCode, true, true);
 }
 
-bool reloadShaders(bool reopen, std::string* errorString)
+const char* g_vertexShaderFile = "../shaders/vertex.glsl";
+const char* g_pixelShaderFile = "../shaders/lighting.glsl";
+
+bool readShaders(bool vertexShader, bool pixelShader, std::string* errorString)
 {
-    if (!readShaderFromFile("../shaders/vertex.glsl", g_demoState.m_vertexShader))
+    if (vertexShader && !readShaderFromFile(g_vertexShaderFile, g_demoState.m_vertexShader))
     {
         if (errorString)
             *errorString = "Cannot read vertex shader from file!";
         return false;
     }
+    if (pixelShader && !readShaderFromFile(g_pixelShaderFile, g_demoState.m_pixelShader))
+    {
+        if (errorString)
+            *errorString = std::string("Cannot read shader from file: ") + g_pixelShaderFile;
+        return false;
+    }
+    return true;
+}
 
-    const char* shaderFiles[] = {
-        "../shaders/ambient.glsl",
-        "../shaders/directional.glsl",
-        "../shaders/spot.glsl",
-        "../shaders/point.glsl"
-    };
+// Ambient light has no normal or specular term, so those features are dropped to share one permutation.
+// The deferred lighting pass reads finished surfaces, alpha testing and normal mapping happened in the G-buffer.
+// Only the directional, spot and point light have shadow maps. The feedback pass only needs the virtual texture ids.
+uint32_t normalizePermutation(uint32_t permutation)
+{
+    ShaderType shaderType = (ShaderType)(permutation & PermutationShaderTypeMask);
+    if (shaderType == ShaderType::Feedback)
+        return (uint32_t)ShaderType::Feedback | PermutationVirtualTexture;
+    if (shaderType == ShaderType::Ambient)
+        permutation &= ~(PermutationNormalMap | PermutationSpecular);
+    if (shaderType == ShaderType::DepthOnly)
+        permutation &= ~(PermutationNormalMap | PermutationSpecular | PermutationDeferred);
+    if (permutation & PermutationDeferred)
+        permutation &= ~(PermutationAlphaTest | PermutationNormalMap | PermutationVirtualTexture);
+    if (shaderType != ShaderType::Directional && shaderType != ShaderType::Spot && shaderType != ShaderType::Point)
+        permutation &= ~PermutationShadows;
+    return permutation;
+}
+
+std::string permutationDefines(uint32_t permutation)
+{
+    const char* typeDefines[] = { "LIGHT_AMBIENT", "LIGHT_DIRECTIONAL", "LIGHT_SPOT", "LIGHT_POINT", "LIGHT_CLUSTERED", "GBUFFER", "DEPTH_ONLY", "FEEDBACK" };
+    static_assert(sizeof(typeDefines) / sizeof(typeDefines[0]) == (size_t)ShaderType::NumShaderTypes, "Missing shader type define");
+    std::string defines = std::string("#define ") + typeDefines[permutation & PermutationShaderTypeMask] + "\n";
+    if (permutation & PermutationAlphaTest)
+        defines += "#define ALPHA_TEST\n";
+    if (permutation & PermutationNormalMap)
+        defines += "#define NORMAL_MAP\n";
+    if (permutation & PermutationSpecular)
+        defines += "#define SPECULAR\n";
+    if (permutation & PermutationDeferred)
+        defines += "#define DEFERRED\n";
+    if (permutation & PermutationShadows)
+        defines += "#define SHADOWS\n";
+    if (permutation & PermutationVirtualTexture)
+        defines += "#define VIRTUAL_TEXTURE\n";
+    return defines;
+}
+
+uint32_t vertexProgramIndex(uint32_t permutation)
+{
+    return (permutation & PermutationDeferred) ? VertexProgramFullscreen : VertexProgramScene;
+}
+
+const size_t NumStagePrograms = NumVertexPrograms + NumPermutations;
+
+// The vertex programs first, then the pixel shader permutations
+StageProgram& stageProgram(size_t index)
+{
+    return index < NumVertexPrograms ? g_demoState.m_vertexPrograms[index] : g_demoState.m_pixelPrograms[index - NumVertexPrograms];
+}
+
+std::string stageProgramDefines(size_t index)
+{
+    if (index < NumVertexPrograms)
+        return index == VertexProgramFullscreen ? "#define FULLSCREEN\n" : "";
+    return permutationDefines((uint32_t)(index - NumVertexPrograms));
+}
+
+// Name used in build errors, permutations list their defines
+std::string stageProgramName(size_t index)
+{
+    std::string defines = stageProgramDefines(index);
+    const std::string& file = index < NumVertexPrograms ? g_demoState.m_vertexShader.m_shaderFile : g_demoState.m_pixelShader.m_shaderFile;
+    if (defines.empty())
+        return file;
+    for (size_t pos = 0; (pos = defines.find("#define ", pos)) != std::string::npos; )
+        defines.erase(pos, 8);
+    std::replace(defines.begin(), defines.end(), '\n', ' ');
+    defines.pop_back();
+    return file + " (" + defines + ")";
+}
+
+// Points every pipeline at the current stage programs
+void updatePipelines()
+{
+    for (uint32_t i = 0; i < NumPermutations; i++)
+    {
+        GLuint pixelProgram = g_demoState.m_pixelPrograms[i].m_shaderId;
+        if (!pixelProgram)
+            continue;
+        GLuint& pipeline = g_demoState.m_pipelines[i];
+        if (!pipeline)
+            glGenProgramPipelines(1, &pipeline);
+        glUseProgramStages(pipeline, GL_VERTEX_SHADER_BIT, g_demoState.m_vertexPrograms[vertexProgramIndex(i)].m_shaderId);
+        glUseProgramStages(pipeline, GL_FRAGMENT_SHADER_BIT, pixelProgram);
+    }
+
+    GLuint vertexProgram = g_demoState.m_vertexPrograms[VertexProgramScene].m_shaderId;
+    if (vertexProgram && !g_demoState.m_positionOnlyPipeline)
+        glGenProgramPipelines(1, &g_demoState.m_positionOnlyPipeline);
+    if (vertexProgram)
+        glUseProgramStages(g_demoState.m_positionOnlyPipeline, GL_VERTEX_SHADER_BIT, vertexProgram);
+}
+
+void setStageProgram(StageProgram& stage, GLuint program, uint64_t key)
+{
+    if (stage.m_shaderId)
+        glDeleteProgram(stage.m_shaderId);
+    stage.m_shaderId = program;
+    stage.m_cacheKey = key;
+    updatePipelines();
+}
+
+// Starts compiling a stage program if its source changed since its last build
+void buildStageProgram(size_t index)
+{
+    StageProgram& stage = stageProgram(index);
+    bool vertexStage = index < NumVertexPrograms;
+    const char* source = vertexStage ? &g_demoState.m_vertexShader.m_shaderCode[0] : &g_demoState.m_pixelShader.m_shaderCode[0];
+    std::string defines = stageProgramDefines(index);
+    std::string code = defines.empty() ? std::string(source) : Util::insertShaderDefines(source, defines.c_str());
+    uint64_t key = vertexStage ? ProgramCache::key(code.c_str(), nullptr) : ProgramCache::key(nullptr, code.c_str());
+    bool building = stage.m_build.m_program != 0;
+    if ((building && key == stage.m_buildKey) || (!building && stage.m_shaderId && key == stage.m_cacheKey))
+        return;
+
+    Util::cancelProgramBuild(stage.m_build);
+    if (GLuint program = ProgramCache::load(key, true))
+    {
+        setStageProgram(stage, program, key);
+        return;
+    }
+    stage.m_buildKey = key;
+    stage.m_buildStartNs = Profiler::nowNs();
+    Util::beginStageBuild(vertexStage ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER, code.c_str(), stage.m_build);
+}
+
+// Starts compiling every requested stage whose source changed since its last build. The current programs keep
+// rendering until updateShaderBuilds() swaps in the new ones, a build that fails leaves the old program in place.
+void buildShaders()
+{
+    PROFILE_SCOPE("buildShaders");
+    for (size_t i = 0; i < NumStagePrograms; i++)
+    {
+        if (stageProgram(i).m_requested)
+            buildStageProgram(i);
+    }
+}
+
+// Starts building a stage program the first time it is asked for
+void requestStageProgram(size_t index)
+{
+    StageProgram& stage = stageProgram(index);
+    if (stage.m_requested)
+        return;
+    stage.m_requested = true;
+    buildStageProgram(index);
+}
+
+void requestPermutation(uint32_t permutation)
+{
+    requestStageProgram(vertexProgramIndex(permutation));
+    requestStageProgram(NumVertexPrograms + permutation);
+}
+
+// The permutation of the shader type and render path with every material feature, reads the virtual textures when
+// they are enabled
+uint32_t fallbackPermutation(uint32_t permutation)
+{
+    uint32_t features = PermutationFallbackFeatures;
+    if (VirtualTexturing::isEnabled())
+        features |= PermutationVirtualTexture;
+    return normalizePermutation((permutation & (PermutationShaderTypeMask | PermutationDeferred)) | features);
+}
+
+bool reloadShaders(bool reopen, std::string* errorString)
+{
+    PROFILE_SCOPE("reloadShaders");
+    if (reopen && !readShaders(true, true, errorString))
+        return false;
+    // The fallback of every light type is always built, the specialized permutations follow on first use
+    for (uint32_t i = 0; i < (uint32_t)ShaderType::NumShaderTypes; i++)
+    {
+        if ((ShaderType)i != ShaderType::Feedback || VirtualTexturing::isEnabled())
+            g_demoState.m_pixelPrograms[fallbackPermutation(i)].m_requested = true;
+    }
+    buildShaders();
+    return true;
+}
+
+bool isBuildingShaders()
+{
+    for (size_t i = 0; i < NumStagePrograms; i++)
+    {
+        if (stageProgram(i).m_build.m_program)
+            return true;
+    }
+    return false;
+}
 
-    for (size_t i = 0; i < (size_t)ShaderType::NumShaderTypes; i++)
+// Swaps in every program whose build finished, wait keeps polling until all builds are done.
+// Returns false if any of the finished builds failed.
+bool updateShaderBuilds(bool wait, std::string* errorString)
+{
+    bool success = true;
+    do
     {
-        if (reopen)
+        for (size_t i = 0; i < NumStagePrograms; i++)
         {
-            if (!readShaderFromFile(shaderFiles[i], g_demoState.m_pixelShaders[i]))
+            StageProgram& stage = stageProgram(i);
+            if (!Util::isProgramBuildComplete(stage.m_build))
+                continue;
+            std::string buildError;
+            GLuint program = Util::finishProgramBuild(stage.m_build, &buildError);
+            if (!program)
             {
                 if (errorString)
-                    *errorString = "Cannot read ambient shader from file!";
-                return false;
+                    *errorString += stageProgramName(i) + ": " + buildError;
+                success = false;
+                continue;
             }
+            // Includes the time until the completion was polled, at most a frame when building in the background
+            ProgramCache::store(stage.m_buildKey, program, Profiler::nowNs() - stage.m_buildStartNs);
+            setStageProgram(stage, program, stage.m_buildKey);
+            // The cached shadow maps were rendered with the old program
+            if (i < NumVertexPrograms || (ShaderType)((i - NumVertexPrograms) & PermutationShaderTypeMask) == ShaderType::DepthOnly)
+                ShadowMaps::invalidate();
+        }
+        if (wait && isBuildingShaders())
+            std::this_thread::yield();
+    } while (wait && isBuildingShaders());
+    return success;
+}
+
+// Reloads shaders that were changed on disk, only the programs built from a changed file are rebuilt
+void checkShaderChanges()
+{
+    std::vector<std::string> changedFiles;
+    if (!g_shaderWatcher.poll(changedFiles))
+        return;
+
+    bool vertexShader = false;
+    bool pixelShader = false;
+    for (const std::string& file : changedFiles)
+    {
+        vertexShader |= file == g_vertexShaderFile;
+        pixelShader |= file == g_pixelShaderFile;
+    }
+    if (!vertexShader && !pixelShader)
+        return;
+
+    g_demoState.m_shaderErrors = "";
+    if (readShaders(vertexShader, pixelShader, &g_demoState.m_shaderErrors))
+        buildShaders();
+}
+
+// Initialize black and white textures used in place of missing material maps
+void createDefaultTextures()
+{
+    uint32_t black = 0xFF000000;
+    uint32_t white = 0xFFFFFFFF;
+    uint32_t flatNormal = 0xFFFF8080;
+
+    glGenTextures(1, &g_blackTexture);
+    glBindTexture(GL_TEXTURE_2D, g_blackTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &black);
+    glGenerateMipmap(g_blackTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glGenTextures(1, &g_whiteTexture);
+    glBindTexture(GL_TEXTURE_2D, g_whiteTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &white);
+    glGenerateMipmap(g_whiteTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glGenTextures(1, &g_flatNormalTexture);
+    glBindTexture(GL_TEXTURE_2D, g_flatNormalTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &flatNormal);
+    glGenerateMipmap(g_flatNormalTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    MemoryTracker::trackTexture(g_blackTexture, MemoryTracker::Category::FallbackTextures, "Black", GL_RGBA8, 1, 1, 1, 1);
+    MemoryTracker::trackTexture(g_whiteTexture, MemoryTracker::Category::FallbackTextures, "White", GL_RGBA8, 1, 1, 1, 1);
+    MemoryTracker::trackTexture(g_flatNormalTexture, MemoryTracker::Category::FallbackTextures, "Flat normal", GL_RGBA8, 1, 1, 1, 1);
+}
+
+// Starts virtual texturing before the model is loaded, its materials register their textures with it
+bool initVirtualTexturing(uint32_t budgetMB, std::string* errString)
+{
+    if (!VirtualTexturing::init("../texturecache", (uint64_t)budgetMB * 1024 * 1024, VirtualTexturing::DefaultLoaderThreads, errString))
+        return false;
+    g_blackVirtualTexture = VirtualTexturing::addSolidTexture(0xFF000000);
+    g_whiteVirtualTexture = VirtualTexturing::addSolidTexture(0xFFFFFFFF);
+    g_flatNormalVirtualTexture = VirtualTexturing::addSolidTexture(0xFFFF8080);
+    g_demoState.m_virtualTextureBudgetMB = (int)budgetMB;
+    g_sponza.setVirtualTextures(true);
+    return true;
+}
+
+// Starts texture streaming before the model is loaded, its materials create their textures with it
+bool initTextureStreaming(uint32_t budgetMB, std::string* errString)
+{
+    if (!TextureStreaming::init("../texturecache", (uint64_t)budgetMB * 1024 * 1024, TextureStreaming::DefaultLoaderThreads, errString))
+        return false;
+    g_demoState.m_textureBudgetMB = (int)budgetMB;
+    g_sponza.setStreamTextures(true);
+    return true;
+}
+
+// What stays of the model in RAM after the upload, as given by --cpu-geometry or the default of the window or run
+ObjLoader::GeometryResidency geometryResidency(const Benchmark::Options& options, bool window)
+{
+    for (int i = 0; i < (int)ObjLoader::GeometryResidency::NumResidencies; i++)
+    {
+        if (options.m_cpuGeometry == ObjLoader::geometryResidencyName((ObjLoader::GeometryResidency)i))
+            return (ObjLoader::GeometryResidency)i;
+    }
+    return window || options.m_softwareRasterizer ? ObjLoader::GeometryResidency::Keep : ObjLoader::GeometryResidency::Release;
+}
+
+Benchmark::PathKey capturePathKey(double time)
+{
+    Benchmark::PathKey key;
+    key.m_time = time;
+    key.m_cameraPosition = g_demoState.m_cameraPosition;
+    key.m_yaw = g_demoState.m_yaw;
+    key.m_pitch = g_demoState.m_pitch;
+    key.m_lightType = (int)g_demoState.m_lightType;
+    key.m_directionalLightDirection = g_demoState.m_directionalLight.m_lightDirection;
+    key.m_spotLightPosition = g_demoState.m_spotLight.m_lightPosition;
+    key.m_spotLightDirection = g_demoState.m_spotLight.m_lightDirection;
+    key.m_pointLightPosition = g_demoState.m_pointLight.m_lightPosition;
+    return key;
+}
+
+void animateClusteredLights(int lightCount, float radius, double time);
+
+// Update of a camera path frame, replaces the light of the path with the many lights if clusteredLights is set
+void updateFromPath(const Benchmark::CameraPath& path, double time, double dt, bool clusteredLights, int lightCount,
+    FrameSnapshot& snapshot)
+{
+    PROFILE_SCOPE("updateFromPath");
+    Benchmark::PathKey key;
+    path.sample(time, key);
+    snapshot.m_inputTimeNs = Profiler::nowNs();
+    snapshot.m_appTime = time;
+    snapshot.m_dt = dt;
+    snapshot.m_cameraPosition = key.m_cameraPosition;
+    snapshot.m_yaw = key.m_yaw;
+    snapshot.m_pitch = key.m_pitch;
+    updateCameraVectors(key.m_yaw, key.m_pitch, snapshot.m_cameraDirection, snapshot.m_cameraUp);
+    snapshot.m_overrideLights = true;
+    snapshot.m_lightType = key.m_lightType >= 0 && key.m_lightType < (int)LightType::NumLightTypes ? key.m_lightType : -1;
+    if (clusteredLights)
+        snapshot.m_lightType = (int)LightType::Clustered;
+    snapshot.m_directionalLightDirection = key.m_directionalLightDirection;
+    snapshot.m_spotLightPosition = key.m_spotLightPosition;
+    snapshot.m_spotLightDirection = key.m_spotLightDirection;
+    snapshot.m_pointLightPosition = key.m_pointLightPosition;
+    if (clusteredLights)
+    {
+        animateClusteredLights(lightCount, g_demoState.m_clusteredLightRadius, time);
+        snapshot.m_clusteredLights = g_updateState.m_clusteredLights;
+    }
+    else
+    {
+        snapshot.m_clusteredLights.clear();
+    }
+}
+
+// Makes the snapshot the state render() draws
+void applySnapshot(const FrameSnapshot& snapshot)
+{
+    g_demoState.m_appTime = snapshot.m_appTime;
+    g_demoState.m_dt = snapshot.m_dt;
+    g_demoState.m_cameraPosition = snapshot.m_cameraPosition;
+    g_demoState.m_cameraDirection = snapshot.m_cameraDirection;
+    g_demoState.m_cameraUp = snapshot.m_cameraUp;
+    g_demoState.m_yaw = snapshot.m_yaw;
+    g_demoState.m_pitch = snapshot.m_pitch;
+    if (snapshot.m_overrideLights)
+    {
+        if (snapshot.m_lightType >= 0)
+            g_demoState.m_lightType = (LightType)snapshot.m_lightType;
+        g_demoState.m_directionalLight.m_lightDirection = snapshot.m_directionalLightDirection;
+        g_demoState.m_spotLight.m_lightPosition = snapshot.m_spotLightPosition;
+        g_demoState.m_spotLight.m_lightDirection = snapshot.m_spotLightDirection;
+        g_demoState.m_pointLight.m_lightPosition = snapshot.m_pointLightPosition;
+    }
+    g_demoState.m_clusteredLights = snapshot.m_clusteredLights;
+}
+
+// Renders every frame of the path offscreen and collects the timings. clusteredLights replaces the light of
+// the path with the many lights and, if scaling is set, averages the light assignment statistics into it.
+void replayPath(const Benchmark::CameraPath& path, const Benchmark::Options& options, Benchmark::RenderTarget& target,
+    bool clusteredLights, std::vector<Benchmark::FrameTiming>& timings, Benchmark::LightScalingResult* scaling)
+{
+    // Timestamps rather than GL_TIME_ELAPSED, elapsed queries can't nest with the profiler's GPU zones
+    GLuint timerQueries[2];
+    glGenQueries(2, timerQueries);
+    std::string errString;
+    uint32_t scalingFrames = 0, clusters = 0, lightIndices = 0;
+
+    int frameCount = (int)(path.duration() / options.m_timeStep) + 1;
+    timings.reserve(frameCount);
+
+    // Warmup frames render the first key so shader compilation and uploads don't skew the first timings.
+    // The update thread samples the path up to the pipeline depth ahead of the frame being rendered.
+    int lightCount = g_demoState.m_clusteredLightCount;
+    FramePipeline::start(options.m_pipelineDepth, [&path, &options, clusteredLights, lightCount](uint64_t pipelineFrame, uint32_t slot)
+    {
+        int frame = (int)pipelineFrame - 1 - options.m_warmupFrames;
+        double time = std::max(frame, 0) * options.m_timeStep;
+        updateFromPath(path, time, options.m_timeStep, clusteredLights, lightCount, g_frameSnapshots[slot]);
+    });
+    for (int frame = -options.m_warmupFrames; frame < frameCount; frame++)
+    {
+        Profiler::newFrame();
+        double time = std::max(frame, 0) * options.m_timeStep;
+        const FrameSnapshot& snapshot = g_frameSnapshots[FramePipeline::beginFrame()];
+        applySnapshot(snapshot);
+
+        std::chrono::high_resolution_clock::time_point frameStart = std::chrono::high_resolution_clock::now();
+        target.bind();
+        glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+        glQueryCounter(timerQueries[0], GL_TIMESTAMP);
+        render(target.width(), target.height());
+        RingBuffer::endFrame();
+        DrawCommands::endFrame();
+        glQueryCounter(timerQueries[1], GL_TIMESTAMP);
+        std::chrono::high_resolution_clock::time_point cpuEnd = std::chrono::high_resolution_clock::now();
+
+        // Each frame is finished before the next starts so timings don't bleed between frames
+        glFinish();
+        std::chrono::high_resolution_clock::time_point frameEnd = std::chrono::high_resolution_clock::now();
+        FramePipeline::endFrame(snapshot.m_inputTimeNs);
+        GLuint64 gpuStart = 0, gpuEnd = 0;
+        glGetQueryObjectui64v(timerQueries[0], GL_QUERY_RESULT, &gpuStart);
+        glGetQueryObjectui64v(timerQueries[1], GL_QUERY_RESULT, &gpuEnd);
+        // The frame is finished, so this reads its own samples
+        resolveSamplesQueries();
+        uint64_t shadedSamples = FrameStats::current(FrameStats::Counter::ShadedSamples);
+
+        std::chrono::duration<double> frameTime = std::chrono::duration_cast<std::chrono::duration<double>>(frameEnd - frameStart);
+        FrameStats::endFrame(frameTime.count());
+        if (frame < 0)
+            continue;
+        if (frame == 0)
+            SoftRasterizer::resetStatistics();
+
+        Benchmark::FrameTiming timing;
+        timing.m_frame = (uint32_t)frame;
+        timing.m_time = time;
+        timing.m_cpuMs = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(cpuEnd - frameStart).count();
+        timing.m_gpuMs = (gpuEnd - gpuStart) / 1000000.0;
+        timing.m_frameMs = frameTime.count() * 1000.0;
+        timing.m_overdraw = (double)shadedSamples / ((double)target.width() * target.height());
+        const DrawCommands::Statistics& commandStats = DrawCommands::statistics();
+        timing.m_recordMs = commandStats.m_recordMs;
+        timing.m_replayMs = commandStats.m_replayMs;
+        timing.m_latencyMs = FramePipeline::statistics().m_lastLatencyMs;
+        timings.push_back(timing);
+
+        if (scaling)
+        {
+            const ClusteredLighting::Statistics& stats = ClusteredLighting::statistics();
+            scaling->m_avgAssignMs += stats.m_assignMs;
+            scaling->m_avgUploadMs += stats.m_uploadMs;
+            clusters += stats.m_clusters;
+            lightIndices += stats.m_lightIndices;
+            scalingFrames++;
         }
-        const char* vsCode = &g_demoState.m_vertexShader.m_shaderCode[0];
-        const char* psCode = &g_demoState.m_pixelShaders[i].m_shaderCode[0];
-        GLuint shader = Util::createShaderProgram(vsCode, psCode, errorString);
-        if (!shader)
+
+        if (options.m_dumpDirectory.length() && frame % options.m_dumpInterval == 0)
         {
-            return false;
+            char frameName[64];
+            snprintf(frameName, sizeof(frameName), "frame_%05d.png", frame);
+            std::string frameFile = Util::combinePath(options.m_dumpDirectory.c_str(), frameName);
+            if (!target.writePng(frameFile.c_str(), &errString))
+                fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
         }
-        if (g_demoState.m_pixelShaders[i].m_shaderId)
-            glDeleteProgram(g_demoState.m_pixelShaders[i].m_shaderId);
-        g_demoState.m_pixelShaders[i].m_shaderId = shader;
     }
-    return true;
+    FramePipeline::stop();
+    glDeleteQueries(2, timerQueries);
+
+    if (scaling && scalingFrames)
+    {
+        scaling->m_avgAssignMs /= scalingFrames;
+        scaling->m_avgUploadMs /= scalingFrames;
+        scaling->m_avgClusterLights = clusters ? (double)lightIndices / clusters : 0.0;
+    }
+}
+
+// Replays a recorded camera path offscreen at a fixed timestep and resolution.
+// Returns 0 on success, 1 on setup errors and 2 if the timings regressed against the baseline.
+int runBenchmark(const Benchmark::Options& options)
+{
+    Profiler::init();
+    JobSystem::init(options.m_threads);
+    MemoryTracker::setBudget((uint64_t)options.m_memoryBudgetMB * 1024 * 1024);
+
+    std::string errString;
+    Benchmark::CameraPath path;
+    if (!path.load(options.m_pathFile.c_str(), &errString) ||
+        !Benchmark::createOffscreenContext(&errString))
+    {
+        fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+        return 1;
+    }
+    Profiler::initGraphics();
+
+    Benchmark::RenderTarget target;
+    Util::enableParallelShaderCompile();
+    if (options.m_programCache)
+        ProgramCache::init("../shadercache", nullptr);
+    if ((options.m_virtualTexturing && !initVirtualTexturing(options.m_virtualTextureBudgetMB, &errString)) ||
+        (options.m_textureStreaming && !options.m_virtualTexturing && !initTextureStreaming(options.m_textureBudgetMB, &errString)) ||
+        !reloadShaders(true, &errString) ||
+        !updateShaderBuilds(true, &errString) ||
+        !target.create(options.m_width, options.m_height, &errString))
+    {
+        fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+        return 1;
+    }
+    createDefaultTextures();
+
+    g_sponza.setErrorCallback([](int, const char* errMessage) { fprintf(stderr, "Loader error: %s\n", errMessage); });
+    if (!g_sponza.loadFile(options.m_modelFile.c_str()))
+    {
+        return 1;
+    }
+    // The bounds are computed from the vertices before initGraphics() may drop them
+    computeSceneBounds();
+    if (TextureStreaming::isEnabled())
+        computeMaterialExtents();
+    uint64_t loadedGeometryBytes = g_sponza.cpuGeometryBytes();
+    g_sponza.setGeometryResidency(geometryResidency(options, false));
+    if (!g_sponza.initGraphics())
+    {
+        return 1;
+    }
+    if (!RingBuffer::init(RingBufferCapacity, &errString) ||
+        !DeferredShading::init(&errString) || !ShadowMaps::init(&errString) || !Instancing::init(&errString))
+    {
+        fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+        return 1;
+    }
+    Instancing::setModelBounds(g_demoState.m_sceneMin, g_demoState.m_sceneMax);
+    if (options.m_instanceFile.length() && !Instancing::loadTransforms(options.m_instanceFile.c_str(), &errString))
+    {
+        fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+        return 1;
+    }
+    if (options.m_instanceFile.empty())
+        Instancing::setGrid(options.m_instanceColumns, options.m_instanceRows, options.m_instanceSpacing);
+    ShadowMaps::setSceneBounds(Instancing::sceneMin(), Instancing::sceneMax());
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+
+    // Every material is drawn each frame, so rendering each light type once requests all the permutations the
+    // path can use. Building them up front keeps compiles out of the timings and the fallbacks out of the images.
+    // The shadowed permutations are only requested once the depth shaders exist, which takes a second round.
+    g_demoState.m_renderPath = options.m_deferred ? RenderPath::Deferred : RenderPath::Forward;
+    g_demoState.m_shadows = options.m_shadows;
+    g_demoState.m_depthPrepass = options.m_depthPrepass;
+    g_demoState.m_validateCommands = options.m_validateCommands;
+    animateClusteredLights(g_demoState.m_clusteredLightCount, g_demoState.m_clusteredLightRadius, 0.0);
+    g_demoState.m_clusteredLights = g_updateState.m_clusteredLights;
+    target.bind();
+    for (int round = 0; round < 2; round++)
+    {
+        for (int lightType = 0; lightType < (int)LightType::NumLightTypes; lightType++)
+        {
+            g_demoState.m_lightType = (LightType)lightType;
+            render(target.width(), target.height());
+            RingBuffer::endFrame();
+            DrawCommands::endFrame();
+        }
+        if (!updateShaderBuilds(true, &errString))
+        {
+            fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+            return 1;
+        }
+    }
+    ProgramCache::logStatistics();
+    // After the warmup, which is only there to build the GL shaders
+    g_demoState.m_softwareRasterizer = options.m_softwareRasterizer;
+
+    int result = 0;
+    if (!options.m_lightCounts.empty())
+    {
+        // Scaling run: the whole path once per light count, shaded with the many lights
+        std::vector<Benchmark::LightScalingResult> results;
+        for (uint32_t lightCount : options.m_lightCounts)
+        {
+            g_demoState.m_clusteredLightCount = (int)lightCount;
+            Benchmark::LightScalingResult scaling;
+            std::vector<Benchmark::FrameTiming> timings;
+            replayPath(path, options, target, true, timings, &scaling);
+            scaling.m_lights = lightCount;
+            scaling.m_summary = Benchmark::summarize(timings);
+            results.push_back(scaling);
+            printf("Lights %u: avg %.3f ms, p95 %.3f ms, avg gpu %.3f ms, assignment %.3f ms, upload %.3f ms, %.2f lights per cluster\n",
+                lightCount, scaling.m_summary.m_avgMs, scaling.m_summary.m_p95Ms, scaling.m_summary.m_avgGpuMs,
+                scaling.m_avgAssignMs, scaling.m_avgUploadMs, scaling.m_avgClusterLights);
+        }
+        if (options.m_outputFile.length() && !Benchmark::writeLightScaling(options.m_outputFile.c_str(), results, &errString))
+        {
+            fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+            result = 1;
+        }
+        target.destroy();
+        ClusteredLighting::destroy();
+        DeferredShading::destroy();
+        ShadowMaps::destroy();
+        Instancing::destroy();
+        RingBuffer::destroy();
+        DrawCommands::destroy();
+        SoftRasterizer::destroy();
+        VirtualTexturing::destroy();
+        TextureStreaming::destroy();
+        JobSystem::destroy();
+        destroySamplesQueries();
+        g_sponza.destroyGraphics();
+        Profiler::destroyGraphics();
+        Benchmark::destroyOffscreenContext();
+        return result;
+    }
+
+    uint64_t firstProfiledFrame = Profiler::currentFrameIndex() + 1;
+    std::vector<Benchmark::FrameTiming> timings;
+    replayPath(path, options, target, false, timings, nullptr);
+
+    if (options.m_traceFile.length())
+    {
+        // Let the profiler read back the GPU zones of the last frames before writing them out
+        uint64_t lastProfiledFrame = Profiler::currentFrameIndex();
+        for (int i = 0; i < 3; i++)
+            Profiler::newFrame();
+        if (!Profiler::writeChromeTrace(options.m_traceFile.c_str(), firstProfiledFrame, lastProfiledFrame, &errString))
+            fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+    }
+
+    Benchmark::Summary summary = Benchmark::summarize(timings);
+    printf("Benchmark: %u frames at %dx%d, avg %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms, avg gpu %.3f ms\n",
+        summary.m_frames, options.m_width, options.m_height, summary.m_avgMs, summary.m_p50Ms, summary.m_p95Ms, summary.m_p99Ms, summary.m_maxMs, summary.m_avgGpuMs);
+    printf("Instances: %u copies, %.3f M triangles per frame\n", Instancing::statistics().m_instances,
+        FrameStats::average(FrameStats::Counter::Triangles) / 1000000.0);
+    printf("Overdraw: %.3f samples per pixel%s\n", summary.m_avgOverdraw, options.m_depthPrepass ? " with the depth pre-pass" : "");
+    const ShadowMaps::Statistics& shadowStats = ShadowMaps::statistics();
+    printf("Shadow maps: %llu passes rendered, %llu skipped\n", (unsigned long long)shadowStats.m_passesRendered, (unsigned long long)shadowStats.m_passesSkipped);
+    JobSystem::Statistics jobStats = JobSystem::statistics();
+    printf("Jobs: %u threads, %llu jobs, %llu stolen\n", JobSystem::threadCount(), (unsigned long long)jobStats.m_jobs,
+        (unsigned long long)jobStats.m_steals);
+    const DrawCommands::Statistics& commandStats = DrawCommands::statistics();
+    const FramePipeline::Statistics& pipelineStats = FramePipeline::statistics();
+    printf("Frame pipeline: depth %u, avg latency %.3f ms, max %.3f ms\n", pipelineStats.m_depth, summary.m_avgLatencyMs,
+        pipelineStats.m_maxLatencyMs);
+    printf("Draw commands: %u lists, %llu commands last frame, avg record %.3f ms, avg replay %.3f ms, %llu invalid lists\n",
+        commandStats.m_lists, (unsigned long long)commandStats.m_commands, summary.m_avgRecordMs, summary.m_avgReplayMs,
+        (unsigned long long)commandStats.m_invalidLists);
+    if (commandStats.m_invalidLists)
+        printf("%s\n", g_demoState.m_commandError.c_str());
+    const RingBuffer::Statistics& ringStats = RingBuffer::statistics();
+    printf("Ring buffer: %.2f MB peak frame of %.1f MB, %llu waits for %.3f ms, grown %u times\n", ringStats.m_peakFrameBytes / 1048576.0,
+        ringStats.m_capacity / 1048576.0, (unsigned long long)ringStats.m_waits, ringStats.m_waitMs, ringStats.m_grows);
+    if (options.m_virtualTexturing)
+    {
+        const VirtualTexturing::Statistics& vtStats = VirtualTexturing::statistics();
+        printf("Virtual texturing: avg %.1f tile requests, %.2f page faults per frame, hit rate %.1f%%, %llu uploads, %llu evictions, %u of %u pages resident, %.1f MB read\n",
+            FrameStats::average(FrameStats::Counter::VirtualTileRequests), FrameStats::average(FrameStats::Counter::VirtualPageFaults),
+            vtStats.m_totalRequests ? 100.0 * vtStats.m_totalHits / vtStats.m_totalRequests : 100.0, (unsigned long long)vtStats.m_totalUploads,
+            (unsigned long long)vtStats.m_totalEvictions, vtStats.m_residentPages, vtStats.m_capacityPages, vtStats.m_bytesRead / 1048576.0);
+    }
+    if (TextureStreaming::isEnabled())
+    {
+        const TextureStreaming::Statistics& streamStats = TextureStreaming::statistics();
+        printf("Texture streaming: %u textures, %.1f of %.1f MB allocated (%.1f MB at full resolution), %u of %u requested textures at their level, %llu uploads, %llu evictions, %.1f MB uploaded\n",
+            streamStats.m_textures, streamStats.m_allocatedBytes / 1048576.0, streamStats.m_budgetBytes / 1048576.0,
+            streamStats.m_fullBytes / 1048576.0, streamStats.m_satisfiedTextures, streamStats.m_requestedTextures,
+            (unsigned long long)streamStats.m_totalUploads, (unsigned long long)streamStats.m_totalEvictions,
+            streamStats.m_bytesUploaded / 1048576.0);
+    }
+    MemoryTracker::Totals memoryTotals = MemoryTracker::totals();
+    printf("Memory: GPU %.1f MB (peak %.1f MB, textures %.1f MB, geometry %.1f MB), CPU geometry %.1f MB%s\n",
+        memoryTotals.m_gpuBytes / 1048576.0, memoryTotals.m_peakGpuBytes / 1048576.0,
+        (memoryTotals.m_bytes[(int)MemoryTracker::Category::MaterialTextures] + memoryTotals.m_bytes[(int)MemoryTracker::Category::StreamedTextures] +
+        memoryTotals.m_bytes[(int)MemoryTracker::Category::VirtualTextures]) / 1048576.0,
+        (memoryTotals.m_bytes[(int)MemoryTracker::Category::VertexBuffers] + memoryTotals.m_bytes[(int)MemoryTracker::Category::IndexBuffers]) / 1048576.0,
+        memoryTotals.m_cpuBytes / 1048576.0, MemoryTracker::isOverBudget() ? ", over budget" : "");
+    printf("CPU geometry: %.1f MB after loading, %.1f MB resident after the upload (%s)\n", loadedGeometryBytes / 1048576.0,
+        g_sponza.cpuGeometryBytes() / 1048576.0, ObjLoader::geometryResidencyName(g_sponza.geometryResidency()));
+    if (options.m_memoryReportFile.length() && !MemoryTracker::writeJson(options.m_memoryReportFile.c_str(), &errString))
+    {
+        fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+        result = 1;
+    }
+    if (options.m_softwareRasterizer)
+    {
+        const SoftRasterizer::Statistics& softStats = SoftRasterizer::statistics();
+        printf("Software rasterizer: %.2f Mtris/s, %.2f Mpix/s, last frame %llu of %llu triangles rasterized, vertices %.3f ms, setup %.3f ms, raster %.3f ms\n",
+            softStats.m_mtrisPerSecond, softStats.m_mpixPerSecond, (unsigned long long)softStats.m_rasterizedTriangles,
+            (unsigned long long)softStats.m_triangles, softStats.m_vertexMs, softStats.m_setupMs, softStats.m_rasterMs);
+    }
+
+    if (options.m_outputFile.length() && !Benchmark::writeTimings(options.m_outputFile.c_str(), timings, summary, &errString))
+    {
+        fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+        result = 1;
+    }
+    if (options.m_writeBaselineFile.length() && !Benchmark::writeBaseline(options.m_writeBaselineFile.c_str(), summary, &errString))
+    {
+        fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+        result = 1;
+    }
+    if (options.m_baselineFile.length())
+    {
+        Benchmark::Summary baseline;
+        std::string report;
+        if (!Benchmark::loadBaseline(options.m_baselineFile.c_str(), baseline, &errString))
+        {
+            fprintf(stderr, "Benchmark error: %s\n", errString.c_str());
+            result = 1;
+        }
+        else if (!Benchmark::compareToBaseline(summary, baseline, options.m_tolerance, report))
+        {
+            printf("%sBenchmark regressed beyond %.0f%% of the baseline\n", report.c_str(), options.m_tolerance * 100.0);
+            result = 2;
+        }
+        else
+        {
+            printf("%s", report.c_str());
+        }
+    }
+
+    target.destroy();
+    ClusteredLighting::destroy();
+    DeferredShading::destroy();
+    ShadowMaps::destroy();
+    Instancing::destroy();
+    RingBuffer::destroy();
+    DrawCommands::destroy();
+    SoftRasterizer::destroy();
+    VirtualTexturing::destroy();
+    TextureStreaming::destroy();
+    JobSystem::destroy();
+    destroySamplesQueries();
+    g_sponza.destroyGraphics();
+    Profiler::destroyGraphics();
+    Benchmark::destroyOffscreenContext();
+    return result;
 }
 
+int appMain(int argc, char** argv);
+
+#ifdef _WIN32
 int __stdcall WinMain(
     HINSTANCE hInstance,
     HINSTANCE hPrevInstance,
@@ -198,11 +1151,37 @@ int __stdcall WinMain(
     int nCmdShow
 )
 {
+    return appMain(__argc, __argv);
+}
+#else
+int main(int argc, char** argv)
+{
+    return appMain(argc, argv);
+}
+#endif
+
+int appMain(int argc, char** argv)
+{
+    Benchmark::Options benchmarkOptions;
+    std::string argError;
+    if (!Benchmark::parseArguments(argc, argv, benchmarkOptions, &argError))
+    {
+        showError(argError.c_str());
+        return 1;
+    }
+    if (benchmarkOptions.m_enabled)
+    {
+        return runBenchmark(benchmarkOptions);
+    }
+
+    Profiler::init();
+    JobSystem::init(0);
+    MemoryTracker::setBudget((uint64_t)benchmarkOptions.m_memoryBudgetMB * 1024 * 1024);
     glfwSetErrorCallback(errorHandler);
     glfwInit();
     glfwWindowHint(GLFW_SAMPLES, 8);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     GLFWwindow* mainWindow = glfwCreateWindow(windowWidth, windowHeight, "Shaders", nullptr, nullptr);
@@ -217,6 +1196,7 @@ int __stdcall WinMain(
     {
         return -1;
     }
+    Profiler::initGraphics();
 
     // Init ImGui
     IMGUI_CHECKVERSION();
@@ -233,62 +1213,66 @@ int __stdcall WinMain(
     guiStyle.FrameRounding = 8;
     guiStyle.WindowRounding = 8;
     
-    // Load our shaders
+    // Load our shaders, with parallel compilation they build while the model loads
     std::string errString;
+    Util::enableParallelShaderCompile();
+    ProgramCache::init("../shadercache", nullptr);
+    if (benchmarkOptions.m_virtualTexturing && !initVirtualTexturing(benchmarkOptions.m_virtualTextureBudgetMB, &errString))
+        showError(errString.c_str());
+    else if (!benchmarkOptions.m_virtualTexturing && benchmarkOptions.m_textureStreaming &&
+        !initTextureStreaming(benchmarkOptions.m_textureBudgetMB, &errString))
+        showError(errString.c_str());
     if (!reloadShaders(true, &errString))
     {
-        MessageBoxA(nullptr, errString.c_str(), "Error", MB_OK);
+        showError(errString.c_str());
         return -1;
     }
     
-    // Initialize black and white textures
-    {
-        uint32_t black = 0xFF000000;
-        uint32_t white = 0xFFFFFFFF;
-        uint32_t flatNormal = 0xFFFF8080;
-
-        glGenTextures(1, &g_blackTexture);
-        glBindTexture(GL_TEXTURE_2D, g_blackTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &black);
-        glGenerateMipmap(g_blackTexture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glGenTextures(1, &g_whiteTexture);
-        glBindTexture(GL_TEXTURE_2D, g_whiteTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &white);
-        glGenerateMipmap(g_whiteTexture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glGenTextures(1, &g_flatNormalTexture);
-        glBindTexture(GL_TEXTURE_2D, g_flatNormalTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &flatNormal);
-        glGenerateMipmap(g_flatNormalTexture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    }
+    createDefaultTextures();
   
     // Load our 3d Model
     g_sponza.setErrorCallback(errorHandler);
     g_sponza.loadFile("sponza.obj");
+    computeSceneBounds();
+    if (TextureStreaming::isEnabled())
+        computeMaterialExtents();
+    g_sponza.setGeometryResidency(geometryResidency(benchmarkOptions, true));
     g_sponza.initGraphics();
+    if (!RingBuffer::init(RingBufferCapacity, &errString) ||
+        !DeferredShading::init(&errString) || !ShadowMaps::init(&errString) || !Instancing::init(&errString))
+    {
+        showError(errString.c_str());
+        return -1;
+    }
+    Instancing::setModelBounds(g_demoState.m_sceneMin, g_demoState.m_sceneMax);
+    ShadowMaps::setSceneBounds(Instancing::sceneMin(), Instancing::sceneMax());
+
+    if (!updateShaderBuilds(true, &errString))
+    {
+        showError(errString.c_str());
+        return -1;
+    }
+    if (g_demoState.m_watchShaders && !g_shaderWatcher.start("../shaders", &errString))
+        g_demoState.m_shaderErrors = errString;
 
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
 
     std::chrono::high_resolution_clock::time_point prevTime = std::chrono::high_resolution_clock::now();
     
-    glfwGetCursorPos(mainWindow, &g_inputState.m_lastMousePosition.x, &g_inputState.m_lastMousePosition.y);
+    // The update continues from the initial camera, on its own thread unless the depth is 0
+    sampleInput(mainWindow);
+    g_updateState.m_cameraPosition = g_demoState.m_cameraPosition;
+    g_updateState.m_yaw = g_demoState.m_yaw;
+    g_updateState.m_pitch = g_demoState.m_pitch;
+    g_updateState.m_lastMousePosition = g_updateInput.m_mousePosition;
+    g_demoState.m_pipelineDepth = (int)std::min(benchmarkOptions.m_pipelineDepth, FramePipeline::MaxDepth);
+    FramePipeline::start(g_demoState.m_pipelineDepth, update);
     while(!glfwWindowShouldClose(mainWindow))
     {
+        Profiler::newFrame();
         glfwPollEvents();
+        sampleInput(mainWindow);
 
         if (g_demoState.m_reloadShaders)
         {
@@ -302,7 +1286,13 @@ int __stdcall WinMain(
             reloadShaders(false, &g_demoState.m_shaderErrors);
             g_demoState.m_recompileShaders = false;
         }
-        update(mainWindow);
+        if (g_shaderWatcher.isRunning())
+            checkShaderChanges();
+        updateShaderBuilds(false, &g_demoState.m_shaderErrors);
+        const FrameSnapshot& snapshot = g_frameSnapshots[FramePipeline::beginFrame()];
+        applySnapshot(snapshot);
+        if (g_demoState.m_recordingPath)
+            g_cameraPath.addKey(capturePathKey(g_demoState.m_appTime - g_demoState.m_recordStartTime));
 
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -310,25 +1300,58 @@ int __stdcall WinMain(
 
         glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
         
-        render(mainWindow);
+        int vpWidth, vpHeight;
+        glfwGetFramebufferSize(mainWindow, &vpWidth, &vpHeight);
+        render(vpWidth, vpHeight);
+        RingBuffer::endFrame();
+        DrawCommands::endFrame();
         renderUI();
 
         ImGui::Render();
         int display_w, display_h;
         glfwGetFramebufferSize(mainWindow, &display_w, &display_h);
         glViewport(0, 0, display_w, display_h);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            PROFILE_SCOPE("ImGui Draw");
+            PROFILE_GPU_SCOPE("ImGui Draw");
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
 
-        glfwSwapBuffers(mainWindow);
+        {
+            PROFILE_SCOPE("SwapBuffers");
+            glfwSwapBuffers(mainWindow);
+        }
+        FramePipeline::endFrame(snapshot.m_inputTimeNs);
         std::chrono::high_resolution_clock::time_point currentTime = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> frameTime = std::chrono::duration_cast<std::chrono::duration<double>>(currentTime - prevTime);
         prevTime = currentTime;
-        g_demoState.m_dt = frameTime.count();
-        g_demoState.m_appTime += frameTime.count();
-    }
+        resolveSamplesQueries();
+        FrameStats::endFrame(frameTime.count());
+
+        if ((uint32_t)g_demoState.m_pipelineDepth != FramePipeline::depth())
+        {
+            FramePipeline::stop();
+            FramePipeline::start((uint32_t)g_demoState.m_pipelineDepth, update);
+        }
+    }
 
     // Cleanup
+    FramePipeline::stop();
+    g_shaderWatcher.stop();
+    FrameStats::stopLogging();
+    ClusteredLighting::destroy();
+    DeferredShading::destroy();
+    ShadowMaps::destroy();
+    Instancing::destroy();
+    RingBuffer::destroy();
+    DrawCommands::destroy();
+    SoftRasterizer::destroy();
+    VirtualTexturing::destroy();
+    TextureStreaming::destroy();
+    JobSystem::destroy();
+    destroySamplesQueries();
     g_sponza.destroyGraphics();
+    Profiler::destroyGraphics();
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -339,126 +1362,804 @@ int __stdcall WinMain(
     return 0;
 }
 
-void render(GLFWwindow* window)
+void setUniform(GLuint program, const char* name, float value)
 {
-    glm::vec3 camPosition = g_demoState.m_cameraPosition;
-    glm::vec3 camDir = glm::normalize(g_demoState.m_cameraDirection);
-    glm::vec3 camUp = glm::normalize(g_demoState.m_cameraUp);
+    glProgramUniform1f(program, glGetUniformLocation(program, name), value);
+    FrameStats::add(FrameStats::Counter::UniformUpdates);
+}
+
+void setUniform(GLuint program, const char* name, int value)
+{
+    glProgramUniform1i(program, glGetUniformLocation(program, name), value);
+    FrameStats::add(FrameStats::Counter::UniformUpdates);
+}
+
+void setUniform(GLuint program, const char* name, const glm::vec3& value)
+{
+    glProgramUniform3fv(program, glGetUniformLocation(program, name), 1, &value[0]);
+    FrameStats::add(FrameStats::Counter::UniformUpdates);
+}
+
+void setUniform(GLuint program, const char* name, const glm::vec2& value)
+{
+    glProgramUniform2fv(program, glGetUniformLocation(program, name), 1, &value[0]);
+    FrameStats::add(FrameStats::Counter::UniformUpdates);
+}
+
+void setUniform(GLuint program, const char* name, const glm::uvec4& value)
+{
+    glProgramUniform4uiv(program, glGetUniformLocation(program, name), 1, &value[0]);
+    FrameStats::add(FrameStats::Counter::UniformUpdates);
+}
+
+void setUniform(GLuint program, const char* name, const glm::mat4x4& value)
+{
+    glProgramUniformMatrix4fv(program, glGetUniformLocation(program, name), 1, GL_FALSE, &value[0][0]);
+    FrameStats::add(FrameStats::Counter::UniformUpdates);
+}
+
+void setUniform(GLuint program, const char* name, const glm::mat4x4* values, int count)
+{
+    glProgramUniformMatrix4fv(program, glGetUniformLocation(program, name), count, GL_FALSE, &values[0][0][0]);
+    FrameStats::add(FrameStats::Counter::UniformUpdates);
+}
+
+void bindTexture(GLuint unit, GLuint texture)
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    FrameStats::add(FrameStats::Counter::TextureBinds);
+}
 
+// Bounds of the loaded model, the many lights are spread inside them
+void computeSceneBounds()
+{
+    glm::vec3 sceneMin(FLT_MAX);
+    glm::vec3 sceneMax(-FLT_MAX);
+    for (const ObjLoader::Mesh* mesh : g_sponza.meshes())
+    {
+        for (const ObjLoader::MeshVertex& vertex : mesh->m_vertices)
+        {
+            sceneMin = glm::min(sceneMin, glm::vec3(vertex.m_position));
+            sceneMax = glm::max(sceneMax, glm::vec3(vertex.m_position));
+        }
+    }
+    g_demoState.m_sceneMin = sceneMin.x <= sceneMax.x ? sceneMin : glm::vec3(0.0f);
+    g_demoState.m_sceneMax = sceneMin.x <= sceneMax.x ? sceneMax : glm::vec3(0.0f);
+}
+
+void computeMaterialExtents()
+{
+    std::map<const ObjLoader::Material*, size_t> extentIndices;
+    std::vector<double> areas, uvAreas;
+    g_materialExtents.clear();
+    for (const ObjLoader::Mesh* mesh : g_sponza.meshes())
+    {
+        for (const ObjLoader::SubMesh* subMesh : mesh->m_subMeshes)
+        {
+            if (!subMesh->m_material)
+                continue;
+            std::map<const ObjLoader::Material*, size_t>::iterator index = extentIndices.find(subMesh->m_material);
+            if (index == extentIndices.end())
+            {
+                index = extentIndices.insert(std::make_pair(subMesh->m_material, g_materialExtents.size())).first;
+                g_materialExtents.push_back(MaterialExtent());
+                g_materialExtents.back().m_material = subMesh->m_material;
+                areas.push_back(0.0);
+                uvAreas.push_back(0.0);
+            }
+            MaterialExtent& extent = g_materialExtents[index->second];
+            const std::vector<unsigned int>& indices = subMesh->m_indices;
+            for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                const ObjLoader::MeshVertex& v0 = mesh->m_vertices[indices[i]];
+                const ObjLoader::MeshVertex& v1 = mesh->m_vertices[indices[i + 1]];
+                const ObjLoader::MeshVertex& v2 = mesh->m_vertices[indices[i + 2]];
+                for (const ObjLoader::MeshVertex* v : { &v0, &v1, &v2 })
+                {
+                    extent.m_min = glm::min(extent.m_min, glm::vec3(v->m_position));
+                    extent.m_max = glm::max(extent.m_max, glm::vec3(v->m_position));
+                }
+                glm::vec3 edge1 = glm::vec3(v1.m_position - v0.m_position);
+                glm::vec3 edge2 = glm::vec3(v2.m_position - v0.m_position);
+                glm::vec2 uvEdge1 = v1.m_texCoord - v0.m_texCoord;
+                glm::vec2 uvEdge2 = v2.m_texCoord - v0.m_texCoord;
+                areas[index->second] += 0.5 * glm::length(glm::cross(edge1, edge2));
+                uvAreas[index->second] += 0.5 * fabs(uvEdge1.x * uvEdge2.y - uvEdge1.y * uvEdge2.x);
+            }
+        }
+    }
+    for (size_t i = 0; i < g_materialExtents.size(); i++)
+        g_materialExtents[i].m_uvAreaPerArea = areas[i] > 0.0 ? (float)(uvAreas[i] / areas[i]) : 0.0f;
+}
+
+// Asks for the mip levels of the streamed textures. A material's bounds give its screen coverage, and its texels are
+// magnified most at the point of the bounds closest to the camera.
+void requestStreamedTextures(const glm::mat4x4& viewProjection, const glm::vec3& camPosition, int vpWidth, int vpHeight, float nearPlane)
+{
+    // Pixels a unit at distance 1 covers
+    float pixelsPerUnit = (float)vpHeight / (2.0f * tanf(0.5f * g_demoState.m_camFov * degToRad));
+    float viewportPixels = (float)vpWidth * (float)vpHeight;
+    for (const MaterialExtent& extent : g_materialExtents)
+    {
+        if (extent.m_min.x > extent.m_max.x)
+            continue;
+        // Outside the frustum if all corners are beyond the same clip plane
+        int outside[6] = {};
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec4 clip = viewProjection * glm::vec4(corner & 1 ? extent.m_max.x : extent.m_min.x,
+                corner & 2 ? extent.m_max.y : extent.m_min.y, corner & 4 ? extent.m_max.z : extent.m_min.z, 1.0f);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                outside[axis * 2] += clip[axis] < -clip.w;
+                outside[axis * 2 + 1] += clip[axis] > clip.w;
+            }
+        }
+        if (std::find(std::begin(outside), std::end(outside), 8) != std::end(outside))
+            continue;
+
+        glm::vec3 closest = glm::min(glm::max(camPosition, extent.m_min), extent.m_max);
+        float distance = std::max(glm::length(closest - camPosition), nearPlane);
+        float radius = 0.5f * glm::length(extent.m_max - extent.m_min) * pixelsPerUnit / distance;
+        float coverage = std::min(3.1416f * radius * radius, viewportPixels);
+        float unitsPerPixel = distance / pixelsPerUnit;
+        float uvAreaPerPixel = extent.m_uvAreaPerArea * unitsPerPixel * unitsPerPixel;
+        const ObjLoader::Material* material = extent.m_material;
+        TextureStreaming::request(material->m_diffuseTexId, uvAreaPerPixel, coverage);
+        TextureStreaming::request(material->m_bumpTexId, uvAreaPerPixel, coverage);
+        TextureStreaming::request(material->m_specularColorTexId, uvAreaPerPixel, coverage);
+        TextureStreaming::request(material->m_specularMapTexId, uvAreaPerPixel, coverage);
+    }
+}
+
+// Places the many lights with a fixed seed, so benchmark runs with the same count see the same lights,
+// and moves them along their orbits for the current time. Runs as part of the update, into g_updateState.
+void animateClusteredLights(int lightCount, float radius, double time)
+{
+    std::vector<ClusteredLightAnchor>& anchors = g_updateState.m_clusteredLightAnchors;
+    std::vector<ClusteredLighting::Light>& lights = g_updateState.m_clusteredLights;
+    size_t count = (size_t)std::max(lightCount, 0);
+    if (anchors.size() != count)
+    {
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        const glm::vec3& sceneMin = g_demoState.m_sceneMin;
+        glm::vec3 sceneSize = g_demoState.m_sceneMax - sceneMin;
+        anchors.resize(count);
+        lights.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            ClusteredLightAnchor& anchor = anchors[i];
+            anchor.m_center = sceneMin + sceneSize * glm::vec3(unit(random), unit(random), unit(random));
+            anchor.m_orbitRadius = 20.0f + 80.0f * unit(random);
+            anchor.m_orbitSpeed = 0.5f + unit(random);
+            anchor.m_phase = 6.2832f * unit(random);
+
+            // Saturated colors, one channel at full strength
+            ClusteredLighting::Light& light = lights[i];
+            light = ClusteredLighting::Light();
+            light.m_color = glm::vec3(unit(random), unit(random), unit(random));
+            light.m_color[i % 3] = 1.0f;
+            // Every fourth light is a spot light pointing down
+            if (i % 4 == 3)
+            {
+                light.m_kind = ClusteredLighting::LightKind::Spot;
+                light.m_direction = glm::normalize(glm::vec3(unit(random) - 0.5f, -1.0f, unit(random) - 0.5f));
+                light.m_cosOuterCone = cosf(35.0f * degToRad);
+                light.m_cosInnerCone = cosf(25.0f * degToRad);
+            }
+        }
+    }
+
+    JobSystem::parallelFor("Animate lights", (uint32_t)count, 1024, [&anchors, &lights, radius, time](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const ClusteredLightAnchor& anchor = anchors[i];
+            float angle = anchor.m_phase + (float)time * anchor.m_orbitSpeed;
+            ClusteredLighting::Light& light = lights[i];
+            light.m_position = anchor.m_center + glm::vec3(cosf(angle), 0.0f, sinf(angle)) * anchor.m_orbitRadius;
+            light.m_radius = radius;
+        }
+    });
+}
+
+ShaderType currentShaderType()
+{
+    switch (g_demoState.m_lightType)
+    {
+    case LightType::Directional:
+        return ShaderType::Directional;
+    case LightType::Spot:
+        return ShaderType::Spot;
+    case LightType::Point:
+        return ShaderType::Point;
+    case LightType::Clustered:
+        return ShaderType::Clustered;
+    default:
+        return ShaderType::Ambient;
+    }
+}
 
-    GLuint shaderProgram = 0;
+// Set by render() when the shadow maps of the current light are up to date
+bool g_renderShadows = false;
+// Set by render() when the main pass runs after a depth pre-pass. Its depth test only passes the visible surfaces,
+// so the alpha test is left to the pre-pass.
+bool g_depthPrepassActive = false;
 
-    // Setup light parameters
+// Cheapest permutation that renders the material correctly: opaque materials skip the alpha test so they keep early depth
+// testing, and the normal map and specular code is left out where it wouldn't change the result
+uint32_t selectPermutation(ShaderType shaderType, const ObjLoader::Material* mat)
+{
+    uint32_t permutation = (uint32_t)shaderType;
+    if (mat && mat->m_diffuseHasAlpha && (shaderType == ShaderType::DepthOnly || !g_depthPrepassActive))
+        permutation |= PermutationAlphaTest;
+    if (mat && (mat->m_bumpTexId || mat->m_bumpVirtualId))
+        permutation |= PermutationNormalMap;
+    if (g_demoState.m_specularMultiplier > 0.0f)
+        permutation |= PermutationSpecular;
+    if (g_renderShadows)
+        permutation |= PermutationShadows;
+    if (VirtualTexturing::isEnabled())
+        permutation |= PermutationVirtualTexture;
+    return normalizePermutation(permutation);
+}
+
+// Returns the permutation to render with, the fallback of the light type while the requested one is still compiling.
+// Returns NumPermutations if neither is available.
+uint32_t resolvePermutation(uint32_t permutation)
+{
+    requestPermutation(permutation);
+    if (!g_demoState.m_vertexPrograms[vertexProgramIndex(permutation)].m_shaderId)
+        return NumPermutations;
+    if (g_demoState.m_pixelPrograms[permutation].m_shaderId)
+        return permutation;
+    // The fallbacks have no shadows, the scene renders unshadowed until the shadowed permutation is built
+    uint32_t fallback = fallbackPermutation(permutation);
+    requestPermutation(fallback);
+    return g_demoState.m_pixelPrograms[fallback].m_shaderId ? fallback : NumPermutations;
+}
+
+// Light and material constants, set once per frame on every permutation that gets bound
+void setLightUniforms(GLuint shaderProgram)
+{
     if (g_demoState.m_lightType == LightType::Unlit)
     {
-        shaderProgram = g_demoState.m_pixelShaders[(int)ShaderType::Ambient].m_shaderId;
         glm::vec3 ambient(1.0f);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "ambientColor"), 1, &ambient[0]);
-        
+        setUniform(shaderProgram, "ambientColor", ambient);
     }
     else if (g_demoState.m_lightType == LightType::Ambient)
     {
-        shaderProgram = g_demoState.m_pixelShaders[(int)ShaderType::Ambient].m_shaderId;
-        glUniform3fv(glGetUniformLocation(shaderProgram, "ambientColor"), 1, &g_demoState.m_ambientColor[0]);
+        setUniform(shaderProgram, "ambientColor", g_demoState.m_ambientColor);
     }
     else if (g_demoState.m_lightType == LightType::Directional)
     {
-        shaderProgram = g_demoState.m_pixelShaders[(int)ShaderType::Directional].m_shaderId;
         glm::vec3 lightDir = glm::normalize(g_demoState.m_directionalLight.m_lightDirection);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightDir"), 1, &lightDir[0]);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightColor"), 1, &g_demoState.m_directionalLight.m_lightColor[0]);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "ambientColor"), 1, &g_demoState.m_ambientColor[0]);
-        glUniform1f(glGetUniformLocation(shaderProgram, "globalSpecMultiplier"), g_demoState.m_specularMultiplier);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "cameraPos"), 1, &g_demoState.m_cameraPosition[0]);
+        setUniform(shaderProgram, "lightDir", lightDir);
+        setUniform(shaderProgram, "lightColor", g_demoState.m_directionalLight.m_lightColor);
+        setUniform(shaderProgram, "ambientColor", g_demoState.m_ambientColor);
     }
     else if (g_demoState.m_lightType == LightType::Spot)
     {
-        shaderProgram = g_demoState.m_pixelShaders[(int)ShaderType::Spot].m_shaderId;
         glm::vec3 lightDir = glm::normalize(g_demoState.m_spotLight.m_lightDirection);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightDir"), 1, &lightDir[0]);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightPos"), 1, &g_demoState.m_spotLight.m_lightPosition[0]);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightColor"), 1, &g_demoState.m_spotLight.m_lightColor[0]);
-        glUniform1f(glGetUniformLocation(shaderProgram, "lightInnerCone"), g_demoState.m_spotLight.m_innerCone * degToRad);
-        glUniform1f(glGetUniformLocation(shaderProgram, "lightOuterCone"), g_demoState.m_spotLight.m_outerCone * degToRad);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "ambientColor"), 1, &g_demoState.m_ambientColor[0]);
-        glUniform1f(glGetUniformLocation(shaderProgram, "globalSpecMultiplier"), g_demoState.m_specularMultiplier);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "cameraPos"), 1, &g_demoState.m_cameraPosition[0]);
+        setUniform(shaderProgram, "lightDir", lightDir);
+        setUniform(shaderProgram, "lightPos", g_demoState.m_spotLight.m_lightPosition);
+        setUniform(shaderProgram, "lightColor", g_demoState.m_spotLight.m_lightColor);
+        setUniform(shaderProgram, "lightInnerCone", g_demoState.m_spotLight.m_innerCone * degToRad);
+        setUniform(shaderProgram, "lightOuterCone", g_demoState.m_spotLight.m_outerCone * degToRad);
+        setUniform(shaderProgram, "ambientColor", g_demoState.m_ambientColor);
     }
     else if (g_demoState.m_lightType == LightType::Point)
     {
-        shaderProgram = g_demoState.m_pixelShaders[(int)ShaderType::Point].m_shaderId;
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightPos"), 1, &g_demoState.m_pointLight.m_lightPosition[0]);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightColor"), 1, &g_demoState.m_pointLight.m_lightColor[0]);
-        glUniform1f(glGetUniformLocation(shaderProgram, "lightOuterRadius"), g_demoState.m_pointLight.m_outerRadius);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "ambientColor"), 1, &g_demoState.m_ambientColor[0]);
-        glUniform1f(glGetUniformLocation(shaderProgram, "globalSpecMultiplier"), g_demoState.m_specularMultiplier);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "cameraPos"), 1, &g_demoState.m_cameraPosition[0]);
+        setUniform(shaderProgram, "lightPos", g_demoState.m_pointLight.m_lightPosition);
+        setUniform(shaderProgram, "lightColor", g_demoState.m_pointLight.m_lightColor);
+        setUniform(shaderProgram, "lightOuterRadius", g_demoState.m_pointLight.m_outerRadius);
+        setUniform(shaderProgram, "ambientColor", g_demoState.m_ambientColor);
+    }
+    else if (g_demoState.m_lightType == LightType::Clustered)
+    {
+        setUniform(shaderProgram, "ambientColor", g_demoState.m_ambientColor);
     }
+    if (g_demoState.m_lightType != LightType::Unlit && g_demoState.m_lightType != LightType::Ambient)
+    {
+        setUniform(shaderProgram, "globalSpecMultiplier", g_demoState.m_specularMultiplier);
+        setUniform(shaderProgram, "shininess", g_demoState.m_specPowerMultiplier);
+        setUniform(shaderProgram, "cameraPos", g_demoState.m_cameraPosition);
+    }
+    if (g_renderShadows && g_demoState.m_lightType == LightType::Directional)
+    {
+        setUniform(shaderProgram, "shadowMatrices", ShadowMaps::cascadeMatrices(), (int)ShadowMaps::CascadeCount);
+        setUniform(shaderProgram, "shadowCascades", (int)ShadowMaps::CascadeTextureUnit);
+    }
+    else if (g_renderShadows && g_demoState.m_lightType == LightType::Spot)
+    {
+        setUniform(shaderProgram, "shadowMatrix", ShadowMaps::spotMatrix());
+        setUniform(shaderProgram, "spotShadowMap", (int)ShadowMaps::SpotTextureUnit);
+    }
+    else if (g_renderShadows && g_demoState.m_lightType == LightType::Point)
+    {
+        setUniform(shaderProgram, "pointShadowRange", ShadowMaps::pointDepthRange());
+        setUniform(shaderProgram, "pointShadowMap", (int)ShadowMaps::PointTextureUnit);
+    }
+}
 
-    // Setup matrices
-    int vpWidth, vpHeight;
-    glfwGetFramebufferSize(window, &vpWidth, &vpHeight);
+void setMaterialUniforms(GLuint shaderProgram)
+{
+    setUniform(shaderProgram, "diffuseTex", 0);
+    setUniform(shaderProgram, "normalTex", 1);
+    setUniform(shaderProgram, "specularColorTex", 2);
+    setUniform(shaderProgram, "specularPowerTex", 3);
+    setUniform(shaderProgram, "virtualPages", (int)VirtualTexturing::PageTextureUnit);
+}
+
+struct DrawItem
+{
+    uint32_t m_permutation;
+    const ObjLoader::Mesh* m_mesh;
+    const ObjLoader::SubMesh* m_subMesh;
+};
+std::vector<DrawItem> g_drawItems;
+
+// Fills g_drawItems with every submesh and the permutation of its material for the given shader type
+void collectDrawItems(ShaderType shaderType)
+{
+    // Sorted by permutation with the alpha tested ones last, so the opaque geometry fills the depth buffer with
+    // early depth testing first and every permutation is bound once per frame
+    g_drawItems.clear();
+    for (const ObjLoader::Mesh* mesh : g_sponza.meshes())
+    {
+        for (const ObjLoader::SubMesh* subMesh : mesh->m_subMeshes)
+        {
+            uint32_t permutation = selectPermutation(shaderType, subMesh->m_material);
+            if (permutation != PermutationPositionOnly)
+                permutation = resolvePermutation(permutation);
+            if (permutation < NumPermutations)
+                g_drawItems.push_back({ permutation, mesh, subMesh });
+        }
+    }
+    std::stable_sort(g_drawItems.begin(), g_drawItems.end(), [](const DrawItem& a, const DrawItem& b)
+    {
+        uint32_t alphaA = a.m_permutation & PermutationAlphaTest;
+        uint32_t alphaB = b.m_permutation & PermutationAlphaTest;
+        return alphaA != alphaB ? alphaA < alphaB : a.m_permutation < b.m_permutation;
+    });
+}
+
+// Records the draws of items [first, end) of g_drawItems, runs on the JobSystem threads. Only reads
+// state that stays unchanged while a pass is recorded. The virtual texture permutations get the virtual texture ids
+// instead of GL textures.
+void recordDrawItems(ShaderType shaderType, uint32_t instanceCount, uint32_t first, uint32_t end, DrawCommands::CommandList& list)
+{
+    for (uint32_t i = first; i < end; i++)
+    {
+        const DrawItem& item = g_drawItems[i];
+        list.bindPipeline(item.m_permutation);
+        list.bindGeometry(item.m_mesh->m_vao, item.m_mesh->m_vertexBuffer);
+
+        // Set material
+        const ObjLoader::SubMesh* subMesh = item.m_subMesh;
+        const ObjLoader::Material* mat = subMesh->m_material;
+        bool virtualTextures = (item.m_permutation & PermutationVirtualTexture) != 0;
+        if (mat && shaderType == ShaderType::DepthOnly)
+        {
+            // Only the alpha test reads a texture
+            if (item.m_permutation != PermutationPositionOnly)
+            {
+                uint32_t diffuseTex = mat->m_diffuseTexId ? mat->m_diffuseTexId : g_blackTexture;
+                if (virtualTextures)
+                    diffuseTex = mat->m_diffuseVirtualId ? mat->m_diffuseVirtualId : g_blackVirtualTexture;
+                list.bindTextures(&diffuseTex, 1);
+            }
+        }
+        else if (mat && virtualTextures)
+        {
+            uint32_t textures[DrawCommands::MaxTextures];
+            textures[0] = mat->m_diffuseVirtualId ? mat->m_diffuseVirtualId : g_blackVirtualTexture;
+            textures[1] = mat->m_bumpVirtualId ? mat->m_bumpVirtualId : g_flatNormalVirtualTexture;
+            textures[2] = mat->m_specularColorVirtualId ? mat->m_specularColorVirtualId : g_whiteVirtualTexture;
+            textures[3] = mat->m_specularMapVirtualId ? mat->m_specularMapVirtualId : g_whiteVirtualTexture;
+            list.bindTextures(textures, DrawCommands::MaxTextures);
+        }
+        else if (mat)
+        {
+            uint32_t textures[DrawCommands::MaxTextures];
+            textures[0] = mat->m_diffuseTexId ? mat->m_diffuseTexId : g_blackTexture;
+            textures[1] = mat->m_bumpTexId ? mat->m_bumpTexId : g_flatNormalTexture;
+            textures[2] = mat->m_specularColorTexId ? mat->m_specularColorTexId : g_whiteTexture;
+            textures[3] = mat->m_specularMapTexId ? mat->m_specularMapTexId : g_whiteTexture;
+            list.bindTextures(textures, DrawCommands::MaxTextures);
+        }
+        list.draw(subMesh->m_indexBuffer, subMesh->m_indexCount, instanceCount);
+    }
+}
+
+// Executes the recorded commands of one pass, the pipelines are permutations
+class GLCommandBackend : public DrawCommands::Backend
+{
+public:
+    explicit GLCommandBackend(ShaderType shaderType) : m_shaderType(shaderType) {}
+
+    void bindPipeline(uint32_t permutation) override
+    {
+        if (permutation == PermutationPositionOnly)
+        {
+            glBindProgramPipeline(g_demoState.m_positionOnlyPipeline);
+            return;
+        }
+        glBindProgramPipeline(g_demoState.m_pipelines[permutation]);
+        GLuint pixelProgram = g_demoState.m_pixelPrograms[permutation].m_shaderId;
+        if (m_shaderType != ShaderType::GBuffer && m_shaderType != ShaderType::DepthOnly && m_shaderType != ShaderType::Feedback)
+            setLightUniforms(pixelProgram);
+        setMaterialUniforms(pixelProgram);
+        // The texture ids are uniforms of the program, the replay drops the bind if the next material uses the same
+        m_virtualProgram = (permutation & PermutationVirtualTexture) ? pixelProgram : 0;
+        if (m_virtualProgram && m_virtualTexturesSet)
+            setUniform(m_virtualProgram, "virtualTextures", m_virtualTextures);
+    }
+
+    void bindGeometry(uint32_t vertexArray, uint32_t vertexBuffer) override
+    {
+        glBindVertexArray(vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    }
 
+    void bindTextures(const uint32_t* textures, uint32_t count) override
+    {
+        if (m_virtualProgram)
+        {
+            m_virtualTextures = glm::uvec4(0u);
+            for (uint32_t slot = 0; slot < count; slot++)
+                m_virtualTextures[slot] = textures[slot];
+            m_virtualTexturesSet = true;
+            setUniform(m_virtualProgram, "virtualTextures", m_virtualTextures);
+            return;
+        }
+        for (uint32_t unit = 0; unit < count; unit++)
+            bindTexture(unit, textures[unit]);
+    }
+
+    void draw(uint32_t indexBuffer, uint32_t indexCount, uint32_t instanceCount) override
+    {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)indexCount, GL_UNSIGNED_INT, 0, (GLsizei)instanceCount);
+        FrameStats::add(FrameStats::Counter::DrawCalls);
+        FrameStats::add(FrameStats::Counter::Triangles, (uint64_t)(indexCount / 3) * instanceCount);
+    }
+private:
+    ShaderType m_shaderType;
+    GLuint m_virtualProgram = 0;
+    glm::uvec4 m_virtualTextures = glm::uvec4(0u);
+    bool m_virtualTexturesSet = false;
+};
+
+// Draws instanceCount copies of the collected items with the instance transforms bound by the caller. The
+// commands are recorded as jobs and replayed here.
+void drawItems(ShaderType shaderType, uint32_t instanceCount)
+{
+    if (!instanceCount)
+        return;
+    PROFILE_SCOPE("drawItems");
+    DrawCommands::record((uint32_t)g_drawItems.size(), [shaderType, instanceCount](uint32_t first, uint32_t end, DrawCommands::CommandList& list)
+    {
+        recordDrawItems(shaderType, instanceCount, first, end, list);
+    });
+    std::string errString;
+    if (g_demoState.m_validateCommands && !DrawCommands::validateLists(&errString) && g_demoState.m_commandError.empty())
+        g_demoState.m_commandError = errString;
+
+    // Switching permutations only binds another pipeline, the vertex program is shared by all of them.
+    // Uniforms are set with glProgramUniform* on the stage program that declares them.
+    glUseProgram(0);
+    GLCommandBackend backend(shaderType);
+    DrawCommands::replay(backend);
+    glBindVertexArray(0);
+}
+
+// The depth-only passes need the alpha tested fallback, drawing without it would leave holes in the depth
+bool depthOnlyShadersReady()
+{
+    return resolvePermutation(fallbackPermutation((uint32_t)ShaderType::DepthOnly)) < NumPermutations;
+}
+
+// Fills the depth buffer of the bound framebuffer, then switches the depth test to GL_EQUAL without writes so
+// the main pass shades every pixel once. Opaque geometry is drawn without a fragment stage.
+void beginDepthPrepass(uint32_t instanceCount)
+{
+    {
+        PROFILE_SCOPE("Depth pre-pass");
+        PROFILE_GPU_SCOPE("Depth pre-pass");
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        collectDrawItems(ShaderType::DepthOnly);
+        drawItems(ShaderType::DepthOnly, instanceCount);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+}
+
+void endDepthPrepass()
+{
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+}
+
+// GL_SAMPLES_PASSED queries around the main pass. The overdraw is their result per viewport pixel, with the
+// pre-pass it approaches 1. Results are read once available, so the CPU never waits for them.
+const size_t SamplesQueryCount = 4;
+GLuint g_samplesQueries[SamplesQueryCount] = {};
+// Queries begun and read back so far, the ones in between are in flight
+uint64_t g_samplesQueriesBegun = 0;
+uint64_t g_samplesQueriesResolved = 0;
+uint64_t g_viewportPixels = 0;
+
+// Returns false if every query is still in flight, the frame is then not counted
+bool beginSamplesQuery()
+{
+    if (!g_samplesQueries[0])
+        glGenQueries((GLsizei)SamplesQueryCount, g_samplesQueries);
+    if (g_samplesQueriesBegun - g_samplesQueriesResolved == SamplesQueryCount)
+        return false;
+    glBeginQuery(GL_SAMPLES_PASSED, g_samplesQueries[g_samplesQueriesBegun % SamplesQueryCount]);
+    return true;
+}
+
+void endSamplesQuery()
+{
+    glEndQuery(GL_SAMPLES_PASSED);
+    g_samplesQueriesBegun++;
+}
+
+// Adds the finished queries to the ShadedSamples counter of the current frame
+void resolveSamplesQueries()
+{
+    while (g_samplesQueriesResolved != g_samplesQueriesBegun)
+    {
+        GLuint query = g_samplesQueries[g_samplesQueriesResolved % SamplesQueryCount];
+        GLuint available = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        GLuint64 samples = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples);
+        FrameStats::add(FrameStats::Counter::ShadedSamples, samples);
+        g_samplesQueriesResolved++;
+    }
+}
+
+void destroySamplesQueries()
+{
+    if (g_samplesQueries[0])
+        glDeleteQueries((GLsizei)SamplesQueryCount, g_samplesQueries);
+    memset(g_samplesQueries, 0, sizeof(g_samplesQueries));
+    g_samplesQueriesBegun = g_samplesQueriesResolved = 0;
+}
+
+// Renders the G-buffer and lights it with one full-screen pass into the bound framebuffer. Returns false without
+// drawing anything while the shaders of the lighting pass are still compiling.
+bool renderDeferred(int vpWidth, int vpHeight, const glm::mat4x4& viewProjection, uint32_t instanceCount)
+{
+    // Collected first so the G-buffer permutations are requested together with the lighting pass
+    collectDrawItems(ShaderType::GBuffer);
+    uint32_t lightingPermutation = (uint32_t)currentShaderType() | PermutationDeferred;
+    if (g_demoState.m_specularMultiplier > 0.0f)
+        lightingPermutation |= PermutationSpecular;
+    if (g_renderShadows)
+        lightingPermutation |= PermutationShadows;
+    lightingPermutation = resolvePermutation(normalizePermutation(lightingPermutation));
+    if (lightingPermutation >= NumPermutations || !DeferredShading::resize(vpWidth, vpHeight, nullptr))
+        return false;
+
+    GLint targetFramebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFramebuffer);
+    {
+        PROFILE_SCOPE("Geometry pass");
+        PROFILE_GPU_SCOPE("Geometry pass");
+        DeferredShading::beginGeometryPass();
+        if (g_depthPrepassActive)
+        {
+            beginDepthPrepass(instanceCount);
+            collectDrawItems(ShaderType::GBuffer);
+        }
+        bool countSamples = beginSamplesQuery();
+        drawItems(ShaderType::GBuffer, instanceCount);
+        if (countSamples)
+            endSamplesQuery();
+        if (g_depthPrepassActive)
+            endDepthPrepass();
+    }
+
+    {
+        PROFILE_SCOPE("Lighting pass");
+        PROFILE_GPU_SCOPE("Lighting pass");
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)targetFramebuffer);
+        glViewport(0, 0, vpWidth, vpHeight);
+        glDisable(GL_DEPTH_TEST);
+        glBindProgramPipeline(g_demoState.m_pipelines[lightingPermutation]);
+        GLuint pixelProgram = g_demoState.m_pixelPrograms[lightingPermutation].m_shaderId;
+        setLightUniforms(pixelProgram);
+        setUniform(pixelProgram, "inverseViewProjection", glm::inverse(viewProjection));
+        setUniform(pixelProgram, "gbufferAlbedoTex", (int)DeferredShading::AlbedoTextureUnit);
+        setUniform(pixelProgram, "gbufferNormalTex", (int)DeferredShading::NormalTextureUnit);
+        setUniform(pixelProgram, "gbufferDepthTex", (int)DeferredShading::DepthTextureUnit);
+        DeferredShading::bindTextures();
+        DeferredShading::drawFullscreenTriangle();
+        glEnable(GL_DEPTH_TEST);
+    }
+    return true;
+}
+
+// Brings the shadow maps of the current light up to date, passes whose placement didn't change are skipped.
+// Returns false if the light casts no shadows or the depth shaders are still compiling.
+bool updateShadowMaps(const glm::mat4x4& view, float aspect, float nearPlane, float farPlane)
+{
+    PROFILE_SCOPE("updateShadowMaps");
+    LightType lightType = g_demoState.m_lightType;
+    if (!g_demoState.m_shadows || (lightType != LightType::Directional && lightType != LightType::Spot && lightType != LightType::Point))
+        return false;
+    // The maps are kept until the light moves, so they can't be rendered with materials missing
+    if (!depthOnlyShadersReady())
+        return false;
+
+    // Copies outside the view still cast shadows into it
+    uint32_t instanceCount = Instancing::bindAll();
+    GLuint vertexProgram = g_demoState.m_vertexPrograms[VertexProgramScene].m_shaderId;
+    ShadowMaps::DrawCallback drawCasters = [vertexProgram, instanceCount](const glm::mat4x4& viewProjection)
+    {
+        setUniform(vertexProgram, "worldViewProjection", viewProjection);
+        collectDrawItems(ShaderType::DepthOnly);
+        drawItems(ShaderType::DepthOnly, instanceCount);
+    };
+    if (lightType == LightType::Directional)
+    {
+        ShadowMaps::updateDirectional(g_demoState.m_directionalLight.m_lightDirection, view, g_demoState.m_camFov * degToRad,
+            aspect, nearPlane, farPlane, drawCasters);
+    }
+    else if (lightType == LightType::Spot)
+    {
+        ShadowMaps::updateSpot(g_demoState.m_spotLight.m_lightPosition, g_demoState.m_spotLight.m_lightDirection,
+            g_demoState.m_spotLight.m_outerCone * degToRad, drawCasters);
+    }
+    else
+    {
+        ShadowMaps::updatePoint(g_demoState.m_pointLight.m_lightPosition, drawCasters);
+    }
+    ShadowMaps::bindTextures();
+    return true;
+}
+
+// Renders the page requests of the virtual textures at a fraction of the viewport, VirtualTexturing::update() reads
+// them back a few frames later
+void renderVirtualTextureFeedback(int vpWidth, int vpHeight, uint32_t instanceCount)
+{
+    PROFILE_SCOPE("Virtual texture feedback");
+    PROFILE_GPU_SCOPE("Virtual texture feedback");
+    GLint targetFramebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFramebuffer);
+    VirtualTexturing::beginFeedbackPass(vpWidth, vpHeight);
+    collectDrawItems(ShaderType::Feedback);
+    drawItems(ShaderType::Feedback, instanceCount);
+    VirtualTexturing::endFeedbackPass();
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)targetFramebuffer);
+    glViewport(0, 0, vpWidth, vpHeight);
+}
+
+// Draws the scene with SoftRasterizer and copies it to the bound framebuffer. Shadows and instance copies are left
+// out, the clustered lights fall back to their ambient term.
+void renderSoftware(int vpWidth, int vpHeight, const glm::mat4x4& viewProjection)
+{
+    PROFILE_SCOPE("renderSoftware");
+    SoftRasterizer::Lighting lighting;
+    lighting.m_ambientColor = g_demoState.m_ambientColor;
+    switch (g_demoState.m_lightType)
+    {
+    case LightType::Unlit:
+        lighting.m_ambientColor = glm::vec3(1.0f);
+        break;
+    case LightType::Directional:
+        lighting.m_type = SoftRasterizer::LightType::Directional;
+        lighting.m_lightDirection = glm::normalize(g_demoState.m_directionalLight.m_lightDirection);
+        lighting.m_lightColor = g_demoState.m_directionalLight.m_lightColor;
+        break;
+    case LightType::Spot:
+        lighting.m_type = SoftRasterizer::LightType::Spot;
+        lighting.m_lightDirection = glm::normalize(g_demoState.m_spotLight.m_lightDirection);
+        lighting.m_lightPosition = g_demoState.m_spotLight.m_lightPosition;
+        lighting.m_lightColor = g_demoState.m_spotLight.m_lightColor;
+        lighting.m_innerCone = g_demoState.m_spotLight.m_innerCone * degToRad;
+        lighting.m_outerCone = g_demoState.m_spotLight.m_outerCone * degToRad;
+        break;
+    case LightType::Point:
+        lighting.m_type = SoftRasterizer::LightType::Point;
+        lighting.m_lightPosition = g_demoState.m_pointLight.m_lightPosition;
+        lighting.m_lightColor = g_demoState.m_pointLight.m_lightColor;
+        lighting.m_outerRadius = g_demoState.m_pointLight.m_outerRadius;
+        break;
+    default:
+        break;
+    }
+    lighting.m_specularMultiplier = g_demoState.m_specularMultiplier;
+    lighting.m_shininess = g_demoState.m_specPowerMultiplier;
+    lighting.m_cameraPosition = g_demoState.m_cameraPosition;
+
+    SoftRasterizer::render(g_sponza, viewProjection, lighting, (uint32_t)vpWidth, (uint32_t)vpHeight);
+    SoftRasterizer::present();
+}
+
+void render(int vpWidth, int vpHeight)
+{
+    PROFILE_SCOPE("render");
+    PROFILE_GPU_SCOPE("render");
+    glm::vec3 camPosition = g_demoState.m_cameraPosition;
+    glm::vec3 camDir = glm::normalize(g_demoState.m_cameraDirection);
+    glm::vec3 camUp = glm::normalize(g_demoState.m_cameraUp);
+
+    // Setup matrices
     glm::mat4x4 world(glm::vec4(1, 0, 0, 0),
                         glm::vec4(0, 1, 0, 0),
                         glm::vec4(0, 0, 1, 0),
                         glm::vec4(0, 0, 0, 1));
 
+    const float nearPlane = 1.0f;
+    const float farPlane = 5000.0f;
     glm::mat4x4 view = glm::lookAt(camPosition, camPosition + camDir, camUp);
-    glm::mat4x4 projection = glm::perspectiveFov(g_demoState.m_camFov * degToRad, (float)vpWidth, (float)vpHeight, 1.0f, 5000.0f);
+    glm::mat4x4 projection = glm::perspectiveFov(g_demoState.m_camFov * degToRad, (float)vpWidth, (float)vpHeight, nearPlane, farPlane);
     glm::mat4x4 wvp = projection * view * world;
+    if (g_demoState.m_softwareRasterizer)
+    {
+        renderSoftware(vpWidth, vpHeight, wvp);
+        return;
+    }
+    if (VirtualTexturing::isEnabled())
+    {
+        VirtualTexturing::update();
+        VirtualTexturing::bind();
+    }
+    if (TextureStreaming::isEnabled())
+    {
+        requestStreamedTextures(wvp, camPosition, vpWidth, vpHeight, nearPlane);
+        TextureStreaming::update();
+    }
+    Instancing::cull(wvp);
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "worldViewProjection"), 1, GL_FALSE, &wvp[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "world"), 1, GL_FALSE, &world[0][0]);
-
-    glUseProgram(shaderProgram);
-    
-    for(const std::unique_ptr<ObjLoader::Mesh>& mesh : g_sponza.meshes())
+    if (g_demoState.m_lightType == LightType::Clustered)
     {
-        glBindVertexArray(mesh->m_vao);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh->m_vertexBuffer);
-        for (const std::unique_ptr<ObjLoader::SubMesh>& subMesh : mesh->m_subMeshes)
-        {
-            // Set material
-            ObjLoader::Material* mat = subMesh->m_material;
-            if (mat)
-            {
-                GLuint diffusetTex = mat->m_diffuseTexId ? mat->m_diffuseTexId : g_blackTexture;
-                GLuint displacementTex = mat->m_displacementTexId ? mat->m_displacementTexId : g_flatNormalTexture;
-                GLuint specColorTex = mat->m_specularColorTexId ? mat->m_specularColorTexId : g_whiteTexture;
-                GLuint specPowerTex = mat->m_specularMapTexId ? mat->m_specularMapTexId : g_whiteTexture;
-                GLfloat shiny = std::min(1.0f, mat->m_shininess);
-                glActiveTexture(GL_TEXTURE0 + 0);
-                glBindTexture(GL_TEXTURE_2D, diffusetTex);
-                glUniform1i(glGetUniformLocation(shaderProgram, "diffuseTex"), 0);
-                glActiveTexture(GL_TEXTURE0 + 1);
-                glBindTexture(GL_TEXTURE_2D, displacementTex);
-                glUniform1i(glGetUniformLocation(shaderProgram, "normalTex"), 1);
-                glActiveTexture(GL_TEXTURE0 + 2);
-                glBindTexture(GL_TEXTURE_2D, specColorTex);
-                glUniform1i(glGetUniformLocation(shaderProgram, "specularColorTex"), 2);
-                glActiveTexture(GL_TEXTURE0 + 3);
-                glBindTexture(GL_TEXTURE_2D, specPowerTex);
-                glUniform1i(glGetUniformLocation(shaderProgram, "specularPowerTex"), 3);
-
-                glUniform1f(glGetUniformLocation(shaderProgram, "shininess"), g_demoState.m_specPowerMultiplier);
-            }
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subMesh->m_indexBuffer);
-            glDrawElements(GL_TRIANGLES, (GLsizei)subMesh->m_indices.size(), GL_UNSIGNED_INT, 0);
-        }
-        glBindVertexArray(0);
+        ClusteredLighting::update(g_demoState.m_clusteredLights, view, projection, nearPlane, farPlane, vpWidth, vpHeight);
+        ClusteredLighting::bindBuffers();
     }
+
+    // The shadow passes share the vertex program, so they go before its camera transform is set
+    g_renderShadows = updateShadowMaps(view, (float)vpWidth / (float)std::max(vpHeight, 1), nearPlane, farPlane);
+    g_depthPrepassActive = g_demoState.m_depthPrepass && depthOnlyShadersReady();
+    g_viewportPixels = (uint64_t)vpWidth * vpHeight;
+
+    GLuint vertexProgram = g_demoState.m_vertexPrograms[VertexProgramScene].m_shaderId;
+    setUniform(vertexProgram, "worldViewProjection", wvp);
+    setUniform(vertexProgram, "world", world);
+    uint32_t instanceCount = Instancing::bindVisible();
+    if (VirtualTexturing::isEnabled())
+        renderVirtualTextureFeedback(vpWidth, vpHeight, instanceCount);
+
+    // Falls back to forward rendering until the deferred shaders are built
+    if (g_demoState.m_renderPath == RenderPath::Deferred && renderDeferred(vpWidth, vpHeight, projection * view, instanceCount))
+        return;
+    ShaderType shaderType = currentShaderType();
+    if (g_depthPrepassActive)
+        beginDepthPrepass(instanceCount);
+    collectDrawItems(shaderType);
+    bool countSamples = beginSamplesQuery();
+    drawItems(shaderType, instanceCount);
+    if (countSamples)
+        endSamplesQuery();
+    if (g_depthPrepassActive)
+        endDepthPrepass();
 }
 
-void update(GLFWwindow* window)
+// Derives the camera direction and up vectors from yaw and pitch
+void updateCameraVectors(float yaw, float pitch, glm::vec3& camDir, glm::vec3& camUp)
 {
-    glm::vec3& camPos = g_demoState.m_cameraPosition;
-    glm::vec3& camDir = g_demoState.m_cameraDirection;
-    glm::vec3& camUp = g_demoState.m_cameraUp;
-
-    // Update camera direction
-    float theta = (90.0f - g_demoState.m_pitch) * degToRad;
-    float phi = g_demoState.m_yaw * degToRad;
+    float theta = (90.0f - pitch) * degToRad;
+    float phi = yaw * degToRad;
     float cosPhi = cosf(phi);
     float cosTheta = cosf(theta);
     float sinPhi = sinf(phi);
@@ -469,79 +2170,166 @@ void update(GLFWwindow* window)
 
     glm::vec3 camSide = glm::cross(camDir, glm::vec3(0.0f, 1.0f, 0.0f));
     camUp = glm::cross(camSide, camDir);
-    camSide = glm::cross(camDir, camUp);
-
-    // Update camera pos
-    float realMoveSpeed = g_demoState.m_moveSpeed * (float)g_demoState.m_dt;
+}
 
-    // Update input
+void sampleInput(GLFWwindow* window)
+{
+    UpdateInput input;
+    input.m_timeNs = Profiler::nowNs();
+    glfwGetCursorPos(window, &input.m_mousePosition.x, &input.m_mousePosition.y);
     if (!g_demoState.m_isEditing)
     {
-        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        {
-            camPos += camDir * realMoveSpeed;
-        }
-        else if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        {
-            camPos -= camDir * realMoveSpeed;
-        }
+        input.m_moveForward = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS;
+        input.m_moveBack = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;
+        input.m_moveLeft = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;
+        input.m_moveRight = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+    }
+    input.m_rotate = glfwGetMouseButton(window, 1) == GLFW_PRESS;
+    input.m_moveSpeed = g_demoState.m_moveSpeed;
+    input.m_sensitivity = g_demoState.m_sensitivity;
+    input.m_lightFollowsCamera = g_demoState.m_lightFollowsCamera;
+    input.m_clusteredLights = g_demoState.m_lightType == LightType::Clustered;
+    input.m_clusteredLightCount = g_demoState.m_clusteredLightCount;
+    input.m_clusteredLightRadius = g_demoState.m_clusteredLightRadius;
+    input.m_animateClusteredLights = g_demoState.m_animateClusteredLights;
+
+    std::lock_guard<std::mutex> lock(g_updateInputMutex);
+    g_updateInput = input;
+}
 
-        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        {
-            camPos -= camSide * realMoveSpeed;
-        }
-        else if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        {
-            camPos += camSide * realMoveSpeed;
-        }
+// Moves the camera with the newest input and animates the lights into the snapshot of the frame
+void update(uint64_t frame, uint32_t slot)
+{
+    PROFILE_SCOPE("update");
+    UpdateInput input;
+    {
+        std::lock_guard<std::mutex> lock(g_updateInputMutex);
+        input = g_updateInput;
     }
+    UpdateState& state = g_updateState;
+    FrameSnapshot& snapshot = g_frameSnapshots[slot];
 
-    camDir = glm::normalize(camDir);
+    // Time since the previous update, the frame time once the pipeline is full. The first frame after a start() of
+    // the pipeline doesn't move, the time the pipeline was stopped is not part of the animation.
+    uint64_t now = Profiler::nowNs();
+    double dt = frame > 1 ? (now - state.m_lastUpdateNs) / 1000000000.0 : 0.0;
+    state.m_lastUpdateNs = now;
+    state.m_appTime += dt;
 
-    glm::dvec2 curMouse;
-    glfwGetCursorPos(window, &curMouse.x, &curMouse.y);
-    glm::dvec2 deltaMouse = curMouse - g_inputState.m_lastMousePosition;
-    g_inputState.m_lastMousePosition = curMouse;
+    glm::vec3& camPos = state.m_cameraPosition;
+    glm::vec3 camDir, camUp;
+    updateCameraVectors(state.m_yaw, state.m_pitch, camDir, camUp);
+    glm::vec3 camSide = glm::cross(camDir, camUp);
 
-    if (glfwGetMouseButton(window, 1) == GLFW_PRESS)
+    // Update camera pos
+    float realMoveSpeed = input.m_moveSpeed * (float)dt;
+    if (input.m_moveForward)
+        camPos += camDir * realMoveSpeed;
+    else if (input.m_moveBack)
+        camPos -= camDir * realMoveSpeed;
+    if (input.m_moveLeft)
+        camPos -= camSide * realMoveSpeed;
+    else if (input.m_moveRight)
+        camPos += camSide * realMoveSpeed;
+
+    glm::dvec2 deltaMouse = input.m_mousePosition - state.m_lastMousePosition;
+    state.m_lastMousePosition = input.m_mousePosition;
+    if (input.m_rotate)
     {
-        g_demoState.m_pitch -= (float)deltaMouse.y * g_demoState.m_sensitivity;
-        g_demoState.m_yaw += (float)deltaMouse.x * g_demoState.m_sensitivity;
-        g_demoState.m_pitch = glm::clamp(g_demoState.m_pitch, -89.0f, 89.0f);
+        state.m_pitch -= (float)deltaMouse.y * input.m_sensitivity;
+        state.m_yaw += (float)deltaMouse.x * input.m_sensitivity;
+        state.m_pitch = glm::clamp(state.m_pitch, -89.0f, 89.0f);
     }
 
+    snapshot.m_inputTimeNs = input.m_timeNs;
+    snapshot.m_appTime = state.m_appTime;
+    snapshot.m_dt = dt;
+    snapshot.m_cameraPosition = camPos;
+    snapshot.m_yaw = state.m_yaw;
+    snapshot.m_pitch = state.m_pitch;
+    updateCameraVectors(state.m_yaw, state.m_pitch, snapshot.m_cameraDirection, snapshot.m_cameraUp);
+
     // Update lights
-    if (g_demoState.m_lightFollowsCamera)
+    snapshot.m_overrideLights = input.m_lightFollowsCamera;
+    snapshot.m_lightType = -1;
+    if (input.m_lightFollowsCamera)
     {
-        g_demoState.m_spotLight.m_lightPosition = camPos;
-        g_demoState.m_pointLight.m_lightPosition = camPos;
-
-        g_demoState.m_directionalLight.m_lightDirection = camDir;
-        g_demoState.m_spotLight.m_lightDirection = camDir;
+        snapshot.m_spotLightPosition = camPos;
+        snapshot.m_pointLightPosition = camPos;
+        snapshot.m_directionalLightDirection = snapshot.m_cameraDirection;
+        snapshot.m_spotLightDirection = snapshot.m_cameraDirection;
+    }
+    if (input.m_clusteredLights)
+    {
+        animateClusteredLights(input.m_clusteredLightCount, input.m_clusteredLightRadius,
+            input.m_animateClusteredLights ? state.m_appTime : 0.0);
+        snapshot.m_clusteredLights = state.m_clusteredLights;
+    }
+    else
+    {
+        snapshot.m_clusteredLights.clear();
     }
-
 }
 
 void renderUI()
 {
+    PROFILE_SCOPE("renderUI");
     ImGui::Begin("Shader Demo");
-    // FPS
-    //int fps = (int)(1.0f / g_demoState.m_dt);
-    //ImGui::Text("%d frames/second", fps);
+    // FPS and frame statistics
+    FrameStats::renderUI();
+    MemoryTracker::renderUI();
     // Camera Params
     ImGui::Text("Controls");
     ImGui::SliderFloat("FOV##fov", &g_demoState.m_camFov, 20.0f, 90.0f);
     ImGui::SliderFloat("Move Speed##movespeed", &g_demoState.m_moveSpeed, 100.0f, 1000.0f);
     ImGui::SliderFloat("Sensitivity##sensitivity", &g_demoState.m_sensitivity, 0.1f, 1.0f);
+    ImGui::Checkbox("Show Profiler##showprofiler", &g_demoState.m_showProfiler);
+    ImGui::SliderInt("Pipeline Depth##pipelinedepth", &g_demoState.m_pipelineDepth, 0, (int)FramePipeline::MaxDepth);
+    const FramePipeline::Statistics& pipelineStats = FramePipeline::statistics();
+    ImGui::Text("Input latency: %.2f ms, avg %.2f ms, max %.2f ms", pipelineStats.m_lastLatencyMs, pipelineStats.m_avgLatencyMs,
+        pipelineStats.m_maxLatencyMs);
+    ImGui::Text("Update %.3f ms, render waited %.3f ms, update waited %.3f ms", pipelineStats.m_lastUpdateMs,
+        pipelineStats.m_renderWaitMs, pipelineStats.m_updateWaitMs);
 
     if (ImGui::CollapsingHeader("Lights"))
     {
-        const char* lightTypes[] = { "Unlit", "Ambient", "Directional", "Spot Light", "Point Light" };
+        const char* lightTypes[] = { "Unlit", "Ambient", "Directional", "Spot Light", "Point Light", "Many Lights" };
         ImGui::Combo("Light Type##lighttype", (int*)&g_demoState.m_lightType, lightTypes, IM_ARRAYSIZE(lightTypes));
+        const char* renderPaths[] = { "Forward", "Deferred" };
+        ImGui::Combo("Render Path##renderpath", (int*)&g_demoState.m_renderPath, renderPaths, IM_ARRAYSIZE(renderPaths));
+        if (g_demoState.m_renderPath == RenderPath::Deferred)
+        {
+            int gbufferPixels = DeferredShading::width() * DeferredShading::height();
+            ImGui::Text("G-buffer: %u bytes per pixel, %.1f MB", DeferredShading::bytesPerPixel(), gbufferPixels * DeferredShading::bytesPerPixel() / (1024.0f * 1024.0f));
+        }
+        // It draws from the CPU copy of the vertices
+        if (g_sponza.geometryResidency() == ObjLoader::GeometryResidency::Keep)
+            ImGui::Checkbox("Software Rasterizer##softwarerasterizer", &g_demoState.m_softwareRasterizer);
+        if (g_demoState.m_softwareRasterizer)
+        {
+            const SoftRasterizer::Statistics& softStats = SoftRasterizer::statistics();
+            ImGui::Text("%.2f Mtris/s, %.2f Mpix/s, raster %.3f ms of %.3f ms", softStats.m_mtrisPerSecond, softStats.m_mpixPerSecond,
+                softStats.m_rasterMs, softStats.m_totalMs);
+        }
         ImGui::ColorEdit3("Ambient##ambientColor", &g_demoState.m_ambientColor[0], 0);
         ImGui::SliderFloat("Specular Multiplier##lightSpecMult", &g_demoState.m_specularMultiplier, 0.0f, 2.0f);
         ImGui::SliderFloat("Specular Power Multiplier##lightSpecPowMult", &g_demoState.m_specPowerMultiplier, 1.0f, 256.0f);
         ImGui::Checkbox("Follow Camera", &g_demoState.m_lightFollowsCamera);
+        ImGui::Checkbox("Shadows##shadows", &g_demoState.m_shadows);
+        ImGui::Checkbox("Depth Pre-pass##depthprepass", &g_demoState.m_depthPrepass);
+        if (g_viewportPixels)
+        {
+            uint64_t shadedSamples = FrameStats::lastFrame().m_counters[(int)FrameStats::Counter::ShadedSamples];
+            ImGui::Text("Overdraw: %.2f samples per pixel", (double)shadedSamples / g_viewportPixels);
+        }
+        if (g_renderShadows)
+        {
+            const FrameStats::FrameSample& frame = FrameStats::lastFrame();
+            const ShadowMaps::Statistics& shadowStats = ShadowMaps::statistics();
+            ImGui::Text("Shadow passes: %llu rendered, %llu cached last frame, %.2f ms last update",
+                (unsigned long long)frame.m_counters[(int)FrameStats::Counter::ShadowPasses],
+                (unsigned long long)frame.m_counters[(int)FrameStats::Counter::ShadowPassesSkipped], shadowStats.m_lastRenderMs);
+        }
         if (g_demoState.m_lightType == LightType::Directional)
         {
             ImGui::ColorEdit3("Color##spotcolor", &g_demoState.m_directionalLight.m_lightColor[0], 0);
@@ -566,29 +2354,19 @@ void renderUI()
             ImGui::SliderFloat("Radius##outerradius", &g_demoState.m_pointLight.m_outerRadius, 20.0f, 4000.0f);
             ImGui::SliderFloat3("Position##p3", &g_demoState.m_pointLight.m_lightPosition[0], -1000.0f, 1000.0f);
         }
+        else if (g_demoState.m_lightType == LightType::Clustered)
+        {
+            ImGui::SliderInt("Light Count##clusteredcount", &g_demoState.m_clusteredLightCount, 1, 8192);
+            ImGui::SliderFloat("Light Radius##clusteredradius", &g_demoState.m_clusteredLightRadius, 20.0f, 1000.0f);
+            ImGui::Checkbox("Animate##clusteredanimate", &g_demoState.m_animateClusteredLights);
+            const ClusteredLighting::Statistics& clusterStats = ClusteredLighting::statistics();
+            ImGui::Text("%u clusters, %u light indices, max %u lights per cluster", clusterStats.m_clusters, clusterStats.m_lightIndices, clusterStats.m_maxClusterLights);
+            ImGui::Text("Assignment %.3f ms on %u threads, upload %.3f ms", clusterStats.m_assignMs, clusterStats.m_threads, clusterStats.m_uploadMs);
+        }
 
         // Shaders
         {
-            ShaderType currentShader;
-            switch (g_demoState.m_lightType)
-            {
-            case LightType::Unlit:
-            case LightType::Ambient:
-                currentShader = ShaderType::Ambient;
-                break;
-            case LightType::Directional:
-                currentShader = ShaderType::Directional;
-                break;
-            case LightType::Spot:
-                currentShader = ShaderType::Spot;
-                break;
-            case LightType::Point:
-                currentShader = ShaderType::Point;
-                break;
-            default:
-                currentShader = ShaderType::Ambient;
-            }
-            ShaderState& curShader = g_demoState.m_pixelShaders[(int)currentShader];
+            ShaderState& curShader = g_demoState.m_pixelShader;
 
             ImGui::Text("Shader Code:");
             if (g_codeFont)
@@ -606,18 +2384,14 @@ void renderUI()
             }
             if (ImGui::Button("Save to disk##saveshader"))
             {
-                for (size_t i = 0; i < (size_t)ShaderType::NumShaderTypes; i++)
+                if (curShader.m_shaderFile.length())
                 {
-                    ShaderState& shaderToSave = g_demoState.m_pixelShaders[i];
-                    if (shaderToSave.m_shaderFile.length())
+                    FILE* f = fopen(curShader.m_shaderFile.c_str(), "wb");
+                    if (f)
                     {
-                        FILE* f = fopen(shaderToSave.m_shaderFile.c_str(), "wb");
-                        if (f)
-                        {
-                            int size = (int)strlen((const char*)&shaderToSave.m_shaderCode[0]);
-                            fwrite(&shaderToSave.m_shaderCode[0], 1, size, f);
-                            fclose(f);
-                        }
+                        int size = (int)strlen((const char*)&curShader.m_shaderCode[0]);
+                        fwrite(&curShader.m_shaderCode[0], 1, size, f);
+                        fclose(f);
                     }
                 }
             }
@@ -635,9 +2409,126 @@ void renderUI()
             {
                 g_demoState.m_recompileShaders = true;
             }
+            if (ImGui::Checkbox("Reload on file change##watchshaders", &g_demoState.m_watchShaders))
+            {
+                if (g_demoState.m_watchShaders)
+                    g_shaderWatcher.start("../shaders", &g_demoState.m_shaderErrors);
+                else
+                    g_shaderWatcher.stop();
+            }
+            if (isBuildingShaders())
+            {
+                ImGui::SameLine();
+                ImGui::Text(Util::isParallelShaderCompileEnabled() ? "Compiling (parallel)..." : "Compiling...");
+            }
+            int builtPermutations = 0;
+            int requestedPermutations = 0;
+            for (const StageProgram& permutation : g_demoState.m_pixelPrograms)
+            {
+                builtPermutations += permutation.m_shaderId ? 1 : 0;
+                requestedPermutations += permutation.m_requested ? 1 : 0;
+            }
+            ImGui::Text("Shader permutations: %d built, %d requested", builtPermutations, requestedPermutations);
+            if (ProgramCache::isEnabled())
+            {
+                const ProgramCache::Statistics& cacheStats = ProgramCache::statistics();
+                ImGui::Text("Program cache: %u hits, %u misses (%u rejected), %u stored, %.1f ms saved", cacheStats.m_hits,
+                    cacheStats.m_misses, cacheStats.m_rejected, cacheStats.m_stored, cacheStats.m_savedMs);
+            }
             ImGui::TextWrapped(g_demoState.m_shaderErrors.c_str());
         }
     }
 
+    if (ImGui::CollapsingHeader("Instancing"))
+    {
+        bool changed = ImGui::SliderInt("Columns##instancecolumns", &g_demoState.m_instanceColumns, 1, 64);
+        changed |= ImGui::SliderInt("Rows##instancerows", &g_demoState.m_instanceRows, 1, 64);
+        changed |= ImGui::SliderFloat("Spacing##instancespacing", &g_demoState.m_instanceSpacing, 0.0f, 2000.0f);
+        if (changed)
+        {
+            Instancing::setGrid((uint32_t)g_demoState.m_instanceColumns, (uint32_t)g_demoState.m_instanceRows, g_demoState.m_instanceSpacing);
+            ShadowMaps::setSceneBounds(Instancing::sceneMin(), Instancing::sceneMax());
+        }
+        const Instancing::Statistics& instanceStats = Instancing::statistics();
+        uint64_t triangles = FrameStats::lastFrame().m_counters[(int)FrameStats::Counter::Triangles];
+        ImGui::Text("%u copies, %u visible, culled in %.3f ms", instanceStats.m_instances, instanceStats.m_visibleInstances, instanceStats.m_cullMs);
+        ImGui::Text("%.2f M triangles submitted last frame", triangles / 1000000.0);
+        const RingBuffer::Statistics& ringStats = RingBuffer::statistics();
+        ImGui::Text("Ring buffer: %.2f MB last frame, %.2f MB peak of %.1f MB", ringStats.m_lastFrameBytes / 1048576.0,
+            ringStats.m_peakFrameBytes / 1048576.0, ringStats.m_capacity / 1048576.0);
+        ImGui::Text("%llu waits for %.3f ms, grown %u times", (unsigned long long)ringStats.m_waits, ringStats.m_waitMs, ringStats.m_grows);
+        const DrawCommands::Statistics& commandStats = DrawCommands::statistics();
+        ImGui::Text("Draw commands: %u lists, %llu commands on %u threads", commandStats.m_lists,
+            (unsigned long long)commandStats.m_commands, commandStats.m_threads);
+        ImGui::Text("Record %.3f ms, replay %.3f ms", commandStats.m_recordMs, commandStats.m_replayMs);
+        ImGui::Checkbox("Validate Commands##validatecommands", &g_demoState.m_validateCommands);
+        if (commandStats.m_invalidLists)
+        {
+            ImGui::Text("%llu invalid lists skipped", (unsigned long long)commandStats.m_invalidLists);
+            ImGui::TextWrapped("%s", g_demoState.m_commandError.c_str());
+        }
+    }
+
+    if (VirtualTexturing::isEnabled() && ImGui::CollapsingHeader("Virtual Texturing"))
+    {
+        const VirtualTexturing::Statistics& vtStats = VirtualTexturing::statistics();
+        ImGui::SliderInt("Budget MB##vtbudget", &g_demoState.m_virtualTextureBudgetMB, 8, 1024);
+        ImGui::SameLine();
+        if (ImGui::Button("Apply##vtbudgetapply"))
+            VirtualTexturing::setBudget((uint64_t)g_demoState.m_virtualTextureBudgetMB * 1024 * 1024);
+        ImGui::Text("%u textures, %u of %u pages resident (%.1f MB), %u pinned", vtStats.m_textures, vtStats.m_residentPages,
+            vtStats.m_capacityPages, vtStats.m_capacityBytes / 1048576.0, vtStats.m_pinnedPages);
+        ImGui::Text("Last feedback: %u tiles, %u page faults, hit rate %.1f%%", vtStats.m_requestedTiles, vtStats.m_pageFaults,
+            vtStats.m_hitRate * 100.0);
+        ImGui::Text("%u loads pending on %u threads, %u uploads, %u evictions, update %.3f ms", vtStats.m_pendingLoads,
+            vtStats.m_loaderThreads, vtStats.m_uploads, vtStats.m_evictions, vtStats.m_updateMs);
+        ImGui::Text("Total: %llu page faults, %llu uploads, %llu evictions, %.1f MB read", (unsigned long long)vtStats.m_totalPageFaults,
+            (unsigned long long)vtStats.m_totalUploads, (unsigned long long)vtStats.m_totalEvictions, vtStats.m_bytesRead / 1048576.0);
+    }
+
+    if (TextureStreaming::isEnabled() && ImGui::CollapsingHeader("Texture Streaming"))
+    {
+        const TextureStreaming::Statistics& streamStats = TextureStreaming::statistics();
+        ImGui::SliderInt("Budget MB##streambudget", &g_demoState.m_textureBudgetMB, 8, 1024);
+        ImGui::SameLine();
+        if (ImGui::Button("Apply##streambudgetapply"))
+            TextureStreaming::setBudget((uint64_t)g_demoState.m_textureBudgetMB * 1024 * 1024);
+        ImGui::Text("%u textures, %.1f MB allocated, %.1f MB uploaded, %.1f MB at full resolution", streamStats.m_textures,
+            streamStats.m_allocatedBytes / 1048576.0, streamStats.m_residentBytes / 1048576.0, streamStats.m_fullBytes / 1048576.0);
+        ImGui::Text("%u of %u requested textures at their level", streamStats.m_satisfiedTextures, streamStats.m_requestedTextures);
+        ImGui::Text("%u loads pending on %u threads, %u uploads, %u evictions, update %.3f ms", streamStats.m_pendingLoads,
+            streamStats.m_loaderThreads, streamStats.m_uploads, streamStats.m_evictions, streamStats.m_updateMs);
+        ImGui::Text("Total: %llu uploads, %llu evictions, %.1f MB uploaded", (unsigned long long)streamStats.m_totalUploads,
+            (unsigned long long)streamStats.m_totalEvictions, streamStats.m_bytesUploaded / 1048576.0);
+    }
+
+    if (ImGui::CollapsingHeader("Benchmark"))
+    {
+        static char pathFile[256] = "camera_path.txt";
+        static std::string pathStatus;
+        ImGui::InputText("Camera Path##camerapathfile", pathFile, sizeof(pathFile));
+        if (!g_demoState.m_recordingPath)
+        {
+            if (ImGui::Button("Record Camera Path##recordpath"))
+            {
+                g_cameraPath.clear();
+                g_demoState.m_recordStartTime = g_demoState.m_appTime;
+                g_demoState.m_recordingPath = true;
+                pathStatus = "";
+            }
+        }
+        else if (ImGui::Button("Stop Recording##stoprecordpath"))
+        {
+            g_demoState.m_recordingPath = false;
+            if (g_cameraPath.save(pathFile, &pathStatus))
+                pathStatus = "Saved " + std::string(pathFile);
+        }
+        ImGui::Text("%d keys, %.2f seconds", (int)g_cameraPath.keyCount(), g_cameraPath.duration());
+        ImGui::TextWrapped("%s", pathStatus.c_str());
+    }
+
     ImGui::End();
+
+    if (g_demoState.m_showProfiler)
+        Profiler::renderUI(&g_demoState.m_showProfiler);
 }
@@ -0,0 +1,392 @@
+#include "memorytracker.h"
+#include <stdio.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include "imgui.h"
+
+using namespace MemoryTracker;
+
+namespace
+{
+    const char* s_categoryNames[] =
+    {
+        "vertex_buffers",
+        "index_buffers",
+        "material_textures",
+        "fallback_textures",
+        "streamed_textures",
+        "virtual_textures",
+        "shadow_maps",
+        "render_targets",
+        "dynamic_buffers",
+        "cpu_geometry"
+    };
+    static_assert(sizeof(s_categoryNames) / sizeof(s_categoryNames[0]) == (size_t)Category::NumCategories, "Missing category names");
+
+    const char* s_resourceNames[] = { "buffer", "texture", "renderbuffer", "host" };
+
+    std::mutex s_mutex;
+    std::unordered_map<uint64_t, Entry> s_entries;
+    Totals s_totals;
+    uint64_t s_budget = 0;
+    bool s_warned = false;
+
+    uint64_t entryKey(Resource resource, uint64_t name)
+    {
+        return ((uint64_t)resource << 56) | (name & 0x00FFFFFFFFFFFFFFull);
+    }
+
+    uint32_t bytesPerTexel(GLenum format)
+    {
+        switch (format)
+        {
+        case GL_R8:
+            return 1;
+        case GL_RG8:
+            return 2;
+        case GL_RGBA16F:
+            return 8;
+        case GL_RGBA32F:
+        case GL_RGBA32UI:
+            return 16;
+        default:
+            // RGBA8, 32 bit depth and single channel 32 bit formats, 24 bit depth is padded to 32 bits
+            return 4;
+        }
+    }
+
+    bool isGpu(Category category)
+    {
+        return category != Category::CpuGeometry;
+    }
+
+    void removeEntry(uint64_t key)
+    {
+        std::unordered_map<uint64_t, Entry>::iterator entry = s_entries.find(key);
+        if (entry == s_entries.end())
+            return;
+        int category = (int)entry->second.m_category;
+        s_totals.m_bytes[category] -= entry->second.m_bytes;
+        s_totals.m_counts[category]--;
+        if (isGpu(entry->second.m_category))
+            s_totals.m_gpuBytes -= entry->second.m_bytes;
+        else
+            s_totals.m_cpuBytes -= entry->second.m_bytes;
+        s_entries.erase(entry);
+        if (s_totals.m_gpuBytes <= s_budget)
+            s_warned = false;
+    }
+
+    void addEntry(uint64_t key, const Entry& entry)
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        removeEntry(key);
+        s_entries[key] = entry;
+        int category = (int)entry.m_category;
+        s_totals.m_bytes[category] += entry.m_bytes;
+        s_totals.m_counts[category]++;
+        if (!isGpu(entry.m_category))
+        {
+            s_totals.m_cpuBytes += entry.m_bytes;
+            return;
+        }
+        s_totals.m_gpuBytes += entry.m_bytes;
+        s_totals.m_peakGpuBytes = std::max(s_totals.m_peakGpuBytes, s_totals.m_gpuBytes);
+        if (s_budget && s_totals.m_gpuBytes > s_budget && !s_warned)
+        {
+            fprintf(stderr, "Memory: GPU resources take %.1f MB, over the budget of %.1f MB (%s %s added %.1f MB)\n",
+                s_totals.m_gpuBytes / 1048576.0, s_budget / 1048576.0, s_categoryNames[category], entry.m_owner.c_str(),
+                entry.m_bytes / 1048576.0);
+            s_warned = true;
+        }
+    }
+
+    void untrack(Resource resource, uint64_t name)
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        removeEntry(entryKey(resource, name));
+    }
+
+    void escapeJson(const std::string& str, std::string& out)
+    {
+        out.clear();
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            out += c;
+        }
+    }
+}
+
+const char* MemoryTracker::categoryName(Category category)
+{
+    return s_categoryNames[(int)category];
+}
+
+const char* MemoryTracker::formatName(GLenum format)
+{
+    switch (format)
+    {
+    case 0: return "";
+    case GL_RGBA: return "RGBA";
+    case GL_RGBA8: return "RGBA8";
+    case GL_RGBA16F: return "RGBA16F";
+    case GL_RGBA32F: return "RGBA32F";
+    case GL_RGBA32UI: return "RGBA32UI";
+    case GL_R8: return "R8";
+    case GL_RG8: return "RG8";
+    case GL_DEPTH_COMPONENT24: return "DEPTH24";
+    case GL_DEPTH_COMPONENT32F: return "DEPTH32F";
+    default: return "other";
+    }
+}
+
+uint64_t MemoryTracker::textureBytes(GLenum format, uint32_t width, uint32_t height, uint32_t layers, uint32_t levels)
+{
+    uint64_t texels = 0;
+    for (uint32_t level = 0; level < levels; level++)
+        texels += (uint64_t)std::max(1u, width >> level) * std::max(1u, height >> level);
+    return texels * layers * bytesPerTexel(format);
+}
+
+void MemoryTracker::trackBuffer(GLuint buffer, Category category, const std::string& owner, uint64_t bytes)
+{
+    Entry entry;
+    entry.m_resource = Resource::Buffer;
+    entry.m_name = buffer;
+    entry.m_category = category;
+    entry.m_owner = owner;
+    entry.m_bytes = bytes;
+    addEntry(entryKey(Resource::Buffer, buffer), entry);
+}
+
+void MemoryTracker::trackTexture(GLuint texture, Category category, const std::string& owner, GLenum format,
+    uint32_t width, uint32_t height, uint32_t layers, uint32_t levels)
+{
+    Entry entry;
+    entry.m_resource = Resource::Texture;
+    entry.m_name = texture;
+    entry.m_category = category;
+    entry.m_owner = owner;
+    entry.m_bytes = textureBytes(format, width, height, layers, levels);
+    entry.m_format = format;
+    entry.m_width = width;
+    entry.m_height = height;
+    entry.m_layers = layers;
+    entry.m_levels = levels;
+    addEntry(entryKey(Resource::Texture, texture), entry);
+}
+
+void MemoryTracker::trackRenderbuffer(GLuint renderbuffer, Category category, const std::string& owner, GLenum format,
+    uint32_t width, uint32_t height)
+{
+    Entry entry;
+    entry.m_resource = Resource::Renderbuffer;
+    entry.m_name = renderbuffer;
+    entry.m_category = category;
+    entry.m_owner = owner;
+    entry.m_bytes = textureBytes(format, width, height, 1, 1);
+    entry.m_format = format;
+    entry.m_width = width;
+    entry.m_height = height;
+    addEntry(entryKey(Resource::Renderbuffer, renderbuffer), entry);
+}
+
+void MemoryTracker::trackHost(const void* memory, Category category, const std::string& owner, uint64_t bytes)
+{
+    Entry entry;
+    entry.m_resource = Resource::Host;
+    entry.m_category = category;
+    entry.m_owner = owner;
+    entry.m_bytes = bytes;
+    addEntry(entryKey(Resource::Host, (uint64_t)(uintptr_t)memory), entry);
+}
+
+void MemoryTracker::untrackBuffer(GLuint buffer)
+{
+    untrack(Resource::Buffer, buffer);
+}
+
+void MemoryTracker::untrackTexture(GLuint texture)
+{
+    untrack(Resource::Texture, texture);
+}
+
+void MemoryTracker::untrackRenderbuffer(GLuint renderbuffer)
+{
+    untrack(Resource::Renderbuffer, renderbuffer);
+}
+
+void MemoryTracker::untrackHost(const void* memory)
+{
+    untrack(Resource::Host, (uint64_t)(uintptr_t)memory);
+}
+
+void MemoryTracker::setBudget(uint64_t budgetBytes)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_budget = budgetBytes;
+    s_warned = false;
+}
+
+uint64_t MemoryTracker::budget()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_budget;
+}
+
+bool MemoryTracker::isOverBudget()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_budget && s_totals.m_gpuBytes > s_budget;
+}
+
+Totals MemoryTracker::totals()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_totals;
+}
+
+std::vector<Entry> MemoryTracker::entries()
+{
+    std::vector<Entry> sorted;
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        sorted.reserve(s_entries.size());
+        for (const std::pair<const uint64_t, Entry>& entry : s_entries)
+            sorted.push_back(entry.second);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Entry& a, const Entry& b)
+    {
+        if (a.m_bytes != b.m_bytes)
+            return a.m_bytes > b.m_bytes;
+        if (a.m_resource != b.m_resource)
+            return a.m_resource < b.m_resource;
+        return a.m_name < b.m_name;
+    });
+    return sorted;
+}
+
+bool MemoryTracker::writeJson(const char* filename, std::string* errString)
+{
+    FILE* f = fopen(filename, "w");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot write ") + filename;
+        return false;
+    }
+    Totals sums = totals();
+    uint64_t budgetBytes = budget();
+    fprintf(f, "{\n  \"gpu_bytes\": %llu,\n  \"cpu_bytes\": %llu,\n  \"peak_gpu_bytes\": %llu,\n  \"budget_bytes\": %llu,\n  \"over_budget\": %s,\n",
+        (unsigned long long)sums.m_gpuBytes, (unsigned long long)sums.m_cpuBytes, (unsigned long long)sums.m_peakGpuBytes,
+        (unsigned long long)budgetBytes, budgetBytes && sums.m_gpuBytes > budgetBytes ? "true" : "false");
+    fprintf(f, "  \"categories\": [\n");
+    for (int i = 0; i < (int)Category::NumCategories; i++)
+    {
+        fprintf(f, "    {\"name\": \"%s\", \"count\": %u, \"bytes\": %llu}%s\n", s_categoryNames[i], sums.m_counts[i],
+            (unsigned long long)sums.m_bytes[i], i + 1 < (int)Category::NumCategories ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"resources\": [\n");
+    std::vector<Entry> sorted = entries();
+    std::string owner;
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        const Entry& entry = sorted[i];
+        escapeJson(entry.m_owner, owner);
+        fprintf(f, "    {\"resource\": \"%s\", \"name\": %u, \"category\": \"%s\", \"owner\": \"%s\", \"bytes\": %llu, \"format\": \"%s\", "
+            "\"width\": %u, \"height\": %u, \"layers\": %u, \"levels\": %u}%s\n", s_resourceNames[(int)entry.m_resource],
+            entry.m_name, s_categoryNames[(int)entry.m_category], owner.c_str(), (unsigned long long)entry.m_bytes,
+            formatName(entry.m_format), entry.m_width, entry.m_height, entry.m_layers, entry.m_levels,
+            i + 1 < sorted.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    bool success = !ferror(f);
+    success = fclose(f) == 0 && success;
+    if (!success && errString)
+        *errString = std::string("Cannot write ") + filename;
+    return success;
+}
+
+void MemoryTracker::renderUI()
+{
+    static char jsonFile[256] = "memory.json";
+    static std::string jsonStatus;
+    // Largest resources listed
+    const size_t MaxListed = 64;
+
+    if (!ImGui::CollapsingHeader("Memory"))
+        return;
+
+    Totals sums = totals();
+    int budgetMB = (int)(budget() / (1024 * 1024));
+    ImGui::Text("GPU %.1f MB (peak %.1f MB), CPU %.1f MB", sums.m_gpuBytes / 1048576.0, sums.m_peakGpuBytes / 1048576.0,
+        sums.m_cpuBytes / 1048576.0);
+    if (ImGui::SliderInt("Budget MB##memorybudget", &budgetMB, 0, 4096))
+        setBudget((uint64_t)budgetMB * 1024 * 1024);
+    if (isOverBudget())
+        ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "GPU resources exceed the budget by %.1f MB",
+            (sums.m_gpuBytes - budget()) / 1048576.0);
+
+    if (ImGui::BeginTable("##memorycategories", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("Category");
+        ImGui::TableSetupColumn("Count");
+        ImGui::TableSetupColumn("MB");
+        ImGui::TableHeadersRow();
+        for (int i = 0; i < (int)Category::NumCategories; i++)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(s_categoryNames[i]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", sums.m_counts[i]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", sums.m_bytes[i] / 1048576.0);
+        }
+        ImGui::EndTable();
+    }
+
+    if (ImGui::TreeNode("Largest Resources##memoryresources"))
+    {
+        std::vector<Entry> sorted = entries();
+        if (ImGui::BeginTable("##memoryentries", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+        {
+            ImGui::TableSetupColumn("Owner");
+            ImGui::TableSetupColumn("Category");
+            ImGui::TableSetupColumn("Format");
+            ImGui::TableSetupColumn("MB");
+            ImGui::TableHeadersRow();
+            for (size_t i = 0; i < std::min(sorted.size(), MaxListed); i++)
+            {
+                const Entry& entry = sorted[i];
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(entry.m_owner.c_str());
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(s_categoryNames[(int)entry.m_category]);
+                ImGui::TableNextColumn();
+                if (entry.m_format)
+                    ImGui::Text("%s %ux%u x%u, %u levels", formatName(entry.m_format), entry.m_width, entry.m_height, entry.m_layers, entry.m_levels);
+                else
+                    ImGui::TextUnformatted(s_resourceNames[(int)entry.m_resource]);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", entry.m_bytes / 1048576.0);
+            }
+            ImGui::EndTable();
+        }
+        ImGui::TreePop();
+    }
+
+    ImGui::InputText("JSON File##memoryjsonfile", jsonFile, sizeof(jsonFile));
+    ImGui::SameLine();
+    if (ImGui::Button("Write##memorywritejson"))
+    {
+        std::string errString;
+        jsonStatus = writeJson(jsonFile, &errString) ? std::string("Written to ") + jsonFile : errString;
+    }
+    if (jsonStatus.length())
+        ImGui::TextUnformatted(jsonStatus.c_str());
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include "GL/glew.h"
+
+// Accounting of the memory held by rendering resources. Every GL buffer, texture and renderbuffer is registered by the
+// code that allocates it, with its size, format, mip levels, owner (mesh, material or module) and category, and
+// unregistered when it is deleted; registering the same object again replaces its entry. CPU copies kept for
+// rendering are registered by their address. The sizes are computed from the formats, drivers may pad and align them.
+// When the GPU total exceeds the budget a warning is printed once, until it drops below the budget again.
+namespace MemoryTracker
+{
+    enum class Category : int
+    {
+        VertexBuffers,
+        IndexBuffers,
+        MaterialTextures,
+        FallbackTextures,
+        StreamedTextures,
+        VirtualTextures,
+        ShadowMaps,
+        RenderTargets,
+        DynamicBuffers,
+        // Vertex and index copies in RAM
+        CpuGeometry,
+        NumCategories // Always at the last position
+    };
+
+    enum class Resource : int
+    {
+        Buffer,
+        Texture,
+        Renderbuffer,
+        Host
+    };
+
+    struct Entry
+    {
+        Resource m_resource = Resource::Buffer;
+        // GL name, 0 for host memory
+        GLuint m_name = 0;
+        Category m_category = Category::VertexBuffers;
+        std::string m_owner;
+        uint64_t m_bytes = 0;
+        // Internal format of textures and renderbuffers, 0 for buffers
+        GLenum m_format = 0;
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        // Array layers or cube faces
+        uint32_t m_layers = 1;
+        uint32_t m_levels = 1;
+    };
+
+    struct Totals
+    {
+        uint64_t m_bytes[(int)Category::NumCategories] = {};
+        uint32_t m_counts[(int)Category::NumCategories] = {};
+        uint64_t m_gpuBytes = 0;
+        uint64_t m_cpuBytes = 0;
+        uint64_t m_peakGpuBytes = 0;
+    };
+
+    const char* categoryName(Category category);
+    const char* formatName(GLenum format);
+    // Size of a texture with the given format, levels from width x height down, layers each
+    uint64_t textureBytes(GLenum format, uint32_t width, uint32_t height, uint32_t layers, uint32_t levels);
+
+    void trackBuffer(GLuint buffer, Category category, const std::string& owner, uint64_t bytes);
+    void trackTexture(GLuint texture, Category category, const std::string& owner, GLenum format, uint32_t width,
+        uint32_t height, uint32_t layers, uint32_t levels);
+    void trackRenderbuffer(GLuint renderbuffer, Category category, const std::string& owner, GLenum format,
+        uint32_t width, uint32_t height);
+    void trackHost(const void* memory, Category category, const std::string& owner, uint64_t bytes);
+    // Names that aren't tracked are ignored, so these can go next to every delete
+    void untrackBuffer(GLuint buffer);
+    void untrackTexture(GLuint texture);
+    void untrackRenderbuffer(GLuint renderbuffer);
+    void untrackHost(const void* memory);
+
+    // GPU bytes, 0 disables the warning
+    void setBudget(uint64_t budgetBytes);
+    uint64_t budget();
+    bool isOverBudget();
+
+    Totals totals();
+    // Largest first
+    std::vector<Entry> entries();
+    // Totals per category and every entry, largest first
+    bool writeJson(const char* filename, std::string* errString);
+
+    // Draws the memory breakdown section, meant to be called inside an existing ImGui window
+    void renderUI();
+}
@@ -3,9 +3,19 @@
 #include <sstream>
 #include <string.h>
 #include <stdarg.h>
-#include <unordered_map>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <memory>
 #include "memorystream.h"
 #include "util.h"
+#include "profiler.h"
+#include "framestats.h"
+#include "jobsystem.h"
+#include "pngdecoder.h"
+#include "virtualtexturing.h"
+#include "texturestreaming.h"
+#include "memorytracker.h"
 #include "png.h"
 using namespace ObjLoader;
 using namespace Util;
@@ -23,87 +33,425 @@ static void error(ObjectFile::fnErrFunc errFunc, int id, const char* msg, ...)
     }
 }
 
-// Only for png files!
-GLuint loadTexture(const char* file)
+namespace
+{
+    const char* s_loadStageNames[] = {
+        "file_read",
+        "count",
+        "tokenize",
+        "parse_numbers",
+        "vertex_dedup",
+        "tangents",
+        "material_parse",
+        "png_decode"
+    };
+    static_assert(sizeof(s_loadStageNames) / sizeof(s_loadStageNames[0]) == (size_t)LoadStage::NumStages, "Missing stage name");
+
+    const char* s_geometryResidencyNames[] = {
+        "keep",
+        "compact",
+        "release"
+    };
+    static_assert(sizeof(s_geometryResidencyNames) / sizeof(s_geometryResidencyNames[0]) == (size_t)GeometryResidency::NumResidencies,
+        "Missing residency name");
+
+    // Adds the lifetime of the scope to a load stage, does nothing when stats is null
+    class StageTimer
+    {
+    public:
+        StageTimer(LoadStatistics* stats, LoadStage stage) : m_stats(stats), m_stage(stage)
+        {
+            if (m_stats)
+                m_start = Profiler::nowNs();
+        }
+        ~StageTimer()
+        {
+            if (m_stats)
+                m_stats->m_stageNs[(int)m_stage] += Profiler::nowNs() - m_start;
+        }
+    private:
+        LoadStatistics* m_stats;
+        LoadStage m_stage;
+        uint64_t m_start = 0;
+    };
+}
+
+const char* ObjLoader::loadStageName(LoadStage stage)
+{
+    return s_loadStageNames[(int)stage];
+}
+
+const char* ObjLoader::geometryResidencyName(GeometryResidency residency)
+{
+    return s_geometryResidencyNames[(int)residency];
+}
+
+uint32_t ObjLoader::packTangent(const glm::vec3& tangent, float handedness)
+{
+    auto component = [](float value) -> uint32_t
+    {
+        return (uint32_t)(int)roundf(std::min(std::max(value, -1.0f), 1.0f) * 511.0f) & 0x3ff;
+    };
+    return component(tangent.x) | (component(tangent.y) << 10) | (component(tangent.z) << 20) | ((handedness < 0.0f ? 3u : 1u) << 30);
+}
+
+glm::vec4 ObjLoader::unpackTangent(uint32_t packed)
+{
+    // Sign extends the fields, -512 clamps to -1 like in GL
+    auto component = [](int32_t value, int bits) -> float
+    {
+        int32_t max = (1 << (bits - 1)) - 1;
+        return std::max((float)value / (float)max, -1.0f);
+    };
+    return glm::vec4(component((int32_t)(packed << 22) >> 22, 10), component((int32_t)(packed << 12) >> 22, 10),
+        component((int32_t)(packed << 2) >> 22, 10), component((int32_t)packed >> 30, 2));
+}
+
+bool ObjLoader::loadPngImage(const char* file, Image& image)
+{
+    std::vector<char> buffer;
+    if (Util::loadFileToBuffer(file, buffer) && buffer.size() &&
+        PngDecoder::decode((const uint8_t*)buffer.data(), buffer.size(), image.m_width, image.m_height, image.m_pixels, nullptr))
+        return true;
+    // Interlaced or damaged files, libpng decodes or rejects them
+    return loadPngImageLibpng(file, image);
+}
+
+bool ObjLoader::loadPngImageLibpng(const char* file, Image& image)
 {
     FILE* f = fopen(file, "rb");
-    if (f)
+    if (!f)
+        return false;
+
+    png_byte header[8];
+    if (fread(header, 1, 8, f) != 8 || png_sig_cmp(header, 0, 8))
+    {
+        fclose(f);
+        return false;
+    }
+    png_struct* ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!ptr)
+    {
+        fclose(f);
+        return false;
+    }
+    png_info* info = png_create_info_struct(ptr);
+    if (!info)
+    {
+        png_destroy_read_struct(&ptr, nullptr, nullptr);
+        fclose(f);
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(ptr)))
     {
-        png_byte header[8];
-        fread(header, 1, 8, f);
-        if (png_sig_cmp(header, 0, 8))
-            return 0;
-        png_struct* ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-        if (!ptr)
-            return 0;
-        png_info* info = png_create_info_struct(ptr);
-        if (!info)
-            return 0;
-
-        if (setjmp(png_jmpbuf(ptr)))
-            return 0;
-        png_init_io(ptr, f);
-        png_set_sig_bytes(ptr, 8);
-        png_read_info(ptr, info);
-        png_uint_32 width = png_get_image_width(ptr, info);
-        png_uint_32 height = png_get_image_height(ptr, info);
-        png_uint_32 colorType = png_get_color_type(ptr, info);
-        png_uint_32 bitDepth = png_get_bit_depth(ptr, info);
-
-        if (bitDepth == 16)
-            png_set_strip_16(ptr);
-
-        if (colorType == PNG_COLOR_TYPE_PALETTE)
-            png_set_palette_to_rgb(ptr);
-        if (colorType == PNG_COLOR_TYPE_GRAY && bitDepth < 8)
-            png_set_expand_gray_1_2_4_to_8(ptr);
-        if (colorType == PNG_COLOR_TYPE_RGB ||
-            colorType == PNG_COLOR_TYPE_GRAY ||
-            colorType == PNG_COLOR_TYPE_PALETTE)
-            png_set_filler(ptr, 0xFF, PNG_FILLER_AFTER);
-        
-        if (colorType == PNG_COLOR_TYPE_GRAY ||
-            colorType == PNG_COLOR_TYPE_GRAY_ALPHA)
-            png_set_gray_to_rgb(ptr);
-
-        if (png_get_valid(ptr, info, PNG_INFO_tRNS))
-            png_set_tRNS_to_alpha(ptr);
-
-        png_read_update_info(ptr, info);
-
-        
-        size_t rowSize = png_get_rowbytes(ptr, info);
-        std::vector<png_byte> buffer;
-        buffer.resize(rowSize * height);
-        for (png_uint_32 y = 0; y < height; y++)
-            png_read_row(ptr, &buffer[0] + rowSize * y, nullptr);
-        //png_destroy_info_struct(ptr, &info);
         png_destroy_read_struct(&ptr, &info, nullptr);
-        GLuint texId;
-        glGenTextures(1, &texId);
-        glBindTexture(GL_TEXTURE_2D, texId);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &buffer[0]);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, 16.0f);
-        return texId;
-    }
-    return 0;
+        fclose(f);
+        return false;
+    }
+    png_init_io(ptr, f);
+    png_set_sig_bytes(ptr, 8);
+    png_read_info(ptr, info);
+    png_uint_32 width = png_get_image_width(ptr, info);
+    png_uint_32 height = png_get_image_height(ptr, info);
+    png_uint_32 colorType = png_get_color_type(ptr, info);
+    png_uint_32 bitDepth = png_get_bit_depth(ptr, info);
+
+    if (bitDepth == 16)
+        png_set_strip_16(ptr);
+
+    if (colorType == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(ptr);
+    if (colorType == PNG_COLOR_TYPE_GRAY && bitDepth < 8)
+        png_set_expand_gray_1_2_4_to_8(ptr);
+    if (colorType == PNG_COLOR_TYPE_RGB ||
+        colorType == PNG_COLOR_TYPE_GRAY ||
+        colorType == PNG_COLOR_TYPE_PALETTE)
+        png_set_filler(ptr, 0xFF, PNG_FILLER_AFTER);
+
+    if (colorType == PNG_COLOR_TYPE_GRAY ||
+        colorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(ptr);
+
+    if (png_get_valid(ptr, info, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(ptr);
+
+    // Adam7 images are read once per pass, libpng merges every pass into the rows read so far
+    int passes = png_set_interlace_handling(ptr);
+    png_read_update_info(ptr, info);
+
+    size_t rowSize = png_get_rowbytes(ptr, info);
+    image.m_width = width;
+    image.m_height = height;
+    image.m_pixels.resize(rowSize * height);
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (png_uint_32 y = 0; y < height; y++)
+            png_read_row(ptr, &image.m_pixels[0] + rowSize * y, nullptr);
+    }
+    png_destroy_read_struct(&ptr, &info, nullptr);
+    fclose(f);
+    return true;
+}
+
+// Only for png files! Runs on the job threads.
+static bool decodeTexture(const char* file, Image& image, LoadStatistics* stats, bool* hasAlpha)
+{
+    PROFILE_SCOPE("decodeTexture");
+    {
+        StageTimer timer(stats, LoadStage::PngDecode);
+        if (!loadPngImage(file, image))
+            return false;
+    }
+    if (stats)
+    {
+        stats->m_textures++;
+        stats->m_texturePixels += (uint64_t)image.m_width * image.m_height;
+    }
+    if (hasAlpha)
+    {
+        *hasAlpha = false;
+        for (size_t i = 3; i < image.m_pixels.size(); i += 4)
+        {
+            if (image.m_pixels[i] != 0xFF)
+            {
+                *hasAlpha = true;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+static GLuint uploadTexture(const Image& image, const std::string& owner)
+{
+    PROFILE_SCOPE("uploadTexture");
+    GLuint texId;
+    glGenTextures(1, &texId);
+    glBindTexture(GL_TEXTURE_2D, texId);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.m_width, image.m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &image.m_pixels[0]);
+    FrameStats::add(FrameStats::Counter::TextureBytes, image.m_pixels.size());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    uint32_t levels = 1;
+    while ((std::max(image.m_width, image.m_height) >> levels) != 0)
+        levels++;
+    MemoryTracker::trackTexture(texId, MemoryTracker::Category::MaterialTextures, owner, GL_RGBA8, image.m_width,
+        image.m_height, 1, levels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, 16.0f);
+    return texId;
 }
 
+namespace
+{
+    // A texture decoded by a job and uploaded on the GL thread
+    struct TextureLoad
+    {
+        std::string m_file;
+        // Material name and map, for the memory accounting
+        std::string m_owner;
+        GLuint* m_texId = nullptr;
+        bool* m_hasAlpha = nullptr;
+        Image m_image;
+        bool m_decoded = false;
+        LoadStatistics m_statistics;
+        JobSystem::Counter m_done;
+    };
+
+    // Objects parsed by one job and the first error it ran into
+    struct ObjectChunk
+    {
+        std::vector<Mesh*> m_meshes;
+        Pool<Mesh> m_meshPool;
+        Pool<SubMesh> m_subMeshPool;
+        LoadStatistics m_statistics;
+        bool m_parsed = false;
+        int m_errorId = 0;
+        std::string m_error;
+    };
+
+    // Objects are grouped into chunks of at least this size, so every job has some work to do
+    const size_t MinChunkBytes = 256 * 1024;
+
+    void addStatistics(LoadStatistics& to, const LoadStatistics& from)
+    {
+        for (int i = 0; i < (int)LoadStage::NumStages; i++)
+            to.m_stageNs[i] += from.m_stageNs[i];
+        to.m_bytes += from.m_bytes;
+        to.m_lines += from.m_lines;
+        to.m_faces += from.m_faces;
+        to.m_vertices += from.m_vertices;
+        to.m_textures += from.m_textures;
+        to.m_texturePixels += from.m_texturePixels;
+    }
+
+    glm::vec3 normalizeOrZero(const glm::vec3& v)
+    {
+        float length = glm::length(v);
+        return length > 0.0f ? v / length : glm::vec3(0.0f);
+    }
+
+    glm::vec3 projectToPlane(const glm::vec3& v, const glm::vec3& normal)
+    {
+        return v - normal * glm::dot(normal, v);
+    }
+
+    // Tangent contributions of the corners of a submesh's triangles, as MikkTSpace computes them: the uv aligned
+    // tangent of the face, projected into the plane of the corner's normal and weighted by the corner angle. w is the
+    // weight, negative where the uv mapping is mirrored. Faces without uv area contribute nothing.
+    void cornerTangents(const Mesh& mesh, const SubMesh& subMesh, glm::vec4* corners)
+    {
+        const std::vector<unsigned int>& indices = subMesh.m_indices;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            const MeshVertex* v[3] = { &mesh.m_vertices[indices[i]], &mesh.m_vertices[indices[i + 1]], &mesh.m_vertices[indices[i + 2]] };
+            glm::vec3 edge1 = glm::vec3(v[1]->m_position - v[0]->m_position);
+            glm::vec3 edge2 = glm::vec3(v[2]->m_position - v[0]->m_position);
+            glm::vec2 uvEdge1 = v[1]->m_texCoord - v[0]->m_texCoord;
+            glm::vec2 uvEdge2 = v[2]->m_texCoord - v[0]->m_texCoord;
+            float signedArea = uvEdge1.x * uvEdge2.y - uvEdge1.y * uvEdge2.x;
+            if (fabsf(signedArea) <= FLT_MIN)
+                continue;
+            float orientation = signedArea > 0.0f ? 1.0f : -1.0f;
+            glm::vec3 faceTangent = (edge1 * uvEdge2.y - edge2 * uvEdge1.y) * orientation;
+            for (int corner = 0; corner < 3; corner++)
+            {
+                glm::vec3 position = glm::vec3(v[corner]->m_position);
+                glm::vec3 normal = normalizeOrZero(v[corner]->m_normal);
+                glm::vec3 toNext = normalizeOrZero(projectToPlane(glm::vec3(v[(corner + 1) % 3]->m_position) - position, normal));
+                glm::vec3 toPrev = normalizeOrZero(projectToPlane(glm::vec3(v[(corner + 2) % 3]->m_position) - position, normal));
+                float angle = acosf(std::min(std::max(glm::dot(toNext, toPrev), -1.0f), 1.0f));
+                corners[i + corner] = glm::vec4(normalizeOrZero(projectToPlane(faceTangent, normal)) * angle, angle * orientation);
+            }
+        }
+    }
+
+    // Tangents of the vertices of normal-mapped submeshes. The corners are computed in parallel across the submeshes
+    // and summed per vertex in parallel across the meshes, whose submeshes share vertices. Unlike MikkTSpace, vertices
+    // whose faces disagree on the handedness aren't split, the handedness of the larger angle wins.
+    void generateTangents(const std::vector<Mesh*>& meshes)
+    {
+        PROFILE_SCOPE("generateTangents");
+        std::vector<const SubMesh*> subMeshes;
+        std::vector<const Mesh*> subMeshOwners;
+        std::vector<size_t> cornerOffsets(1, 0);
+        // Range of subMeshes of every mesh
+        std::vector<size_t> meshSubMeshes(1, 0);
+        for (const Mesh* mesh : meshes)
+        {
+            for (const SubMesh* subMesh : mesh->m_subMeshes)
+            {
+                if (subMesh->m_material && subMesh->m_material->m_bumpMap.length())
+                {
+                    subMeshes.push_back(subMesh);
+                    subMeshOwners.push_back(mesh);
+                    cornerOffsets.push_back(cornerOffsets.back() + subMesh->m_indices.size());
+                }
+            }
+            meshSubMeshes.push_back(subMeshes.size());
+        }
+        if (subMeshes.empty())
+            return;
 
-#define CANNOT_OPEN(file) { error(m_errorCallback, 1, "Cannot open file: '%s'", (file)); return false; }
-#define CHECK_MESHGROUP_WITHOUT_MESH() if (currentMesh == nullptr) { error(m_errorCallback, 2, "Trying to create a meshgroup without an active mesh"); return false; }
-#define CHECK_VERTS_WITHOUT_MESH() if (currentMesh == nullptr) { error(m_errorCallback, 3, "Trying to define vertices without an active mesh"); return false; }
-#define CHECK_MAT_WITHOUT_MESHGROUP() if (currentMesh == nullptr) { error(m_errorCallback, 4, "Trying to use material outside of mesh group"); return false; }
-#define CHECK_FACES_WITHOUT_MESHGROUP() if (currentMesh == nullptr) { error(m_errorCallback, 5, "Trying to define face outside of mesh group"); return false; }
-#define UNKNOWN_FACE() { error(m_errorCallback, 10, "Unknown face format"); return false; }
-#define UNKNOWN_MATERIAL(matName) { error(m_errorCallback, 11, "Unknown material: '%s'", (matName)); return false; }
-#define MAT_EXISTS(matName) { error(m_errorCallback, 12, "Duplicate Material: '%s'", (matName)); return false; }
-#define CHECK_MATDEF_WITHOUT_MAT() if (currentMaterial == nullptr) { error(m_errorCallback, 20, "Trying define material without an active material"); return false; }
+        std::vector<glm::vec4> corners(cornerOffsets.back(), glm::vec4(0.0f));
+        JobSystem::parallelFor("Corner tangents", (uint32_t)subMeshes.size(), 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; i++)
+                cornerTangents(*subMeshOwners[i], *subMeshes[i], &corners[cornerOffsets[i]]);
+        });
+        JobSystem::parallelFor("Vertex tangents", (uint32_t)meshes.size(), 1, [&](uint32_t begin, uint32_t end)
+        {
+            std::vector<glm::vec4> sums;
+            for (uint32_t m = begin; m < end; m++)
+            {
+                if (meshSubMeshes[m] == meshSubMeshes[m + 1])
+                    continue;
+                Mesh& mesh = *meshes[m];
+                sums.assign(mesh.m_vertices.size(), glm::vec4(0.0f));
+                for (size_t i = meshSubMeshes[m]; i < meshSubMeshes[m + 1]; i++)
+                {
+                    const std::vector<unsigned int>& indices = subMeshes[i]->m_indices;
+                    const glm::vec4* subMeshCorners = &corners[cornerOffsets[i]];
+                    for (size_t c = 0; c < indices.size(); c++)
+                        sums[indices[c]] += subMeshCorners[c];
+                }
+                // Vertices without a contribution get any tangent in the plane of their normal
+                for (size_t i = 0; i < sums.size(); i++)
+                {
+                    MeshVertex& vertex = mesh.m_vertices[i];
+                    glm::vec3 tangent = normalizeOrZero(glm::vec3(sums[i]));
+                    if (tangent == glm::vec3(0.0f))
+                    {
+                        glm::vec3 normal = normalizeOrZero(vertex.m_normal);
+                        glm::vec3 axis = fabsf(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+                        tangent = normalizeOrZero(projectToPlane(axis, normal));
+                    }
+                    vertex.m_tangent = packTangent(tangent, sums[i].w < 0.0f ? -1.0f : 1.0f);
+                }
+            }
+        });
+    }
+
+    // Longest line TextReader returns with its default size
+    const size_t MaxLineLength = 512;
+
+    // A line split in place, the same tokens split() returns without allocating them. Only the first MaxTokens are
+    // kept, no OBJ or MTL statement the loader reads has more.
+    struct LineTokens
+    {
+        static const size_t MaxTokens = 5;
+        char m_line[MaxLineLength + 1];
+        const char* m_tokens[MaxTokens];
+        size_t m_count = 0;
+
+        void split(const char* line, size_t length)
+        {
+            length = std::min(length, MaxLineLength);
+            memcpy(m_line, line, length);
+            m_line[length] = 0;
+            m_count = tokenize(m_line, ' ', m_tokens, MaxTokens);
+        }
+        void split(const char* line)
+        {
+            split(line, strlen(line));
+        }
+        size_t size() const { return m_count; }
+        const char* operator[](size_t index) const { return m_tokens[index]; }
+        bool is(const char* keyword) const { return m_count && !strcmp(m_tokens[0], keyword); }
+    };
+
+    // Starts a chunk of the OBJ file: "o name", split like the parser does
+    bool isObjectLine(const char* line, const char* end)
+    {
+        if (end - line < 2 || line[0] != 'o' || line[1] != ' ')
+            return false;
+        LineTokens tokens;
+        tokens.split(line, end - line);
+        return tokens.size() == 2 && tokens.is("o");
+    }
+
+    // Sizes of an object's temporaries found by the counting pass of parseObjects()
+    struct ObjectCounts
+    {
+        size_t m_positions = 0;
+        size_t m_texCoords = 0;
+        size_t m_normals = 0;
+    };
+}
+
+#define CANNOT_OPEN(file) { error(errorCallback, 1, "Cannot open file: '%s'", (file)); return false; }
+#define CHECK_MESHGROUP_WITHOUT_MESH() if (currentMesh == nullptr) { error(errorCallback, 2, "Trying to create a meshgroup without an active mesh"); return false; }
+#define CHECK_VERTS_WITHOUT_MESH() if (currentMesh == nullptr) { error(errorCallback, 3, "Trying to define vertices without an active mesh"); return false; }
+#define CHECK_MAT_WITHOUT_MESHGROUP() if (currentSubMesh == nullptr) { error(errorCallback, 4, "Trying to use material outside of mesh group"); return false; }
+#define CHECK_FACES_WITHOUT_MESHGROUP() if (currentSubMesh == nullptr) { error(errorCallback, 5, "Trying to define face outside of mesh group"); return false; }
+#define UNKNOWN_FACE() { error(errorCallback, 10, "Unknown face format"); return false; }
+#define UNKNOWN_MATERIAL(matName) { error(errorCallback, 11, "Unknown material: '%s'", (matName)); return false; }
+#define MAT_EXISTS(matName) { error(errorCallback, 12, "Duplicate Material: '%s'", (matName)); return false; }
+#define INVALID_FACE_INDEX(face) { error(errorCallback, 13, "Face index out of range: '%s'", (face)); return false; }
+#define CHECK_MATDEF_WITHOUT_MAT() if (currentMaterial == nullptr) { error(errorCallback, 20, "Trying define material without an active material"); return false; }
 
 struct VertexID
 {
@@ -115,7 +463,7 @@ struct VertexID
 
     bool operator==(const VertexID& other) const
     {
-        return pidx == other.pidx && tidx == other.tidx && nidx == other.tidx;
+        return pidx == other.pidx && tidx == other.tidx && nidx == other.nidx;
     }
 };
 
@@ -126,74 +474,351 @@ namespace std
     {
         size_t operator()(const VertexID& k) const
         {
-            return ((size_t)k.pidx << 31 | (size_t)k.tidx) ^ ((size_t)k.nidx << 16);
+            // Missing indices are -1, so the parts must be mixed as unsigned values or they saturate the hash
+            return ((size_t)(uint32_t)k.pidx * 73856093u) ^ ((size_t)(uint32_t)k.tidx * 19349663u) ^ ((size_t)(uint32_t)k.nidx * 83492791u);
         }
     };
 }
 
-ObjectFile::ObjectFile(const char* dataPath) : m_dataPath(dataPath)
+namespace
 {
+    // Open addressing table from face vertices to mesh vertex indices, kept in the arena of the object's temporaries
+    class VertexMap
+    {
+    public:
+        explicit VertexMap(Arena& arena) : m_arena(arena) {}
+
+        // Empties the table, call it after the arena is reset
+        void reset(size_t expectedCount)
+        {
+            size_t capacity = 64;
+            while (capacity < expectedCount * 2)
+                capacity *= 2;
+            allocate(capacity);
+        }
 
+        // Returns the index stored for id, or inserts index and returns it
+        unsigned int findOrInsert(const VertexID& id, unsigned int index)
+        {
+            Entry* entry = find(id);
+            if (entry->m_id.pidx >= 0)
+                return entry->m_index;
+            entry->m_id = id;
+            entry->m_index = index;
+            // At most half full
+            if (++m_count * 2 > m_capacity)
+                grow();
+            return index;
+        }
+    private:
+        // Resolved position indices are never negative, so a negative one marks a free entry
+        struct Entry
+        {
+            VertexID m_id;
+            unsigned int m_index;
+        };
+
+        void allocate(size_t capacity)
+        {
+            m_entries = m_arena.allocateArray<Entry>(capacity);
+            m_capacity = capacity;
+            m_count = 0;
+            for (size_t i = 0; i < capacity; i++)
+                m_entries[i].m_id = VertexID();
+        }
+
+        Entry* find(const VertexID& id)
+        {
+            size_t mask = m_capacity - 1;
+            for (size_t i = std::hash<VertexID>()(id) & mask;; i = (i + 1) & mask)
+            {
+                Entry& entry = m_entries[i];
+                if (entry.m_id.pidx < 0 || entry.m_id == id)
+                    return &entry;
+            }
+        }
+
+        void grow()
+        {
+            Entry* entries = m_entries;
+            size_t capacity = m_capacity;
+            allocate(capacity * 2);
+            for (size_t i = 0; i < capacity; i++)
+            {
+                if (entries[i].m_id.pidx >= 0)
+                {
+                    *find(entries[i].m_id) = entries[i];
+                    m_count++;
+                }
+            }
+        }
+
+        Arena& m_arena;
+        Entry* m_entries = nullptr;
+        size_t m_capacity = 0;
+        size_t m_count = 0;
+    };
 }
 
-void ObjectFile::setErrorCallback(fnErrFunc func)
+ObjectFile::ObjectFile(const char* dataPath) : m_dataPath(dataPath)
 {
-    m_errorCallback = func;
+
 }
 
-bool ObjectFile::loadTextureFile(const char* filename, GLuint& outId)
+void ObjectFile::setErrorCallback(fnErrFunc func)
 {
-    if (strlen(filename) > 0)
-    {
-        std::string texFile = combinePath(m_dataPath.c_str(), filename);
-        outId = loadTexture(texFile.c_str());
-        return true;
-    }
-    return false;
+    m_errorCallback = func;
 }
 
 bool ObjectFile::initGraphics()
 {
-    // Load material textures
-    for(auto& iter : m_materialLibrary)
-    {
-        Material& material = *iter.second;
-        loadTextureFile(material.m_diffuseMap.c_str(), material.m_diffuseTexId);
-        loadTextureFile(material.m_specularColorMap.c_str(), material.m_specularColorTexId);
-        loadTextureFile(material.m_specularMap.c_str(), material.m_specularMapTexId);
-        loadTextureFile(material.m_ambientMap.c_str(), material.m_ambientTexId);
-        loadTextureFile(material.m_displacementMap.c_str(), material.m_displacementTexId);
-        loadTextureFile(material.m_bumpMap.c_str(), material.m_bumpTexId);
-    }
+    PROFILE_SCOPE("ObjectFile::initGraphics");
+    if (m_virtualTextures)
+        addVirtualTextures();
+    else if (m_streamTextures)
+        addStreamedTextures();
+    else
+        loadTextures();
 
     // Initialize Vertex and Index Buffers
-    for(std::unique_ptr<Mesh>& mesh : m_meshes)
+    for(Mesh* mesh : m_meshes)
     {
         glGenVertexArrays(1, &mesh->m_vao);
         glBindVertexArray(mesh->m_vao);
         glGenBuffers(1, &mesh->m_vertexBuffer);
         glBindBuffer(GL_ARRAY_BUFFER, mesh->m_vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, mesh->m_vertices.size() * sizeof(MeshVertex), &mesh->m_vertices[0], GL_STATIC_DRAW);
+        mesh->m_vertexCount = (uint32_t)mesh->m_vertices.size();
+        glBufferData(GL_ARRAY_BUFFER, mesh->m_vertexCount * sizeof(MeshVertex), &mesh->m_vertices[0], GL_STATIC_DRAW);
+        FrameStats::add(FrameStats::Counter::BufferBytes, mesh->m_vertexCount * sizeof(MeshVertex));
+        MemoryTracker::trackBuffer(mesh->m_vertexBuffer, MemoryTracker::Category::VertexBuffers, mesh->m_name,
+            mesh->m_vertexCount * sizeof(MeshVertex));
         setVertexDescriptor();
         glBindVertexArray(0);
-        for (std::unique_ptr<SubMesh>& subMesh : mesh->m_subMeshes)
+        for (SubMesh* subMesh : mesh->m_subMeshes)
         {
             glGenBuffers(1, &subMesh->m_indexBuffer);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subMesh->m_indexBuffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, subMesh->m_indices.size() * sizeof(unsigned int), &subMesh->m_indices[0], GL_STATIC_DRAW);
+            subMesh->m_indexCount = (uint32_t)subMesh->m_indices.size();
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, subMesh->m_indexCount * sizeof(unsigned int), &subMesh->m_indices[0], GL_STATIC_DRAW);
+            FrameStats::add(FrameStats::Counter::BufferBytes, subMesh->m_indexCount * sizeof(unsigned int));
+            MemoryTracker::trackBuffer(subMesh->m_indexBuffer, MemoryTracker::Category::IndexBuffers,
+                mesh->m_name + " " + subMesh->m_name, subMesh->m_indexCount * sizeof(unsigned int));
         }
     }
+    applyGeometryResidency();
     return true;
 }
 
+// The vertex arrays are reserved for the value counts of their object and grow past them, so the kept copies are
+// shrunk to their size; the dropped ones are swapped out, clear() wouldn't free them
+void ObjectFile::applyGeometryResidency()
+{
+    for (Mesh* mesh : m_meshes)
+    {
+        if (m_geometryResidency == GeometryResidency::Compact)
+        {
+            mesh->m_positions.resize(mesh->m_vertices.size());
+            for (size_t i = 0; i < mesh->m_vertices.size(); i++)
+                mesh->m_positions[i] = glm::vec3(mesh->m_vertices[i].m_position);
+        }
+        if (m_geometryResidency == GeometryResidency::Keep)
+            mesh->m_vertices.shrink_to_fit();
+        else
+            std::vector<MeshVertex>().swap(mesh->m_vertices);
+        if (m_geometryResidency == GeometryResidency::Keep)
+        {
+            MemoryTracker::trackHost(&mesh->m_vertices, MemoryTracker::Category::CpuGeometry, mesh->m_name,
+                mesh->m_vertices.capacity() * sizeof(MeshVertex));
+        }
+        else if (m_geometryResidency == GeometryResidency::Compact)
+        {
+            MemoryTracker::trackHost(&mesh->m_positions, MemoryTracker::Category::CpuGeometry, mesh->m_name,
+                mesh->m_positions.capacity() * sizeof(glm::vec3));
+        }
+
+        for (SubMesh* subMesh : mesh->m_subMeshes)
+        {
+            if (m_geometryResidency == GeometryResidency::Release)
+            {
+                std::vector<unsigned int>().swap(subMesh->m_indices);
+                continue;
+            }
+            subMesh->m_indices.shrink_to_fit();
+            MemoryTracker::trackHost(&subMesh->m_indices, MemoryTracker::Category::CpuGeometry,
+                mesh->m_name + " " + subMesh->m_name, subMesh->m_indices.capacity() * sizeof(unsigned int));
+        }
+    }
+}
+
+uint64_t ObjectFile::cpuGeometryBytes() const
+{
+    uint64_t bytes = 0;
+    for (const Mesh* mesh : m_meshes)
+    {
+        bytes += mesh->m_vertices.capacity() * sizeof(MeshVertex) + mesh->m_positions.capacity() * sizeof(glm::vec3);
+        for (const SubMesh* subMesh : mesh->m_subMeshes)
+            bytes += subMesh->m_indices.capacity() * sizeof(unsigned int);
+    }
+    return bytes;
+}
+
+// Material textures are decoded as jobs and uploaded in order as they finish. Only a few decodes per thread run ahead
+// of the uploads, so the decoded images of the whole library are never held at once.
+void ObjectFile::loadTextures()
+{
+    std::vector<std::unique_ptr<TextureLoad>> loads;
+    auto addLoad = [&](const Material& material, const std::string& filename, GLuint& texId, bool* hasAlpha)
+    {
+        if (filename.empty())
+            return;
+        std::unique_ptr<TextureLoad> load = std::make_unique<TextureLoad>();
+        load->m_owner = material.m_name + " " + filename;
+        // Material libraries exported on Windows use backslashes, which only Windows accepts
+        load->m_file = combinePath(m_dataPath.c_str(), filename.c_str());
+        std::replace(load->m_file.begin(), load->m_file.end(), '\\', '/');
+        load->m_texId = &texId;
+        load->m_hasAlpha = hasAlpha;
+        loads.push_back(std::move(load));
+    };
+    for(auto& iter : m_materialLibrary)
+    {
+        Material& material = *iter.second;
+        addLoad(material, material.m_diffuseMap, material.m_diffuseTexId, &material.m_diffuseHasAlpha);
+        addLoad(material, material.m_specularColorMap, material.m_specularColorTexId, nullptr);
+        addLoad(material, material.m_specularMap, material.m_specularMapTexId, nullptr);
+        addLoad(material, material.m_ambientMap, material.m_ambientTexId, nullptr);
+        addLoad(material, material.m_displacementMap, material.m_displacementTexId, nullptr);
+        addLoad(material, material.m_bumpMap, material.m_bumpTexId, nullptr);
+    }
+
+    bool collect = m_collectStatistics;
+    auto startDecode = [collect](TextureLoad* load)
+    {
+        JobSystem::run("Decode texture", [load, collect]
+        {
+            load->m_decoded = decodeTexture(load->m_file.c_str(), load->m_image, collect ? &load->m_statistics : nullptr, load->m_hasAlpha);
+        }, &load->m_done);
+    };
+    size_t window = (size_t)JobSystem::threadCount() * 2;
+    for (size_t i = 0; i < std::min(window, loads.size()); i++)
+        startDecode(loads[i].get());
+    for (size_t i = 0; i < loads.size(); i++)
+    {
+        TextureLoad& load = *loads[i];
+        JobSystem::wait(load.m_done);
+        if (i + window < loads.size())
+            startDecode(loads[i + window].get());
+        *load.m_texId = load.m_decoded ? uploadTexture(load.m_image, load.m_owner) : 0;
+        load.m_image = Image();
+        if (collect)
+            addStatistics(m_statistics, load.m_statistics);
+    }
+}
+
+// The paged files are built as jobs, registering them with the page tables needs the GL thread
+void ObjectFile::addVirtualTextures()
+{
+    struct VirtualLoad
+    {
+        std::string m_file;
+        uint32_t* m_id;
+        bool* m_hasAlpha;
+    };
+    std::vector<VirtualLoad> loads;
+    std::vector<std::string> files;
+    auto addLoad = [&](const std::string& filename, uint32_t& id, bool* hasAlpha)
+    {
+        if (filename.empty())
+            return;
+        VirtualLoad load = { combinePath(m_dataPath.c_str(), filename.c_str()), &id, hasAlpha };
+        std::replace(load.m_file.begin(), load.m_file.end(), '\\', '/');
+        if (std::find(files.begin(), files.end(), load.m_file) == files.end())
+            files.push_back(load.m_file);
+        loads.push_back(load);
+    };
+    for (auto& iter : m_materialLibrary)
+    {
+        Material& material = *iter.second;
+        addLoad(material.m_diffuseMap, material.m_diffuseVirtualId, &material.m_diffuseHasAlpha);
+        addLoad(material.m_specularColorMap, material.m_specularColorVirtualId, nullptr);
+        addLoad(material.m_specularMap, material.m_specularMapVirtualId, nullptr);
+        addLoad(material.m_bumpMap, material.m_bumpVirtualId, nullptr);
+    }
+
+    // Every file once, preparing the same paged file on two threads would race
+    JobSystem::parallelFor("Prepare paged textures", (uint32_t)files.size(), 1, [&files](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+            VirtualTexturing::preparePagedFile(files[i].c_str(), nullptr);
+    });
+    for (const VirtualLoad& load : loads)
+    {
+        std::string errString;
+        *load.m_id = VirtualTexturing::addTexture(load.m_file.c_str(), load.m_hasAlpha, &errString);
+        if (!*load.m_id)
+            error(m_errorCallback, 30, "Cannot load virtual texture: %s", errString.c_str());
+    }
+}
+
+// Like the virtual textures: the tail files are built as jobs, creating the textures needs the GL thread
+void ObjectFile::addStreamedTextures()
+{
+    struct StreamedLoad
+    {
+        std::string m_file;
+        GLuint* m_texId;
+        bool* m_hasAlpha;
+    };
+    std::vector<StreamedLoad> loads;
+    std::vector<std::string> files;
+    auto addLoad = [&](const std::string& filename, GLuint& texId, bool* hasAlpha)
+    {
+        if (filename.empty())
+            return;
+        StreamedLoad load = { combinePath(m_dataPath.c_str(), filename.c_str()), &texId, hasAlpha };
+        std::replace(load.m_file.begin(), load.m_file.end(), '\\', '/');
+        if (std::find(files.begin(), files.end(), load.m_file) == files.end())
+            files.push_back(load.m_file);
+        loads.push_back(load);
+    };
+    for (auto& iter : m_materialLibrary)
+    {
+        Material& material = *iter.second;
+        addLoad(material.m_diffuseMap, material.m_diffuseTexId, &material.m_diffuseHasAlpha);
+        addLoad(material.m_specularColorMap, material.m_specularColorTexId, nullptr);
+        addLoad(material.m_specularMap, material.m_specularMapTexId, nullptr);
+        addLoad(material.m_ambientMap, material.m_ambientTexId, nullptr);
+        addLoad(material.m_displacementMap, material.m_displacementTexId, nullptr);
+        addLoad(material.m_bumpMap, material.m_bumpTexId, nullptr);
+    }
+
+    // Every file once, preparing the same tail file on two threads would race
+    JobSystem::parallelFor("Prepare texture tails", (uint32_t)files.size(), 1, [&files](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+            TextureStreaming::prepareTailFile(files[i].c_str(), nullptr);
+    });
+    for (const StreamedLoad& load : loads)
+    {
+        std::string errString;
+        if (!TextureStreaming::addTexture(load.m_file.c_str(), load.m_texId, load.m_hasAlpha, &errString))
+            error(m_errorCallback, 31, "Cannot load streamed texture: %s", errString.c_str());
+    }
+}
+
 bool ObjectFile::destroyGraphics()
 {
-    for (std::unique_ptr<Mesh>& mesh : m_meshes)
+    for (Mesh* mesh : m_meshes)
     {
+        MemoryTracker::untrackBuffer(mesh->m_vertexBuffer);
+        MemoryTracker::untrackHost(&mesh->m_vertices);
+        MemoryTracker::untrackHost(&mesh->m_positions);
         glDeleteBuffers(1, &mesh->m_vertexBuffer);
         glDeleteVertexArrays(1, &mesh->m_vao);
-        for (std::unique_ptr<SubMesh>& subMesh : mesh->m_subMeshes)
+        for (SubMesh* subMesh : mesh->m_subMeshes)
         {
+            MemoryTracker::untrackBuffer(subMesh->m_indexBuffer);
+            MemoryTracker::untrackHost(&subMesh->m_indices);
             glDeleteBuffers(1, &subMesh->m_indexBuffer);
         }
     }
@@ -201,6 +826,9 @@ bool ObjectFile::destroyGraphics()
     for (auto& iter : m_materialLibrary)
     {
         Material& material = *iter.second;
+        for (GLuint texId : { material.m_diffuseTexId, material.m_specularColorTexId, material.m_specularMapTexId,
+            material.m_ambientTexId, material.m_displacementTexId, material.m_bumpTexId })
+            MemoryTracker::untrackTexture(texId);
         glDeleteTextures(1, &material.m_diffuseTexId);
         glDeleteTextures(1, &material.m_specularColorTexId);
         glDeleteTextures(1, &material.m_specularMapTexId);
@@ -217,255 +845,414 @@ void ObjectFile::setVertexDescriptor()
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, MeshVertex::m_position));
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, MeshVertex::m_normal));
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, MeshVertex::m_texCoord));
+    glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, MeshVertex::m_tangent));
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+}
+
+// Parses the p, p/t, p//n and p/t/n face vertex formats. Missing indices are returned as 0.
+static bool parseFaceVertex(const char* token, int& pidx, int& tidx, int& nidx)
+{
+    char* end;
+    pidx = (int)strtol(token, &end, 10);
+    tidx = 0;
+    nidx = 0;
+    if (end == token)
+        return false;
+    if (*end == '/')
+    {
+        token = end + 1;
+        if (*token != '/')
+            tidx = (int)strtol(token, &end, 10);
+        else
+            end = (char*)token;
+        if (*end == '/')
+            nidx = (int)strtol(end + 1, &end, 10);
+    }
+    return *end == 0;
+}
+
+// Converts a 1 based (or negative, relative) OBJ index into an index into the current mesh's array.
+// Indices restart at every object, like the positions, texcoords and normals they refer to.
+static int resolveIndex(int idx, size_t count)
+{
+    if (idx < 0)
+        return (int)count + idx;
+    return idx - 1;
 }
 
 bool ObjectFile::loadFile(const char* filename)
 {
+    PROFILE_SCOPE("ObjectFile::loadFile");
+    const fnErrFunc& errorCallback = m_errorCallback;
+    LoadStatistics* stats = m_collectStatistics ? &m_statistics : nullptr;
     std::string filePath = combinePath(m_dataPath.c_str(), filename);
     FILE* f = fopen(filePath.c_str(), "rb");
     if (f)
     {
         std::vector<char> fileBuffer;
-        readToBuffer(f, fileBuffer);
-
-        MemoryStream ms(&fileBuffer[0], fileBuffer.size());
-        TextReader<MemoryStream> reader(ms);
-
-        Mesh* currentMesh = nullptr;
-        SubMesh* currentSubMesh = nullptr;
-        std::vector<std::string> parts;
-        std::vector<std::string> sparts;
-        std::unordered_map<VertexID, size_t> vertexMap;
+        {
+            StageTimer timer(stats, LoadStage::FileRead);
+            readToBuffer(f, fileBuffer);
+            fclose(f);
+        }
+        if (stats)
+            stats->m_bytes += fileBuffer.size();
+        if (fileBuffer.empty())
+            return true;
 
-        while (const char* line = reader.readLine())
+        // Indices restart at every object, so runs of objects are parsed as independent jobs. The material libraries
+        // are loaded up front, the jobs only look materials up.
+        const char* data = &fileBuffer[0];
+        const char* dataEnd = data + fileBuffer.size();
+        std::vector<size_t> chunkStarts(1, 0);
+        for (const char* line = data; line < dataEnd; )
         {
-            if (line[0] == '#')
-                continue;
-            parts.clear();
-            split(line, ' ', parts);
-            if (parts.size() == 2)
+            // Line ends like TextReader::readLine()
+            const char* lineEnd = line;
+            while (lineEnd < dataEnd && *lineEnd != '\n' && *lineEnd != '\r')
+                lineEnd++;
+            if (!strncmp(line, "mtllib ", std::min<size_t>(7, lineEnd - line)) && lineEnd - line > 7)
             {
-                if (parts[0] == "mtllib")
+                LineTokens tokens;
+                tokens.split(line, lineEnd - line);
+                if (tokens.size() == 2 && tokens.is("mtllib"))
                 {
-                    if (!loadMaterialLibrary(parts[1].c_str()))
+                    StageTimer timer(stats, LoadStage::MaterialParse);
+                    if (!loadMaterialLibrary(tokens[1]))
                         return false;
                 }
-                else if (parts[0] == "o")
-                {
-                    m_meshes.push_back(std::make_unique<Mesh>(parts[1].c_str()));
-                    if (currentMesh)
-                    {
-                        currentMesh->m_positions.resize(0);
-                        currentMesh->m_texCoords.resize(0);
-                        currentMesh->m_normals.resize(0);
-                    }
-                    currentMesh = m_meshes.back().get();
-                    currentSubMesh = nullptr;
-                    vertexMap.clear();
-                }
-                else if (parts[0] == "g")
-                {
-                    CHECK_MESHGROUP_WITHOUT_MESH();
-                    currentMesh->m_subMeshes.push_back(std::make_unique<SubMesh>(parts[1].c_str()));
-                    currentSubMesh = currentMesh->m_subMeshes.back().get();
-                }
-                else if (parts[0] == "usemtl")
+            }
+            else if ((size_t)(line - data) >= chunkStarts.back() + MinChunkBytes && isObjectLine(line, lineEnd))
+            {
+                chunkStarts.push_back(line - data);
+            }
+            line = lineEnd + (lineEnd + 1 < dataEnd && lineEnd[0] == '\r' && lineEnd[1] == '\n' ? 2 : 1);
+        }
+
+        std::vector<ObjectChunk> chunks(chunkStarts.size());
+        JobSystem::parallelFor("Parse objects", (uint32_t)chunks.size(), 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                ObjectChunk& chunk = chunks[i];
+                size_t chunkEnd = i + 1 < chunkStarts.size() ? chunkStarts[i + 1] : fileBuffer.size();
+                fnErrFunc chunkError = [&chunk](int id, const char* message)
                 {
-                    CHECK_MAT_WITHOUT_MESHGROUP();
-                    auto mtlIter = m_materialLibrary.find(parts[1]);
-                    if (mtlIter == m_materialLibrary.end())
+                    if (chunk.m_error.empty())
                     {
-                        UNKNOWN_MATERIAL(parts[1].c_str());
+                        chunk.m_errorId = id;
+                        chunk.m_error = message;
                     }
+                };
+                chunk.m_parsed = parseObjects(data + chunkStarts[i], chunkEnd - chunkStarts[i], chunk.m_meshes,
+                    chunk.m_meshPool, chunk.m_subMeshPool, stats ? &chunk.m_statistics : nullptr, chunkError);
+            }
+        });
 
-                    currentSubMesh->m_material = mtlIter->second.get();
-                }
+        // In file order, so a failed chunk keeps the meshes before its error like a sequential parse would
+        for (ObjectChunk& chunk : chunks)
+        {
+            m_meshes.insert(m_meshes.end(), chunk.m_meshes.begin(), chunk.m_meshes.end());
+            m_meshPool.splice(chunk.m_meshPool);
+            m_subMeshPool.splice(chunk.m_subMeshPool);
+            if (stats)
+                addStatistics(*stats, chunk.m_statistics);
+            if (!chunk.m_parsed)
+            {
+                error(errorCallback, chunk.m_errorId, "%s", chunk.m_error.c_str());
+                return false;
+            }
+        }
+        {
+            StageTimer timer(stats, LoadStage::Tangents);
+            generateTangents(m_meshes);
+        }
+        if (stats)
+        {
+            for (const Mesh* mesh : m_meshes)
+                stats->m_vertices += mesh->m_vertices.size();
+        }
+    }
+    else
+    {
+        CANNOT_OPEN(filename);
+    }
+    return true;
+}
+
+// Parses lines of the OBJ file that start at an object, or the beginning of the file, into meshes
+bool ObjectFile::parseObjects(const char* data, size_t length, std::vector<Mesh*>& meshes, Pool<Mesh>& meshPool,
+    Pool<SubMesh>& subMeshPool, LoadStatistics* stats, const fnErrFunc& errorCallback) const
+{
+    LineTokens parts;
+
+    // Counts the values of every object and the indices of every group first, so the temporaries and the index
+    // arrays are allocated once at their final size. Lines are split like in the parsing pass.
+    std::vector<ObjectCounts> objectCounts;
+    std::vector<size_t> groupIndexCounts;
+    {
+        StageTimer timer(stats, LoadStage::Count);
+        MemoryStream ms(data, length);
+        TextReader<MemoryStream> reader(ms);
+        bool inGroup = false;
+        while (const char* line = reader.readLine())
+        {
+            if (line[0] == '#')
+                continue;
+            parts.split(line);
+            if (parts.size() == 2 && parts.is("o"))
+            {
+                objectCounts.push_back(ObjectCounts());
+                inGroup = false;
             }
-            else if (parts.size() == 3)
+            else if (objectCounts.empty())
             {
-                if (parts[0] == "vt")
-                {
-                    CHECK_VERTS_WITHOUT_MESH();
-                    glm::vec2 uv;
-                    uv[0] = (float)atof(parts[1].c_str());
-                    uv[1] = 1.0f - (float)atof(parts[2].c_str());
-                    currentMesh->m_texCoords.push_back(uv);
-                }
+                continue;
             }
-            else if (parts.size() == 4)
+            else if (parts.size() == 2 && parts.is("g"))
             {
-                if (parts[0] == "v")
-                {
-                    CHECK_VERTS_WITHOUT_MESH();
-                    glm::vec4 vec;
-                    vec[0] = (float)atof(parts[1].c_str());
-                    vec[1] = (float)atof(parts[2].c_str());
-                    vec[2] = (float)atof(parts[3].c_str());
-                    vec[3] = 1.0f;
-                    currentMesh->m_positions.push_back(vec);
-                }
-                else if (parts[0] == "vt")
-                {
-                    CHECK_VERTS_WITHOUT_MESH();
-                    glm::vec2 uv;
-                    uv[0] = (float)atof(parts[1].c_str());
-                    uv[1] = 1.0f - (float)atof(parts[2].c_str());
-                    currentMesh->m_texCoords.push_back(uv);
-                }
-                else if (parts[0] == "vn")
-                {
-                    CHECK_VERTS_WITHOUT_MESH();
-                    glm::vec3 vec;
-                    vec[0] = (float)atof(parts[1].c_str());
-                    vec[1] = (float)atof(parts[2].c_str());
-                    vec[2] = (float)atof(parts[3].c_str());
-                    currentMesh->m_normals.push_back(vec);
-                }
-                else if (parts[0] == "f")
+                groupIndexCounts.push_back(0);
+                inGroup = true;
+            }
+            else if ((parts.size() == 4 || parts.size() == 5) && parts.is("v"))
+            {
+                objectCounts.back().m_positions++;
+            }
+            else if ((parts.size() == 3 || parts.size() == 4) && parts.is("vt"))
+            {
+                objectCounts.back().m_texCoords++;
+            }
+            else if (parts.size() == 4 && parts.is("vn"))
+            {
+                objectCounts.back().m_normals++;
+            }
+            else if ((parts.size() == 4 || parts.size() == 5) && parts.is("f") && inGroup)
+            {
+                groupIndexCounts.back() += parts.size() == 4 ? 3 : 6;
+            }
+        }
+    }
+
+    MemoryStream ms(data, length);
+    TextReader<MemoryStream> reader(ms);
+
+    Mesh* currentMesh = nullptr;
+    SubMesh* currentSubMesh = nullptr;
+    size_t objectIndex = 0;
+    size_t groupIndex = 0;
+    // The temporaries of the current object, the arena is reset at every object
+    Arena arena;
+    ArenaVector<glm::vec4> positions(arena);
+    ArenaVector<glm::vec2> texCoords(arena);
+    ArenaVector<glm::vec3> normals(arena);
+    VertexMap vertexMap(arena);
+
+    // Returns the index of the mesh vertex for a face vertex token, adding the vertex if it wasn't seen before
+    auto faceVertex = [&](const char* token, unsigned int& vertIdx) -> bool
+    {
+        int pidx, tidx, nidx;
+        {
+            StageTimer timer(stats, LoadStage::ParseNumbers);
+            if (!parseFaceVertex(token, pidx, tidx, nidx))
+            {
+                UNKNOWN_FACE();
+            }
+        }
+
+        StageTimer timer(stats, LoadStage::VertexDedup);
+        pidx = resolveIndex(pidx, positions.size());
+        tidx = tidx ? resolveIndex(tidx, texCoords.size()) : -1;
+        nidx = nidx ? resolveIndex(nidx, normals.size()) : -1;
+        if (pidx < 0 || pidx >= (int)positions.size() ||
+            tidx >= (int)texCoords.size() ||
+            nidx >= (int)normals.size())
+        {
+            INVALID_FACE_INDEX(token);
+        }
+
+        vertIdx = vertexMap.findOrInsert(VertexID(pidx, tidx, nidx), (unsigned int)currentMesh->m_vertices.size());
+        if (vertIdx == currentMesh->m_vertices.size())
+        {
+            MeshVertex vert;
+
+            vert.m_position = positions[pidx];
+            if (tidx >= 0)
+                vert.m_texCoord = texCoords[tidx];
+            if (nidx >= 0)
+                vert.m_normal = normals[nidx];
+            currentMesh->m_vertices.push_back(vert);
+        }
+        return true;
+    };
+
+    while (const char* line = reader.readLine())
+    {
+        if (line[0] == '#')
+            continue;
+        if (stats)
+            stats->m_lines++;
+        {
+            StageTimer timer(stats, LoadStage::Tokenize);
+            parts.split(line);
+        }
+        if (parts.size() == 2)
+        {
+            // mtllib lines were handled by loadFile()
+            if (parts.is("o"))
+            {
+                currentMesh = meshPool.create(parts[1]);
+                meshes.push_back(currentMesh);
+                currentSubMesh = nullptr;
+
+                positions.clear();
+                texCoords.clear();
+                normals.clear();
+                arena.reset();
+                const ObjectCounts& counts = objectCounts[objectIndex++];
+                positions.reserve(counts.m_positions);
+                texCoords.reserve(counts.m_texCoords);
+                normals.reserve(counts.m_normals);
+                // Every value is usually used by at least one vertex, the deduplicated vertices can't be counted
+                // without doing the deduplication
+                size_t expectedVertices = std::max(counts.m_positions, std::max(counts.m_texCoords, counts.m_normals));
+                vertexMap.reset(expectedVertices);
+                currentMesh->m_vertices.reserve(expectedVertices);
+            }
+            else if (parts.is("g"))
+            {
+                CHECK_MESHGROUP_WITHOUT_MESH();
+                currentSubMesh = subMeshPool.create(parts[1]);
+                currentSubMesh->m_indices.reserve(groupIndexCounts[groupIndex++]);
+                currentMesh->m_subMeshes.push_back(currentSubMesh);
+            }
+            else if (parts.is("usemtl"))
+            {
+                CHECK_MAT_WITHOUT_MESHGROUP();
+                auto mtlIter = m_materialLibrary.find(parts[1]);
+                if (mtlIter == m_materialLibrary.end())
                 {
-                    CHECK_FACES_WITHOUT_MESHGROUP();
-                    for (int curIdx = 1; curIdx < 4; curIdx++)
-                    {
-                        sparts.clear();
-                        split(parts[curIdx].c_str(), '/', sparts);
-                        unsigned int pidx = -1;
-                        unsigned int tidx = -1;
-                        unsigned int nidx = -1;
-                        pidx = atoi(sparts[0].c_str());
-                        if (sparts.size() >= 1) // p/uv
-                        {
-                            tidx = atoi(sparts[1].c_str());
-                        }
-                        if (sparts.size() >= 2) // p/uv/n
-                        {
-                            nidx = atoi(sparts[2].c_str());
-                        }
-                        if (sparts.size() > 3)
-                        {
-                            UNKNOWN_FACE();
-                        }
-                        VertexID id(pidx, tidx, nidx);
-                        auto viter = vertexMap.find(id);
-                        unsigned int vertIdx = 0;
-                        if (viter == vertexMap.end())
-                        {
-                            MeshVertex vert;
-
-                            vert.m_position = currentMesh->m_positions[pidx-1];
-                            if (currentMesh->m_texCoords.size() > 0 && tidx != -1)
-                                vert.m_texCoord = currentMesh->m_texCoords[tidx-1];
-                            if (currentMesh->m_normals.size() > 0 && nidx != -1)
-                                vert.m_normal = currentMesh->m_normals[nidx-1];
-
-                            vertIdx = (unsigned int)currentMesh->m_vertices.size();
-                            currentMesh->m_vertices.push_back(vert);
-                            vertexMap[id] = vertIdx;
-                        }
-                        else
-                        {
-                            vertIdx = (unsigned int)viter->second;
-                        }
-
-                        currentSubMesh->m_indices.push_back(vertIdx);
-                    }
+                    UNKNOWN_MATERIAL(parts[1]);
                 }
+
+                currentSubMesh->m_material = mtlIter->second;
+            }
+        }
+        else if (parts.size() == 3)
+        {
+            if (parts.is("vt"))
+            {
+                CHECK_VERTS_WITHOUT_MESH();
+                StageTimer timer(stats, LoadStage::ParseNumbers);
+                glm::vec2 uv;
+                uv[0] = (float)atof(parts[1]);
+                uv[1] = 1.0f - (float)atof(parts[2]);
+                texCoords.push_back(uv);
+            }
+        }
+        else if (parts.size() == 4)
+        {
+            if (parts.is("v"))
+            {
+                CHECK_VERTS_WITHOUT_MESH();
+                StageTimer timer(stats, LoadStage::ParseNumbers);
+                glm::vec4 vec;
+                vec[0] = (float)atof(parts[1]);
+                vec[1] = (float)atof(parts[2]);
+                vec[2] = (float)atof(parts[3]);
+                vec[3] = 1.0f;
+                positions.push_back(vec);
+            }
+            else if (parts.is("vt"))
+            {
+                CHECK_VERTS_WITHOUT_MESH();
+                StageTimer timer(stats, LoadStage::ParseNumbers);
+                glm::vec2 uv;
+                uv[0] = (float)atof(parts[1]);
+                uv[1] = 1.0f - (float)atof(parts[2]);
+                texCoords.push_back(uv);
             }
-            else if (parts.size() == 5)
+            else if (parts.is("vn"))
             {
-                if (parts[0] == "v")
+                CHECK_VERTS_WITHOUT_MESH();
+                StageTimer timer(stats, LoadStage::ParseNumbers);
+                glm::vec3 vec;
+                vec[0] = (float)atof(parts[1]);
+                vec[1] = (float)atof(parts[2]);
+                vec[2] = (float)atof(parts[3]);
+                normals.push_back(vec);
+            }
+            else if (parts.is("f"))
+            {
+                CHECK_FACES_WITHOUT_MESHGROUP();
+                for (int curIdx = 1; curIdx < 4; curIdx++)
                 {
-                    CHECK_VERTS_WITHOUT_MESH();
-                    glm::vec4 vec;
-                    vec[0] = (float)atof(parts[1].c_str());
-                    vec[1] = (float)atof(parts[2].c_str());
-                    vec[2] = (float)atof(parts[3].c_str());
-                    vec[3] = (float)atof(parts[4].c_str());
-                    currentMesh->m_positions.push_back(vec);
+                    unsigned int vertIdx = 0;
+                    if (!faceVertex(parts[curIdx], vertIdx))
+                        return false;
+                    currentSubMesh->m_indices.push_back(vertIdx);
                 }
-                else if (parts[0] == "f")
+                if (stats)
+                    stats->m_faces++;
+            }
+        }
+        else if (parts.size() == 5)
+        {
+            if (parts.is("v"))
+            {
+                CHECK_VERTS_WITHOUT_MESH();
+                StageTimer timer(stats, LoadStage::ParseNumbers);
+                glm::vec4 vec;
+                vec[0] = (float)atof(parts[1]);
+                vec[1] = (float)atof(parts[2]);
+                vec[2] = (float)atof(parts[3]);
+                vec[3] = (float)atof(parts[4]);
+                positions.push_back(vec);
+            }
+            else if (parts.is("f"))
+            {
+                CHECK_FACES_WITHOUT_MESHGROUP();
+                unsigned int indices[4];
+                for (int curIdx = 1; curIdx < 5; curIdx++)
                 {
-                    CHECK_FACES_WITHOUT_MESHGROUP();
-                    unsigned int indices[4];
-                    unsigned int curIndex = 0;
-                    for (int curIdx = 1; curIdx < 5; curIdx++)
-                    {
-                        sparts.clear();
-                        split(parts[curIdx].c_str(), '/', sparts);
-                        unsigned int pidx = -1;
-                        unsigned int tidx = -1;
-                        unsigned int nidx = -1;
-                        pidx = atoi(sparts[0].c_str());
-                        if (sparts.size() >= 1) // p/uv
-                        {
-                            tidx = atoi(sparts[1].c_str());
-                        }
-                        if (sparts.size() >= 2) // p/uv/n
-                        {
-                            nidx = atoi(sparts[2].c_str());
-                        }
-                        if (sparts.size() > 3)
-                        {
-                            UNKNOWN_FACE();
-                        }
-                        VertexID id(pidx, tidx, nidx);
-                        auto viter = vertexMap.find(id);
-                        unsigned int vertIdx = 0;
-                        if (viter == vertexMap.end())
-                        {
-                            MeshVertex vert;
-
-                            vert.m_position = currentMesh->m_positions[pidx - 1];
-                            if (currentMesh->m_texCoords.size() > 0 && tidx != -1)
-                                vert.m_texCoord = currentMesh->m_texCoords[tidx - 1];
-                            if (currentMesh->m_normals.size() > 0 && nidx != -1)
-                                vert.m_normal = currentMesh->m_normals[nidx - 1];
-
-                            vertIdx = (unsigned int)currentMesh->m_vertices.size();
-                            currentMesh->m_vertices.push_back(vert);
-                            vertexMap[id] = vertIdx;
-                        }
-                        else
-                        {
-                            vertIdx = (unsigned int)viter->second;
-                        }
-                        indices[curIndex++] = vertIdx;
-                    }
-                    currentSubMesh->m_indices.push_back(indices[0]);
-                    currentSubMesh->m_indices.push_back(indices[1]);
-                    currentSubMesh->m_indices.push_back(indices[2]);
-                    currentSubMesh->m_indices.push_back(indices[0]);
-                    currentSubMesh->m_indices.push_back(indices[2]);
-                    currentSubMesh->m_indices.push_back(indices[3]);
-
+                    if (!faceVertex(parts[curIdx], indices[curIdx - 1]))
+                        return false;
                 }
-
+                currentSubMesh->m_indices.push_back(indices[0]);
+                currentSubMesh->m_indices.push_back(indices[1]);
+                currentSubMesh->m_indices.push_back(indices[2]);
+                currentSubMesh->m_indices.push_back(indices[0]);
+                currentSubMesh->m_indices.push_back(indices[2]);
+                currentSubMesh->m_indices.push_back(indices[3]);
+                if (stats)
+                    stats->m_faces++;
             }
-        };
-        fclose(f);
-    }
-    else
-    {
-        CANNOT_OPEN(filename);
+
+        }
     }
     return true;
 }
 
 bool ObjectFile::loadMaterialLibrary(const char* filename)
 {
+    PROFILE_SCOPE("ObjectFile::loadMaterialLibrary");
+    const fnErrFunc& errorCallback = m_errorCallback;
     std::string filePath = combinePath(m_dataPath.c_str(), filename);
     FILE* f = fopen(filePath.c_str(), "rb");
     if (f)
     {
         std::vector<char> fileBuffer;
         readToBuffer(f, fileBuffer);
+        fclose(f);
+        if (fileBuffer.empty())
+            return true;
 
         MemoryStream ms(&fileBuffer[0], fileBuffer.size());
         TextReader<MemoryStream> reader(ms);
 
-        std::vector<std::string> parts;
+        LineTokens parts;
 
         Material* currentMaterial = nullptr;
         while (const char* line = reader.readLine())
@@ -474,74 +1261,73 @@ bool ObjectFile::loadMaterialLibrary(const char* filename)
                 continue;
             if (line[0] == '\t')
                 line++;
-            parts.clear();
-            split(line, ' ', parts);
+            parts.split(line);
             if (parts.size() == 2)
             {
-                if (parts[0] == "newmtl")
+                if (parts.is("newmtl"))
                 {
                     auto miter = m_materialLibrary.find(parts[1]);
                     if (miter == m_materialLibrary.end())
                     {
-                        auto insertResult = m_materialLibrary.insert(std::make_pair(parts[1], std::make_unique<Material>(parts[1].c_str())));
-                        currentMaterial = insertResult.first->second.get();
+                        currentMaterial = m_materialPool.create(parts[1]);
+                        m_materialLibrary.insert(std::make_pair(currentMaterial->m_name, currentMaterial));
                     }
                     else
                     {
                         MAT_EXISTS(parts[1]);
                     }
                 }
-                else if (parts[0] == "illum")
+                else if (parts.is("illum"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
-                    currentMaterial->m_illuminationType = atoi(parts[1].c_str());
+                    currentMaterial->m_illuminationType = atoi(parts[1]);
                 }
-                else if (parts[0] == "Ns")
+                else if (parts.is("Ns"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
-                    currentMaterial->m_shininess = (float)atof(parts[1].c_str());
+                    currentMaterial->m_shininess = (float)atof(parts[1]);
                 }
-                else if (parts[0] == "d")
+                else if (parts.is("d"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
-                    currentMaterial->m_alpha = (float)atof(parts[1].c_str());
+                    currentMaterial->m_alpha = (float)atof(parts[1]);
                 }
-                else if (parts[0] == "Tr")
+                else if (parts.is("Tr"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
-                    currentMaterial->m_alpha = 1.0f - (float)atof(parts[1].c_str());
+                    currentMaterial->m_alpha = 1.0f - (float)atof(parts[1]);
                 }
-                else if (parts[0] == "map_Kd")
+                else if (parts.is("map_Kd"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     currentMaterial->m_diffuseMap = parts[1];
                 }
-                else if (parts[0] == "map_Ks")
+                else if (parts.is("map_Ks"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     currentMaterial->m_specularColorMap = parts[1];
                 }
-                else if (parts[0] == "map_Ns")
+                else if (parts.is("map_Ns"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     currentMaterial->m_specularMap = parts[1];
                 }
-                else if (parts[0] == "map_Disp" || parts[0] == "disp")
+                else if (parts.is("map_Disp") || parts.is("disp"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     currentMaterial->m_displacementMap = parts[1];
                 }
-                else if (parts[0] == "map_bump" || parts[0] == "bump")
+                else if (parts.is("map_bump") || parts.is("bump"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     currentMaterial->m_bumpMap = parts[1];
                 }
-                else if (parts[0] == "map_Ka")
+                else if (parts.is("map_Ka"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     currentMaterial->m_ambientMap = parts[1];
                 }
-                else if (parts[0] == "map_d")
+                else if (parts.is("map_d"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     currentMaterial->m_alphaMap = parts[1];
@@ -549,36 +1335,35 @@ bool ObjectFile::loadMaterialLibrary(const char* filename)
             }
             else if (parts.size() == 4)
             {
-                if (parts[0] == "Ka")
+                if (parts.is("Ka"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     glm::vec3 vec;
-                    vec[0] = (float)atof(parts[1].c_str());
-                    vec[1] = (float)atof(parts[2].c_str());
-                    vec[2] = (float)atof(parts[3].c_str());
+                    vec[0] = (float)atof(parts[1]);
+                    vec[1] = (float)atof(parts[2]);
+                    vec[2] = (float)atof(parts[3]);
                     currentMaterial->m_ambientColor = vec;
                 }
-                else if (parts[0] == "Kd")
+                else if (parts.is("Kd"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     glm::vec3 vec;
-                    vec[0] = (float)atof(parts[1].c_str());
-                    vec[1] = (float)atof(parts[2].c_str());
-                    vec[2] = (float)atof(parts[3].c_str());
+                    vec[0] = (float)atof(parts[1]);
+                    vec[1] = (float)atof(parts[2]);
+                    vec[2] = (float)atof(parts[3]);
                     currentMaterial->m_diffuseColor = vec;
                 }
-                else if (parts[0] == "Ks")
+                else if (parts.is("Ks"))
                 {
                     CHECK_MATDEF_WITHOUT_MAT();
                     glm::vec3 vec;
-                    vec[0] = (float)atof(parts[1].c_str());
-                    vec[1] = (float)atof(parts[2].c_str());
-                    vec[2] = (float)atof(parts[3].c_str());
+                    vec[0] = (float)atof(parts[1]);
+                    vec[1] = (float)atof(parts[2]);
+                    vec[2] = (float)atof(parts[3]);
                     currentMaterial->m_specularColor = vec;
                 }
             }
         }
-        fclose(f);
     }
     else
     {
@@ -9,6 +9,7 @@
 
 #include "glm/glm.hpp"
 #include "GL/glew.h"
+#include "arena.h"
 
 namespace ObjLoader
 {
@@ -37,6 +38,14 @@ namespace ObjLoader
         GLuint m_alphaTexId = 0;
         GLuint m_displacementTexId = 0;
         GLuint m_bumpTexId = 0;
+        // VirtualTexturing ids of the textures the shaders read, used instead of the GL textures when the file was
+        // set up with virtual textures
+        uint32_t m_diffuseVirtualId = 0;
+        uint32_t m_specularColorVirtualId = 0;
+        uint32_t m_specularMapVirtualId = 0;
+        uint32_t m_bumpVirtualId = 0;
+        // Set if the diffuse texture has any texel that isn't fully opaque, only those materials need the alpha test
+        bool m_diffuseHasAlpha = false;
 
         Material() {}
         Material(const char* name) : m_name(name) {}
@@ -48,6 +57,8 @@ namespace ObjLoader
         std::string m_name;
         Material* m_material;
         std::vector<unsigned int> m_indices;
+        // Size of the index buffer, m_indices may be released after the upload
+        uint32_t m_indexCount = 0;
         GLuint m_indexBuffer = 0;
     };
     struct MeshVertex
@@ -55,22 +66,85 @@ namespace ObjLoader
         glm::vec4 m_position;
         glm::vec3 m_normal;
         glm::vec2 m_texCoord;
-        MeshVertex() : m_position(0), m_normal(0), m_texCoord(0) {}
+        // Tangent and handedness of normal-mapped vertices, see packTangent()
+        uint32_t m_tangent;
+        MeshVertex() : m_position(0), m_normal(0), m_texCoord(0), m_tangent(0) {}
 
     };
     struct Mesh
     {
         Mesh(const char* name) : m_name(name) {}
         std::string m_name;
-        std::vector<glm::vec4> m_positions;
-        std::vector<glm::vec3> m_normals;
-        std::vector<glm::vec2> m_texCoords;
         std::vector<MeshVertex> m_vertices;
-        std::vector<std::unique_ptr<SubMesh>> m_subMeshes;
+        // Vertex positions kept instead of m_vertices with GeometryResidency::Compact
+        std::vector<glm::vec3> m_positions;
+        // Size of the vertex buffer, m_vertices may be released after the upload
+        uint32_t m_vertexCount = 0;
+        // Owned by the ObjectFile's pool
+        std::vector<SubMesh*> m_subMeshes;
         GLuint m_vertexBuffer = 0;
         GLuint m_vao = 0;
     };
     
+    // What initGraphics() keeps of the geometry in RAM after uploading it
+    enum class GeometryResidency : int
+    {
+        // Mesh::m_vertices and SubMesh::m_indices, which SoftRasterizer draws from
+        Keep,
+        // Mesh::m_positions and SubMesh::m_indices, enough for CPU queries like bounds or picking
+        Compact,
+        // Only the vertex and index counts
+        Release,
+        NumResidencies // Always at the last position
+    };
+
+    const char* geometryResidencyName(GeometryResidency residency);
+
+    // Unit tangent in xyz and handedness (+1 or -1) in w as GL_INT_2_10_10_10_REV, signed normalized
+    uint32_t packTangent(const glm::vec3& tangent, float handedness);
+    glm::vec4 unpackTangent(uint32_t packed);
+
+    // RGBA8 image decoded from a PNG file
+    struct Image
+    {
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        std::vector<uint8_t> m_pixels;
+    };
+
+    // Decodes a PNG file of any color type to RGBA8, with PngDecoder and libpng for the files it doesn't handle
+    bool loadPngImage(const char* file, Image& image);
+    // The same with libpng only, the reference for PngDecoder
+    bool loadPngImageLibpng(const char* file, Image& image);
+
+    // Stages timed by ObjectFile when statistics collection is enabled
+    enum class LoadStage : int
+    {
+        FileRead,
+        Count,
+        Tokenize,
+        ParseNumbers,
+        VertexDedup,
+        Tangents,
+        MaterialParse,
+        PngDecode,
+        NumStages // Always at the last position
+    };
+
+    const char* loadStageName(LoadStage stage);
+
+    // Objects and textures are processed by several jobs, the stage times are summed over them
+    struct LoadStatistics
+    {
+        uint64_t m_stageNs[(int)LoadStage::NumStages] = {};
+        uint64_t m_bytes = 0;
+        uint64_t m_lines = 0;
+        uint64_t m_faces = 0;
+        uint64_t m_vertices = 0;
+        uint64_t m_textures = 0;
+        uint64_t m_texturePixels = 0;
+    };
+
     class ObjectFile
     {
     public:
@@ -82,13 +156,46 @@ namespace ObjLoader
         bool initGraphics();
         bool destroyGraphics();
         void setVertexDescriptor();
-        const std::vector<std::unique_ptr<Mesh>>& meshes() const { return m_meshes; }
+        const std::vector<Mesh*>& meshes() const { return m_meshes; }
+        const std::map<std::string, Material*>& materials() const { return m_materialLibrary; }
+        const std::string& dataPath() const { return m_dataPath; }
+
+        // Stage timing adds a clock read around every parsed token, so it is off by default
+        void setCollectStatistics(bool collect) { m_collectStatistics = collect; }
+        const LoadStatistics& statistics() const { return m_statistics; }
+        void resetStatistics() { m_statistics = LoadStatistics(); }
+        // Registers the material textures with VirtualTexturing in initGraphics() instead of uploading them, which
+        // needs VirtualTexturing::init() first
+        void setVirtualTextures(bool virtualTextures) { m_virtualTextures = virtualTextures; }
+        // Creates the material textures with TextureStreaming in initGraphics(), only their smallest levels uploaded,
+        // which needs TextureStreaming::init() first. Virtual textures take precedence.
+        void setStreamTextures(bool streamTextures) { m_streamTextures = streamTextures; }
+        // Applied at the end of initGraphics(), which can't run again once the vertices were dropped
+        void setGeometryResidency(GeometryResidency residency) { m_geometryResidency = residency; }
+        GeometryResidency geometryResidency() const { return m_geometryResidency; }
+        // Capacity of the vertex, position and index arrays of all meshes
+        uint64_t cpuGeometryBytes() const;
     private:
-        bool loadTextureFile(const char* filename, GLuint& outId);
+        // Meshes and their submeshes are created in the given pools, which are spliced into the file's afterwards
+        bool parseObjects(const char* data, size_t length, std::vector<Mesh*>& meshes, Pool<Mesh>& meshPool,
+            Pool<SubMesh>& subMeshPool, LoadStatistics* stats, const fnErrFunc& errorCallback) const;
         bool loadMaterialLibrary(const char* filename);
+        void loadTextures();
+        void addVirtualTextures();
+        void addStreamedTextures();
+        void applyGeometryResidency();
         fnErrFunc m_errorCallback;
         std::string m_dataPath;
-        std::map<std::string, std::unique_ptr<Material>> m_materialLibrary;
-        std::vector<std::unique_ptr<Mesh>> m_meshes;
+        // Meshes, submeshes and materials live in pools, they are destroyed with the file
+        Pool<Mesh> m_meshPool;
+        Pool<SubMesh> m_subMeshPool;
+        Pool<Material> m_materialPool;
+        std::map<std::string, Material*> m_materialLibrary;
+        std::vector<Mesh*> m_meshes;
+        bool m_collectStatistics = false;
+        bool m_virtualTextures = false;
+        bool m_streamTextures = false;
+        GeometryResidency m_geometryResidency = GeometryResidency::Keep;
+        LoadStatistics m_statistics;
     };
 }
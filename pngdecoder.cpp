@@ -0,0 +1,1092 @@
+#include "pngdecoder.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PNG_DECODER_SSE 1
+#endif
+
+namespace
+{
+    const uint8_t s_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    // libpng's default user limits, larger images go to libpng so it reports them the same way
+    const uint32_t MaxDimension = 1000000;
+    const uint64_t MaxFilteredBytes = 1ull << 31;
+
+    enum ColorType
+    {
+        Gray = 0,
+        Rgb = 2,
+        Palette = 3,
+        GrayAlpha = 4,
+        Rgba = 6
+    };
+
+    uint32_t readBigEndian32(const uint8_t* p)
+    {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    uint16_t readBigEndian16(const uint8_t* p)
+    {
+        return (uint16_t)((p[0] << 8) | p[1]);
+    }
+
+    bool fail(std::string* errString, const char* error)
+    {
+        if (errString)
+            *errString = error;
+        return false;
+    }
+
+    // Huffman decode table entries: the code length in bits 0-7, extra bits (or the index bits of a subtable) in
+    // bits 8-11, flags in bits 12-15 and the value (literal, length or distance base, subtable start) in bits 16-31.
+    // Codes up to the table's root bits are looked up directly, longer ones go through a subtable indexed by the bits
+    // after the root bits.
+    const uint32_t EntryLiteral = 0x1000;
+    const uint32_t EntryEnd = 0x2000;
+    const uint32_t EntrySubtable = 0x4000;
+    const uint32_t EntryInvalid = 0x8000;
+
+    const uint32_t LitlenRootBits = 11;
+    const uint32_t DistanceRootBits = 8;
+    const uint32_t PrecodeRootBits = 7;
+    const uint32_t MaxCodeLength = 15;
+    const uint32_t LitlenSymbols = 288;
+    const uint32_t DistanceSymbols = 32;
+    const uint32_t PrecodeSymbols = 19;
+    // Root table plus a subtable of (15 - root bits) index bits for every symbol, the most that can be needed
+    const uint32_t LitlenTableSize = (1 << LitlenRootBits) + LitlenSymbols * (1 << (MaxCodeLength - LitlenRootBits));
+    const uint32_t DistanceTableSize = (1 << DistanceRootBits) + DistanceSymbols * (1 << (MaxCodeLength - DistanceRootBits));
+    const uint32_t PrecodeTableSize = 1 << PrecodeRootBits;
+
+    const uint16_t s_lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115,
+        131, 163, 195, 227, 258 };
+    const uint8_t s_lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const uint16_t s_distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537,
+        2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const uint8_t s_distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    const uint8_t s_precodeOrder[PrecodeSymbols] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    uint32_t makeEntry(uint32_t value, uint32_t extraBits, uint32_t flags)
+    {
+        return (value << 16) | (extraBits << 8) | flags;
+    }
+
+    uint32_t litlenEntry(uint32_t symbol)
+    {
+        if (symbol < 256)
+            return makeEntry(symbol, 0, EntryLiteral);
+        if (symbol == 256)
+            return makeEntry(0, 0, EntryEnd);
+        if (symbol < 286)
+            return makeEntry(s_lengthBase[symbol - 257], s_lengthExtra[symbol - 257], 0);
+        return EntryInvalid;
+    }
+
+    uint32_t distanceEntry(uint32_t symbol)
+    {
+        return symbol < 30 ? makeEntry(s_distanceBase[symbol], s_distanceExtra[symbol], 0) : EntryInvalid;
+    }
+
+    uint32_t precodeEntry(uint32_t symbol)
+    {
+        return makeEntry(symbol, 0, 0);
+    }
+
+    // Builds the decode table of a canonical Huffman code. Incomplete codes are rejected like zlib does, except for a
+    // single code of length 1 (and no codes at all) when allowIncomplete is set, which deflate allows for distances.
+    bool buildTable(const uint8_t* lengths, uint32_t symbolCount, uint32_t (*symbolEntry)(uint32_t), uint32_t rootBits,
+        bool allowIncomplete, uint32_t* table)
+    {
+        uint32_t counts[MaxCodeLength + 1] = {};
+        for (uint32_t symbol = 0; symbol < symbolCount; symbol++)
+            counts[lengths[symbol]]++;
+        counts[0] = 0;
+        uint32_t maxLength = 0;
+        for (uint32_t length = 1; length <= MaxCodeLength; length++)
+        {
+            if (counts[length])
+                maxLength = length;
+        }
+        int32_t left = 1;
+        for (uint32_t length = 1; length <= MaxCodeLength; length++)
+        {
+            left = (left << 1) - (int32_t)counts[length];
+            if (left < 0)
+                return false;
+        }
+        if (left > 0 && maxLength && (!allowIncomplete || maxLength != 1))
+            return false;
+        if (!maxLength && !allowIncomplete)
+            return false;
+
+        uint32_t nextCode[MaxCodeLength + 1] = {};
+        uint32_t code = 0;
+        for (uint32_t length = 1; length <= MaxCodeLength; length++)
+        {
+            code = (code + counts[length - 1]) << 1;
+            nextCode[length] = code;
+        }
+
+        uint32_t rootSize = 1u << rootBits;
+        std::fill_n(table, rootSize, EntryInvalid);
+        uint32_t subtableBits = maxLength > rootBits ? maxLength - rootBits : 0;
+        uint32_t nextSubtable = rootSize;
+        for (uint32_t symbol = 0; symbol < symbolCount; symbol++)
+        {
+            uint32_t length = lengths[symbol];
+            if (!length)
+                continue;
+            // Deflate packs codes starting at their most significant bit, the bit reader delivers the least
+            // significant bit first
+            uint32_t canonical = nextCode[length]++;
+            uint32_t reversed = 0;
+            for (uint32_t bit = 0; bit < length; bit++)
+                reversed |= ((canonical >> bit) & 1) << (length - 1 - bit);
+
+            uint32_t entry = symbolEntry(symbol);
+            if (length <= rootBits)
+            {
+                for (uint32_t i = reversed; i < rootSize; i += 1u << length)
+                    table[i] = entry | length;
+                continue;
+            }
+            uint32_t prefix = reversed & (rootSize - 1);
+            if (!(table[prefix] & EntrySubtable))
+            {
+                table[prefix] = makeEntry(nextSubtable, subtableBits, EntrySubtable) | rootBits;
+                std::fill_n(table + nextSubtable, 1u << subtableBits, EntryInvalid);
+                nextSubtable += 1u << subtableBits;
+            }
+            uint32_t* subtable = table + (table[prefix] >> 16);
+            uint32_t subLength = length - rootBits;
+            for (uint32_t i = reversed >> rootBits; i < (1u << subtableBits); i += 1u << subLength)
+                subtable[i] = entry | subLength;
+        }
+        return true;
+    }
+
+    struct FixedTables
+    {
+        uint32_t m_litlen[LitlenTableSize];
+        uint32_t m_distance[DistanceTableSize];
+
+        FixedTables()
+        {
+            uint8_t lengths[LitlenSymbols];
+            std::fill_n(lengths, 144, (uint8_t)8);
+            std::fill_n(lengths + 144, 112, (uint8_t)9);
+            std::fill_n(lengths + 256, 24, (uint8_t)7);
+            std::fill_n(lengths + 280, 8, (uint8_t)8);
+            buildTable(lengths, LitlenSymbols, litlenEntry, LitlenRootBits, false, m_litlen);
+            std::fill_n(lengths, DistanceSymbols, (uint8_t)5);
+            buildTable(lengths, DistanceSymbols, distanceEntry, DistanceRootBits, false, m_distance);
+        }
+    };
+
+    const FixedTables& fixedTables()
+    {
+        static const FixedTables s_tables;
+        return s_tables;
+    }
+
+    // Little-endian bit reader over the compressed data. Refills load 8 bytes at once while they are available, the
+    // bits above m_bitCount are the following input bytes and get ORed in again unchanged by the next refill.
+    // Past the end of the input zero bytes are shifted in and counted, a stream that uses them is truncated.
+    struct BitReader
+    {
+        const uint8_t* m_next;
+        const uint8_t* m_end;
+        uint64_t m_bits = 0;
+        uint32_t m_bitCount = 0;
+        uint32_t m_overrun = 0;
+
+        BitReader(const uint8_t* data, size_t size) : m_next(data), m_end(data + size) {}
+
+        // At least 56 bits are available afterwards
+        inline void refill()
+        {
+            if (m_end - m_next >= 8)
+            {
+                uint64_t word;
+                memcpy(&word, m_next, 8);
+                m_bits |= word << m_bitCount;
+                m_next += (63 - m_bitCount) >> 3;
+                m_bitCount |= 56;
+                return;
+            }
+            while (m_bitCount < 56)
+            {
+                if (m_next < m_end)
+                    m_bits |= (uint64_t)*m_next++ << m_bitCount;
+                else
+                    m_overrun++;
+                m_bitCount += 8;
+            }
+        }
+        inline uint32_t peek(uint32_t count) const
+        {
+            return (uint32_t)(m_bits & ((1ull << count) - 1));
+        }
+        inline void consume(uint32_t count)
+        {
+            m_bits >>= count;
+            m_bitCount -= count;
+        }
+        inline uint32_t read(uint32_t count)
+        {
+            uint32_t value = peek(count);
+            consume(count);
+            return value;
+        }
+        // Drops the bits up to the next byte boundary and gives the whole buffered bytes back to the input.
+        // Returns false if bytes past the end were used.
+        bool alignToByte()
+        {
+            consume(m_bitCount & 7);
+            uint32_t buffered = m_bitCount >> 3;
+            if (m_overrun > buffered)
+                return false;
+            m_next -= buffered - m_overrun;
+            m_bits = 0;
+            m_bitCount = 0;
+            m_overrun = 0;
+            return true;
+        }
+    };
+
+    inline uint32_t decodeSymbol(BitReader& reader, const uint32_t* table, uint32_t rootBits)
+    {
+        uint32_t entry = table[reader.peek(rootBits)];
+        if (entry & EntrySubtable)
+        {
+            reader.consume(rootBits);
+            entry = table[(entry >> 16) + reader.peek((entry >> 8) & 0xF)];
+        }
+        reader.consume(entry & 0xFF);
+        return entry;
+    }
+
+    // Tables of one dynamic block, kept together so they stay in one place on the stack
+    struct DynamicTables
+    {
+        uint32_t m_precode[PrecodeTableSize];
+        uint32_t m_litlen[LitlenTableSize];
+        uint32_t m_distance[DistanceTableSize];
+    };
+
+    bool readDynamicTables(BitReader& reader, DynamicTables& tables)
+    {
+        reader.refill();
+        uint32_t litlenCount = reader.read(5) + 257;
+        uint32_t distanceCount = reader.read(5) + 1;
+        uint32_t precodeCount = reader.read(4) + 4;
+        if (litlenCount > 286 || distanceCount > 30)
+            return false;
+
+        uint8_t precodeLengths[PrecodeSymbols] = {};
+        for (uint32_t i = 0; i < precodeCount; i++)
+        {
+            reader.refill();
+            precodeLengths[s_precodeOrder[i]] = (uint8_t)reader.read(3);
+        }
+        if (!buildTable(precodeLengths, PrecodeSymbols, precodeEntry, PrecodeRootBits, false, tables.m_precode))
+            return false;
+
+        uint8_t lengths[LitlenSymbols + DistanceSymbols] = {};
+        uint32_t total = litlenCount + distanceCount;
+        for (uint32_t i = 0; i < total;)
+        {
+            reader.refill();
+            uint32_t entry = decodeSymbol(reader, tables.m_precode, PrecodeRootBits);
+            if (entry & EntryInvalid)
+                return false;
+            uint32_t symbol = entry >> 16;
+            if (symbol < 16)
+            {
+                lengths[i++] = (uint8_t)symbol;
+                continue;
+            }
+            uint8_t value = 0;
+            uint32_t repeat;
+            if (symbol == 16)
+            {
+                if (!i)
+                    return false;
+                value = lengths[i - 1];
+                repeat = 3 + reader.read(2);
+            }
+            else if (symbol == 17)
+            {
+                repeat = 3 + reader.read(3);
+            }
+            else
+            {
+                repeat = 11 + reader.read(7);
+            }
+            if (i + repeat > total)
+                return false;
+            std::fill_n(lengths + i, repeat, value);
+            i += repeat;
+        }
+        // Without an end-of-block code the block can't end
+        if (!lengths[256])
+            return false;
+        return buildTable(lengths, litlenCount, litlenEntry, LitlenRootBits, false, tables.m_litlen) &&
+            buildTable(lengths + litlenCount, distanceCount, distanceEntry, DistanceRootBits, true, tables.m_distance);
+    }
+
+    // Decodes the symbols of one compressed block. Every iteration starts with a refill, which covers the longest
+    // length/distance pair (15 + 5 + 15 + 13 bits).
+    bool inflateBlock(BitReader& reader, const uint32_t* litlen, const uint32_t* distance, uint8_t* outStart, uint8_t*& out,
+        uint8_t* outEnd)
+    {
+        for (;;)
+        {
+            reader.refill();
+            uint32_t entry = decodeSymbol(reader, litlen, LitlenRootBits);
+            if (entry & EntryLiteral)
+            {
+                if (out == outEnd)
+                    return false;
+                *out++ = (uint8_t)(entry >> 16);
+                // Literals come in runs, a second one still fits in the remaining bits
+                entry = decodeSymbol(reader, litlen, LitlenRootBits);
+                if (entry & EntryLiteral)
+                {
+                    if (out == outEnd)
+                        return false;
+                    *out++ = (uint8_t)(entry >> 16);
+                    continue;
+                }
+                reader.refill();
+            }
+            if (entry & EntryEnd)
+                return reader.m_overrun <= 8;
+            if (entry & EntryInvalid)
+                return false;
+
+            uint32_t length = (entry >> 16) + reader.read((entry >> 8) & 0xF);
+            entry = decodeSymbol(reader, distance, DistanceRootBits);
+            if (entry & EntryInvalid)
+                return false;
+            uint32_t offset = (entry >> 16) + reader.read((entry >> 8) & 0xF);
+            if (offset > (size_t)(out - outStart) || length > (size_t)(outEnd - out))
+                return false;
+
+            const uint8_t* source = out - offset;
+            uint8_t* target = out;
+            out += length;
+            if (offset >= 8)
+            {
+                // Each 8 byte chunk only reads bytes written before it. May write up to 7 bytes past the match,
+                // into the slack or over output that comes later.
+                do
+                {
+                    uint64_t chunk;
+                    memcpy(&chunk, source, 8);
+                    memcpy(target, &chunk, 8);
+                    source += 8;
+                    target += 8;
+                } while (target < out);
+            }
+            else if (offset == 1)
+            {
+                memset(target, *source, length);
+            }
+            else
+            {
+                while (target < out)
+                    *target++ = *source++;
+            }
+            if (reader.m_overrun > 8)
+                return false;
+        }
+    }
+
+    uint32_t adler32(const uint8_t* data, size_t size)
+    {
+        const uint32_t Modulus = 65521;
+        // The largest multiple of 16 bytes before the 32-bit sums can overflow
+        const size_t ChunkBytes = 5552;
+        uint32_t a = 1;
+        uint32_t b = 0;
+#ifdef PNG_DECODER_SSE
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i weightsLow = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+        const __m128i weightsHigh = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+#endif
+        while (size)
+        {
+            size_t chunk = std::min(size, ChunkBytes);
+            size -= chunk;
+#ifdef PNG_DECODER_SSE
+            // Lane sums, the byte sum in lanes 0 and 2
+            __m128i sumA = _mm_cvtsi32_si128((int)a);
+            __m128i sumB = _mm_cvtsi32_si128((int)b);
+            for (; chunk >= 16; chunk -= 16, data += 16)
+            {
+                __m128i bytes = _mm_loadu_si128((const __m128i*)data);
+                sumB = _mm_add_epi32(sumB, _mm_slli_epi32(sumA, 4));
+                sumA = _mm_add_epi32(sumA, _mm_sad_epu8(bytes, zero));
+                __m128i weighted = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightsLow),
+                    _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightsHigh));
+                sumB = _mm_add_epi32(sumB, weighted);
+            }
+            alignas(16) uint32_t lanesA[4];
+            alignas(16) uint32_t lanesB[4];
+            _mm_store_si128((__m128i*)lanesA, sumA);
+            _mm_store_si128((__m128i*)lanesB, sumB);
+            a = lanesA[0] + lanesA[1] + lanesA[2] + lanesA[3];
+            b = lanesB[0] + lanesB[1] + lanesB[2] + lanesB[3];
+#endif
+            for (; chunk; chunk--)
+            {
+                a += *data++;
+                b += a;
+            }
+            a %= Modulus;
+            b %= Modulus;
+        }
+        return (b << 16) | a;
+    }
+
+#ifdef PNG_DECODER_SSE
+    inline __m128i loadPixel(const uint8_t* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, 4);
+        return _mm_cvtsi32_si128((int)value);
+    }
+
+    inline void storePixel(uint8_t* p, __m128i pixel)
+    {
+        uint32_t value = (uint32_t)_mm_cvtsi128_si32(pixel);
+        memcpy(p, &value, 4);
+    }
+
+    // Lanes of a pixel, 3 byte pixels are still loaded and stored as 4 bytes: nothing is added to the fourth byte, so
+    // it is written back unchanged. That byte is the next pixel, the next row's filter type or the buffer slack.
+    template<uint32_t Bpp>
+    inline __m128i pixelMask()
+    {
+        return _mm_cvtsi32_si128(Bpp == 3 ? 0x00FFFFFF : -1);
+    }
+
+    // The Sub, Average and Paeth filters depend on the pixel to the left, so 3 and 4 byte pixels are unfiltered one
+    // pixel per register. Paeth works in 16-bit lanes like libpng's SSE2 code.
+    template<uint32_t Bpp>
+    void unfilterSubSimd(uint8_t* row, size_t rowBytes)
+    {
+        const __m128i mask = pixelMask<Bpp>();
+        __m128i left = _mm_setzero_si128();
+        for (size_t i = 0; i < rowBytes; i += Bpp)
+        {
+            __m128i pixel = _mm_add_epi8(loadPixel(row + i), left);
+            storePixel(row + i, pixel);
+            left = _mm_and_si128(pixel, mask);
+        }
+    }
+
+    template<uint32_t Bpp>
+    void unfilterAverageSimd(uint8_t* row, const uint8_t* previous, size_t rowBytes)
+    {
+        const __m128i mask = pixelMask<Bpp>();
+        const __m128i one = _mm_set1_epi8(1);
+        __m128i left = _mm_setzero_si128();
+        for (size_t i = 0; i < rowBytes; i += Bpp)
+        {
+            __m128i up = _mm_and_si128(loadPixel(previous + i), mask);
+            // avg_epu8 rounds up, the filter rounds down
+            __m128i average = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), one));
+            __m128i pixel = _mm_add_epi8(loadPixel(row + i), average);
+            storePixel(row + i, pixel);
+            left = _mm_and_si128(pixel, mask);
+        }
+    }
+
+    inline __m128i abs16(__m128i x)
+    {
+        return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+    }
+
+    inline __m128i select16(__m128i mask, __m128i a, __m128i b)
+    {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+
+    template<uint32_t Bpp>
+    void unfilterPaethSimd(uint8_t* row, const uint8_t* previous, size_t rowBytes)
+    {
+        const __m128i mask = pixelMask<Bpp>();
+        const __m128i zero = _mm_setzero_si128();
+        __m128i a = zero;
+        __m128i c = zero;
+        for (size_t i = 0; i < rowBytes; i += Bpp)
+        {
+            __m128i b = _mm_unpacklo_epi8(_mm_and_si128(loadPixel(previous + i), mask), zero);
+            // p = a + b - c, the distances of p to a, b and c
+            __m128i pa = _mm_sub_epi16(b, c);
+            __m128i pb = _mm_sub_epi16(a, c);
+            __m128i pc = abs16(_mm_add_epi16(pa, pb));
+            pa = abs16(pa);
+            pb = abs16(pb);
+            __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            // Ties go to a, then b
+            __m128i nearest = select16(_mm_cmpeq_epi16(smallest, pa), a, select16(_mm_cmpeq_epi16(smallest, pb), b, c));
+            __m128i pixel = _mm_add_epi8(loadPixel(row + i), _mm_packus_epi16(nearest, nearest));
+            storePixel(row + i, pixel);
+            a = _mm_unpacklo_epi8(_mm_and_si128(pixel, mask), zero);
+            c = b;
+        }
+    }
+#endif
+
+    void unfilterUp(uint8_t* row, const uint8_t* previous, size_t rowBytes)
+    {
+        size_t i = 0;
+#ifdef PNG_DECODER_SSE
+        for (; i + 16 <= rowBytes; i += 16)
+        {
+            __m128i sum = _mm_add_epi8(_mm_loadu_si128((const __m128i*)(row + i)), _mm_loadu_si128((const __m128i*)(previous + i)));
+            _mm_storeu_si128((__m128i*)(row + i), sum);
+        }
+#endif
+        for (; i < rowBytes; i++)
+            row[i] = (uint8_t)(row[i] + previous[i]);
+    }
+
+    void unfilterSub(uint8_t* row, size_t rowBytes, uint32_t bpp)
+    {
+        for (size_t i = bpp; i < rowBytes; i++)
+            row[i] = (uint8_t)(row[i] + row[i - bpp]);
+    }
+
+    void unfilterAverage(uint8_t* row, const uint8_t* previous, size_t rowBytes, uint32_t bpp)
+    {
+        for (size_t i = 0; i < bpp; i++)
+            row[i] = (uint8_t)(row[i] + (previous[i] >> 1));
+        for (size_t i = bpp; i < rowBytes; i++)
+            row[i] = (uint8_t)(row[i] + ((row[i - bpp] + previous[i]) >> 1));
+    }
+
+    void unfilterPaeth(uint8_t* row, const uint8_t* previous, size_t rowBytes, uint32_t bpp)
+    {
+        for (size_t i = 0; i < bpp; i++)
+            row[i] = (uint8_t)(row[i] + previous[i]);
+        for (size_t i = bpp; i < rowBytes; i++)
+        {
+            int a = row[i - bpp];
+            int b = previous[i];
+            int c = previous[i - bpp];
+            int pa = abs(b - c);
+            int pb = abs(a - c);
+            int pc = abs(a + b - 2 * c);
+            int predictor = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+            row[i] = (uint8_t)(row[i] + predictor);
+        }
+    }
+
+    // Rows are stored as a filter type byte followed by rowBytes of data, previous is a zero row for the first one
+    bool unfilterRows(uint8_t* data, size_t rowBytes, uint32_t height, uint32_t bpp, const uint8_t* zeroRow)
+    {
+        const uint8_t* previous = zeroRow;
+        for (uint32_t y = 0; y < height; y++)
+        {
+            uint8_t* row = data + (size_t)y * (rowBytes + 1) + 1;
+            switch (row[-1])
+            {
+            case 0:
+                break;
+            case 1:
+#ifdef PNG_DECODER_SSE
+                if (bpp == 4)
+                    unfilterSubSimd<4>(row, rowBytes);
+                else if (bpp == 3)
+                    unfilterSubSimd<3>(row, rowBytes);
+                else
+#endif
+                    unfilterSub(row, rowBytes, bpp);
+                break;
+            case 2:
+                unfilterUp(row, previous, rowBytes);
+                break;
+            case 3:
+#ifdef PNG_DECODER_SSE
+                if (bpp == 4)
+                    unfilterAverageSimd<4>(row, previous, rowBytes);
+                else if (bpp == 3)
+                    unfilterAverageSimd<3>(row, previous, rowBytes);
+                else
+#endif
+                    unfilterAverage(row, previous, rowBytes, bpp);
+                break;
+            case 4:
+#ifdef PNG_DECODER_SSE
+                if (bpp == 4)
+                    unfilterPaethSimd<4>(row, previous, rowBytes);
+                else if (bpp == 3)
+                    unfilterPaethSimd<3>(row, previous, rowBytes);
+                else
+#endif
+                    unfilterPaeth(row, previous, rowBytes, bpp);
+                break;
+            default:
+                return false;
+            }
+            previous = row;
+        }
+        return true;
+    }
+
+    // The tRNS chunk as libpng keeps it
+    struct Transparency
+    {
+        bool m_present = false;
+        uint16_t m_gray = 0;
+        uint16_t m_red = 0;
+        uint16_t m_green = 0;
+        uint16_t m_blue = 0;
+        uint32_t m_alphaCount = 0;
+        uint8_t m_alpha[256] = {};
+    };
+
+    void expandGray(const uint8_t* source, uint8_t* target, uint32_t width)
+    {
+        uint32_t x = 0;
+#ifdef PNG_DECODER_SSE
+        const __m128i opaque = _mm_set1_epi8((char)0xFF);
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i gray = _mm_loadu_si128((const __m128i*)(source + x));
+            __m128i grayGrayLow = _mm_unpacklo_epi8(gray, gray);
+            __m128i grayGrayHigh = _mm_unpackhi_epi8(gray, gray);
+            __m128i grayAlphaLow = _mm_unpacklo_epi8(gray, opaque);
+            __m128i grayAlphaHigh = _mm_unpackhi_epi8(gray, opaque);
+            __m128i* out = (__m128i*)(target + x * 4);
+            _mm_storeu_si128(out, _mm_unpacklo_epi16(grayGrayLow, grayAlphaLow));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(grayGrayLow, grayAlphaLow));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(grayGrayHigh, grayAlphaHigh));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(grayGrayHigh, grayAlphaHigh));
+        }
+#endif
+        for (; x < width; x++)
+        {
+            uint8_t* out = target + x * 4;
+            out[0] = out[1] = out[2] = source[x];
+            out[3] = 0xFF;
+        }
+    }
+
+    void expandGrayAlpha(const uint8_t* source, uint8_t* target, uint32_t width)
+    {
+        uint32_t x = 0;
+#ifdef PNG_DECODER_SSE
+        const __m128i lowBytes = _mm_set1_epi16(0xFF);
+        for (; x + 8 <= width; x += 8)
+        {
+            // Every 16-bit lane is gray | alpha << 8, widened to gray | gray << 8 | lane << 16
+            __m128i grayAlpha = _mm_loadu_si128((const __m128i*)(source + x * 2));
+            __m128i gray = _mm_and_si128(grayAlpha, lowBytes);
+            __m128i grayGray = _mm_or_si128(gray, _mm_slli_epi16(gray, 8));
+            __m128i* out = (__m128i*)(target + x * 4);
+            _mm_storeu_si128(out, _mm_unpacklo_epi16(grayGray, grayAlpha));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(grayGray, grayAlpha));
+        }
+#endif
+        for (; x < width; x++)
+        {
+            uint8_t* out = target + x * 4;
+            out[0] = out[1] = out[2] = source[x * 2];
+            out[3] = source[x * 2 + 1];
+        }
+    }
+
+    void expandRgb(const uint8_t* source, uint8_t* target, uint32_t width)
+    {
+        const uint32_t opaque = 0xFF000000;
+        uint32_t x = 0;
+        // Four pixels from three little-endian words
+        for (; x + 4 <= width; x += 4)
+        {
+            uint32_t words[3];
+            memcpy(words, source + x * 3, 12);
+            uint32_t pixels[4] = {
+                words[0] | opaque,
+                (words[0] >> 24) | (words[1] << 8) | opaque,
+                (words[1] >> 16) | (words[2] << 16) | opaque,
+                (words[2] >> 8) | opaque
+            };
+            memcpy(target + x * 4, pixels, 16);
+        }
+        for (; x < width; x++)
+        {
+            uint8_t* out = target + x * 4;
+            memcpy(out, source + x * 3, 3);
+            out[3] = 0xFF;
+        }
+    }
+
+    void expandRgbTransparent(const uint8_t* source, uint8_t* target, uint32_t width, const Transparency& transparency)
+    {
+        // libpng compares 8-bit samples against the low byte of the tRNS values
+        uint8_t red = (uint8_t)transparency.m_red;
+        uint8_t green = (uint8_t)transparency.m_green;
+        uint8_t blue = (uint8_t)transparency.m_blue;
+        for (uint32_t x = 0; x < width; x++)
+        {
+            const uint8_t* in = source + x * 3;
+            uint8_t* out = target + x * 4;
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+            out[3] = in[0] == red && in[1] == green && in[2] == blue ? 0 : 0xFF;
+        }
+    }
+
+    // Palette and gray images of up to 8 bits, through a table of the RGBA values of every index
+    void expandIndexed(const uint8_t* source, uint8_t* target, uint32_t width, uint32_t bitDepth, const uint32_t* table)
+    {
+        uint32_t* out = (uint32_t*)target;
+        if (bitDepth == 8)
+        {
+            for (uint32_t x = 0; x < width; x++)
+                out[x] = table[source[x]];
+            return;
+        }
+        // The first pixel is in the most significant bits
+        uint32_t perByte = 8 / bitDepth;
+        uint32_t mask = (1u << bitDepth) - 1;
+        for (uint32_t x = 0; x < width; x++)
+        {
+            uint32_t shift = 8 - bitDepth * (x % perByte + 1);
+            out[x] = table[(source[x / perByte] >> shift) & mask];
+        }
+    }
+
+    // 16-bit samples keep their high byte, tRNS compares the full values
+    void expand16(const uint8_t* source, uint8_t* target, uint32_t width, uint8_t colorType, const Transparency& transparency)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            uint8_t* out = target + x * 4;
+            if (colorType == Gray)
+            {
+                const uint8_t* in = source + x * 2;
+                out[0] = out[1] = out[2] = in[0];
+                out[3] = transparency.m_present && readBigEndian16(in) == transparency.m_gray ? 0 : 0xFF;
+            }
+            else if (colorType == GrayAlpha)
+            {
+                const uint8_t* in = source + x * 4;
+                out[0] = out[1] = out[2] = in[0];
+                out[3] = in[2];
+            }
+            else if (colorType == Rgb)
+            {
+                const uint8_t* in = source + x * 6;
+                out[0] = in[0];
+                out[1] = in[2];
+                out[2] = in[4];
+                out[3] = transparency.m_present && readBigEndian16(in) == transparency.m_red &&
+                    readBigEndian16(in + 2) == transparency.m_green && readBigEndian16(in + 4) == transparency.m_blue ? 0 : 0xFF;
+            }
+            else
+            {
+                const uint8_t* in = source + x * 8;
+                out[0] = in[0];
+                out[1] = in[2];
+                out[2] = in[4];
+                out[3] = in[6];
+            }
+        }
+    }
+
+    uint32_t channelCount(uint8_t colorType)
+    {
+        switch (colorType)
+        {
+        case Rgb: return 3;
+        case GrayAlpha: return 2;
+        case Rgba: return 4;
+        default: return 1;
+        }
+    }
+
+    bool isValidFormat(uint8_t colorType, uint8_t bitDepth)
+    {
+        switch (colorType)
+        {
+        case Gray: return bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8 || bitDepth == 16;
+        case Palette: return bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8;
+        case Rgb:
+        case GrayAlpha:
+        case Rgba: return bitDepth == 8 || bitDepth == 16;
+        default: return false;
+        }
+    }
+}
+
+bool PngDecoder::readHeader(const uint8_t* data, size_t size, Header& header, std::string* errString)
+{
+    if (size < 33 || memcmp(data, s_signature, 8))
+        return fail(errString, "Not a PNG file");
+    if (readBigEndian32(data + 8) != 13 || memcmp(data + 12, "IHDR", 4))
+        return fail(errString, "Missing IHDR chunk");
+    const uint8_t* ihdr = data + 16;
+    header.m_width = readBigEndian32(ihdr);
+    header.m_height = readBigEndian32(ihdr + 4);
+    header.m_bitDepth = ihdr[8];
+    header.m_colorType = ihdr[9];
+    header.m_interlace = ihdr[12];
+    if (!header.m_width || !header.m_height || header.m_width > MaxDimension || header.m_height > MaxDimension)
+        return fail(errString, "Invalid or too large image size");
+    if (!isValidFormat(header.m_colorType, header.m_bitDepth) || ihdr[10] || ihdr[11] || header.m_interlace > 1)
+        return fail(errString, "Invalid IHDR chunk");
+    return true;
+}
+
+bool PngDecoder::inflate(const uint8_t* data, size_t size, uint8_t* output, size_t outputSize, std::string* errString)
+{
+    if (size < 6)
+        return fail(errString, "Truncated zlib stream");
+    uint32_t method = data[0] & 0xF;
+    uint32_t windowBits = (data[0] >> 4) + 8;
+    if (method != 8 || windowBits > 15 || ((data[0] << 8) | data[1]) % 31 || (data[1] & 0x20))
+        return fail(errString, "Invalid zlib header");
+
+    BitReader reader(data + 2, size - 2);
+    uint8_t* out = output;
+    uint8_t* outEnd = output + outputSize;
+    std::unique_ptr<DynamicTables> dynamicTables;
+    bool finalBlock = false;
+    while (!finalBlock)
+    {
+        reader.refill();
+        finalBlock = reader.read(1) != 0;
+        uint32_t type = reader.read(2);
+        if (type == 0)
+        {
+            if (!reader.alignToByte() || reader.m_end - reader.m_next < 4)
+                return fail(errString, "Truncated zlib stream");
+            uint32_t length = reader.m_next[0] | (reader.m_next[1] << 8);
+            uint32_t inverse = reader.m_next[2] | (reader.m_next[3] << 8);
+            reader.m_next += 4;
+            if (length != (~inverse & 0xFFFF))
+                return fail(errString, "Invalid stored block length");
+            if ((size_t)(reader.m_end - reader.m_next) < length || (size_t)(outEnd - out) < length)
+                return fail(errString, "Invalid stored block");
+            memcpy(out, reader.m_next, length);
+            out += length;
+            reader.m_next += length;
+            continue;
+        }
+
+        const uint32_t* litlen;
+        const uint32_t* distance;
+        if (type == 1)
+        {
+            litlen = fixedTables().m_litlen;
+            distance = fixedTables().m_distance;
+        }
+        else if (type == 2)
+        {
+            if (!dynamicTables)
+                dynamicTables.reset(new DynamicTables);
+            if (!readDynamicTables(reader, *dynamicTables))
+                return fail(errString, "Invalid Huffman code lengths");
+            litlen = dynamicTables->m_litlen;
+            distance = dynamicTables->m_distance;
+        }
+        else
+        {
+            return fail(errString, "Invalid block type");
+        }
+        if (!inflateBlock(reader, litlen, distance, output, out, outEnd))
+            return fail(errString, "Invalid or truncated compressed data");
+    }
+
+    if (out != outEnd)
+        return fail(errString, "Not enough image data");
+    if (!reader.alignToByte() || reader.m_end - reader.m_next < 4)
+        return fail(errString, "Missing Adler-32 checksum");
+    if (readBigEndian32(reader.m_next) != adler32(output, outputSize))
+        return fail(errString, "Adler-32 checksum mismatch");
+    return true;
+}
+
+bool PngDecoder::decode(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height, std::vector<uint8_t>& pixels,
+    std::string* errString)
+{
+    Header header;
+    if (!readHeader(data, size, header, errString))
+        return false;
+    if (header.m_interlace)
+        return fail(errString, "Interlaced PNG files are not supported");
+
+    // Chunk CRCs are not checked, the zlib stream has its own checksum
+    uint32_t palette[256] = {};
+    uint32_t paletteSize = 0;
+    Transparency transparency;
+    bool seenData = false;
+    const uint8_t* firstData = nullptr;
+    size_t firstDataSize = 0;
+    // Only used when the image data is split over several IDAT chunks
+    thread_local std::vector<uint8_t> s_compressed;
+    s_compressed.clear();
+    size_t offset = 8;
+    for (;;)
+    {
+        if (size - offset < 12)
+            return fail(errString, "Truncated PNG file");
+        uint32_t length = readBigEndian32(data + offset);
+        const uint8_t* type = data + offset + 4;
+        const uint8_t* chunk = data + offset + 8;
+        if (length > 0x7FFFFFFF || size - offset - 12 < length)
+            return fail(errString, "Truncated PNG file");
+        offset += 12 + (size_t)length;
+
+        if (!memcmp(type, "IHDR", 4))
+        {
+            if (offset != 33)
+                return fail(errString, "Duplicate IHDR chunk");
+        }
+        else if (!memcmp(type, "PLTE", 4))
+        {
+            if (length % 3 || !length || length > 768 || paletteSize || seenData)
+                return fail(errString, "Invalid PLTE chunk");
+            if (header.m_colorType == Palette)
+            {
+                // libpng drops the entries the bit depth can't index
+                paletteSize = std::min(length / 3, 1u << header.m_bitDepth);
+                for (uint32_t i = 0; i < paletteSize; i++)
+                    palette[i] = chunk[i * 3] | (chunk[i * 3 + 1] << 8) | (chunk[i * 3 + 2] << 16);
+            }
+        }
+        else if (!memcmp(type, "tRNS", 4))
+        {
+            // Chunks libpng ignores with a warning are ignored as well
+            if (transparency.m_present || seenData)
+                continue;
+            if (header.m_colorType == Gray && length == 2)
+            {
+                transparency.m_gray = readBigEndian16(chunk);
+                transparency.m_present = true;
+            }
+            else if (header.m_colorType == Rgb && length == 6)
+            {
+                transparency.m_red = readBigEndian16(chunk);
+                transparency.m_green = readBigEndian16(chunk + 2);
+                transparency.m_blue = readBigEndian16(chunk + 4);
+                transparency.m_present = true;
+            }
+            else if (header.m_colorType == Palette && paletteSize && length && length <= paletteSize)
+            {
+                transparency.m_alphaCount = length;
+                memcpy(transparency.m_alpha, chunk, length);
+                transparency.m_present = true;
+            }
+        }
+        else if (!memcmp(type, "IDAT", 4))
+        {
+            if (!seenData)
+            {
+                firstData = chunk;
+                firstDataSize = length;
+            }
+            else
+            {
+                if (s_compressed.empty())
+                    s_compressed.assign(firstData, firstData + firstDataSize);
+                s_compressed.insert(s_compressed.end(), chunk, chunk + length);
+            }
+            seenData = true;
+        }
+        else if (!memcmp(type, "IEND", 4))
+        {
+            break;
+        }
+        else if (!(type[0] & 0x20))
+        {
+            // Unknown critical chunk, ancillary ones are skipped
+            return fail(errString, "Unsupported critical chunk");
+        }
+    }
+    if (!seenData)
+        return fail(errString, "Missing image data");
+    if (header.m_colorType == Palette && !paletteSize)
+        return fail(errString, "Missing palette");
+
+    uint32_t channels = channelCount(header.m_colorType);
+    uint64_t rowBytes = ((uint64_t)header.m_width * channels * header.m_bitDepth + 7) / 8;
+    uint64_t filteredBytes = (rowBytes + 1) * header.m_height;
+    if (filteredBytes > MaxFilteredBytes)
+        return fail(errString, "Image too large");
+
+    // Reused by the next decode on this thread, the slack is for the wide match copies
+    thread_local std::vector<uint8_t> s_filtered;
+    s_filtered.resize((size_t)filteredBytes + 16);
+    const uint8_t* compressed = s_compressed.empty() ? firstData : s_compressed.data();
+    size_t compressedSize = s_compressed.empty() ? firstDataSize : s_compressed.size();
+    if (!inflate(compressed, compressedSize, s_filtered.data(), (size_t)filteredBytes, errString))
+        return false;
+
+    // One byte longer for the 4 byte loads of 3 byte pixels
+    std::vector<uint8_t> zeroRow((size_t)rowBytes + 1, 0);
+    uint32_t bpp = std::max(1u, channels * header.m_bitDepth / 8);
+    if (!unfilterRows(s_filtered.data(), (size_t)rowBytes, header.m_height, bpp, zeroRow.data()))
+        return fail(errString, "Invalid filter type");
+
+    // RGBA of every index of palette and gray images up to 8 bits, low bit depths scaled to 8 bits
+    uint32_t table[256];
+    bool indexed = header.m_colorType == Palette ||
+        (header.m_colorType == Gray && (header.m_bitDepth < 8 || transparency.m_present) && header.m_bitDepth <= 8);
+    if (header.m_colorType == Palette)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t alpha = i < transparency.m_alphaCount ? transparency.m_alpha[i] : 0xFF;
+            table[i] = (i < paletteSize ? palette[i] : 0) | (alpha << 24);
+        }
+    }
+    else if (indexed)
+    {
+        uint32_t mask = (1u << header.m_bitDepth) - 1;
+        uint32_t scale = 255 / mask;
+        for (uint32_t i = 0; i <= mask; i++)
+        {
+            uint32_t gray = i * scale;
+            uint32_t alpha = transparency.m_present && i == (transparency.m_gray & mask) ? 0 : 0xFF;
+            table[i] = gray | (gray << 8) | (gray << 16) | (alpha << 24);
+        }
+    }
+
+    width = header.m_width;
+    height = header.m_height;
+    pixels.resize((size_t)width * height * 4);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint8_t* source = s_filtered.data() + (size_t)y * (rowBytes + 1) + 1;
+        uint8_t* target = pixels.data() + (size_t)y * width * 4;
+        if (indexed)
+            expandIndexed(source, target, width, header.m_bitDepth, table);
+        else if (header.m_bitDepth == 16)
+            expand16(source, target, width, header.m_colorType, transparency);
+        else if (header.m_colorType == Rgba)
+            memcpy(target, source, (size_t)width * 4);
+        else if (header.m_colorType == Rgb && transparency.m_present)
+            expandRgbTransparent(source, target, width, transparency);
+        else if (header.m_colorType == Rgb)
+            expandRgb(source, target, width);
+        else if (header.m_colorType == GrayAlpha)
+            expandGrayAlpha(source, target, width);
+        else
+            expandGray(source, target, width);
+    }
+    return true;
+}
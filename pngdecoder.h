@@ -0,0 +1,31 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+// PNG decoder for the texture loads. The whole zlib stream is inflated in one pass by a table-driven inflater, the
+// row filters are undone in place (with SSE2 for 3 and 4 byte pixels where available) and the rows are expanded to
+// RGBA8 with the same rules as the libpng setup of ObjLoader::loadPngImage: 16-bit samples keep their high byte,
+// palettes, gray and tRNS are expanded and missing alpha is filled with 0xFF. The output matches that libpng setup bit
+// for bit. Interlaced images are not handled, decode() fails on them and the caller falls back to libpng.
+namespace PngDecoder
+{
+    struct Header
+    {
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        uint8_t m_bitDepth = 0;
+        uint8_t m_colorType = 0;
+        uint8_t m_interlace = 0;
+    };
+
+    // Reads the IHDR chunk only
+    bool readHeader(const uint8_t* data, size_t size, Header& header, std::string* errString);
+    // Decodes to RGBA8, rows top to bottom. Returns false and fills errString on corrupt or unsupported files.
+    bool decode(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height, std::vector<uint8_t>& pixels,
+        std::string* errString);
+
+    // zlib stream (RFC 1950) in one shot into output, which must have outputSize bytes plus 16 bytes of slack for the
+    // wide match copies. Fails unless the stream decompresses to exactly outputSize bytes and its Adler-32 matches.
+    bool inflate(const uint8_t* data, size_t size, uint8_t* output, size_t outputSize, std::string* errString);
+}
@@ -0,0 +1,517 @@
+#include "profiler.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include "imgui.h"
+#include "jobsystem.h"
+
+using namespace Profiler;
+
+namespace
+{
+    // Number of frames of zones kept for the timeline and for trace export
+    const size_t MaxHistoryFrames = 600;
+    // Number of query sets in flight. A set is read back when it is about to be reused,
+    // GpuQueryLatency frames after it was recorded.
+    const size_t GpuQueryLatency = 2;
+
+    struct GpuQuery
+    {
+        const char* m_name = nullptr;
+        GLuint m_timestampQuery = 0;
+        GLuint m_elapsedQuery = 0;
+    };
+
+    struct GpuQuerySet
+    {
+        uint64_t m_frameIndex = 0;
+        std::vector<GpuQuery> m_queries;
+        size_t m_used = 0;
+    };
+
+    std::mutex s_mutex;
+    std::chrono::high_resolution_clock::time_point s_startTime;
+    FrameRecord s_currentFrame;
+    std::deque<FrameRecord> s_history;
+
+    bool s_gpuEnabled = false;
+    int64_t s_gpuOffsetNs = 0;
+    bool s_gpuZoneActive = false;
+    GpuQuerySet s_gpuSets[GpuQueryLatency];
+    uint64_t s_droppedGpuZones = 0;
+
+    uint64_t s_captureFirst = 0;
+    uint64_t s_captureLast = 0;
+    bool s_capturePending = false;
+    std::string s_captureFile;
+    std::string s_statusMessage;
+
+    std::atomic<uint32_t> s_nextThreadId(1);
+    thread_local uint32_t t_threadId = 0;
+    thread_local uint32_t t_depth = 0;
+    // Zones of the jobs running on this thread, a job waiting for others runs them inside its own zone
+    thread_local std::vector<ZoneHandle> t_jobZones;
+
+    void setStatusMessage(const std::string& message)
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_statusMessage = message;
+    }
+
+    uint32_t threadId()
+    {
+        if (t_threadId == 0)
+            t_threadId = s_nextThreadId++;
+        return t_threadId;
+    }
+
+    FrameRecord* findFrameLocked(uint64_t frameIndex)
+    {
+        if (frameIndex == s_currentFrame.m_frameIndex)
+            return &s_currentFrame;
+        if (s_history.empty() || frameIndex < s_history.front().m_frameIndex || frameIndex > s_history.back().m_frameIndex)
+            return nullptr;
+        return &s_history[(size_t)(frameIndex - s_history.front().m_frameIndex)];
+    }
+
+    void resolveGpuQueries(GpuQuerySet& set)
+    {
+        if (set.m_used == 0)
+            return;
+
+        FrameRecord* frame = findFrameLocked(set.m_frameIndex);
+        for (size_t i = 0; i < set.m_used; i++)
+        {
+            GpuQuery& query = set.m_queries[i];
+
+            // Never wait on the GPU, if the result is not there yet the zone is dropped
+            GLuint available = 0;
+            glGetQueryObjectuiv(query.m_elapsedQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                s_droppedGpuZones++;
+                continue;
+            }
+
+            GLuint64 timestamp = 0;
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query.m_timestampQuery, GL_QUERY_RESULT, &timestamp);
+            glGetQueryObjectui64v(query.m_elapsedQuery, GL_QUERY_RESULT, &elapsed);
+            if (frame)
+            {
+                Zone zone;
+                zone.m_name = query.m_name;
+                zone.m_startNs = (uint64_t)((int64_t)timestamp + s_gpuOffsetNs);
+                zone.m_endNs = zone.m_startNs + elapsed;
+                frame->m_gpuZones.push_back(zone);
+            }
+        }
+        if (frame)
+            frame->m_gpuResolved = true;
+        set.m_used = 0;
+    }
+
+    void escapeJson(const char* str, std::string& out)
+    {
+        out.clear();
+        for (const char* c = str; c && *c; c++)
+        {
+            if (*c == '"' || *c == '\\')
+                out += '\\';
+            out += *c;
+        }
+    }
+
+    ImU32 zoneColor(const char* name)
+    {
+        // Stable color per zone name so the same zone looks the same from frame to frame
+        uint32_t hash = 2166136261u;
+        for (const char* c = name; c && *c; c++)
+            hash = (hash ^ (uint8_t)*c) * 16777619u;
+        uint32_t r = 80 + (hash & 0x7F);
+        uint32_t g = 80 + ((hash >> 8) & 0x7F);
+        uint32_t b = 80 + ((hash >> 16) & 0x7F);
+        return IM_COL32(r, g, b, 255);
+    }
+}
+
+uint64_t Profiler::nowNs()
+{
+    std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - s_startTime).count();
+}
+
+void Profiler::init()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_startTime = std::chrono::high_resolution_clock::now();
+    s_history.clear();
+    s_currentFrame = FrameRecord();
+    s_currentFrame.m_frameIndex = 0;
+    s_currentFrame.m_startNs = 0;
+    JobSystem::setZoneHooks([](const char* name) { t_jobZones.push_back(beginCpuZone(name)); },
+        [] { endCpuZone(t_jobZones.back()); t_jobZones.pop_back(); });
+}
+
+void Profiler::initGraphics()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+
+    // Calibrate GPU timestamps against our CPU clock so both can be shown on one timeline
+    GLint64 gpuTime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    s_gpuOffsetNs = (int64_t)nowNs() - (int64_t)gpuTime;
+    s_gpuEnabled = true;
+}
+
+void Profiler::destroyGraphics()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (GpuQuerySet& set : s_gpuSets)
+    {
+        for (GpuQuery& query : set.m_queries)
+        {
+            glDeleteQueries(1, &query.m_timestampQuery);
+            glDeleteQueries(1, &query.m_elapsedQuery);
+        }
+        set.m_queries.clear();
+        set.m_used = 0;
+    }
+    s_gpuEnabled = false;
+}
+
+void Profiler::newFrame()
+{
+    std::string captureFile;
+    uint64_t captureFirst = 0, captureLast = 0;
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        uint64_t now = nowNs();
+        s_currentFrame.m_endNs = now;
+        s_history.push_back(std::move(s_currentFrame));
+        if (s_history.size() > MaxHistoryFrames)
+            s_history.pop_front();
+
+        s_currentFrame = FrameRecord();
+        s_currentFrame.m_frameIndex = s_history.back().m_frameIndex + 1;
+        s_currentFrame.m_startNs = now;
+
+        if (s_gpuEnabled)
+        {
+            GpuQuerySet& set = s_gpuSets[s_currentFrame.m_frameIndex % GpuQueryLatency];
+            resolveGpuQueries(set);
+            set.m_frameIndex = s_currentFrame.m_frameIndex;
+        }
+
+        // Write the capture once the GPU results of its last frame have been read back
+        if (s_capturePending && s_currentFrame.m_frameIndex > s_captureLast + GpuQueryLatency)
+        {
+            captureFile = s_captureFile;
+            captureFirst = s_captureFirst;
+            captureLast = s_captureLast;
+            s_capturePending = false;
+        }
+    }
+
+    if (captureFile.length())
+    {
+        std::string errString;
+        if (writeChromeTrace(captureFile.c_str(), captureFirst, captureLast, &errString))
+            setStatusMessage("Wrote " + captureFile);
+        else
+            setStatusMessage(errString);
+    }
+}
+
+uint64_t Profiler::currentFrameIndex()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_currentFrame.m_frameIndex;
+}
+
+ZoneHandle Profiler::beginCpuZone(const char* name)
+{
+    Zone zone;
+    zone.m_name = name;
+    zone.m_threadId = threadId();
+    zone.m_depth = t_depth++;
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    zone.m_startNs = nowNs();
+    ZoneHandle handle;
+    handle.m_frameIndex = s_currentFrame.m_frameIndex;
+    handle.m_index = (uint32_t)s_currentFrame.m_cpuZones.size();
+    s_currentFrame.m_cpuZones.push_back(zone);
+    return handle;
+}
+
+void Profiler::endCpuZone(const ZoneHandle& handle)
+{
+    if (handle.m_index == UINT32_MAX)
+        return;
+    t_depth--;
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    FrameRecord* frame = findFrameLocked(handle.m_frameIndex);
+    if (frame && handle.m_index < frame->m_cpuZones.size())
+        frame->m_cpuZones[handle.m_index].m_endNs = nowNs();
+}
+
+ZoneHandle Profiler::beginGpuZone(const char* name)
+{
+    ZoneHandle handle;
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (!s_gpuEnabled || s_gpuZoneActive)
+        return handle;
+
+    GpuQuerySet& set = s_gpuSets[s_currentFrame.m_frameIndex % GpuQueryLatency];
+    if (set.m_used == set.m_queries.size())
+    {
+        GpuQuery query;
+        glGenQueries(1, &query.m_timestampQuery);
+        glGenQueries(1, &query.m_elapsedQuery);
+        set.m_queries.push_back(query);
+    }
+    GpuQuery& query = set.m_queries[set.m_used];
+    query.m_name = name;
+    glQueryCounter(query.m_timestampQuery, GL_TIMESTAMP);
+    glBeginQuery(GL_TIME_ELAPSED, query.m_elapsedQuery);
+    s_gpuZoneActive = true;
+
+    handle.m_frameIndex = s_currentFrame.m_frameIndex;
+    handle.m_index = (uint32_t)set.m_used++;
+    return handle;
+}
+
+void Profiler::endGpuZone(const ZoneHandle& handle)
+{
+    if (handle.m_index == UINT32_MAX)
+        return;
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    glEndQuery(GL_TIME_ELAPSED);
+    s_gpuZoneActive = false;
+}
+
+uint64_t Profiler::oldestFrameIndex()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_history.empty() ? s_currentFrame.m_frameIndex : s_history.front().m_frameIndex;
+}
+
+uint64_t Profiler::latestResolvedFrameIndex()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (auto iter = s_history.rbegin(); iter != s_history.rend(); ++iter)
+    {
+        if (iter->m_gpuResolved || !s_gpuEnabled)
+            return iter->m_frameIndex;
+    }
+    return s_history.empty() ? 0 : s_history.front().m_frameIndex;
+}
+
+bool Profiler::writeChromeTrace(const char* filename, uint64_t firstFrame, uint64_t lastFrame, std::string* errString)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (s_history.empty() || lastFrame < firstFrame)
+    {
+        if (errString)
+            *errString = "No frames to write";
+        return false;
+    }
+    firstFrame = std::max(firstFrame, s_history.front().m_frameIndex);
+    lastFrame = std::min(lastFrame, s_history.back().m_frameIndex);
+
+    FILE* f = fopen(filename, "wb");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot open trace file: ") + filename;
+        return false;
+    }
+
+    // CPU threads live in process 1 and the GPU queue in process 2, so Perfetto shows them as separate tracks
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"GPU\"}}");
+
+    std::string name;
+    for (uint64_t frameIndex = firstFrame; frameIndex <= lastFrame; frameIndex++)
+    {
+        const FrameRecord* frame = findFrameLocked(frameIndex);
+        if (!frame)
+            continue;
+
+        fprintf(f, ",\n{\"name\":\"Frame %llu\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":0}",
+            (unsigned long long)frame->m_frameIndex, frame->m_startNs / 1000.0, (frame->m_endNs - frame->m_startNs) / 1000.0);
+        for (const Zone& zone : frame->m_cpuZones)
+        {
+            uint64_t endNs = zone.m_endNs ? zone.m_endNs : frame->m_endNs;
+            escapeJson(zone.m_name, name);
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                name.c_str(), zone.m_startNs / 1000.0, (endNs - zone.m_startNs) / 1000.0, zone.m_threadId);
+        }
+        for (const Zone& zone : frame->m_gpuZones)
+        {
+            escapeJson(zone.m_name, name);
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":2,\"tid\":0}",
+                name.c_str(), zone.m_startNs / 1000.0, (zone.m_endNs - zone.m_startNs) / 1000.0);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return true;
+}
+
+void Profiler::captureFrames(uint64_t frameCount, const char* filename)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_captureFirst = s_currentFrame.m_frameIndex + 1;
+    s_captureLast = s_captureFirst + std::max<uint64_t>(frameCount, 1) - 1;
+    s_captureFile = filename;
+    s_capturePending = true;
+    s_statusMessage = "Capturing...";
+}
+
+void Profiler::renderUI(bool* open)
+{
+    static bool paused = false;
+    static uint64_t selectedFrame = 0;
+    static int exportFrameCount = 60;
+    static char traceFile[256] = "profile_trace.json";
+
+    if (!ImGui::Begin("Profiler", open))
+    {
+        ImGui::End();
+        return;
+    }
+
+    uint64_t oldest = oldestFrameIndex();
+    uint64_t latest = latestResolvedFrameIndex();
+    if (!paused || selectedFrame < oldest)
+        selectedFrame = latest;
+
+    // Frame time history
+    {
+        std::vector<float> frameTimes;
+        {
+            std::lock_guard<std::mutex> lock(s_mutex);
+            size_t count = std::min<size_t>(s_history.size(), 240);
+            for (size_t i = s_history.size() - count; i < s_history.size(); i++)
+                frameTimes.push_back((s_history[i].m_endNs - s_history[i].m_startNs) / 1000000.0f);
+        }
+        float lastFrameMs = frameTimes.size() ? frameTimes.back() : 0.0f;
+        ImGui::Text("%.2f ms/frame (%.1f FPS)", lastFrameMs, lastFrameMs > 0.0f ? 1000.0f / lastFrameMs : 0.0f);
+        if (frameTimes.size())
+            ImGui::PlotHistogram("##frametimes", &frameTimes[0], (int)frameTimes.size(), 0, "Frame Time (ms)", 0.0f, 33.3f, ImVec2(-FLT_MIN, 60));
+    }
+
+    ImGui::Checkbox("Pause##profilerpause", &paused);
+    ImGui::SameLine();
+    if (ImGui::SmallButton("<##profilerprev") && selectedFrame > oldest)
+    {
+        paused = true;
+        selectedFrame--;
+    }
+    ImGui::SameLine();
+    if (ImGui::SmallButton(">##profilernext") && selectedFrame < latest)
+    {
+        paused = true;
+        selectedFrame++;
+    }
+    ImGui::SameLine();
+    ImGui::Text("Frame %llu", (unsigned long long)selectedFrame);
+
+    // Timeline of the selected frame
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        const FrameRecord* frame = findFrameLocked(selectedFrame);
+        if (frame && frame->m_endNs > frame->m_startNs)
+        {
+            uint32_t maxDepth = 0;
+            uint64_t gpuTotalNs = 0;
+            for (const Zone& zone : frame->m_cpuZones)
+                maxDepth = std::max(maxDepth, zone.m_depth);
+            for (const Zone& zone : frame->m_gpuZones)
+                gpuTotalNs += zone.m_endNs - zone.m_startNs;
+            ImGui::Text("CPU %.3f ms  GPU %.3f ms", (frame->m_endNs - frame->m_startNs) / 1000000.0, gpuTotalNs / 1000000.0);
+
+            const float rowHeight = ImGui::GetTextLineHeight() + 4.0f;
+            ImVec2 origin = ImGui::GetCursorScreenPos();
+            float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+            float height = rowHeight * (maxDepth + 3);
+            ImDrawList* drawList = ImGui::GetWindowDrawList();
+            drawList->AddRectFilled(origin, ImVec2(origin.x + width, origin.y + height), IM_COL32(30, 30, 30, 255));
+
+            // GPU zones can finish after the CPU frame has ended, so scale to whichever ends last
+            uint64_t frameStart = frame->m_startNs;
+            uint64_t frameEnd = frame->m_endNs;
+            for (const Zone& zone : frame->m_gpuZones)
+                frameEnd = std::max(frameEnd, zone.m_endNs);
+            double scale = width / (double)(frameEnd - frameStart);
+
+            auto drawZone = [&](const Zone& zone, float y)
+            {
+                uint64_t endNs = zone.m_endNs ? zone.m_endNs : frame->m_endNs;
+                float x0 = origin.x + (float)((double)((int64_t)zone.m_startNs - (int64_t)frameStart) * scale);
+                float x1 = origin.x + (float)((double)((int64_t)endNs - (int64_t)frameStart) * scale);
+                x1 = std::max(x1, x0 + 1.0f);
+                ImVec2 a(x0, y);
+                ImVec2 b(x1, y + rowHeight - 1.0f);
+                drawList->AddRectFilled(a, b, zoneColor(zone.m_name));
+                drawList->PushClipRect(a, b, true);
+                drawList->AddText(ImVec2(x0 + 2.0f, y + 1.0f), IM_COL32(255, 255, 255, 255), zone.m_name);
+                drawList->PopClipRect();
+                if (ImGui::IsMouseHoveringRect(a, b))
+                    ImGui::SetTooltip("%s: %.3f ms", zone.m_name, (endNs - zone.m_startNs) / 1000000.0);
+            };
+
+            for (const Zone& zone : frame->m_cpuZones)
+                drawZone(zone, origin.y + zone.m_depth * rowHeight);
+            float gpuRowY = origin.y + (maxDepth + 2) * rowHeight;
+            drawList->AddText(ImVec2(origin.x + 2.0f, gpuRowY - rowHeight), IM_COL32(180, 180, 180, 255), "GPU");
+            for (const Zone& zone : frame->m_gpuZones)
+                drawZone(zone, gpuRowY);
+            ImGui::Dummy(ImVec2(width, height));
+        }
+        else
+        {
+            ImGui::Text("No data for this frame");
+        }
+    }
+
+    // Trace export
+    ImGui::Separator();
+    ImGui::InputText("Trace File##tracefile", traceFile, sizeof(traceFile));
+    ImGui::SliderInt("Frames##traceframes", &exportFrameCount, 1, (int)MaxHistoryFrames);
+    if (ImGui::Button("Write Last Frames##writetrace"))
+    {
+        uint64_t first = selectedFrame >= (uint64_t)exportFrameCount ? selectedFrame - exportFrameCount + 1 : 0;
+        std::string errString;
+        if (writeChromeTrace(traceFile, first, selectedFrame, &errString))
+            setStatusMessage(std::string("Wrote ") + traceFile);
+        else
+            setStatusMessage(errString);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Capture Next Frames##capturetrace"))
+    {
+        captureFrames(exportFrameCount, traceFile);
+    }
+    uint64_t droppedGpuZones;
+    std::string statusMessage;
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        droppedGpuZones = s_droppedGpuZones;
+        statusMessage = s_statusMessage;
+    }
+    if (droppedGpuZones)
+        ImGui::Text("%llu GPU zones dropped (results not ready)", (unsigned long long)droppedGpuZones);
+    ImGui::TextWrapped("%s", statusMessage.c_str());
+
+    ImGui::End();
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include "GL/glew.h"
+
+// Hierarchical CPU/GPU frame profiler.
+//
+// CPU zones are recorded with PROFILE_SCOPE and may nest freely on any thread.
+// GPU zones are recorded with PROFILE_GPU_SCOPE using GL_TIME_ELAPSED queries.
+// Elapsed queries cannot nest, so GPU zones must be sequential; a GPU zone opened
+// while another one is active is ignored. Query results are double-buffered and
+// read back two frames later, so the profiler never stalls the pipeline waiting on
+// the GPU.
+namespace Profiler
+{
+    struct Zone
+    {
+        const char* m_name = nullptr;
+        uint64_t m_startNs = 0;
+        uint64_t m_endNs = 0;
+        uint32_t m_depth = 0;
+        uint32_t m_threadId = 0;
+    };
+
+    struct FrameRecord
+    {
+        uint64_t m_frameIndex = 0;
+        uint64_t m_startNs = 0;
+        uint64_t m_endNs = 0;
+        std::vector<Zone> m_cpuZones;
+        std::vector<Zone> m_gpuZones;
+        bool m_gpuResolved = false;
+    };
+
+    struct ZoneHandle
+    {
+        uint64_t m_frameIndex = 0;
+        uint32_t m_index = UINT32_MAX;
+    };
+
+    // Starts the profiler. Everything recorded before the first newFrame() call ends up in frame 0.
+    void init();
+    // Must be called once a GL context is current to enable GPU zones
+    void initGraphics();
+    void destroyGraphics();
+
+    // Closes the current frame and opens the next one
+    void newFrame();
+    uint64_t currentFrameIndex();
+    uint64_t nowNs();
+
+    ZoneHandle beginCpuZone(const char* name);
+    void endCpuZone(const ZoneHandle& handle);
+    ZoneHandle beginGpuZone(const char* name);
+    void endGpuZone(const ZoneHandle& handle);
+
+    uint64_t oldestFrameIndex();
+    uint64_t latestResolvedFrameIndex();
+
+    // Writes frames [firstFrame, lastFrame] in the chrome://tracing / Perfetto JSON format
+    bool writeChromeTrace(const char* filename, uint64_t firstFrame, uint64_t lastFrame, std::string* errString);
+    // Records the next frameCount frames, then writes them to filename
+    void captureFrames(uint64_t frameCount, const char* filename);
+
+    void renderUI(bool* open);
+
+    class CpuScope
+    {
+    public:
+        CpuScope(const char* name) : m_handle(beginCpuZone(name)) {}
+        ~CpuScope() { endCpuZone(m_handle); }
+    private:
+        ZoneHandle m_handle;
+    };
+
+    class GpuScope
+    {
+    public:
+        GpuScope(const char* name) : m_handle(beginGpuZone(name)) {}
+        ~GpuScope() { endGpuZone(m_handle); }
+    private:
+        ZoneHandle m_handle;
+    };
+}
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(name) Profiler::CpuScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) Profiler::GpuScope PROFILE_CONCAT(profileGpuScope, __LINE__)(name)
@@ -0,0 +1,194 @@
+#include "programcache.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "util.h"
+#include "profiler.h"
+
+using namespace ProgramCache;
+
+namespace
+{
+    const uint32_t CacheMagic = 0x4e494250; // "PBIN"
+    const uint32_t CacheVersion = 1;
+
+    struct FileHeader
+    {
+        uint32_t m_magic;
+        uint32_t m_version;
+        uint64_t m_key;
+        uint32_t m_format;
+        uint32_t m_length;
+        uint64_t m_buildNs;
+    };
+
+    bool s_enabled = false;
+    std::string s_directory;
+    // Hash of the driver strings, mixed into every key
+    uint64_t s_driverHash = 0;
+    Statistics s_statistics;
+
+    // 64 bit FNV-1a
+    uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    uint64_t hashString(uint64_t hash, const char* str)
+    {
+        // Includes the terminator so "ab" + "c" and "a" + "bc" hash differently
+        return hashBytes(hash, str ? str : "", str ? strlen(str) + 1 : 1);
+    }
+
+    std::string entryPath(uint64_t key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return Util::combinePath(s_directory.c_str(), name);
+    }
+}
+
+bool ProgramCache::init(const char* directory, std::string* errString)
+{
+    s_enabled = false;
+    GLint formats = 0;
+    if (GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0)
+    {
+        if (errString)
+            *errString = "Program binaries are not supported by the driver";
+        return false;
+    }
+    if (!Util::createDirectory(directory))
+    {
+        if (errString)
+            *errString = std::string("Cannot create program cache directory: ") + directory;
+        return false;
+    }
+
+    s_directory = directory;
+    s_driverHash = 0xcbf29ce484222325ull;
+    s_driverHash = hashString(s_driverHash, (const char*)glGetString(GL_VENDOR));
+    s_driverHash = hashString(s_driverHash, (const char*)glGetString(GL_RENDERER));
+    s_driverHash = hashString(s_driverHash, (const char*)glGetString(GL_VERSION));
+    s_driverHash = hashString(s_driverHash, (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
+    s_enabled = true;
+    return true;
+}
+
+bool ProgramCache::isEnabled()
+{
+    return s_enabled;
+}
+
+uint64_t ProgramCache::key(const char* vsCode, const char* psCode)
+{
+    uint64_t hash = hashString(s_driverHash, vsCode);
+    return hashString(hash, psCode);
+}
+
+GLuint ProgramCache::load(uint64_t key, bool separable)
+{
+    if (!s_enabled)
+        return 0;
+
+    PROFILE_SCOPE("ProgramCache::load");
+    uint64_t start = Profiler::nowNs();
+    std::string path = entryPath(key);
+    std::vector<char> buffer;
+    if (!Util::loadFileToBuffer(path.c_str(), buffer))
+    {
+        s_statistics.m_misses++;
+        return 0;
+    }
+
+    FileHeader header;
+    if (buffer.size() < sizeof(header))
+    {
+        s_statistics.m_misses++;
+        return 0;
+    }
+    memcpy(&header, &buffer[0], sizeof(header));
+    if (header.m_magic != CacheMagic || header.m_version != CacheVersion || header.m_key != key ||
+        buffer.size() != sizeof(header) + header.m_length)
+    {
+        s_statistics.m_misses++;
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramParameteri(program, GL_PROGRAM_SEPARABLE, separable ? GL_TRUE : GL_FALSE);
+    glProgramBinary(program, header.m_format, &buffer[sizeof(header)], header.m_length);
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        // Usually a driver update that kept the version string, the entry is rebuilt on the next store
+        glDeleteProgram(program);
+        remove(path.c_str());
+        s_statistics.m_misses++;
+        s_statistics.m_rejected++;
+        return 0;
+    }
+
+    s_statistics.m_hits++;
+    double loadMs = (double)(Profiler::nowNs() - start) / 1000000.0;
+    s_statistics.m_savedMs += (double)header.m_buildNs / 1000000.0 - loadMs;
+    return program;
+}
+
+bool ProgramCache::store(uint64_t key, GLuint program, uint64_t buildNs)
+{
+    if (!s_enabled)
+        return false;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+    FileHeader header;
+    header.m_magic = CacheMagic;
+    header.m_version = CacheVersion;
+    header.m_key = key;
+    header.m_format = format;
+    header.m_length = (uint32_t)length;
+    header.m_buildNs = buildNs;
+
+    std::string path = entryPath(key);
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool written = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(&binary[0], 1, length, f) == (size_t)length;
+    fclose(f);
+    if (!written)
+    {
+        remove(path.c_str());
+        return false;
+    }
+    s_statistics.m_stored++;
+    return true;
+}
+
+const Statistics& ProgramCache::statistics()
+{
+    return s_statistics;
+}
+
+void ProgramCache::logStatistics()
+{
+    printf("Program cache: %u hits, %u misses (%u rejected), %u stored, %.1f ms saved\n",
+        s_statistics.m_hits, s_statistics.m_misses, s_statistics.m_rejected, s_statistics.m_stored, s_statistics.m_savedMs);
+}
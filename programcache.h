@@ -0,0 +1,36 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include "GL/glew.h"
+
+// On-disk cache of linked program binaries (ARB_get_program_binary). Entries are
+// keyed by a hash of the shader sources and the GL vendor/renderer/version strings,
+// so a driver update or a source edit simply misses instead of loading a stale binary.
+namespace ProgramCache
+{
+    struct Statistics
+    {
+        uint32_t m_hits = 0;
+        uint32_t m_misses = 0;
+        // Binaries the driver refused to load, these count as misses too
+        uint32_t m_rejected = 0;
+        uint32_t m_stored = 0;
+        // Recorded build time of the cache hits minus the time it took to load them
+        double m_savedMs = 0.0;
+    };
+
+    // Needs a current GL context. Returns false if the driver has no binary formats, the cache stays disabled then.
+    bool init(const char* directory, std::string* errString);
+    bool isEnabled();
+
+    // Single stage programs pass nullptr for the missing stage
+    uint64_t key(const char* vsCode, const char* psCode);
+    // Returns the linked program or 0 on a miss. separable must match the program that was stored.
+    GLuint load(uint64_t key, bool separable);
+    // buildNs is the time it took to compile and link the program, used to report the time saved by later hits
+    bool store(uint64_t key, GLuint program, uint64_t buildNs);
+
+    const Statistics& statistics();
+    // Prints the statistics, for the benchmark summary
+    void logStatistics();
+}
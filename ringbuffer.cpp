@@ -0,0 +1,217 @@
+#include "ringbuffer.h"
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <string.h>
+#include "memorytracker.h"
+#include "profiler.h"
+
+using namespace RingBuffer;
+
+namespace
+{
+    const GLbitfield MapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    // A frame in flight and the end of its allocations
+    struct FrameFence
+    {
+        GLsync m_fence = nullptr;
+        uint64_t m_end = 0;
+    };
+
+    GLuint s_buffer = 0;
+    uint8_t* s_mapped = nullptr;
+    GLsizeiptr s_alignment = 256;
+    // Positions count bytes since the ring was created, the offset in the buffer is the position modulo the capacity.
+    // Everything before s_released is no longer read by the GPU.
+    uint64_t s_head = 0;
+    uint64_t s_released = 0;
+    uint64_t s_frameStart = 0;
+    std::deque<FrameFence> s_frames;
+    // Buffers replaced by a grow, the current frame's earlier allocations may still be bound from them
+    std::vector<GLuint> s_retiredBuffers;
+    Statistics s_statistics;
+
+    uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Waits for the oldest frame in flight, or only checks it if wait is false. Returns false if it's still running.
+    bool releaseOldestFrame(bool wait)
+    {
+        FrameFence& frame = s_frames.front();
+        GLenum result = glClientWaitSync(frame.m_fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED && wait)
+        {
+            PROFILE_SCOPE("RingBuffer wait");
+            uint64_t start = Profiler::nowNs();
+            do
+            {
+                result = glClientWaitSync(frame.m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            } while (result == GL_TIMEOUT_EXPIRED);
+            s_statistics.m_waits++;
+            s_statistics.m_waitMs += (Profiler::nowNs() - start) / 1000000.0;
+        }
+        if (result == GL_TIMEOUT_EXPIRED)
+            return false;
+        glDeleteSync(frame.m_fence);
+        s_released = frame.m_end;
+        s_frames.pop_front();
+        return true;
+    }
+
+    void releaseAllFrames()
+    {
+        for (FrameFence& frame : s_frames)
+            glDeleteSync(frame.m_fence);
+        s_frames.clear();
+    }
+
+    bool createBuffer(GLsizeiptr capacity)
+    {
+        glGenBuffers(1, &s_buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, s_buffer);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, capacity, nullptr, MapFlags);
+        MemoryTracker::trackBuffer(s_buffer, MemoryTracker::Category::DynamicBuffers, "Ring buffer", (uint64_t)capacity);
+        s_mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity, MapFlags);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        s_head = s_released = s_frameStart = 0;
+        s_statistics.m_capacity = s_mapped ? capacity : 0;
+        return s_mapped != nullptr;
+    }
+
+    void deleteRetiredBuffers()
+    {
+        // Draws still reading the buffers keep their storage alive until they finish
+        for (GLuint buffer : s_retiredBuffers)
+            MemoryTracker::untrackBuffer(buffer);
+        if (!s_retiredBuffers.empty())
+            glDeleteBuffers((GLsizei)s_retiredBuffers.size(), &s_retiredBuffers[0]);
+        s_retiredBuffers.clear();
+    }
+
+    // The buffer is deleted by the next deleteRetiredBuffers()
+    void retireBuffer()
+    {
+        releaseAllFrames();
+        if (s_mapped)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, s_buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        if (s_buffer)
+            s_retiredBuffers.push_back(s_buffer);
+        s_buffer = 0;
+        s_mapped = nullptr;
+        s_statistics.m_capacity = 0;
+    }
+}
+
+bool RingBuffer::init(GLsizeiptr capacity, std::string* errString)
+{
+    if (!GLEW_VERSION_4_4 && !GLEW_ARB_buffer_storage)
+    {
+        if (errString)
+            *errString = "The ring buffer needs glBufferStorage (OpenGL 4.4 or ARB_buffer_storage)";
+        return false;
+    }
+    GLint uniformAlignment = 0, storageAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+    s_alignment = std::max<GLsizeiptr>(16, std::max(uniformAlignment, storageAlignment));
+    if (!createBuffer((GLsizeiptr)alignUp(capacity, s_alignment)))
+    {
+        retireBuffer();
+        deleteRetiredBuffers();
+        if (errString)
+            *errString = "Cannot create the persistently mapped ring buffer";
+        return false;
+    }
+    return true;
+}
+
+void RingBuffer::destroy()
+{
+    retireBuffer();
+    deleteRetiredBuffers();
+    s_statistics = Statistics();
+}
+
+bool RingBuffer::allocate(GLsizeiptr size, Allocation& allocation)
+{
+    if (!s_buffer)
+        return false;
+    uint64_t alignedSize = alignUp(std::max<GLsizeiptr>(size, 1), s_alignment);
+    uint64_t capacity = (uint64_t)s_statistics.m_capacity;
+    uint64_t position = s_head;
+    // Allocations don't wrap, the rest of the ring is skipped instead
+    if (position % capacity + alignedSize > capacity)
+        position = alignUp(position, capacity);
+    if (position + alignedSize - s_frameStart > capacity)
+    {
+        // This frame alone needs more than the ring, its earlier allocations keep the old buffer alive
+        GLsizeiptr grown = (GLsizeiptr)alignUp(std::max(capacity, s_head - s_frameStart + alignedSize) * 2, s_alignment);
+        retireBuffer();
+        if (!createBuffer(grown))
+            return false;
+        s_statistics.m_grows++;
+        capacity = (uint64_t)grown;
+        position = 0;
+    }
+    // Once every frame in flight is released only this frame's allocations are left, and they fit
+    while (position + alignedSize - s_released > capacity && !s_frames.empty())
+        releaseOldestFrame(true);
+
+    s_head = position + alignedSize;
+    allocation.m_buffer = s_buffer;
+    allocation.m_offset = (GLintptr)(position % capacity);
+    allocation.m_size = (GLsizeiptr)alignedSize;
+    allocation.m_data = s_mapped + allocation.m_offset;
+    return true;
+}
+
+bool RingBuffer::upload(const void* data, GLsizeiptr size, Allocation& allocation)
+{
+    if (!allocate(size, allocation))
+        return false;
+    if (size)
+        memcpy(allocation.m_data, data, size);
+    return true;
+}
+
+void RingBuffer::bind(GLenum target, GLuint binding, const Allocation& allocation)
+{
+    glBindBufferRange(target, binding, allocation.m_buffer, allocation.m_offset, allocation.m_size);
+}
+
+void RingBuffer::endFrame()
+{
+    if (!s_buffer)
+        return;
+    GLsizeiptr frameBytes = (GLsizeiptr)(s_head - s_frameStart);
+    s_statistics.m_lastFrameBytes = frameBytes;
+    s_statistics.m_peakFrameBytes = std::max(s_statistics.m_peakFrameBytes, frameBytes);
+    if (frameBytes)
+    {
+        FrameFence frame;
+        frame.m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        frame.m_end = s_head;
+        s_frames.push_back(frame);
+    }
+    s_frameStart = s_head;
+    deleteRetiredBuffers();
+
+    // Finished frames are released without waiting, only a CPU too far ahead waits here
+    while (!s_frames.empty())
+    {
+        if (!releaseOldestFrame(s_frames.size() > MaxFramesInFlight))
+            break;
+    }
+}
+
+const Statistics& RingBuffer::statistics()
+{
+    return s_statistics;
+}
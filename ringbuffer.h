@@ -0,0 +1,51 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include "GL/glew.h"
+
+// Streaming memory for data that changes every frame. One buffer is created with glBufferStorage and stays
+// persistently and coherently mapped, so an upload is a memcpy into an allocation. Allocations are handed out
+// linearly around the ring; endFrame() puts a fence behind the frame's commands and an allocation only waits
+// for a fence when it would overwrite data a frame in flight still reads. Nothing is re-specified or orphaned.
+namespace RingBuffer
+{
+    // Frames the CPU may run ahead of the GPU before endFrame() waits
+    const uint32_t MaxFramesInFlight = 3;
+
+    struct Allocation
+    {
+        GLuint m_buffer = 0;
+        GLintptr m_offset = 0;
+        // Rounded up to the offset alignment, never 0, so the range can always be bound
+        GLsizeiptr m_size = 0;
+        // Write-only, valid until the allocation is bound for the GPU
+        void* m_data = nullptr;
+    };
+
+    struct Statistics
+    {
+        GLsizeiptr m_capacity = 0;
+        GLsizeiptr m_lastFrameBytes = 0;
+        GLsizeiptr m_peakFrameBytes = 0;
+        // Allocations that had to wait for the GPU to release their space
+        uint64_t m_waits = 0;
+        double m_waitMs = 0.0;
+        // Times a frame needed more than the whole ring and it was recreated twice as large
+        uint32_t m_grows = 0;
+    };
+
+    // Needs a current GL context with glBufferStorage (GL 4.4 or ARB_buffer_storage)
+    bool init(GLsizeiptr capacity, std::string* errString);
+    void destroy();
+
+    // Aligned for binding as uniform or shader storage buffer range. Returns false if the ring isn't initialized.
+    bool allocate(GLsizeiptr size, Allocation& allocation);
+    // Copies data into a new allocation
+    bool upload(const void* data, GLsizeiptr size, Allocation& allocation);
+    // Binds an allocation to an indexed uniform or shader storage buffer binding
+    void bind(GLenum target, GLuint binding, const Allocation& allocation);
+    // Call after the last command of the frame that reads its allocations
+    void endFrame();
+
+    const Statistics& statistics();
+}
@@ -0,0 +1,284 @@
+#include "scenegen.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "png.h"
+#include "util.h"
+
+using namespace SceneGen;
+
+namespace
+{
+    const char* s_faceMixNames[] = {
+        "triangles",
+        "quads",
+        "mixed"
+    };
+
+    // Small deterministic generator, the output must not depend on the platform's rand()
+    uint32_t nextRandom(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    float randomFloat(uint32_t& state)
+    {
+        return (float)(nextRandom(state) & 0xFFFFFF) / (float)0xFFFFFF;
+    }
+
+    bool writeImage(const char* filename, uint32_t size, int channels, const std::vector<uint8_t>& pixels, std::string* errString)
+    {
+        FILE* f = fopen(filename, "wb");
+        if (!f)
+        {
+            if (errString)
+                *errString = std::string("Cannot open file for writing: ") + filename;
+            return false;
+        }
+        png_struct* ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        png_info* info = ptr ? png_create_info_struct(ptr) : nullptr;
+        if (!ptr || !info || setjmp(png_jmpbuf(ptr)))
+        {
+            png_destroy_write_struct(&ptr, &info);
+            fclose(f);
+            if (errString)
+                *errString = std::string("Cannot write PNG file: ") + filename;
+            return false;
+        }
+        int colorType = channels == 1 ? PNG_COLOR_TYPE_GRAY : (channels == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGBA);
+        png_init_io(ptr, f);
+        png_set_IHDR(ptr, info, size, size, 8, colorType, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(ptr, info);
+        for (uint32_t y = 0; y < size; y++)
+            png_write_row(ptr, &pixels[(size_t)y * size * channels]);
+        png_write_end(ptr, nullptr);
+        png_destroy_write_struct(&ptr, &info);
+        fclose(f);
+        return true;
+    }
+
+    // Smooth bands plus per-pixel noise, so the files compress roughly like real textures
+    bool writeTexture(const char* filename, uint32_t size, int channels, uint32_t seed, std::string* errString)
+    {
+        std::vector<uint8_t> pixels((size_t)size * size * channels);
+        uint32_t state = seed * 2654435761u + 1;
+        float freq[4];
+        for (int c = 0; c < 4; c++)
+            freq[c] = 2.0f + randomFloat(state) * 14.0f;
+        uint8_t* out = &pixels[0];
+        for (uint32_t y = 0; y < size; y++)
+        {
+            for (uint32_t x = 0; x < size; x++)
+            {
+                float u = (float)x / size;
+                float v = (float)y / size;
+                for (int c = 0; c < channels; c++)
+                {
+                    float value = 0.5f + 0.35f * sinf(u * freq[c] * 6.2831853f) * cosf(v * freq[(c + 1) & 3] * 6.2831853f);
+                    value += (randomFloat(state) - 0.5f) * 0.15f;
+                    value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+                    *out++ = (uint8_t)(value * 255.0f);
+                }
+            }
+        }
+        return writeImage(filename, size, channels, pixels, errString);
+    }
+
+    std::string textureName(const Params& params, uint32_t set, const char* kind)
+    {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "%s_%s_%u.png", params.m_name.c_str(), kind, set);
+        return buffer;
+    }
+}
+
+const char* SceneGen::faceMixName(FaceMix mix)
+{
+    return s_faceMixNames[(int)mix];
+}
+
+bool SceneGen::parseFaceMix(const char* name, FaceMix& mix)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (strcmp(name, s_faceMixNames[i]) == 0)
+        {
+            mix = (FaceMix)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SceneGen::generate(const char* directory, const Params& params, Result* result, std::string* errString)
+{
+    Result res;
+    uint32_t objectCount = params.m_objectCount ? params.m_objectCount : 1;
+    uint32_t materialCount = params.m_materialCount ? params.m_materialCount : 1;
+    uint32_t groupsPerObject = params.m_groupsPerObject ? params.m_groupsPerObject : 1;
+    uint32_t textureSets = params.m_textureSize ? (params.m_textureSetCount ? params.m_textureSetCount : materialCount) : 0;
+
+    // Textures
+    for (uint32_t set = 0; set < textureSets; set++)
+    {
+        uint32_t seed = params.m_seed * 7919 + set * 3;
+        if (!writeTexture(Util::combinePath(directory, textureName(params, set, "diffuse").c_str()).c_str(), params.m_textureSize, 3, seed, errString) ||
+            !writeTexture(Util::combinePath(directory, textureName(params, set, "spec").c_str()).c_str(), params.m_textureSize, 1, seed + 1, errString) ||
+            !writeTexture(Util::combinePath(directory, textureName(params, set, "bump").c_str()).c_str(), params.m_textureSize, 4, seed + 2, errString))
+            return false;
+        res.m_textures += 3;
+    }
+
+    // Material library
+    res.m_mtlFile = params.m_name + ".mtl";
+    std::string mtlPath = Util::combinePath(directory, res.m_mtlFile.c_str());
+    FILE* f = fopen(mtlPath.c_str(), "wb");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot open file for writing: ") + mtlPath;
+        return false;
+    }
+    uint32_t state = params.m_seed | 1;
+    for (uint32_t m = 0; m < materialCount; m++)
+    {
+        fprintf(f, "newmtl material_%u\n", m);
+        fprintf(f, "\tNs %.4f\n", 10.0f + randomFloat(state) * 90.0f);
+        fprintf(f, "\td 1.0000\n");
+        fprintf(f, "\tillum 2\n");
+        fprintf(f, "\tKa %.4f %.4f %.4f\n", randomFloat(state), randomFloat(state), randomFloat(state));
+        fprintf(f, "\tKd %.4f %.4f %.4f\n", randomFloat(state), randomFloat(state), randomFloat(state));
+        fprintf(f, "\tKs %.4f %.4f %.4f\n", randomFloat(state), randomFloat(state), randomFloat(state));
+        if (textureSets)
+        {
+            uint32_t set = m % textureSets;
+            fprintf(f, "\tmap_Kd %s\n", textureName(params, set, "diffuse").c_str());
+            fprintf(f, "\tmap_Ns %s\n", textureName(params, set, "spec").c_str());
+            fprintf(f, "\tmap_bump %s\n", textureName(params, set, "bump").c_str());
+        }
+        fprintf(f, "\n");
+    }
+    fclose(f);
+
+    // Geometry, every object is a displaced grid of side x side vertices
+    res.m_objFile = params.m_name + ".obj";
+    std::string objPath = Util::combinePath(directory, res.m_objFile.c_str());
+    f = fopen(objPath.c_str(), "wb");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot open file for writing: ") + objPath;
+        return false;
+    }
+    uint32_t verticesPerObject = params.m_vertexCount / objectCount;
+    uint32_t side = (uint32_t)(sqrtf((float)verticesPerObject) + 0.5f);
+    side = side < 2 ? 2 : side;
+    uint32_t cells = side - 1;
+    uint32_t rowsPerGroup = (cells + groupsPerObject - 1) / groupsPerObject;
+    fprintf(f, "# Generated by SceneGen: %u objects, %u vertices, faces %s\n", objectCount, objectCount * side * side, faceMixName(params.m_faceMix));
+    fprintf(f, "mtllib %s\n", res.m_mtlFile.c_str());
+
+    for (uint32_t o = 0; o < objectCount; o++)
+    {
+        fprintf(f, "o object_%u\n", o);
+        float originX = (float)(o % 16) * (float)side * 1.1f;
+        float originZ = (float)(o / 16) * (float)side * 1.1f;
+        for (uint32_t y = 0; y < side; y++)
+        {
+            for (uint32_t x = 0; x < side; x++)
+            {
+                float height = sinf(x * 0.37f) * cosf(y * 0.23f) * 2.0f + randomFloat(state) * 0.1f;
+                fprintf(f, "v %.6f %.6f %.6f\n", originX + x, height, originZ + y);
+            }
+        }
+        if (params.m_texCoords)
+        {
+            for (uint32_t y = 0; y < side; y++)
+                for (uint32_t x = 0; x < side; x++)
+                    fprintf(f, "vt %.6f %.6f\n", (float)x / cells, (float)y / cells);
+        }
+        if (params.m_normals)
+        {
+            for (uint32_t y = 0; y < side; y++)
+            {
+                for (uint32_t x = 0; x < side; x++)
+                {
+                    float nx = -cosf(x * 0.37f) * cosf(y * 0.23f) * 0.74f;
+                    float nz = sinf(x * 0.37f) * sinf(y * 0.23f) * 0.46f;
+                    float len = sqrtf(nx * nx + 1.0f + nz * nz);
+                    fprintf(f, "vn %.6f %.6f %.6f\n", nx / len, 1.0f / len, nz / len);
+                }
+            }
+        }
+        res.m_vertices += (uint64_t)side * side;
+
+        // Writes one face vertex in the format selected by the attribute flags
+        auto vertex = [&](uint32_t idx)
+        {
+            if (params.m_texCoords && params.m_normals)
+                fprintf(f, " %u/%u/%u", idx, idx, idx);
+            else if (params.m_texCoords)
+                fprintf(f, " %u/%u", idx, idx);
+            else if (params.m_normals)
+                fprintf(f, " %u//%u", idx, idx);
+            else
+                fprintf(f, " %u", idx);
+        };
+
+        for (uint32_t g = 0; g < groupsPerObject; g++)
+        {
+            uint32_t firstRow = g * rowsPerGroup;
+            uint32_t lastRow = std::min(firstRow + rowsPerGroup, cells);
+            if (firstRow >= lastRow)
+                break;
+            fprintf(f, "g object_%u_group_%u\n", o, g);
+            fprintf(f, "usemtl material_%u\n", (o * groupsPerObject + g) % materialCount);
+            for (uint32_t y = firstRow; y < lastRow; y++)
+            {
+                for (uint32_t x = 0; x < cells; x++)
+                {
+                    uint32_t a = y * side + x + 1;
+                    uint32_t b = a + 1;
+                    uint32_t c = a + side;
+                    uint32_t d = c + 1;
+                    bool quad = params.m_faceMix == FaceMix::Quads ||
+                        (params.m_faceMix == FaceMix::Mixed && ((x + y) & 1));
+                    if (quad)
+                    {
+                        fprintf(f, "f");
+                        vertex(a);
+                        vertex(b);
+                        vertex(d);
+                        vertex(c);
+                        fprintf(f, "\n");
+                        res.m_faces++;
+                    }
+                    else
+                    {
+                        fprintf(f, "f");
+                        vertex(a);
+                        vertex(b);
+                        vertex(d);
+                        fprintf(f, "\nf");
+                        vertex(a);
+                        vertex(d);
+                        vertex(c);
+                        fprintf(f, "\n");
+                        res.m_faces += 2;
+                    }
+                }
+            }
+        }
+    }
+    res.m_objBytes = (uint64_t)ftell(f);
+    fclose(f);
+
+    if (result)
+        *result = res;
+    return true;
+}
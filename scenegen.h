@@ -0,0 +1,51 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+
+// Synthetic OBJ/MTL/PNG scene generator used by the loader benchmark. Every
+// parameter that changes the loader's work can be set independently, so a
+// benchmark can sweep one of them while keeping the others fixed.
+namespace SceneGen
+{
+    enum class FaceMix : int
+    {
+        Triangles,
+        Quads,
+        Mixed // Alternating quads and triangle pairs
+    };
+
+    struct Params
+    {
+        std::string m_name = "scene";
+        // Approximate total vertex count, split evenly between the objects
+        uint32_t m_vertexCount = 200000;
+        FaceMix m_faceMix = FaceMix::Mixed;
+        bool m_texCoords = true;
+        bool m_normals = true;
+        uint32_t m_objectCount = 8;
+        uint32_t m_groupsPerObject = 4;
+        uint32_t m_materialCount = 16;
+        // Every material gets a diffuse (RGB), specular (gray) and bump (RGBA) map of this size, 0 = no textures
+        uint32_t m_textureSize = 256;
+        // Number of distinct texture sets shared by the materials, 0 = one set per material
+        uint32_t m_textureSetCount = 0;
+        uint32_t m_seed = 1;
+    };
+
+    const char* faceMixName(FaceMix mix);
+    bool parseFaceMix(const char* name, FaceMix& mix);
+
+    struct Result
+    {
+        std::string m_objFile;
+        std::string m_mtlFile;
+        uint64_t m_vertices = 0;
+        uint64_t m_faces = 0;
+        uint64_t m_textures = 0;
+        uint64_t m_objBytes = 0;
+    };
+
+    // Writes <name>.obj, <name>.mtl and the textures into directory, which must exist.
+    // Face indices restart at every object, the same way ObjLoader::ObjectFile reads them.
+    bool generate(const char* directory, const Params& params, Result* result, std::string* errString);
+}
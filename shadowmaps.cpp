@@ -0,0 +1,343 @@
+#include "shadowmaps.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include "glm/gtc/matrix_transform.hpp"
+#include "framestats.h"
+#include "memorytracker.h"
+#include "profiler.h"
+
+using namespace ShadowMaps;
+
+namespace
+{
+    // Cascades end here rather than at the far plane, the last cascade would be too coarse to be useful
+    const float ShadowDistance = 3000.0f;
+    // Blend between uniform and logarithmic split distances
+    const float SplitLambda = 0.75f;
+    // A cascade covers this multiple of the bounding sphere of its frustum slice and snaps to a grid of half the
+    // radius, so the sphere stays inside until the camera crosses a grid line
+    const float CascadePadding = 1.5f;
+    const float CascadeSnapStep = 0.5f;
+    const float SpotNearPlane = 5.0f;
+    const float PointNearPlane = 1.0f;
+
+    // The matrix a map was rendered with, its pass is skipped while the matrix doesn't change
+    struct Placement
+    {
+        glm::mat4x4 m_viewProjection = glm::mat4x4(1.0f);
+        bool m_valid = false;
+    };
+
+    GLuint s_framebuffer = 0;
+    GLuint s_cascadeTexture = 0;
+    GLuint s_spotTexture = 0;
+    GLuint s_pointTexture = 0;
+    Placement s_cascades[CascadeCount];
+    Placement s_spot;
+    Placement s_pointFaces[6];
+    glm::mat4x4 s_cascadeMatrices[CascadeCount];
+    glm::mat4x4 s_spotMatrix = glm::mat4x4(1.0f);
+    glm::vec2 s_pointDepthRange = glm::vec2(PointNearPlane, 1000.0f);
+    glm::vec3 s_sceneMin = glm::vec3(0.0f);
+    glm::vec3 s_sceneMax = glm::vec3(0.0f);
+    Statistics s_statistics;
+
+    // Clip space to texture space
+    const glm::mat4x4 s_textureBias(
+        glm::vec4(0.5f, 0.0f, 0.0f, 0.0f),
+        glm::vec4(0.0f, 0.5f, 0.0f, 0.0f),
+        glm::vec4(0.0f, 0.0f, 0.5f, 0.0f),
+        glm::vec4(0.5f, 0.5f, 0.5f, 1.0f));
+
+    bool sameMatrix(const glm::mat4x4& a, const glm::mat4x4& b)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            if (a[i] != b[i])
+                return false;
+        }
+        return true;
+    }
+
+    void setShadowSampling(GLenum target, GLenum wrap)
+    {
+        // Linear filtering with depth comparison gives 2x2 percentage closer filtering in hardware
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, wrap);
+        glTexParameteri(target, GL_TEXTURE_WRAP_R, wrap);
+        glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(target, GL_TEXTURE_BORDER_COLOR, border);
+    }
+
+    glm::vec3 upVector(const glm::vec3& direction)
+    {
+        return fabsf(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+
+    // Distance from a point to the farthest corner of the scene bounds
+    float farthestSceneDistance(const glm::vec3& position)
+    {
+        glm::vec3 farthest = glm::max(glm::abs(s_sceneMin - position), glm::abs(s_sceneMax - position));
+        return std::max(glm::length(farthest), 1.0f);
+    }
+
+    // Renders one pass into a layer of the bound texture if its matrix changed, returns true if it did
+    bool updatePass(Placement& placement, const glm::mat4x4& viewProjection, GLenum attachTarget, GLuint texture,
+        int layer, int resolution, const DrawCallback& draw)
+    {
+        if (placement.m_valid && sameMatrix(placement.m_viewProjection, viewProjection))
+        {
+            s_statistics.m_passesSkipped++;
+            FrameStats::add(FrameStats::Counter::ShadowPassesSkipped);
+            return false;
+        }
+
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, s_framebuffer);
+        if (attachTarget == GL_TEXTURE_2D_ARRAY)
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+        else
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, attachTarget, texture, 0);
+        glViewport(0, 0, resolution, resolution);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        draw(viewProjection);
+
+        placement.m_viewProjection = viewProjection;
+        placement.m_valid = true;
+        s_statistics.m_passesRendered++;
+        FrameStats::add(FrameStats::Counter::ShadowPasses);
+        return true;
+    }
+
+    // Saves the framebuffer and viewport the passes change, and the depth bias they render with
+    struct PassState
+    {
+        GLint m_framebuffer = 0;
+        GLint m_viewport[4] = {};
+        uint64_t m_start = 0;
+
+        PassState()
+        {
+            m_start = Profiler::nowNs();
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_framebuffer);
+            glGetIntegerv(GL_VIEWPORT, m_viewport);
+            // Slope scaled bias against shadow acne on surfaces at grazing angles to the light
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(2.0f, 4.0f);
+        }
+
+        ~PassState()
+        {
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)m_framebuffer);
+            glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+            s_statistics.m_lastRenderMs = (double)(Profiler::nowNs() - m_start) / 1000000.0;
+        }
+    };
+}
+
+bool ShadowMaps::init(std::string* errString)
+{
+    glGenFramebuffers(1, &s_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, s_framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenTextures(1, &s_cascadeTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, s_cascadeTexture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, CascadeResolution, CascadeResolution, CascadeCount);
+    setShadowSampling(GL_TEXTURE_2D_ARRAY, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Border depth 1 keeps everything outside the cone lit
+    glGenTextures(1, &s_spotTexture);
+    glBindTexture(GL_TEXTURE_2D, s_spotTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, SpotResolution, SpotResolution);
+    setShadowSampling(GL_TEXTURE_2D, GL_CLAMP_TO_BORDER);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenTextures(1, &s_pointTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, s_pointTexture);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT32F, PointResolution, PointResolution);
+    setShadowSampling(GL_TEXTURE_CUBE_MAP, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    if (!s_framebuffer || !s_cascadeTexture || !s_spotTexture || !s_pointTexture)
+    {
+        if (errString)
+            *errString = "Cannot create shadow maps";
+        return false;
+    }
+    uint64_t bytes = ((uint64_t)CascadeResolution * CascadeResolution * CascadeCount +
+        (uint64_t)SpotResolution * SpotResolution + (uint64_t)PointResolution * PointResolution * 6) * 4;
+    FrameStats::add(FrameStats::Counter::TextureBytes, bytes);
+    MemoryTracker::trackTexture(s_cascadeTexture, MemoryTracker::Category::ShadowMaps, "Directional cascades",
+        GL_DEPTH_COMPONENT32F, CascadeResolution, CascadeResolution, CascadeCount, 1);
+    MemoryTracker::trackTexture(s_spotTexture, MemoryTracker::Category::ShadowMaps, "Spot light", GL_DEPTH_COMPONENT32F,
+        SpotResolution, SpotResolution, 1, 1);
+    MemoryTracker::trackTexture(s_pointTexture, MemoryTracker::Category::ShadowMaps, "Point light cube",
+        GL_DEPTH_COMPONENT32F, PointResolution, PointResolution, 6, 1);
+    invalidate();
+    return true;
+}
+
+void ShadowMaps::destroy()
+{
+    GLuint textures[] = { s_cascadeTexture, s_spotTexture, s_pointTexture };
+    for (GLuint texture : textures)
+        MemoryTracker::untrackTexture(texture);
+    glDeleteTextures(3, textures);
+    glDeleteFramebuffers(1, &s_framebuffer);
+    s_cascadeTexture = s_spotTexture = s_pointTexture = s_framebuffer = 0;
+}
+
+void ShadowMaps::setSceneBounds(const glm::vec3& sceneMin, const glm::vec3& sceneMax)
+{
+    s_sceneMin = sceneMin;
+    s_sceneMax = sceneMax;
+    invalidate();
+}
+
+void ShadowMaps::invalidate()
+{
+    for (Placement& placement : s_cascades)
+        placement.m_valid = false;
+    for (Placement& placement : s_pointFaces)
+        placement.m_valid = false;
+    s_spot.m_valid = false;
+}
+
+void ShadowMaps::updateDirectional(const glm::vec3& lightDirection, const glm::mat4x4& cameraView, float fov, float aspect,
+    float nearPlane, float farPlane, const DrawCallback& draw)
+{
+    PROFILE_SCOPE("ShadowMaps::updateDirectional");
+    PROFILE_GPU_SCOPE("Shadow maps");
+    PassState passState;
+
+    // Rotation only, the cascades are placed in its xy plane
+    glm::vec3 direction = glm::normalize(lightDirection);
+    glm::mat4x4 lightView = glm::lookAt(glm::vec3(0.0f), direction, upVector(direction));
+
+    // The depth range covers the whole scene so casters outside a cascade's slice still cast into it
+    float minDepth = FLT_MAX;
+    float maxDepth = -FLT_MAX;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 position((corner & 1) ? s_sceneMax.x : s_sceneMin.x, (corner & 2) ? s_sceneMax.y : s_sceneMin.y,
+            (corner & 4) ? s_sceneMax.z : s_sceneMin.z);
+        float depth = -(lightView * glm::vec4(position, 1.0f)).z;
+        minDepth = std::min(minDepth, depth);
+        maxDepth = std::max(maxDepth, depth);
+    }
+    minDepth -= 1.0f;
+    maxDepth += 1.0f;
+
+    glm::mat4x4 cameraToWorld = glm::inverse(cameraView);
+    float tanY = tanf(fov * 0.5f);
+    float tanX = tanY * aspect;
+    float shadowFar = std::min(farPlane, ShadowDistance);
+    float sliceNear = nearPlane;
+    for (uint32_t i = 0; i < CascadeCount; i++)
+    {
+        float fraction = (float)(i + 1) / CascadeCount;
+        float logSplit = nearPlane * powf(shadowFar / nearPlane, fraction);
+        float uniformSplit = nearPlane + (shadowFar - nearPlane) * fraction;
+        float sliceFar = SplitLambda * logSplit + (1.0f - SplitLambda) * uniformSplit;
+
+        // Bounding sphere of the slice, centered on the view axis. It doesn't depend on the camera orientation,
+        // so turning the camera only moves the center.
+        float centerDepth = (sliceNear + sliceFar) * 0.5f;
+        glm::vec2 nearExtent(sliceNear * tanX, sliceNear * tanY);
+        glm::vec2 farExtent(sliceFar * tanX, sliceFar * tanY);
+        float radius = sqrtf(std::max(glm::dot(nearExtent, nearExtent) + (centerDepth - sliceNear) * (centerDepth - sliceNear),
+            glm::dot(farExtent, farExtent) + (sliceFar - centerDepth) * (sliceFar - centerDepth)));
+        glm::vec4 center = lightView * (cameraToWorld * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+
+        float snapStep = radius * CascadeSnapStep;
+        glm::vec2 snapped(floorf(center.x / snapStep + 0.5f) * snapStep, floorf(center.y / snapStep + 0.5f) * snapStep);
+        float halfExtent = radius * CascadePadding;
+        glm::mat4x4 projection = glm::ortho(snapped.x - halfExtent, snapped.x + halfExtent, snapped.y - halfExtent,
+            snapped.y + halfExtent, minDepth, maxDepth);
+        glm::mat4x4 viewProjection = projection * lightView;
+        updatePass(s_cascades[i], viewProjection, GL_TEXTURE_2D_ARRAY, s_cascadeTexture, (int)i, CascadeResolution, draw);
+        s_cascadeMatrices[i] = s_textureBias * viewProjection;
+        sliceNear = sliceFar;
+    }
+}
+
+void ShadowMaps::updateSpot(const glm::vec3& position, const glm::vec3& direction, float outerCone, const DrawCallback& draw)
+{
+    PROFILE_SCOPE("ShadowMaps::updateSpot");
+    PROFILE_GPU_SCOPE("Shadow maps");
+    PassState passState;
+
+    glm::vec3 lightDirection = glm::normalize(direction);
+    glm::mat4x4 view = glm::lookAt(position, position + lightDirection, upVector(lightDirection));
+    // A little wider than the cone so the filter taps at its edge stay inside the map
+    float fov = std::min(outerCone * 2.0f * 1.1f, 3.0f);
+    glm::mat4x4 projection = glm::perspective(fov, 1.0f, SpotNearPlane, farthestSceneDistance(position));
+    glm::mat4x4 viewProjection = projection * view;
+    updatePass(s_spot, viewProjection, GL_TEXTURE_2D, s_spotTexture, 0, SpotResolution, draw);
+    s_spotMatrix = s_textureBias * viewProjection;
+}
+
+void ShadowMaps::updatePoint(const glm::vec3& position, const DrawCallback& draw)
+{
+    PROFILE_SCOPE("ShadowMaps::updatePoint");
+    PROFILE_GPU_SCOPE("Shadow maps");
+    PassState passState;
+
+    // Cube map face orientations, the shader compares against the depth along the major axis
+    const glm::vec3 faceDirections[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+    const glm::vec3 faceUps[6] = {
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+
+    s_pointDepthRange = glm::vec2(PointNearPlane, farthestSceneDistance(position));
+    glm::mat4x4 projection = glm::perspective(1.5707963f, 1.0f, s_pointDepthRange.x, s_pointDepthRange.y);
+    for (int face = 0; face < 6; face++)
+    {
+        glm::mat4x4 view = glm::lookAt(position, position + faceDirections[face], faceUps[face]);
+        updatePass(s_pointFaces[face], projection * view, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, s_pointTexture, 0, PointResolution, draw);
+    }
+}
+
+const glm::mat4x4* ShadowMaps::cascadeMatrices()
+{
+    return s_cascadeMatrices;
+}
+
+const glm::mat4x4& ShadowMaps::spotMatrix()
+{
+    return s_spotMatrix;
+}
+
+glm::vec2 ShadowMaps::pointDepthRange()
+{
+    return s_pointDepthRange;
+}
+
+void ShadowMaps::bindTextures()
+{
+    glActiveTexture(GL_TEXTURE0 + CascadeTextureUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, s_cascadeTexture);
+    glActiveTexture(GL_TEXTURE0 + SpotTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, s_spotTexture);
+    glActiveTexture(GL_TEXTURE0 + PointTextureUnit);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, s_pointTexture);
+    FrameStats::add(FrameStats::Counter::TextureBinds, 3);
+}
+
+const Statistics& ShadowMaps::statistics()
+{
+    return s_statistics;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <functional>
+#include <inttypes.h>
+#include <string>
+#include "glm/glm.hpp"
+#include "GL/glew.h"
+
+// Shadow maps for the directional light (cascaded), the spot light and the point light (cube map). The scene is
+// static, so every map remembers the placement it was rendered with and is only rendered again when that changes:
+// the light moved, or a cascade had to follow the camera into a new cell of its snapping grid. Cascades cover a
+// padded area around their slice of the view frustum, so small camera movements keep reusing them.
+namespace ShadowMaps
+{
+    const uint32_t CascadeCount = 4;
+    const int CascadeResolution = 1024;
+    const int SpotResolution = 1024;
+    const int PointResolution = 512;
+
+    // Texture units of the maps, after the material textures
+    const GLuint CascadeTextureUnit = 4;
+    const GLuint SpotTextureUnit = 5;
+    const GLuint PointTextureUnit = 6;
+
+    struct Statistics
+    {
+        // Since init, one pass per cascade, spot map or cube face
+        uint64_t m_passesRendered = 0;
+        uint64_t m_passesSkipped = 0;
+        double m_lastRenderMs = 0.0;
+    };
+
+    // Draws the shadow casters with the given view-projection matrix into the bound depth buffer
+    typedef std::function<void(const glm::mat4x4& viewProjection)> DrawCallback;
+
+    // Needs a current GL context
+    bool init(std::string* errString);
+    void destroy();
+
+    // Bounds of the shadow casters, used for the depth ranges. Invalidates every map.
+    void setSceneBounds(const glm::vec3& sceneMin, const glm::vec3& sceneMax);
+    // Forces every map to be rendered again on its next update
+    void invalidate();
+
+    // Each update renders the passes whose placement changed and counts the others as skipped.
+    // cameraView and the projection parameters describe the camera the cascades are fitted to.
+    void updateDirectional(const glm::vec3& lightDirection, const glm::mat4x4& cameraView, float fov, float aspect,
+        float nearPlane, float farPlane, const DrawCallback& draw);
+    void updateSpot(const glm::vec3& position, const glm::vec3& direction, float outerCone, const DrawCallback& draw);
+    void updatePoint(const glm::vec3& position, const DrawCallback& draw);
+
+    // World to shadow texture space, xyz in [0, 1] inside the map
+    const glm::mat4x4* cascadeMatrices();
+    const glm::mat4x4& spotMatrix();
+    // Near and far plane of the cube map faces
+    glm::vec2 pointDepthRange();
+
+    void bindTextures();
+    const Statistics& statistics();
+}
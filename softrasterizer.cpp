@@ -0,0 +1,1107 @@
+#include "softrasterizer.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "GL/glew.h"
+#include "jobsystem.h"
+#include "memorytracker.h"
+#include "profiler.h"
+#include "util.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SOFTRASTER_SSE 1
+#endif
+
+using namespace SoftRasterizer;
+using namespace ObjLoader;
+
+namespace
+{
+    // Four floats, one per pixel of a 2x2 quad: (x, y), (x + 1, y), (x, y + 1), (x + 1, y + 1). SSE2 where available
+    // and plain loops otherwise, both round the same way.
+#ifdef SOFTRASTER_SSE
+    struct Float4
+    {
+        __m128 m;
+        Float4() {}
+        Float4(__m128 value) : m(value) {}
+        Float4(float value) : m(_mm_set1_ps(value)) {}
+        Float4(float a, float b, float c, float d) : m(_mm_setr_ps(a, b, c, d)) {}
+    };
+
+    // Result of a comparison, every bit of a lane is set where it holds
+    struct Mask4
+    {
+        __m128 m;
+    };
+
+    inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.m, b.m); }
+    inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.m, b.m); }
+    inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.m, b.m); }
+    inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.m, b.m); }
+    inline Float4 operator-(Float4 a) { return _mm_sub_ps(_mm_setzero_ps(), a.m); }
+    inline Float4 vmin(Float4 a, Float4 b) { return _mm_min_ps(a.m, b.m); }
+    inline Float4 vmax(Float4 a, Float4 b) { return _mm_max_ps(a.m, b.m); }
+    inline Float4 vsqrt(Float4 a) { return _mm_sqrt_ps(a.m); }
+    inline Mask4 less(Float4 a, Float4 b) { return { _mm_cmplt_ps(a.m, b.m) }; }
+    inline Mask4 greater(Float4 a, Float4 b) { return { _mm_cmpgt_ps(a.m, b.m) }; }
+    inline Mask4 greaterEqual(Float4 a, Float4 b) { return { _mm_cmpge_ps(a.m, b.m) }; }
+    inline Mask4 operator&(Mask4 a, Mask4 b) { return { _mm_and_ps(a.m, b.m) }; }
+    // Bit i is set if lane i of the mask is
+    inline int maskBits(Mask4 mask) { return _mm_movemask_ps(mask.m); }
+    // a where the mask lane is set, b elsewhere
+    inline Float4 select(Mask4 mask, Float4 a, Float4 b) { return _mm_or_ps(_mm_and_ps(mask.m, a.m), _mm_andnot_ps(mask.m, b.m)); }
+    inline float firstLane(Float4 a) { return _mm_cvtss_f32(a.m); }
+    inline void store(float* lanes, Float4 a) { _mm_storeu_ps(lanes, a.m); }
+
+    // Lane 1 minus lane 0 and lane 2 minus lane 0 in every lane, the coarse derivatives of a quad
+    inline Float4 ddx(Float4 a) { return _mm_sub_ps(_mm_shuffle_ps(a.m, a.m, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(a.m, a.m, 0)); }
+    inline Float4 ddy(Float4 a) { return _mm_sub_ps(_mm_shuffle_ps(a.m, a.m, _MM_SHUFFLE(2, 2, 2, 2)), _mm_shuffle_ps(a.m, a.m, 0)); }
+
+    // RGBA8 texel to one channel per lane in 0..255
+    inline Float4 unpackTexel(uint32_t texel)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i bytes = _mm_cvtsi32_si128((int)texel);
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+    }
+
+    inline void transpose(Float4 (&rows)[4]) { _MM_TRANSPOSE4_PS(rows[0].m, rows[1].m, rows[2].m, rows[3].m); }
+
+    // The two pixels of the quad in each row
+    inline Float4 loadQuad(const float* row0, const float* row1)
+    {
+        return _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)row0), (const __m64*)row1);
+    }
+
+    inline void storeQuad(float* row0, float* row1, Float4 a)
+    {
+        _mm_storel_pi((__m64*)row0, a.m);
+        _mm_storeh_pi((__m64*)row1, a.m);
+    }
+
+    // Truncates the channels, in 0..255, to RGBA8 and writes the pixels of the quad where the mask is set
+    inline void storeQuad(uint32_t* row0, uint32_t* row1, Mask4 mask, Float4 r, Float4 g, Float4 b, Float4 a)
+    {
+        __m128i rgba = _mm_or_si128(_mm_or_si128(_mm_cvttps_epi32(r.m), _mm_slli_epi32(_mm_cvttps_epi32(g.m), 8)),
+            _mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(b.m), 16), _mm_slli_epi32(_mm_cvttps_epi32(a.m), 24)));
+        __m128i color = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)row0), _mm_loadl_epi64((const __m128i*)row1));
+        __m128i keep = _mm_castps_si128(mask.m);
+        color = _mm_or_si128(_mm_and_si128(keep, rgba), _mm_andnot_si128(keep, color));
+        _mm_storel_epi64((__m128i*)row0, color);
+        _mm_storel_epi64((__m128i*)row1, _mm_unpackhi_epi64(color, color));
+    }
+#else
+    struct Float4
+    {
+        float m[4];
+        Float4() {}
+        Float4(float value) : m{ value, value, value, value } {}
+        Float4(float a, float b, float c, float d) : m{ a, b, c, d } {}
+    };
+
+    // Result of a comparison, bit i is set where it holds for lane i
+    struct Mask4
+    {
+        int m;
+    };
+
+#define FLOAT4_OP(name, expr) inline Float4 name(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.m[i] = expr; return r; }
+    FLOAT4_OP(operator+, a.m[i] + b.m[i])
+    FLOAT4_OP(operator-, a.m[i] - b.m[i])
+    FLOAT4_OP(operator*, a.m[i] * b.m[i])
+    FLOAT4_OP(operator/, a.m[i] / b.m[i])
+    FLOAT4_OP(vmin, a.m[i] < b.m[i] ? a.m[i] : b.m[i])
+    FLOAT4_OP(vmax, a.m[i] > b.m[i] ? a.m[i] : b.m[i])
+#undef FLOAT4_OP
+#define MASK4_OP(name, expr) inline Mask4 name(Float4 a, Float4 b) { Mask4 r = { 0 }; for (int i = 0; i < 4; i++) r.m |= (expr) << i; return r; }
+    MASK4_OP(less, a.m[i] < b.m[i])
+    MASK4_OP(greater, a.m[i] > b.m[i])
+    MASK4_OP(greaterEqual, a.m[i] >= b.m[i])
+#undef MASK4_OP
+    inline Float4 operator-(Float4 a) { return Float4(0.0f) - a; }
+    inline Float4 vsqrt(Float4 a) { return Float4(sqrtf(a.m[0]), sqrtf(a.m[1]), sqrtf(a.m[2]), sqrtf(a.m[3])); }
+    inline Mask4 operator&(Mask4 a, Mask4 b) { return { a.m & b.m }; }
+    inline int maskBits(Mask4 mask) { return mask.m; }
+    inline Float4 select(Mask4 mask, Float4 a, Float4 b)
+    {
+        Float4 r;
+        for (int i = 0; i < 4; i++)
+            r.m[i] = mask.m & (1 << i) ? a.m[i] : b.m[i];
+        return r;
+    }
+    inline float firstLane(Float4 a) { return a.m[0]; }
+    inline void store(float* lanes, Float4 a) { memcpy(lanes, a.m, sizeof(a.m)); }
+
+    inline Float4 ddx(Float4 a) { return Float4(a.m[1] - a.m[0]); }
+    inline Float4 ddy(Float4 a) { return Float4(a.m[2] - a.m[0]); }
+
+    inline Float4 unpackTexel(uint32_t texel)
+    {
+        return Float4((float)(texel & 0xFF), (float)((texel >> 8) & 0xFF), (float)((texel >> 16) & 0xFF), (float)(texel >> 24));
+    }
+
+    inline void transpose(Float4 (&rows)[4])
+    {
+        for (int i = 0; i < 4; i++)
+            for (int j = i + 1; j < 4; j++)
+                std::swap(rows[i].m[j], rows[j].m[i]);
+    }
+
+    inline Float4 loadQuad(const float* row0, const float* row1) { return Float4(row0[0], row0[1], row1[0], row1[1]); }
+
+    inline void storeQuad(float* row0, float* row1, Float4 a)
+    {
+        row0[0] = a.m[0];
+        row0[1] = a.m[1];
+        row1[0] = a.m[2];
+        row1[1] = a.m[3];
+    }
+
+    inline void storeQuad(uint32_t* row0, uint32_t* row1, Mask4 mask, Float4 r, Float4 g, Float4 b, Float4 a)
+    {
+        uint32_t* pixels[4] = { &row0[0], &row0[1], &row1[0], &row1[1] };
+        for (int i = 0; i < 4; i++)
+        {
+            if (mask.m & (1 << i))
+                *pixels[i] = (uint32_t)r.m[i] | ((uint32_t)g.m[i] << 8) | ((uint32_t)b.m[i] << 16) | ((uint32_t)a.m[i] << 24);
+        }
+    }
+#endif
+
+    inline Float4 vclamp(Float4 x, float low, float high) { return vmin(vmax(x, Float4(low)), Float4(high)); }
+
+    // Applies a scalar function without a SIMD version to every lane
+    inline Float4 perLane(Float4 a, float (*function)(float))
+    {
+        float lanes[4];
+        store(lanes, a);
+        return Float4(function(lanes[0]), function(lanes[1]), function(lanes[2]), function(lanes[3]));
+    }
+
+    struct Vec3x4
+    {
+        Float4 x, y, z;
+        Vec3x4() {}
+        Vec3x4(Float4 vx, Float4 vy, Float4 vz) : x(vx), y(vy), z(vz) {}
+        explicit Vec3x4(const glm::vec3& v) : x(v.x), y(v.y), z(v.z) {}
+    };
+
+    inline Vec3x4 operator+(const Vec3x4& a, const Vec3x4& b) { return Vec3x4(a.x + b.x, a.y + b.y, a.z + b.z); }
+    inline Vec3x4 operator-(const Vec3x4& a, const Vec3x4& b) { return Vec3x4(a.x - b.x, a.y - b.y, a.z - b.z); }
+    inline Vec3x4 operator*(const Vec3x4& a, Float4 s) { return Vec3x4(a.x * s, a.y * s, a.z * s); }
+    inline Vec3x4 operator*(const Vec3x4& a, const Vec3x4& b) { return Vec3x4(a.x * b.x, a.y * b.y, a.z * b.z); }
+    inline Vec3x4 operator-(const Vec3x4& a) { return Vec3x4(-a.x, -a.y, -a.z); }
+    inline Float4 dot(const Vec3x4& a, const Vec3x4& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline Vec3x4 cross(const Vec3x4& a, const Vec3x4& b)
+    {
+        return Vec3x4(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    }
+    inline Vec3x4 normalize(const Vec3x4& a) { return a * (Float4(1.0f) / vsqrt(dot(a, a))); }
+
+    struct Level
+    {
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        // RGBA8, the first row is the first row of the image like in GL
+        std::vector<uint32_t> m_texels;
+    };
+
+    struct Texture
+    {
+        std::vector<Level> m_levels;
+    };
+
+    // The textures bound for a material by the GL renderer, with the same defaults for missing maps
+    struct MaterialTextures
+    {
+        const Texture* m_diffuse = nullptr;
+        const Texture* m_normal = nullptr;
+        const Texture* m_specularColor = nullptr;
+        const Texture* m_specularPower = nullptr;
+        bool m_alphaTest = false;
+        bool m_normalMap = false;
+    };
+
+    struct ClipVertex
+    {
+        glm::vec4 m_clip;
+        glm::vec3 m_world;
+        glm::vec3 m_normal;
+        glm::vec2 m_texCoord;
+        glm::vec4 m_tangent;
+    };
+
+    // Values interpolated over a triangle: window depth and 1 / w linearly, the attributes divided by w
+    enum Plane
+    {
+        PlaneDepth,
+        PlaneInvW,
+        PlaneWorldX,
+        PlaneWorldY,
+        PlaneWorldZ,
+        PlaneNormalX,
+        PlaneNormalY,
+        PlaneNormalZ,
+        PlaneU,
+        PlaneV,
+        PlaneTangentX,
+        PlaneTangentY,
+        PlaneTangentZ,
+        PlaneTangentW,
+        PlaneCount
+    };
+
+    struct Triangle
+    {
+        // Edge i covers (x, y) where m_edgeDx[i] * (y - m_edgeY[i]) - m_edgeDy[i] * (x - m_edgeX[i]) is positive,
+        // or zero on the inclusive edges
+        float m_edgeX[3];
+        float m_edgeY[3];
+        float m_edgeDx[3];
+        float m_edgeDy[3];
+        bool m_edgeInclusive[3];
+        // Value, x and y gradient of every plane relative to the origin
+        float m_originX;
+        float m_originY;
+        float m_planes[PlaneCount][3];
+        // Pixels of the bounding box, clamped to the viewport
+        int32_t m_minX, m_minY, m_maxX, m_maxY;
+        const MaterialTextures* m_material;
+    };
+
+    // A range of a submesh's triangles, set up by one job and binned into the tiles they touch
+    struct Batch
+    {
+        uint32_t m_mesh = 0;
+        const SubMesh* m_subMesh = nullptr;
+        uint32_t m_first = 0;
+        uint32_t m_count = 0;
+        std::vector<Triangle> m_triangles;
+        // Triangle indices per tile, in submission order
+        std::vector<std::vector<uint32_t>> m_bins;
+    };
+
+    // Triangles per batch, small enough to spread a submesh over the threads
+    const uint32_t BatchTriangles = 4096;
+    // Vertices are snapped to 1/16 pixel, so the edge tests of neighbouring triangles see the same coordinates
+    const float SubpixelSteps = 16.0f;
+    // Triangles are only clipped against the sides this many viewports away, keeping the snapped coordinates exact
+    const float GuardBand = 16.0f;
+    const float AlphaTestThreshold = 0.1f;
+
+    std::map<std::string, std::unique_ptr<Texture>> s_textures;
+    std::unordered_map<const Material*, MaterialTextures> s_materials;
+    Texture s_blackTexture;
+    Texture s_whiteTexture;
+    Texture s_flatNormalTexture;
+    MaterialTextures s_noMaterial;
+    const ObjectFile* s_textureObject = nullptr;
+
+    std::vector<std::vector<ClipVertex>> s_vertices;
+    std::vector<Batch> s_batches;
+    glm::mat4x4 s_viewProjection;
+    Lighting s_lighting;
+
+    // Rounded up to whole quads, so a quad never reads outside the buffers
+    std::vector<uint32_t> s_color;
+    std::vector<float> s_depth;
+    uint32_t s_width = 0;
+    uint32_t s_height = 0;
+    uint32_t s_stride = 0;
+    uint32_t s_tilesX = 0;
+    uint32_t s_tilesY = 0;
+
+    GLuint s_presentTexture = 0;
+    GLuint s_presentFramebuffer = 0;
+    uint32_t s_presentWidth = 0;
+    uint32_t s_presentHeight = 0;
+    Statistics s_statistics;
+
+    double toMs(uint64_t ns)
+    {
+        return (double)ns / 1000000.0;
+    }
+
+    Texture solidTexture(uint32_t rgba)
+    {
+        Texture texture;
+        Level level;
+        level.m_width = 1;
+        level.m_height = 1;
+        level.m_texels.push_back(rgba);
+        texture.m_levels.push_back(level);
+        return texture;
+    }
+
+    // Box filtered chain down to 1x1 like glGenerateMipmap, odd sizes drop their last row or column
+    void buildMipChain(Texture& texture)
+    {
+        while (texture.m_levels.back().m_width > 1 || texture.m_levels.back().m_height > 1)
+        {
+            const Level& source = texture.m_levels.back();
+            Level level;
+            level.m_width = std::max(1u, source.m_width / 2);
+            level.m_height = std::max(1u, source.m_height / 2);
+            level.m_texels.resize((size_t)level.m_width * level.m_height);
+            for (uint32_t y = 0; y < level.m_height; y++)
+            {
+                uint32_t y0 = std::min(y * 2, source.m_height - 1);
+                uint32_t y1 = std::min(y * 2 + 1, source.m_height - 1);
+                for (uint32_t x = 0; x < level.m_width; x++)
+                {
+                    uint32_t x0 = std::min(x * 2, source.m_width - 1);
+                    uint32_t x1 = std::min(x * 2 + 1, source.m_width - 1);
+                    const uint32_t texels[4] = { source.m_texels[y0 * source.m_width + x0], source.m_texels[y0 * source.m_width + x1],
+                        source.m_texels[y1 * source.m_width + x0], source.m_texels[y1 * source.m_width + x1] };
+                    uint32_t result = 0;
+                    for (int channel = 0; channel < 4; channel++)
+                    {
+                        uint32_t sum = 2;
+                        for (uint32_t texel : texels)
+                            sum += (texel >> (channel * 8)) & 0xFF;
+                        result |= (sum / 4) << (channel * 8);
+                    }
+                    level.m_texels[y * level.m_width + x] = result;
+                }
+            }
+            texture.m_levels.push_back(std::move(level));
+        }
+    }
+
+    // Decodes every texture the materials of object use, as jobs
+    void loadTextures(const ObjectFile& object)
+    {
+        PROFILE_SCOPE("SoftRasterizer::loadTextures");
+        s_textures.clear();
+        s_materials.clear();
+        s_blackTexture = solidTexture(0xFF000000);
+        s_whiteTexture = solidTexture(0xFFFFFFFF);
+        s_flatNormalTexture = solidTexture(0xFFFF8080);
+        s_noMaterial.m_diffuse = &s_blackTexture;
+        s_noMaterial.m_normal = &s_flatNormalTexture;
+        s_noMaterial.m_specularColor = &s_whiteTexture;
+        s_noMaterial.m_specularPower = &s_whiteTexture;
+
+        // Resolved like ObjectFile::initGraphics() does
+        auto texturePath = [&object](const std::string& filename)
+        {
+            std::string path = Util::combinePath(object.dataPath().c_str(), filename.c_str());
+            std::replace(path.begin(), path.end(), '\\', '/');
+            return path;
+        };
+        std::vector<std::string> paths;
+        for (auto& iter : object.materials())
+        {
+            const Material& material = *iter.second;
+            for (const std::string* map : { &material.m_diffuseMap, &material.m_bumpMap, &material.m_specularColorMap, &material.m_specularMap })
+            {
+                if (map->length() && !s_textures.count(texturePath(*map)))
+                {
+                    paths.push_back(texturePath(*map));
+                    s_textures[paths.back()] = nullptr;
+                }
+            }
+        }
+
+        std::vector<std::unique_ptr<Texture>> textures(paths.size());
+        JobSystem::parallelFor("Decode texture", (uint32_t)paths.size(), 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                Image image;
+                if (!loadPngImage(paths[i].c_str(), image))
+                    continue;
+                std::unique_ptr<Texture> texture = std::make_unique<Texture>();
+                Level level;
+                level.m_width = image.m_width;
+                level.m_height = image.m_height;
+                level.m_texels.resize((size_t)image.m_width * image.m_height);
+                memcpy(level.m_texels.data(), image.m_pixels.data(), level.m_texels.size() * sizeof(uint32_t));
+                texture->m_levels.push_back(std::move(level));
+                buildMipChain(*texture);
+                textures[i] = std::move(texture);
+            }
+        });
+        for (size_t i = 0; i < paths.size(); i++)
+            s_textures[paths[i]] = std::move(textures[i]);
+
+        auto find = [&](const std::string& filename, const Texture* fallback) -> const Texture*
+        {
+            if (filename.empty())
+                return fallback;
+            const std::unique_ptr<Texture>& texture = s_textures[texturePath(filename)];
+            return texture ? texture.get() : fallback;
+        };
+        for (auto& iter : object.materials())
+        {
+            const Material& material = *iter.second;
+            MaterialTextures textures;
+            textures.m_diffuse = find(material.m_diffuseMap, &s_blackTexture);
+            textures.m_normal = find(material.m_bumpMap, &s_flatNormalTexture);
+            textures.m_specularColor = find(material.m_specularColorMap, &s_whiteTexture);
+            textures.m_specularPower = find(material.m_specularMap, &s_whiteTexture);
+            textures.m_alphaTest = material.m_diffuseHasAlpha;
+            textures.m_normalMap = textures.m_normal != &s_flatNormalTexture;
+            s_materials[&material] = textures;
+        }
+        s_textureObject = &object;
+    }
+
+    // RGBA in 0..255, repeat wrapping
+    inline Float4 sampleBilinear(const Level& level, float u, float v)
+    {
+        u -= floorf(u);
+        v -= floorf(v);
+        float x = u * level.m_width - 0.5f;
+        float y = v * level.m_height - 0.5f;
+        float fx = floorf(x);
+        float fy = floorf(y);
+        int x0 = (int)fx;
+        int y0 = (int)fy;
+        int x1 = x0 + 1;
+        int y1 = y0 + 1;
+        int width = (int)level.m_width;
+        int height = (int)level.m_height;
+        x0 = x0 < 0 ? width - 1 : x0;
+        y0 = y0 < 0 ? height - 1 : y0;
+        x1 = x1 >= width ? 0 : x1;
+        y1 = y1 >= height ? 0 : y1;
+        const uint32_t* row0 = &level.m_texels[(size_t)y0 * width];
+        const uint32_t* row1 = &level.m_texels[(size_t)y1 * width];
+        Float4 ax(x - fx);
+        Float4 ay(y - fy);
+        Float4 t00 = unpackTexel(row0[x0]);
+        Float4 t10 = unpackTexel(row0[x1]);
+        Float4 t01 = unpackTexel(row1[x0]);
+        Float4 t11 = unpackTexel(row1[x1]);
+        Float4 top = t00 + (t10 - t00) * ax;
+        Float4 bottom = t01 + (t11 - t01) * ax;
+        return top + (bottom - top) * ay;
+    }
+
+    struct Color4
+    {
+        Float4 r, g, b, a;
+    };
+
+    // Trilinear sample of all four pixels with the LOD of the quad, like GL_LINEAR_MIPMAP_LINEAR without anisotropy
+    Color4 sampleQuad(const Texture& texture, Float4 u, Float4 v)
+    {
+        const Level& base = texture.m_levels[0];
+        Float4 dudx = ddx(u) * Float4((float)base.m_width);
+        Float4 dvdx = ddx(v) * Float4((float)base.m_height);
+        Float4 dudy = ddy(u) * Float4((float)base.m_width);
+        Float4 dvdy = ddy(v) * Float4((float)base.m_height);
+        float rho2 = firstLane(vmax(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy));
+        float lod = rho2 > 0.0f ? 0.5f * log2f(rho2) : 0.0f;
+        int maxLevel = (int)texture.m_levels.size() - 1;
+
+        float us[4];
+        float vs[4];
+        store(us, u);
+        store(vs, v);
+        Float4 texels[4];
+        if (lod <= 0.0f || maxLevel == 0)
+        {
+            // Magnified
+            for (int lane = 0; lane < 4; lane++)
+                texels[lane] = sampleBilinear(base, us[lane], vs[lane]);
+        }
+        else if (lod >= (float)maxLevel)
+        {
+            for (int lane = 0; lane < 4; lane++)
+                texels[lane] = sampleBilinear(texture.m_levels[maxLevel], us[lane], vs[lane]);
+        }
+        else
+        {
+            int level = (int)lod;
+            Float4 weight(lod - (float)level);
+            const Level& fine = texture.m_levels[level];
+            const Level& coarse = texture.m_levels[level + 1];
+            for (int lane = 0; lane < 4; lane++)
+            {
+                Float4 a = sampleBilinear(fine, us[lane], vs[lane]);
+                Float4 b = sampleBilinear(coarse, us[lane], vs[lane]);
+                texels[lane] = a + (b - a) * weight;
+            }
+        }
+        // One texel per register to one channel per register
+        transpose(texels);
+        Float4 scale(1.0f / 255.0f);
+        Color4 color;
+        color.r = texels[0] * scale;
+        color.g = texels[1] * scale;
+        color.b = texels[2] * scale;
+        color.a = texels[3] * scale;
+        return color;
+    }
+
+    Float4 evaluate(const Triangle& tri, Plane plane, Float4 x, Float4 y)
+    {
+        const float* p = tri.m_planes[plane];
+        return Float4(p[0]) + Float4(p[1]) * x + Float4(p[2]) * y;
+    }
+
+    // perturbNormal() of lighting.glsl: vertexNormal and tangent are interpolated and not normalized, normal is the
+    // normalized one returned where they give no frame
+    Vec3x4 perturbNormal(const Vec3x4& normal, const Vec3x4& vertexNormal, const Vec3x4& tangent, Float4 handedness,
+        Float4 u, Float4 v, const Texture& normalTexture)
+    {
+        Mask4 mirrored = less(handedness, Float4(0.0f));
+        Vec3x4 bitangent = cross(vertexNormal, tangent) * select(mirrored, Float4(-1.0f), Float4(1.0f));
+
+        Color4 map = sampleQuad(normalTexture, u, v);
+        Vec3x4 mapNormal(map.r * Float4(2.0f) - Float4(1.0f), map.g * Float4(2.0f) - Float4(1.0f), map.b * Float4(2.0f) - Float4(1.0f));
+        Vec3x4 perturbed = tangent * mapNormal.x + bitangent * mapNormal.y + vertexNormal * mapNormal.z;
+        Float4 length = dot(perturbed, perturbed);
+        Mask4 valid = greater(length, Float4(0.0f));
+        Float4 scale = Float4(1.0f) / vsqrt(select(valid, length, Float4(1.0f)));
+        perturbed = perturbed * scale;
+        return Vec3x4(select(valid, perturbed.x, normal.x), select(valid, perturbed.y, normal.y), select(valid, perturbed.z, normal.z));
+    }
+
+    Float4 powLanes(Float4 base, Float4 exponent)
+    {
+        float b[4];
+        float e[4];
+        store(b, base);
+        store(e, exponent);
+        return Float4(powf(b[0], e[0]), powf(b[1], e[1]), powf(b[2], e[2]), powf(b[3], e[3]));
+    }
+
+    // Shades the covered pixels of the quad at (x, y) that pass the depth test, returns how many were written
+    uint32_t shadeQuad(const Triangle& tri, int x, int y, Mask4 mask)
+    {
+        Float4 px((float)x + 0.5f, (float)x + 1.5f, (float)x + 0.5f, (float)x + 1.5f);
+        Float4 py((float)y + 0.5f, (float)y + 0.5f, (float)y + 1.5f, (float)y + 1.5f);
+
+        float* depthRow0 = &s_depth[(size_t)y * s_stride + x];
+        float* depthRow1 = depthRow0 + s_stride;
+        Float4 depth = loadQuad(depthRow0, depthRow1);
+        Float4 z = evaluate(tri, PlaneDepth, px, py);
+        mask = mask & less(z, depth);
+        if (!maskBits(mask))
+            return 0;
+
+        // Perspective-correct attributes, the helper pixels outside the triangle are extrapolated like on a GPU
+        Float4 w = Float4(1.0f) / evaluate(tri, PlaneInvW, px, py);
+        Vec3x4 world(evaluate(tri, PlaneWorldX, px, py) * w, evaluate(tri, PlaneWorldY, px, py) * w, evaluate(tri, PlaneWorldZ, px, py) * w);
+        Vec3x4 normal(evaluate(tri, PlaneNormalX, px, py) * w, evaluate(tri, PlaneNormalY, px, py) * w, evaluate(tri, PlaneNormalZ, px, py) * w);
+        Float4 u = evaluate(tri, PlaneU, px, py) * w;
+        Float4 v = evaluate(tri, PlaneV, px, py) * w;
+
+        const MaterialTextures& material = *tri.m_material;
+        Color4 diffuse = sampleQuad(*material.m_diffuse, u, v);
+        if (material.m_alphaTest)
+        {
+            mask = mask & greaterEqual(diffuse.a, Float4(AlphaTestThreshold));
+            if (!maskBits(mask))
+                return 0;
+        }
+
+        const Lighting& lighting = s_lighting;
+        Vec3x4 light(lighting.m_ambientColor);
+        if (lighting.m_type != LightType::Ambient)
+        {
+            Vec3x4 vertexNormal = normal;
+            normal = normalize(normal);
+            if (material.m_normalMap)
+            {
+                Vec3x4 tangent(evaluate(tri, PlaneTangentX, px, py) * w, evaluate(tri, PlaneTangentY, px, py) * w,
+                    evaluate(tri, PlaneTangentZ, px, py) * w);
+                normal = perturbNormal(normal, vertexNormal, tangent, evaluate(tri, PlaneTangentW, px, py) * w, u, v, *material.m_normal);
+            }
+
+            Vec3x4 lightToSurface;
+            Float4 gradient(1.0f);
+            if (lighting.m_type == LightType::Directional)
+            {
+                lightToSurface = Vec3x4(lighting.m_lightDirection);
+            }
+            else if (lighting.m_type == LightType::Spot)
+            {
+                lightToSurface = Vec3x4(lighting.m_lightDirection);
+                Float4 cosAngle = dot(normalize(world - Vec3x4(lighting.m_lightPosition)), lightToSurface);
+                Float4 angle = perLane(vclamp(cosAngle, -1.0f, 1.0f), acosf);
+                float range = lighting.m_outerCone - lighting.m_innerCone;
+                gradient = Float4(1.0f) - (vclamp(angle, lighting.m_innerCone, lighting.m_outerCone) - Float4(lighting.m_innerCone)) / Float4(range);
+            }
+            else
+            {
+                Vec3x4 surfaceToLight = Vec3x4(lighting.m_lightPosition) - world;
+                Float4 distance = vsqrt(dot(surfaceToLight, surfaceToLight));
+                lightToSurface = -surfaceToLight * (Float4(1.0f) / distance);
+                Float4 ratio = Float4(5.0f) * vmin(distance, Float4(lighting.m_outerRadius)) / Float4(lighting.m_outerRadius);
+                gradient = Float4(1.0f) / (ratio * ratio + Float4(1.0f));
+            }
+
+            Float4 NdotL = vclamp(-dot(normal, lightToSurface), 0.0f, 1.0f);
+            light = light + Vec3x4(lighting.m_lightColor) * (gradient * NdotL);
+            if (lighting.m_specularMultiplier > 0.0f)
+            {
+                Color4 specularColor = sampleQuad(*material.m_specularColor, u, v);
+                Color4 specularPower = sampleQuad(*material.m_specularPower, u, v);
+                Vec3x4 reflection = lightToSurface - normal * (Float4(2.0f) * dot(normal, lightToSurface));
+                Vec3x4 viewDir = normalize(Vec3x4(lighting.m_cameraPosition) - world);
+                Float4 RdotV = vmax(dot(reflection, viewDir), Float4(0.0f));
+                Float4 specular = powLanes(RdotV, specularPower.r * Float4(lighting.m_shininess)) * gradient * Float4(lighting.m_specularMultiplier);
+                light = light + Vec3x4(specularColor.r, specularColor.g, specularColor.b) * specular;
+            }
+        }
+
+        // To RGBA8 with rounding, like the GL framebuffer conversion
+        Float4 half(0.5f);
+        Float4 scale(255.0f);
+        uint32_t* colorRow0 = &s_color[(size_t)y * s_stride + x];
+        uint32_t* colorRow1 = colorRow0 + s_stride;
+        storeQuad(colorRow0, colorRow1, mask, vclamp(light.x * diffuse.r, 0.0f, 1.0f) * scale + half,
+            vclamp(light.y * diffuse.g, 0.0f, 1.0f) * scale + half, vclamp(light.z * diffuse.b, 0.0f, 1.0f) * scale + half,
+            vclamp(diffuse.a, 0.0f, 1.0f) * scale + half);
+        storeQuad(depthRow0, depthRow1, select(mask, z, depth));
+
+        static const uint8_t s_bitCounts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+        return s_bitCounts[maskBits(mask)];
+    }
+
+    // Clears the tile and draws the triangles binned into it, in submission order
+    uint64_t rasterizeTile(uint32_t tile)
+    {
+        int tileX = (int)((tile % s_tilesX) * TileSize);
+        int tileY = (int)((tile / s_tilesX) * TileSize);
+        int tileEndX = std::min(tileX + (int)TileSize, (int)s_stride);
+        int tileEndY = std::min(tileY + (int)TileSize, (int)((s_height + 1) & ~1u));
+        for (int y = tileY; y < tileEndY; y++)
+        {
+            std::fill_n(&s_color[(size_t)y * s_stride + tileX], tileEndX - tileX, 0u);
+            std::fill_n(&s_depth[(size_t)y * s_stride + tileX], tileEndX - tileX, 1.0f);
+        }
+
+        // Lanes of pixels outside the viewport in the last column and row of quads
+        Float4 laneX(0.0f, 1.0f, 0.0f, 1.0f);
+        Float4 laneY(0.0f, 0.0f, 1.0f, 1.0f);
+        uint64_t pixels = 0;
+        for (const Batch& batch : s_batches)
+        {
+            for (uint32_t index : batch.m_bins[tile])
+            {
+                const Triangle& tri = batch.m_triangles[index];
+                int startX = std::max(tri.m_minX, tileX) & ~1;
+                int startY = std::max(tri.m_minY, tileY) & ~1;
+                int endX = std::min(tri.m_maxX + 1, tileEndX);
+                int endY = std::min(tri.m_maxY + 1, tileEndY);
+                for (int y = startY; y < endY; y += 2)
+                {
+                    Float4 py = Float4((float)y + 0.5f) + laneY;
+                    Mask4 rowMask = less(Float4((float)y) + laneY, Float4((float)s_height));
+                    for (int x = startX; x < endX; x += 2)
+                    {
+                        Float4 px = Float4((float)x + 0.5f) + laneX;
+                        Mask4 mask = rowMask & less(Float4((float)x) + laneX, Float4((float)s_width));
+                        for (int edge = 0; edge < 3 && maskBits(mask); edge++)
+                        {
+                            Float4 value = Float4(tri.m_edgeDx[edge]) * (py - Float4(tri.m_edgeY[edge])) -
+                                Float4(tri.m_edgeDy[edge]) * (px - Float4(tri.m_edgeX[edge]));
+                            Mask4 inside = tri.m_edgeInclusive[edge] ? greaterEqual(value, Float4(0.0f)) : greater(value, Float4(0.0f));
+                            mask = mask & inside;
+                        }
+                        if (maskBits(mask))
+                            pixels += shadeQuad(tri, x, y, mask);
+                    }
+                }
+            }
+        }
+        return pixels;
+    }
+
+    ClipVertex lerp(const ClipVertex& a, const ClipVertex& b, float t)
+    {
+        ClipVertex result;
+        result.m_clip = a.m_clip + (b.m_clip - a.m_clip) * t;
+        result.m_world = a.m_world + (b.m_world - a.m_world) * t;
+        result.m_normal = a.m_normal + (b.m_normal - a.m_normal) * t;
+        result.m_texCoord = a.m_texCoord + (b.m_texCoord - a.m_texCoord) * t;
+        result.m_tangent = a.m_tangent + (b.m_tangent - a.m_tangent) * t;
+        return result;
+    }
+
+    // Near plane and guard band, positive inside
+    const int ClipPlaneCount = 5;
+    float clipDistance(const glm::vec4& clip, int plane)
+    {
+        switch (plane)
+        {
+        case 0: return clip.z + clip.w;
+        case 1: return GuardBand * clip.w - clip.x;
+        case 2: return GuardBand * clip.w + clip.x;
+        case 3: return GuardBand * clip.w - clip.y;
+        default: return GuardBand * clip.w + clip.y;
+        }
+    }
+
+    // Sets up a triangle that is in front of the near plane and inside the guard band. Returns false if it covers
+    // no pixel center.
+    bool setupTriangle(const ClipVertex* vertices[3], const MaterialTextures* material, Triangle& tri)
+    {
+        float sx[3], sy[3];
+        float values[PlaneCount][3];
+        for (int i = 0; i < 3; i++)
+        {
+            const ClipVertex& v = *vertices[i];
+            float invW = 1.0f / v.m_clip.w;
+            sx[i] = roundf(((v.m_clip.x * invW) * 0.5f + 0.5f) * s_width * SubpixelSteps) / SubpixelSteps;
+            sy[i] = roundf(((v.m_clip.y * invW) * 0.5f + 0.5f) * s_height * SubpixelSteps) / SubpixelSteps;
+            values[PlaneDepth][i] = (v.m_clip.z * invW) * 0.5f + 0.5f;
+            values[PlaneInvW][i] = invW;
+            values[PlaneWorldX][i] = v.m_world.x * invW;
+            values[PlaneWorldY][i] = v.m_world.y * invW;
+            values[PlaneWorldZ][i] = v.m_world.z * invW;
+            values[PlaneNormalX][i] = v.m_normal.x * invW;
+            values[PlaneNormalY][i] = v.m_normal.y * invW;
+            values[PlaneNormalZ][i] = v.m_normal.z * invW;
+            values[PlaneU][i] = v.m_texCoord.x * invW;
+            values[PlaneV][i] = v.m_texCoord.y * invW;
+            values[PlaneTangentX][i] = v.m_tangent.x * invW;
+            values[PlaneTangentY][i] = v.m_tangent.y * invW;
+            values[PlaneTangentZ][i] = v.m_tangent.z * invW;
+            values[PlaneTangentW][i] = v.m_tangent.w * invW;
+        }
+
+        // Exact for snapped coordinates
+        double area = ((double)sx[1] - sx[0]) * ((double)sy[2] - sy[0]) - ((double)sx[2] - sx[0]) * ((double)sy[1] - sy[0]);
+        if (area == 0.0)
+            return false;
+        tri.m_minX = std::max(0, (int)floorf(std::min(sx[0], std::min(sx[1], sx[2]))));
+        tri.m_minY = std::max(0, (int)floorf(std::min(sy[0], std::min(sy[1], sy[2]))));
+        tri.m_maxX = std::min((int)s_width - 1, (int)ceilf(std::max(sx[0], std::max(sx[1], sx[2]))));
+        tri.m_maxY = std::min((int)s_height - 1, (int)ceilf(std::max(sy[0], std::max(sy[1], sy[2]))));
+        if (tri.m_minX > tri.m_maxX || tri.m_minY > tri.m_maxY)
+            return false;
+
+        for (int edge = 0; edge < 3; edge++)
+        {
+            // Both triangles of a shared edge evaluate it from its lower vertex, so they see the same values with
+            // opposite signs and a pixel center on the edge belongs to exactly one of them
+            int a = edge;
+            int b = (edge + 1) % 3;
+            float sign = area > 0.0 ? 1.0f : -1.0f;
+            if (sy[b] < sy[a] || (sy[b] == sy[a] && sx[b] < sx[a]))
+            {
+                std::swap(a, b);
+                sign = -sign;
+            }
+            tri.m_edgeX[edge] = sx[a];
+            tri.m_edgeY[edge] = sy[a];
+            tri.m_edgeDx[edge] = (sx[b] - sx[a]) * sign;
+            tri.m_edgeDy[edge] = (sy[b] - sy[a]) * sign;
+            tri.m_edgeInclusive[edge] = tri.m_edgeDy[edge] > 0.0f || (tri.m_edgeDy[edge] == 0.0f && tri.m_edgeDx[edge] < 0.0f);
+        }
+
+        float dx1 = sx[1] - sx[0], dy1 = sy[1] - sy[0];
+        float dx2 = sx[2] - sx[0], dy2 = sy[2] - sy[0];
+        float invArea = (float)(1.0 / area);
+        tri.m_originX = sx[0];
+        tri.m_originY = sy[0];
+        for (int plane = 0; plane < PlaneCount; plane++)
+        {
+            float d1 = values[plane][1] - values[plane][0];
+            float d2 = values[plane][2] - values[plane][0];
+            float gradientX = (d1 * dy2 - d2 * dy1) * invArea;
+            float gradientY = (d2 * dx1 - d1 * dx2) * invArea;
+            // Stored relative to the pixel origin, so the quads evaluate it without the triangle origin
+            tri.m_planes[plane][0] = values[plane][0] - gradientX * sx[0] - gradientY * sy[0];
+            tri.m_planes[plane][1] = gradientX;
+            tri.m_planes[plane][2] = gradientY;
+        }
+        tri.m_material = material;
+        return true;
+    }
+
+    void addTriangle(Batch& batch, const ClipVertex* vertices[3], const MaterialTextures* material)
+    {
+        Triangle tri;
+        if (!setupTriangle(vertices, material, tri))
+            return;
+        uint32_t index = (uint32_t)batch.m_triangles.size();
+        batch.m_triangles.push_back(tri);
+        for (uint32_t tileY = tri.m_minY / TileSize; tileY <= tri.m_maxY / TileSize; tileY++)
+        {
+            for (uint32_t tileX = tri.m_minX / TileSize; tileX <= tri.m_maxX / TileSize; tileX++)
+                batch.m_bins[tileY * s_tilesX + tileX].push_back(index);
+        }
+    }
+
+    // Culls, clips and sets up the triangles of a batch
+    void setupBatch(Batch& batch)
+    {
+        batch.m_triangles.clear();
+        batch.m_bins.resize(s_tilesX * s_tilesY);
+        for (std::vector<uint32_t>& bin : batch.m_bins)
+            bin.clear();
+
+        const std::vector<ClipVertex>& vertices = s_vertices[batch.m_mesh];
+        const std::vector<unsigned int>& indices = batch.m_subMesh->m_indices;
+        auto material = s_materials.find(batch.m_subMesh->m_material);
+        const MaterialTextures* textures = material != s_materials.end() ? &material->second : &s_noMaterial;
+        for (uint32_t i = batch.m_first; i < batch.m_first + batch.m_count; i++)
+        {
+            const ClipVertex* triangle[3] = { &vertices[indices[i * 3]], &vertices[indices[i * 3 + 1]], &vertices[indices[i * 3 + 2]] };
+
+            // Entirely outside one of the frustum planes
+            bool outside = false;
+            uint32_t clipMask = 0;
+            for (int plane = 0; plane < 6 && !outside; plane++)
+            {
+                int component = plane / 2;
+                float side = plane & 1 ? -1.0f : 1.0f;
+                outside = true;
+                for (int v = 0; v < 3; v++)
+                    outside = outside && side * triangle[v]->m_clip[component] > triangle[v]->m_clip.w;
+            }
+            if (outside)
+                continue;
+            for (int plane = 0; plane < ClipPlaneCount; plane++)
+            {
+                for (int v = 0; v < 3; v++)
+                {
+                    if (clipDistance(triangle[v]->m_clip, plane) < 0.0f)
+                        clipMask |= 1u << plane;
+                }
+            }
+            if (!clipMask)
+            {
+                addTriangle(batch, triangle, textures);
+                continue;
+            }
+
+            // Clipped into a convex polygon and drawn as a fan
+            ClipVertex polygon[2][3 + ClipPlaneCount];
+            int count = 3;
+            for (int v = 0; v < 3; v++)
+                polygon[0][v] = *triangle[v];
+            int current = 0;
+            for (int plane = 0; plane < ClipPlaneCount && count >= 3; plane++)
+            {
+                if (!(clipMask & (1u << plane)))
+                    continue;
+                int next = 0;
+                for (int v = 0; v < count; v++)
+                {
+                    const ClipVertex& a = polygon[current][v];
+                    const ClipVertex& b = polygon[current][(v + 1) % count];
+                    float da = clipDistance(a.m_clip, plane);
+                    float db = clipDistance(b.m_clip, plane);
+                    if (da >= 0.0f)
+                        polygon[1 - current][next++] = a;
+                    if ((da >= 0.0f) != (db >= 0.0f))
+                        polygon[1 - current][next++] = lerp(a, b, da / (da - db));
+                }
+                current = 1 - current;
+                count = next;
+            }
+            for (int v = 1; v + 1 < count; v++)
+            {
+                const ClipVertex* fan[3] = { &polygon[current][0], &polygon[current][v], &polygon[current][v + 1] };
+                addTriangle(batch, fan, textures);
+            }
+        }
+    }
+
+    void resize(uint32_t width, uint32_t height)
+    {
+        if (width == s_width && height == s_height)
+            return;
+        s_width = width;
+        s_height = height;
+        s_stride = (width + 1) & ~1u;
+        s_tilesX = (width + TileSize - 1) / TileSize;
+        s_tilesY = (height + TileSize - 1) / TileSize;
+        size_t size = (size_t)s_stride * ((height + 1) & ~1u);
+        s_color.assign(size, 0);
+        s_depth.assign(size, 1.0f);
+    }
+}
+
+void SoftRasterizer::destroy()
+{
+    s_textures.clear();
+    s_materials.clear();
+    s_textureObject = nullptr;
+    s_vertices.clear();
+    s_batches.clear();
+    s_color.clear();
+    s_depth.clear();
+    s_width = s_height = s_stride = 0;
+    if (s_presentFramebuffer)
+        glDeleteFramebuffers(1, &s_presentFramebuffer);
+    if (s_presentTexture)
+    {
+        MemoryTracker::untrackTexture(s_presentTexture);
+        glDeleteTextures(1, &s_presentTexture);
+    }
+    s_presentFramebuffer = 0;
+    s_presentTexture = 0;
+    s_presentWidth = s_presentHeight = 0;
+    s_statistics = Statistics();
+}
+
+void SoftRasterizer::render(const ObjectFile& object, const glm::mat4x4& viewProjection, const Lighting& lighting,
+    uint32_t width, uint32_t height)
+{
+    PROFILE_SCOPE("SoftRasterizer::render");
+    if (s_textureObject != &object)
+        loadTextures(object);
+    resize(std::max(width, 1u), std::max(height, 1u));
+    s_viewProjection = viewProjection;
+    s_lighting = lighting;
+    uint64_t start = Profiler::nowNs();
+
+    const std::vector<Mesh*>& meshes = object.meshes();
+    s_vertices.resize(meshes.size());
+    JobSystem::parallelFor("Transform vertices", (uint32_t)meshes.size(), 0, [&meshes](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const std::vector<MeshVertex>& source = meshes[i]->m_vertices;
+            std::vector<ClipVertex>& vertices = s_vertices[i];
+            vertices.resize(source.size());
+            for (size_t v = 0; v < source.size(); v++)
+            {
+                vertices[v].m_clip = s_viewProjection * source[v].m_position;
+                vertices[v].m_world = glm::vec3(source[v].m_position);
+                vertices[v].m_normal = source[v].m_normal;
+                vertices[v].m_texCoord = source[v].m_texCoord;
+                vertices[v].m_tangent = unpackTangent(source[v].m_tangent);
+            }
+        }
+    });
+    uint64_t vertexEnd = Profiler::nowNs();
+
+    // Opaque submeshes first like the GL renderer, so the alpha tested ones find the depth buffer filled
+    uint64_t triangles = 0;
+    uint32_t batchCount = 0;
+    for (int alphaTested = 0; alphaTested < 2; alphaTested++)
+    {
+        for (uint32_t mesh = 0; mesh < (uint32_t)meshes.size(); mesh++)
+        {
+            for (const SubMesh* subMesh : meshes[mesh]->m_subMeshes)
+            {
+                auto material = s_materials.find(subMesh->m_material);
+                bool alphaTest = material != s_materials.end() && material->second.m_alphaTest;
+                if (alphaTest != (alphaTested != 0))
+                    continue;
+                uint32_t count = (uint32_t)(subMesh->m_indices.size() / 3);
+                triangles += count;
+                for (uint32_t first = 0; first < count; first += BatchTriangles)
+                {
+                    if (batchCount == s_batches.size())
+                        s_batches.emplace_back();
+                    Batch& batch = s_batches[batchCount++];
+                    batch.m_mesh = mesh;
+                    batch.m_subMesh = subMesh;
+                    batch.m_first = first;
+                    batch.m_count = std::min(BatchTriangles, count - first);
+                }
+            }
+        }
+    }
+    s_batches.resize(batchCount);
+    JobSystem::parallelFor("Set up triangles", batchCount, 1, [](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+            setupBatch(s_batches[i]);
+    });
+    uint64_t setupEnd = Profiler::nowNs();
+
+    uint32_t tileCount = s_tilesX * s_tilesY;
+    std::atomic<uint64_t> pixels{ 0 };
+    JobSystem::parallelFor("Rasterize tiles", tileCount, 1, [&pixels](uint32_t begin, uint32_t end)
+    {
+        uint64_t written = 0;
+        for (uint32_t tile = begin; tile < end; tile++)
+            written += rasterizeTile(tile);
+        pixels += written;
+    });
+    uint64_t end = Profiler::nowNs();
+
+    uint64_t rasterized = 0;
+    for (const Batch& batch : s_batches)
+        rasterized += batch.m_triangles.size();
+    s_statistics.m_width = s_width;
+    s_statistics.m_height = s_height;
+    s_statistics.m_triangles = triangles;
+    s_statistics.m_rasterizedTriangles = rasterized;
+    s_statistics.m_pixels = pixels;
+    s_statistics.m_vertexMs = toMs(vertexEnd - start);
+    s_statistics.m_setupMs = toMs(setupEnd - vertexEnd);
+    s_statistics.m_rasterMs = toMs(end - setupEnd);
+    s_statistics.m_totalMs = toMs(end - start);
+    s_statistics.m_frames++;
+    s_statistics.m_totalTriangles += triangles;
+    s_statistics.m_totalPixels += pixels;
+    s_statistics.m_totalSeconds += (end - start) / 1000000000.0;
+    if (s_statistics.m_totalSeconds > 0.0)
+    {
+        s_statistics.m_mtrisPerSecond = s_statistics.m_totalTriangles / s_statistics.m_totalSeconds / 1000000.0;
+        s_statistics.m_mpixPerSecond = s_statistics.m_totalPixels / s_statistics.m_totalSeconds / 1000000.0;
+    }
+}
+
+void SoftRasterizer::present()
+{
+    PROFILE_SCOPE("SoftRasterizer::present");
+    if (!s_width || !s_height)
+        return;
+    if (!s_presentTexture)
+    {
+        glGenTextures(1, &s_presentTexture);
+        glGenFramebuffers(1, &s_presentFramebuffer);
+    }
+    if (s_presentWidth != s_width || s_presentHeight != s_height)
+    {
+        glBindTexture(GL_TEXTURE_2D, s_presentTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, s_width, s_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        MemoryTracker::trackTexture(s_presentTexture, MemoryTracker::Category::RenderTargets, "Software rasterizer output",
+            GL_RGBA8, s_width, s_height, 1, 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, s_presentFramebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s_presentTexture, 0);
+        s_presentWidth = s_width;
+        s_presentHeight = s_height;
+    }
+
+    // Rows are bottom up like GL window coordinates
+    glBindTexture(GL_TEXTURE_2D, s_presentTexture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)s_stride);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, s_width, s_height, GL_RGBA, GL_UNSIGNED_BYTE, s_color.data());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    GLint drawFramebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, s_presentFramebuffer);
+    glBlitFramebuffer(0, 0, s_width, s_height, 0, 0, s_width, s_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)drawFramebuffer);
+}
+
+const Statistics& SoftRasterizer::statistics()
+{
+    return s_statistics;
+}
+
+void SoftRasterizer::resetStatistics()
+{
+    s_statistics.m_frames = 0;
+    s_statistics.m_totalTriangles = 0;
+    s_statistics.m_totalPixels = 0;
+    s_statistics.m_totalSeconds = 0.0;
+    s_statistics.m_mtrisPerSecond = 0.0;
+    s_statistics.m_mpixPerSecond = 0.0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <inttypes.h>
+#include "glm/glm.hpp"
+#include "objloader.h"
+
+// CPU reference renderer for machines without a GPU, and for occlusion or offline work. Draws the meshes and
+// materials of an ObjectFile with the forward lighting models of lighting.glsl (ambient, directional, spot and point
+// light with normal maps, specular and the alpha test) into its own color and depth buffers. Vertices are
+// transformed and triangles set up as JobSystem jobs, binned into screen tiles and every tile is rasterized by one
+// job in 2x2 pixel quads, one pixel per SSE2 lane (or plain loops without SSE2): edge tests, depth, perspective-correct
+// interpolation, the texture LOD from the quad derivatives and the lighting. Textures are decoded again from the
+// material's files with box filtered mip chains and sampled trilinearly, without anisotropic filtering. Shadows,
+// clustered lights and instanced copies are not drawn. The image is shown with a GL blit, so the app still needs a GL
+// context when it renders in software.
+namespace SoftRasterizer
+{
+    const uint32_t TileSize = 64;
+
+    enum class LightType : int
+    {
+        Ambient,
+        Directional,
+        Spot,
+        Point
+    };
+
+    struct Lighting
+    {
+        LightType m_type = LightType::Ambient;
+        glm::vec3 m_ambientColor = glm::vec3(1.0f);
+        glm::vec3 m_lightColor = glm::vec3(1.0f);
+        // Normalized direction the light travels in, directional and spot light
+        glm::vec3 m_lightDirection = glm::vec3(0.0f, -1.0f, 0.0f);
+        glm::vec3 m_lightPosition = glm::vec3(0.0f);
+        // Radians
+        float m_innerCone = 0.0f;
+        float m_outerCone = 0.0f;
+        float m_outerRadius = 1.0f;
+        // 0 leaves out the specular term
+        float m_specularMultiplier = 0.0f;
+        float m_shininess = 32.0f;
+        glm::vec3 m_cameraPosition = glm::vec3(0.0f);
+    };
+
+    struct Statistics
+    {
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        // Last frame: triangles submitted, triangles left after culling and clipping, pixels written
+        uint64_t m_triangles = 0;
+        uint64_t m_rasterizedTriangles = 0;
+        uint64_t m_pixels = 0;
+        double m_vertexMs = 0.0;
+        double m_setupMs = 0.0;
+        double m_rasterMs = 0.0;
+        double m_totalMs = 0.0;
+        // Since resetStatistics()
+        uint64_t m_frames = 0;
+        uint64_t m_totalTriangles = 0;
+        uint64_t m_totalPixels = 0;
+        double m_totalSeconds = 0.0;
+        double m_mtrisPerSecond = 0.0;
+        double m_mpixPerSecond = 0.0;
+    };
+
+    // Frees the textures and buffers, and the GL objects of present()
+    void destroy();
+
+    // Renders object into the internal buffers, which are resized to width x height. The textures of object are
+    // decoded on its first frame. world is the identity, viewProjection takes positions to clip space like in GL.
+    void render(const ObjLoader::ObjectFile& object, const glm::mat4x4& viewProjection, const Lighting& lighting,
+        uint32_t width, uint32_t height);
+    // Copies the last image into the bound draw framebuffer, needs a current GL context
+    void present();
+
+    const Statistics& statistics();
+    void resetStatistics();
+}
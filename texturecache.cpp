@@ -0,0 +1,74 @@
+#include "texturecache.h"
+#include <sys/stat.h>
+#include "util.h"
+
+bool TextureCache::fail(std::string* errString, const std::string& message)
+{
+    if (errString)
+        *errString = message;
+    return false;
+}
+
+std::string TextureCache::cacheFilePath(const char* directory, const char* pngFile, const char* extension)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char* c = pngFile; *c; c++)
+    {
+        hash ^= (uint8_t)*c;
+        hash *= 0x100000001b3ull;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)hash, extension);
+    return Util::combinePath(directory, name);
+}
+
+bool TextureCache::sourceStamp(const char* file, uint64_t& size, uint64_t& time)
+{
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(file, &info) != 0)
+        return false;
+#else
+    struct stat info;
+    if (stat(file, &info) != 0)
+        return false;
+#endif
+    size = (uint64_t)info.st_size;
+    time = (uint64_t)info.st_mtime;
+    return true;
+}
+
+void TextureCache::downsample(const uint8_t* source, uint32_t width, uint32_t height, uint8_t* target, uint32_t targetWidth,
+    uint32_t targetHeight)
+{
+    for (uint32_t y = 0; y < targetHeight; y++)
+    {
+        const uint8_t* row0 = &source[(size_t)std::min(2 * y, height - 1) * width * 4];
+        const uint8_t* row1 = &source[(size_t)std::min(2 * y + 1, height - 1) * width * 4];
+        uint8_t* out = &target[(size_t)y * targetWidth * 4];
+        for (uint32_t x = 0; x < targetWidth; x++)
+        {
+            size_t x0 = (size_t)std::min(2 * x, width - 1) * 4;
+            size_t x1 = (size_t)std::min(2 * x + 1, width - 1) * 4;
+            for (uint32_t c = 0; c < 4; c++)
+                out[x * 4 + c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+        }
+    }
+}
+
+bool TextureCache::writeFile(const std::string& file, const std::function<bool(FILE* f)>& write, std::string* errString)
+{
+    std::string tempFile = file + ".tmp";
+    FILE* f = fopen(tempFile.c_str(), "wb");
+    if (!f)
+        return fail(errString, "Cannot write " + tempFile);
+    bool success = write(f);
+    success = fclose(f) == 0 && success;
+    remove(file.c_str());
+    if (!success || rename(tempFile.c_str(), file.c_str()) != 0)
+    {
+        remove(tempFile.c_str());
+        return fail(errString, "Cannot write " + file);
+    }
+    return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <inttypes.h>
+#include <stdio.h>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Shared by VirtualTexturing and TextureStreaming: the cache files they convert PNG textures into and the threads that
+// read them back while the GL thread keeps rendering.
+namespace TextureCache
+{
+    // Stores message in errString if it isn't null and returns false
+    bool fail(std::string* errString, const std::string& message);
+    // Cache file of pngFile in directory, named by the 64 bit FNV-1a of the file name plus extension (like ".vtex")
+    std::string cacheFilePath(const char* directory, const char* pngFile, const char* extension);
+    // Size and modification time of a source file, cache files built from another version are rebuilt
+    bool sourceStamp(const char* file, uint64_t& size, uint64_t& time);
+    // Box filters an RGBA8 level into the next one, odd sizes repeat their last row or column
+    void downsample(const uint8_t* source, uint32_t width, uint32_t height, uint8_t* target, uint32_t targetWidth,
+        uint32_t targetHeight);
+    // Calls write with a temporary file that is renamed to file once complete, an interrupted build never looks valid
+    bool writeFile(const std::string& file, const std::function<bool(FILE* f)>& write, std::string* errString);
+
+    // Threads that take requests from the back of a queue, load them without holding the lock and keep the results
+    // until the GL thread takes them
+    template<typename Request, typename Result>
+    class Loaders
+    {
+    public:
+        typedef std::function<void(const Request& request, Result& result)> LoadFunction;
+
+        ~Loaders() { stop(); }
+
+        void start(uint32_t threadCount, const LoadFunction& load)
+        {
+            m_load = load;
+            for (uint32_t i = 0; i < threadCount; i++)
+                m_threads.push_back(std::thread(&Loaders::threadMain, this));
+        }
+
+        // Joins the threads, the queued requests and the results that weren't taken are dropped
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_condition.notify_all();
+            for (std::thread& thread : m_threads)
+                thread.join();
+            m_threads.clear();
+            m_stop = false;
+            m_queue.clear();
+            m_results.clear();
+        }
+
+        // Runs edit on the queue under the lock, then wakes the threads. The back of the queue is taken first.
+        void editQueue(const std::function<void(std::vector<Request>& queue)>& edit)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                edit(m_queue);
+            }
+            m_condition.notify_all();
+        }
+
+        // Moves up to maxCount results into results, oldest first
+        void takeResults(std::vector<Result>& results, size_t maxCount)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t count = std::min(m_results.size(), maxCount);
+            results.insert(results.end(), std::make_move_iterator(m_results.begin()), std::make_move_iterator(m_results.begin() + count));
+            m_results.erase(m_results.begin(), m_results.begin() + count);
+        }
+
+    private:
+        void threadMain()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true)
+            {
+                m_condition.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                if (m_stop)
+                    return;
+                Request request = std::move(m_queue.back());
+                m_queue.pop_back();
+                lock.unlock();
+
+                Result result;
+                m_load(request, result);
+
+                lock.lock();
+                m_results.push_back(std::move(result));
+            }
+        }
+
+        LoadFunction m_load;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::vector<Request> m_queue;
+        std::vector<Result> m_results;
+        bool m_stop = false;
+        std::vector<std::thread> m_threads;
+    };
+}
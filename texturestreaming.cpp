@@ -0,0 +1,607 @@
+#include "texturestreaming.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "objloader.h"
+#include "util.h"
+#include "profiler.h"
+#include "framestats.h"
+#include "memorytracker.h"
+#include "texturecache.h"
+
+using namespace TextureStreaming;
+
+namespace
+{
+    const uint32_t TailFileMagic = 0x50494D54; // "TMIP"
+    const uint32_t TailFileVersion = 1;
+    const uint32_t FlagHasAlpha = 1;
+    // A level that arrives fades in from at most this many levels coarser
+    const float MaxFade = 2.0f;
+
+    struct FileHeader
+    {
+        uint32_t m_magic;
+        uint32_t m_version;
+        // Size and modification time of the PNG file it was built from
+        uint64_t m_sourceSize;
+        uint64_t m_sourceTime;
+        uint32_t m_width;
+        uint32_t m_height;
+        // All levels of the texture and the first one stored in the file, the others follow finest first
+        uint32_t m_levels;
+        uint32_t m_tailLevel;
+        uint32_t m_flags;
+        uint32_t m_reserved;
+    };
+
+    struct Texture
+    {
+        std::string m_file;
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        uint32_t m_levels = 0;
+        uint32_t m_tailLevel = 0;
+        bool m_hasAlpha = false;
+        GLuint m_texture = 0;
+        // Material ids that hold the texture name
+        std::vector<GLuint*> m_bindings;
+        // Finest level of the storage and finest level uploaded, all coarser ones are uploaded too
+        uint32_t m_allocatedLevel = 0;
+        uint32_t m_residentLevel = 0;
+        // Planned by the last update()
+        uint32_t m_targetLevel = 0;
+        float m_fade = 0.0f;
+        // Requests of the current frame
+        bool m_requested = false;
+        float m_uvAreaPerPixel = 0.0f;
+        float m_coverage = 0.0f;
+    };
+
+    struct LoadRequest
+    {
+        uint32_t m_texture = 0;
+        std::string m_file;
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        // Levels first up to but not including last
+        uint32_t m_firstLevel = 0;
+        uint32_t m_lastLevel = 0;
+        float m_priority = 0.0f;
+    };
+
+    struct LoadedLevels
+    {
+        uint32_t m_texture = 0;
+        uint32_t m_firstLevel = 0;
+        bool m_success = false;
+        // Finest first
+        std::vector<std::vector<uint8_t>> m_levels;
+    };
+
+    bool s_enabled = false;
+    std::string s_directory;
+    uint64_t s_budget = 0;
+    Statistics s_statistics;
+
+    std::vector<std::unique_ptr<Texture>> s_textures;
+    std::unordered_map<std::string, uint32_t> s_textureIndices;
+    // Current GL name of every texture
+    std::unordered_map<GLuint, uint32_t> s_textureNames;
+
+    // The queue of the loader threads is sorted by priority
+    TextureCache::Loaders<LoadRequest, LoadedLevels> s_loaders;
+    // Only used on the GL thread: textures queued, being loaded or loaded and waiting for their upload
+    std::unordered_set<uint32_t> s_pendingTextures;
+
+    uint32_t levelWidth(uint32_t width, uint32_t level) { return std::max(1u, width >> level); }
+
+    size_t levelBytes(uint32_t width, uint32_t height, uint32_t level)
+    {
+        return (size_t)levelWidth(width, level) * levelWidth(height, level) * 4;
+    }
+
+    // Bytes of the levels from level down to the last one
+    uint64_t storageBytes(const Texture& texture, uint32_t level)
+    {
+        uint64_t bytes = 0;
+        for (uint32_t i = level; i < texture.m_levels; i++)
+            bytes += levelBytes(texture.m_width, texture.m_height, i);
+        return bytes;
+    }
+
+    uint32_t levelCount(uint32_t width, uint32_t height)
+    {
+        uint32_t levels = 1;
+        while ((std::max(width, height) >> levels) != 0)
+            levels++;
+        return levels;
+    }
+
+    uint32_t tailLevel(uint32_t width, uint32_t height)
+    {
+        uint32_t level = 0;
+        while (std::max(levelWidth(width, level), levelWidth(height, level)) > TailSize)
+            level++;
+        return level;
+    }
+
+    bool readHeader(FILE* f, FileHeader& header)
+    {
+        return fread(&header, sizeof(header), 1, f) == 1 && header.m_magic == TailFileMagic &&
+            header.m_version == TailFileVersion && header.m_width && header.m_height &&
+            header.m_levels == levelCount(header.m_width, header.m_height) &&
+            header.m_tailLevel == tailLevel(header.m_width, header.m_height);
+    }
+
+    // Box filters the levels of a decoded image and keeps the levels first up to but not including last, finest first
+    void buildLevels(ObjLoader::Image& image, uint32_t firstLevel, uint32_t lastLevel, std::vector<std::vector<uint8_t>>& levels)
+    {
+        uint32_t width = image.m_width;
+        uint32_t height = image.m_height;
+        levels.clear();
+        std::vector<uint8_t> level = std::move(image.m_pixels);
+        std::vector<uint8_t> next;
+        for (uint32_t i = 0; i < lastLevel; i++)
+        {
+            if (i > 0)
+            {
+                next.resize(levelBytes(width, height, i));
+                TextureCache::downsample(level.data(), levelWidth(width, i - 1), levelWidth(height, i - 1), next.data(),
+                    levelWidth(width, i), levelWidth(height, i));
+                level.swap(next);
+            }
+            if (i >= firstLevel)
+                levels.push_back(level);
+        }
+    }
+
+    bool buildTailFile(const char* pngFile, const std::string& tailFile, uint64_t sourceSize, uint64_t sourceTime,
+        std::string* errString)
+    {
+        PROFILE_SCOPE("buildTailFile");
+        ObjLoader::Image image;
+        if (!ObjLoader::loadPngImage(pngFile, image) || !image.m_width || !image.m_height)
+            return TextureCache::fail(errString, std::string("Cannot decode texture ") + pngFile);
+
+        FileHeader header = {};
+        header.m_magic = TailFileMagic;
+        header.m_version = TailFileVersion;
+        header.m_sourceSize = sourceSize;
+        header.m_sourceTime = sourceTime;
+        header.m_width = image.m_width;
+        header.m_height = image.m_height;
+        header.m_levels = levelCount(image.m_width, image.m_height);
+        header.m_tailLevel = tailLevel(image.m_width, image.m_height);
+        for (size_t i = 3; i < image.m_pixels.size(); i += 4)
+        {
+            if (image.m_pixels[i] != 0xFF)
+            {
+                header.m_flags |= FlagHasAlpha;
+                break;
+            }
+        }
+        std::vector<std::vector<uint8_t>> levels;
+        buildLevels(image, header.m_tailLevel, header.m_levels, levels);
+
+        return TextureCache::writeFile(tailFile, [&header, &levels](FILE* f)
+        {
+            bool success = fwrite(&header, sizeof(header), 1, f) == 1;
+            for (size_t i = 0; i < levels.size() && success; i++)
+                success = fwrite(levels[i].data(), 1, levels[i].size(), f) == levels[i].size();
+            return success;
+        }, errString);
+    }
+
+    // Decodes the PNG of a request into its levels, runs on the loader threads. Fails if the file changed size.
+    bool loadLevels(const LoadRequest& request, std::vector<std::vector<uint8_t>>& levels)
+    {
+        ObjLoader::Image image;
+        if (!ObjLoader::loadPngImage(request.m_file.c_str(), image) || image.m_width != request.m_width || image.m_height != request.m_height)
+            return false;
+        buildLevels(image, request.m_firstLevel, request.m_lastLevel, levels);
+        return true;
+    }
+
+    // Lets the shaders sample the uploaded levels only, minus the levels still fading in
+    void applyClamps(const Texture& texture)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture.m_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)(texture.m_residentLevel - texture.m_allocatedLevel));
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, texture.m_fade);
+    }
+
+    void setBindings(Texture& texture, GLuint name)
+    {
+        for (GLuint* binding : texture.m_bindings)
+            *binding = name;
+    }
+
+    // New storage from level down with the resident levels moved over. Dropping levels is an eviction.
+    void reallocate(uint32_t index, uint32_t level)
+    {
+        Texture& texture = *s_textures[index];
+        GLuint storage;
+        glGenTextures(1, &storage);
+        glBindTexture(GL_TEXTURE_2D, storage);
+        glTexStorage2D(GL_TEXTURE_2D, (GLsizei)(texture.m_levels - level), GL_RGBA8,
+            (GLsizei)levelWidth(texture.m_width, level), (GLsizei)levelWidth(texture.m_height, level));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, 16.0f);
+        MemoryTracker::trackTexture(storage, MemoryTracker::Category::StreamedTextures, texture.m_file, GL_RGBA8,
+            levelWidth(texture.m_width, level), levelWidth(texture.m_height, level), 1, texture.m_levels - level);
+
+        if (level > texture.m_residentLevel)
+        {
+            s_statistics.m_evictions++;
+            s_statistics.m_totalEvictions++;
+            texture.m_residentLevel = level;
+            texture.m_fade = 0.0f;
+        }
+        if (texture.m_texture)
+        {
+            for (uint32_t i = texture.m_residentLevel; i < texture.m_levels; i++)
+            {
+                glCopyImageSubData(texture.m_texture, GL_TEXTURE_2D, (GLint)(i - texture.m_allocatedLevel), 0, 0, 0,
+                    storage, GL_TEXTURE_2D, (GLint)(i - level), 0, 0, 0,
+                    (GLsizei)levelWidth(texture.m_width, i), (GLsizei)levelWidth(texture.m_height, i), 1);
+            }
+            s_textureNames.erase(texture.m_texture);
+            MemoryTracker::untrackTexture(texture.m_texture);
+            glDeleteTextures(1, &texture.m_texture);
+        }
+        texture.m_texture = storage;
+        texture.m_allocatedLevel = level;
+        s_textureNames[storage] = index;
+        setBindings(texture, storage);
+        applyClamps(texture);
+    }
+
+    // Level of a texture the requests of this frame need, its allocation if nobody asked for it
+    uint32_t wantedLevel(const Texture& texture)
+    {
+        if (!texture.m_requested)
+            return texture.m_allocatedLevel;
+        float texelsPerPixel = texture.m_uvAreaPerPixel * (float)texture.m_width * (float)texture.m_height;
+        if (!(texelsPerPixel > 1.0f))
+            return 0;
+        return std::min((uint32_t)floorf(0.5f * log2f(texelsPerPixel)), texture.m_tailLevel);
+    }
+
+    // Uploads levels finished by the loader threads that extend the resident levels of their texture
+    void uploadLoadedLevels()
+    {
+        std::vector<LoadedLevels> loaded;
+        s_loaders.takeResults(loaded, MaxUploadsPerFrame);
+        for (LoadedLevels& levels : loaded)
+        {
+            s_pendingTextures.erase(levels.m_texture);
+            if (!levels.m_success)
+                continue;
+            Texture& texture = *s_textures[levels.m_texture];
+            uint32_t previous = texture.m_residentLevel;
+            glBindTexture(GL_TEXTURE_2D, texture.m_texture);
+            // Coarsest first, the storage may have been shrunk since the load was queued
+            for (size_t i = levels.m_levels.size(); i-- > 0; )
+            {
+                uint32_t level = levels.m_firstLevel + (uint32_t)i;
+                if (level >= texture.m_residentLevel)
+                    continue;
+                if (level + 1 != texture.m_residentLevel || level < texture.m_allocatedLevel)
+                    break;
+                glTexSubImage2D(GL_TEXTURE_2D, (GLint)(level - texture.m_allocatedLevel), 0, 0,
+                    (GLsizei)levelWidth(texture.m_width, level), (GLsizei)levelWidth(texture.m_height, level),
+                    GL_RGBA, GL_UNSIGNED_BYTE, levels.m_levels[i].data());
+                FrameStats::add(FrameStats::Counter::TextureBytes, levels.m_levels[i].size());
+                s_statistics.m_bytesUploaded += levels.m_levels[i].size();
+                texture.m_residentLevel = level;
+            }
+            if (texture.m_residentLevel == previous)
+                continue;
+            texture.m_fade = std::min(texture.m_fade + (float)(previous - texture.m_residentLevel), MaxFade);
+            applyClamps(texture);
+            s_statistics.m_uploads++;
+            s_statistics.m_totalUploads++;
+        }
+    }
+
+    // Grants the wanted levels by coverage while they fit into the budget. The tails always stay, and with room left
+    // textures keep finer levels they already have.
+    void planAllocations()
+    {
+        uint64_t used = 0;
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> wanted(s_textures.size());
+        for (uint32_t i = 0; i < s_textures.size(); i++)
+        {
+            const Texture& texture = *s_textures[i];
+            used += storageBytes(texture, texture.m_tailLevel);
+            wanted[i] = wantedLevel(texture);
+            order.push_back(i);
+        }
+        std::stable_sort(order.begin(), order.end(), [](uint32_t a, uint32_t b)
+        {
+            const Texture& textureA = *s_textures[a];
+            const Texture& textureB = *s_textures[b];
+            if (textureA.m_requested != textureB.m_requested)
+                return textureA.m_requested;
+            return textureA.m_coverage > textureB.m_coverage;
+        });
+        for (uint32_t index : order)
+        {
+            Texture& texture = *s_textures[index];
+            uint64_t tailBytes = storageBytes(texture, texture.m_tailLevel);
+            texture.m_targetLevel = texture.m_tailLevel;
+            for (uint32_t level = wanted[index]; level < texture.m_tailLevel; level++)
+            {
+                uint64_t extra = storageBytes(texture, level) - tailBytes;
+                if (used + extra <= s_budget)
+                {
+                    texture.m_targetLevel = level;
+                    used += extra;
+                    break;
+                }
+            }
+        }
+        for (uint32_t index : order)
+        {
+            Texture& texture = *s_textures[index];
+            if (texture.m_allocatedLevel >= texture.m_targetLevel)
+                continue;
+            uint64_t extra = storageBytes(texture, texture.m_allocatedLevel) - storageBytes(texture, texture.m_targetLevel);
+            if (used + extra <= s_budget)
+            {
+                texture.m_targetLevel = texture.m_allocatedLevel;
+                used += extra;
+            }
+        }
+    }
+
+    // Replaces the load queue with the levels the textures are missing, most covered textures first
+    void queueLoads()
+    {
+        std::vector<LoadRequest> requests;
+        for (uint32_t i = 0; i < s_textures.size(); i++)
+        {
+            const Texture& texture = *s_textures[i];
+            if (!texture.m_requested)
+                continue;
+            uint32_t level = std::max(texture.m_targetLevel, wantedLevel(texture));
+            if (level >= texture.m_residentLevel)
+                continue;
+            LoadRequest request;
+            request.m_texture = i;
+            request.m_file = texture.m_file;
+            request.m_width = texture.m_width;
+            request.m_height = texture.m_height;
+            request.m_firstLevel = level;
+            request.m_lastLevel = texture.m_residentLevel;
+            request.m_priority = texture.m_coverage;
+            requests.push_back(request);
+        }
+        // The back is taken first
+        std::stable_sort(requests.begin(), requests.end(), [](const LoadRequest& a, const LoadRequest& b) { return a.m_priority < b.m_priority; });
+        s_loaders.editQueue([&requests](std::vector<LoadRequest>& queue)
+        {
+            // Requests that weren't started yet are replaced, this frame's requests know better what is needed
+            for (const LoadRequest& request : queue)
+                s_pendingTextures.erase(request.m_texture);
+            queue.clear();
+            for (LoadRequest& request : requests)
+            {
+                if (s_pendingTextures.insert(request.m_texture).second)
+                    queue.push_back(std::move(request));
+            }
+        });
+    }
+}
+
+bool TextureStreaming::init(const char* cacheDirectory, uint64_t budgetBytes, uint32_t loaderThreads, std::string* errString)
+{
+    destroy();
+    s_directory = cacheDirectory;
+    if (!Util::createDirectory(cacheDirectory))
+        return TextureCache::fail(errString, std::string("Cannot create the texture cache ") + cacheDirectory);
+
+    s_statistics = Statistics();
+    s_budget = budgetBytes;
+    s_statistics.m_budgetBytes = budgetBytes;
+    loaderThreads = std::max(loaderThreads, 1u);
+    s_loaders.start(loaderThreads, [](const LoadRequest& request, LoadedLevels& loaded)
+    {
+        PROFILE_SCOPE("Decode texture levels");
+        loaded.m_texture = request.m_texture;
+        loaded.m_firstLevel = request.m_firstLevel;
+        loaded.m_success = loadLevels(request, loaded.m_levels);
+    });
+    s_statistics.m_loaderThreads = loaderThreads;
+    s_enabled = true;
+    return true;
+}
+
+void TextureStreaming::destroy()
+{
+    s_loaders.stop();
+    s_pendingTextures.clear();
+    if (!s_enabled)
+        return;
+    for (std::unique_ptr<Texture>& texture : s_textures)
+    {
+        MemoryTracker::untrackTexture(texture->m_texture);
+        glDeleteTextures(1, &texture->m_texture);
+        setBindings(*texture, 0);
+    }
+    s_textures.clear();
+    s_textureIndices.clear();
+    s_textureNames.clear();
+    s_enabled = false;
+}
+
+bool TextureStreaming::isEnabled()
+{
+    return s_enabled;
+}
+
+bool TextureStreaming::prepareTailFile(const char* pngFile, std::string* errString)
+{
+    uint64_t sourceSize = 0, sourceTime = 0;
+    if (!TextureCache::sourceStamp(pngFile, sourceSize, sourceTime))
+        return TextureCache::fail(errString, std::string("Cannot find texture ") + pngFile);
+    std::string tailFile = TextureCache::cacheFilePath(s_directory.c_str(), pngFile, ".tmip");
+    FILE* f = fopen(tailFile.c_str(), "rb");
+    if (f)
+    {
+        FileHeader header;
+        bool valid = readHeader(f, header) && header.m_sourceSize == sourceSize && header.m_sourceTime == sourceTime;
+        fclose(f);
+        if (valid)
+            return true;
+    }
+    return buildTailFile(pngFile, tailFile, sourceSize, sourceTime, errString);
+}
+
+bool TextureStreaming::addTexture(const char* pngFile, GLuint* texId, bool* hasAlpha, std::string* errString)
+{
+    std::unordered_map<std::string, uint32_t>::const_iterator existing = s_textureIndices.find(pngFile);
+    if (existing != s_textureIndices.end())
+    {
+        Texture& texture = *s_textures[existing->second];
+        texture.m_bindings.push_back(texId);
+        *texId = texture.m_texture;
+        if (hasAlpha)
+            *hasAlpha = texture.m_hasAlpha;
+        return true;
+    }
+
+    PROFILE_SCOPE("TextureStreaming::addTexture");
+    if (!prepareTailFile(pngFile, errString))
+        return false;
+    std::string tailFile = TextureCache::cacheFilePath(s_directory.c_str(), pngFile, ".tmip");
+    FILE* f = fopen(tailFile.c_str(), "rb");
+    if (!f)
+        return TextureCache::fail(errString, "Cannot read " + tailFile);
+    FileHeader header;
+    std::vector<std::vector<uint8_t>> levels;
+    bool success = readHeader(f, header);
+    for (uint32_t i = header.m_tailLevel; i < header.m_levels && success; i++)
+    {
+        levels.emplace_back(levelBytes(header.m_width, header.m_height, i));
+        success = fread(levels.back().data(), 1, levels.back().size(), f) == levels.back().size();
+    }
+    fclose(f);
+    if (!success)
+        return TextureCache::fail(errString, "Cannot read " + tailFile);
+
+    std::unique_ptr<Texture> texture = std::make_unique<Texture>();
+    texture->m_file = pngFile;
+    texture->m_width = header.m_width;
+    texture->m_height = header.m_height;
+    texture->m_levels = header.m_levels;
+    texture->m_tailLevel = header.m_tailLevel;
+    texture->m_hasAlpha = (header.m_flags & FlagHasAlpha) != 0;
+    texture->m_allocatedLevel = texture->m_residentLevel = texture->m_targetLevel = header.m_tailLevel;
+    texture->m_bindings.push_back(texId);
+    uint32_t index = (uint32_t)s_textures.size();
+    s_textures.push_back(std::move(texture));
+    s_textureIndices[pngFile] = index;
+    reallocate(index, header.m_tailLevel);
+
+    const Texture& added = *s_textures[index];
+    for (uint32_t i = 0; i < (uint32_t)levels.size(); i++)
+    {
+        uint32_t level = added.m_tailLevel + i;
+        glTexSubImage2D(GL_TEXTURE_2D, (GLint)i, 0, 0, (GLsizei)levelWidth(added.m_width, level),
+            (GLsizei)levelWidth(added.m_height, level), GL_RGBA, GL_UNSIGNED_BYTE, levels[i].data());
+        FrameStats::add(FrameStats::Counter::TextureBytes, levels[i].size());
+    }
+    if (hasAlpha)
+        *hasAlpha = added.m_hasAlpha;
+    s_statistics.m_textures = (uint32_t)s_textures.size();
+    return true;
+}
+
+void TextureStreaming::setBudget(uint64_t budgetBytes)
+{
+    s_budget = budgetBytes;
+    s_statistics.m_budgetBytes = budgetBytes;
+}
+
+uint64_t TextureStreaming::budget()
+{
+    return s_budget;
+}
+
+void TextureStreaming::request(GLuint texture, float uvAreaPerPixel, float coverage)
+{
+    std::unordered_map<GLuint, uint32_t>::const_iterator index = s_textureNames.find(texture);
+    if (!texture || index == s_textureNames.end())
+        return;
+    Texture& streamed = *s_textures[index->second];
+    streamed.m_uvAreaPerPixel = streamed.m_requested ? std::min(streamed.m_uvAreaPerPixel, uvAreaPerPixel) : uvAreaPerPixel;
+    streamed.m_coverage += coverage;
+    streamed.m_requested = true;
+}
+
+void TextureStreaming::update()
+{
+    if (!s_enabled)
+        return;
+    PROFILE_SCOPE("TextureStreaming::update");
+    uint64_t startNs = Profiler::nowNs();
+    s_statistics.m_uploads = 0;
+    s_statistics.m_evictions = 0;
+
+    uploadLoadedLevels();
+    planAllocations();
+    // Shrinking first frees the memory the growing textures take
+    for (uint32_t i = 0; i < s_textures.size(); i++)
+    {
+        if (s_textures[i]->m_targetLevel > s_textures[i]->m_allocatedLevel)
+            reallocate(i, s_textures[i]->m_targetLevel);
+    }
+    for (uint32_t i = 0; i < s_textures.size(); i++)
+    {
+        if (s_textures[i]->m_targetLevel < s_textures[i]->m_allocatedLevel)
+            reallocate(i, s_textures[i]->m_targetLevel);
+    }
+    queueLoads();
+
+    s_statistics.m_allocatedBytes = s_statistics.m_residentBytes = s_statistics.m_fullBytes = 0;
+    s_statistics.m_requestedTextures = s_statistics.m_satisfiedTextures = 0;
+    for (std::unique_ptr<Texture>& texture : s_textures)
+    {
+        if (texture->m_fade > 0.0f)
+        {
+            texture->m_fade = std::max(texture->m_fade - FadeStep, 0.0f);
+            applyClamps(*texture);
+        }
+        s_statistics.m_allocatedBytes += storageBytes(*texture, texture->m_allocatedLevel);
+        s_statistics.m_residentBytes += storageBytes(*texture, texture->m_residentLevel);
+        s_statistics.m_fullBytes += storageBytes(*texture, 0);
+        if (texture->m_requested)
+        {
+            s_statistics.m_requestedTextures++;
+            if (texture->m_residentLevel <= wantedLevel(*texture))
+                s_statistics.m_satisfiedTextures++;
+        }
+        texture->m_requested = false;
+        texture->m_uvAreaPerPixel = 0.0f;
+        texture->m_coverage = 0.0f;
+    }
+    s_statistics.m_pendingLoads = (uint32_t)s_pendingTextures.size();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    s_statistics.m_updateMs = (Profiler::nowNs() - startNs) / 1000000.0;
+}
+
+const Statistics& TextureStreaming::statistics()
+{
+    return s_statistics;
+}
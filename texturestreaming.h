@@ -0,0 +1,74 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include "GL/glew.h"
+
+// Progressive mip streaming of the material textures under a GPU memory budget. At load only the tail of every
+// texture, the levels up to TailSize texels, is uploaded; it is read from a small tail file in the cache directory that
+// is built once per PNG. The texture has immutable storage (glTexStorage2D) from its finest allocated level down, and
+// GL_TEXTURE_BASE_LEVEL points at the finest level uploaded so far, so sampling never reads a level that isn't there.
+// Every frame the caller asks for the level each texture needs and the screen coverage of its use. update() plans the
+// allocations: the wanted levels are granted by coverage until the budget is used up, textures nobody asked for give
+// their levels up first. Finer levels are decoded from the PNG by loader threads, most covered textures first, and
+// uploaded on the GL thread; GL_TEXTURE_MIN_LOD fades a new level in over a few frames. Growing or shrinking a texture
+// moves its resident levels into new storage, so the texture names change and the registered ids are rewritten.
+namespace TextureStreaming
+{
+    // Levels up to this size are uploaded at load and never evicted
+    const uint32_t TailSize = 64;
+    const uint32_t DefaultLoaderThreads = 2;
+    // Loaded textures uploaded per update(), the rest waits for the next frame
+    const uint32_t MaxUploadsPerFrame = 4;
+    // MIN_LOD steps per update() while a new level fades in
+    const float FadeStep = 0.25f;
+
+    struct Statistics
+    {
+        uint32_t m_textures = 0;
+        uint32_t m_loaderThreads = 0;
+        uint64_t m_budgetBytes = 0;
+        // Storage of all textures, the uploaded levels of it, and all levels of all textures
+        uint64_t m_allocatedBytes = 0;
+        uint64_t m_residentBytes = 0;
+        uint64_t m_fullBytes = 0;
+        // Textures asked for in the last frame and the ones of them that have the level they need
+        uint32_t m_requestedTextures = 0;
+        uint32_t m_satisfiedTextures = 0;
+        // Textures waiting for or being decoded by the loader threads
+        uint32_t m_pendingLoads = 0;
+        // Last update()
+        uint32_t m_uploads = 0;
+        uint32_t m_evictions = 0;
+        double m_updateMs = 0.0;
+        // Since init()
+        uint64_t m_totalUploads = 0;
+        uint64_t m_totalEvictions = 0;
+        uint64_t m_bytesUploaded = 0;
+    };
+
+    // Needs a current GL context. Starts the loader threads.
+    bool init(const char* cacheDirectory, uint64_t budgetBytes, uint32_t loaderThreads, std::string* errString);
+    void destroy();
+    bool isEnabled();
+
+    // Builds the tail file of a PNG file unless it is up to date. Doesn't need GL, can run on any thread, but not twice
+    // for the same file at once.
+    bool prepareTailFile(const char* pngFile, std::string* errString);
+    // Creates the texture of a PNG file with its tail uploaded and stores its name in texId, which must stay valid
+    // until destroy(): it is rewritten whenever the texture moves to new storage and set to 0 by destroy(), which
+    // deletes the textures. The same file shares one texture. hasAlpha is set if any texel isn't fully opaque.
+    bool addTexture(const char* pngFile, GLuint* texId, bool* hasAlpha, std::string* errString);
+
+    void setBudget(uint64_t budgetBytes);
+    uint64_t budget();
+
+    // Asks for a texture for the current frame: uvAreaPerPixel is the uv area one pixel covers where the texture is
+    // magnified most, coverage the pixels it covers on screen. The finest level and the summed coverage of all
+    // requests of a frame count. Names that aren't streamed textures are ignored.
+    void request(GLuint texture, float uvAreaPerPixel, float coverage);
+    // Call once per frame before drawing and after the requests: uploads loaded levels, plans the allocations for the
+    // budget, reallocates textures and queues the loads
+    void update();
+
+    const Statistics& statistics();
+}
@@ -1,6 +1,16 @@
 #include "util.h"
 #include <sstream>
+#include <algorithm>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+#include "png.h"
 
 std::string Util::combinePath(const char* partA, const char* partB)
 {
@@ -20,6 +30,53 @@ std::string Util::combinePath(const char* partA, const char* partB)
     return ss.str();
 }
 
+bool Util::createDirectory(const char* path)
+{
+#ifdef _WIN32
+    int result = _mkdir(path);
+#else
+    int result = mkdir(path, 0755);
+#endif
+    struct stat info;
+    return result == 0 || (stat(path, &info) == 0 && (info.st_mode & S_IFDIR));
+}
+
+bool Util::listFiles(const char* directory, const char* extension, std::vector<std::string>& files)
+{
+    size_t first = files.size();
+    size_t extensionLength = strlen(extension);
+    auto matches = [extension, extensionLength](const char* name)
+    {
+        size_t length = strlen(name);
+        return length >= extensionLength && !strcmp(name + length - extensionLength, extension);
+    };
+#ifdef _WIN32
+    std::string pattern = combinePath(directory, "*");
+    _finddata_t data;
+    intptr_t handle = _findfirst(pattern.c_str(), &data);
+    if (handle == -1)
+        return false;
+    do
+    {
+        if (!(data.attrib & _A_SUBDIR) && matches(data.name))
+            files.push_back(data.name);
+    } while (_findnext(handle, &data) == 0);
+    _findclose(handle);
+#else
+    DIR* dir = opendir(directory);
+    if (!dir)
+        return false;
+    while (dirent* entry = readdir(dir))
+    {
+        if (entry->d_name[0] != '.' && matches(entry->d_name))
+            files.push_back(entry->d_name);
+    }
+    closedir(dir);
+#endif
+    std::sort(files.begin() + first, files.end());
+    return true;
+}
+
 bool Util::loadFileToBuffer(const char* filename, std::vector<char>& buffer, bool fixedBufferSize, bool nullTerminate)
 {
     FILE* f = fopen(filename, "rb");
@@ -79,94 +136,202 @@ void Util::split(const char* str, char delim, std::vector<std::string>& retVal)
     };
 }
 
-bool Util::compileShader(GLuint shader, std::string* errString)
+size_t Util::tokenize(char* str, char delim, const char** tokens, size_t maxTokens)
 {
-    GLint compiled = 0;
-
-    glCompileShader(shader);
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-    if (!compiled)
+    // Like split(), the last character always belongs to a token, even if it is a delimiter
+    size_t sz = strlen(str);
+    size_t count = 0;
+    bool inToken = false;
+    for (size_t i = 0; i < sz; i++)
     {
-        if (errString)
+        if (str[i] == delim && i != sz - 1)
+        {
+            str[i] = 0;
+            inToken = false;
+        }
+        else if (!inToken)
         {
-            GLsizei len;
+            if (count < maxTokens)
+                tokens[count] = str + i;
+            count++;
+            inToken = true;
+        }
+    }
+    return count;
+}
 
-            glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
-            if (len > 1)
-            {
-                std::vector<char> infoBuffer;
-                infoBuffer.resize(len);
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
-                GLsizei infoSize;
-                glGetShaderInfoLog(shader, len, &infoSize, &infoBuffer[0]);
-                *errString = &infoBuffer[0];
-            }
-        }
+static bool s_parallelShaderCompile = false;
+
+bool Util::enableParallelShaderCompile()
+{
+    if (GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    else if (GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+    else
         return false;
-    }
+    s_parallelShaderCompile = true;
     return true;
 }
 
-bool Util::linkProgram(GLuint program, std::string* errString)
+bool Util::isParallelShaderCompileEnabled()
+{
+    return s_parallelShaderCompile;
+}
+
+void Util::beginStageBuild(GLenum stage, const char* code, ProgramBuild& build)
+{
+    GLuint shader = glCreateShader(stage);
+    glShaderSource(shader, 1, &code, 0);
+    glCompileShader(shader);
+    if (stage == GL_VERTEX_SHADER)
+        build.m_vertexShader = shader;
+    else
+        build.m_pixelShader = shader;
+
+    build.m_program = glCreateProgram();
+    glProgramParameteri(build.m_program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    glProgramParameteri(build.m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glAttachShader(build.m_program, shader);
+    glLinkProgram(build.m_program);
+}
+
+bool Util::isProgramBuildComplete(const ProgramBuild& build)
 {
-    GLint linked = 0;
+    if (!build.m_program)
+        return false;
+    if (!s_parallelShaderCompile)
+        return true;
+    GLint complete = 0;
+    glGetProgramiv(build.m_program, GL_COMPLETION_STATUS_KHR, &complete);
+    return complete != 0;
+}
 
-    glLinkProgram(program);
-    glGetProgramiv(program, GL_LINK_STATUS, &linked);
-    if (!linked)
+GLuint Util::finishProgramBuild(ProgramBuild& build, std::string* errString)
+{
+    GLuint program = build.m_program;
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status && errString)
     {
-        if (errString)
+        // The shader logs point at the actual error, the link log only says that a shader failed to compile
+        GLuint shaders[] = { build.m_vertexShader, build.m_pixelShader };
+        std::vector<char> infoBuffer;
+        bool foundShaderError = false;
+        for (GLuint shader : shaders)
         {
-            GLsizei len;
-
+            if (!shader)
+                continue;
+            GLint compiled = 0;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+            GLsizei len = 0;
+            glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
+            if (!compiled && len > 1)
+            {
+                infoBuffer.resize(len);
+                glGetShaderInfoLog(shader, len, nullptr, &infoBuffer[0]);
+                *errString = &infoBuffer[0];
+                foundShaderError = true;
+                break;
+            }
+        }
+        if (!foundShaderError)
+        {
+            GLsizei len = 0;
             glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
             if (len > 1)
             {
-                std::vector<char> infoBuffer;
                 infoBuffer.resize(len);
-
-                GLsizei infoSize;
-                glGetProgramInfoLog(program, len, &infoSize, &infoBuffer[0]);
-
+                glGetProgramInfoLog(program, len, nullptr, &infoBuffer[0]);
                 *errString = &infoBuffer[0];
             }
         }
-        return false;
     }
-    return true;
+
+    if (build.m_vertexShader)
+        glDetachShader(program, build.m_vertexShader);
+    if (build.m_pixelShader)
+        glDetachShader(program, build.m_pixelShader);
+    glDeleteShader(build.m_vertexShader);
+    glDeleteShader(build.m_pixelShader);
+    if (!status)
+    {
+        glDeleteProgram(program);
+        program = 0;
+    }
+    build = ProgramBuild();
+    return program;
+}
+
+void Util::cancelProgramBuild(ProgramBuild& build)
+{
+    if (!build.m_program)
+        return;
+    glDeleteShader(build.m_vertexShader);
+    glDeleteShader(build.m_pixelShader);
+    glDeleteProgram(build.m_program);
+    build = ProgramBuild();
 }
 
-GLuint Util::createShaderProgram(const char* vsCode, const char* psCode, std::string* errString)
+std::string Util::insertShaderDefines(const char* code, const char* defines)
 {
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vsCode, 0);
-    if (!compileShader(vertexShader, errString))
+    // #version has to stay the first statement, so the defines go on the line after it
+    const char* insertAt = code;
+    while (*insertAt == ' ' || *insertAt == '\t' || *insertAt == '\r' || *insertAt == '\n')
+        insertAt++;
+    if (strncmp(insertAt, "#version", 8) == 0)
     {
-        glDeleteShader(vertexShader);
-        return 0;
+        insertAt = strchr(insertAt, '\n');
+        insertAt = insertAt ? insertAt + 1 : code + strlen(code);
     }
-
-    GLuint pixelShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(pixelShader, 1, &psCode, 0);
-    if (!compileShader(pixelShader, errString))
+    else
     {
-        glDeleteShader(pixelShader);
-        return 0;
+        insertAt = code;
     }
 
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, pixelShader);
+    std::string result(code, insertAt);
+    if (insertAt > code && insertAt[-1] != '\n')
+        result += '\n';
+    result += defines;
+    // Keeps the line numbers of compile errors matching the file
+    int line = 1 + (int)std::count(code, insertAt, '\n');
+    result += "#line " + std::to_string(line) + "\n";
+    result += insertAt;
+    return result;
+}
+
+bool Util::writePng(const char* filename, unsigned int width, unsigned int height, const unsigned char* rgba, std::string* errString)
+{
+    FILE* f = fopen(filename, "wb");
+    if (!f)
+    {
+        if (errString)
+            *errString = std::string("Cannot open file: ") + filename;
+        return false;
+    }
 
-    if (!linkProgram(shaderProgram, errString))
+    png_struct* ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_info* info = ptr ? png_create_info_struct(ptr) : nullptr;
+    if (!ptr || !info || setjmp(png_jmpbuf(ptr)))
     {
-        glDeleteShader(vertexShader);
-        glDeleteShader(pixelShader);
-        glDeleteShader(shaderProgram);
-        return 0;
+        png_destroy_write_struct(&ptr, &info);
+        fclose(f);
+        if (errString)
+            *errString = std::string("Cannot write png: ") + filename;
+        return false;
     }
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(pixelShader);
-    return shaderProgram;
+    png_init_io(ptr, f);
+    png_set_IHDR(ptr, info, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(ptr, info);
+    for (unsigned int y = 0; y < height; y++)
+        png_write_row(ptr, rgba + (size_t)y * width * 4);
+    png_write_end(ptr, nullptr);
+    png_destroy_write_struct(&ptr, &info);
+    fclose(f);
+    return true;
 }
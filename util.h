@@ -5,11 +5,40 @@
 
 namespace Util
 {
+    // A program whose compile and link were issued but not necessarily finished.
+    // Builds are single stage (separable) and only use the shader of their stage.
+    struct ProgramBuild
+    {
+        GLuint m_program = 0;
+        GLuint m_vertexShader = 0;
+        GLuint m_pixelShader = 0;
+    };
+
     std::string combinePath(const char* partA, const char* partB);
+    // Returns true if the directory exists afterwards, parent directories are not created
+    bool createDirectory(const char* path);
+    // Appends the names of the files in directory ending in extension (like ".png"), sorted, returns false if the
+    // directory can't be read
+    bool listFiles(const char* directory, const char* extension, std::vector<std::string>& files);
     bool loadFileToBuffer(const char* filename, std::vector<char>& buffer, bool fixedBufferSize = false, bool nullTerminate = false);
     void readToBuffer(FILE* f, std::vector<char>& buf, bool fixedBufferSize = false, bool nullTerminate = false);
     void split(const char* str, char delim, std::vector<std::string>& retVal);
-    bool compileShader(GLuint shader, std::string* errString);
-    bool linkProgram(GLuint program, std::string* errString);
-    GLuint createShaderProgram(const char* vertexShaderFile, const char* pixelShaderFile, std::string* errString);
+    // Splits str in place like split(), without allocating: delimiters become terminators and the first maxTokens
+    // tokens are stored. Returns the number of tokens, which may be larger than maxTokens.
+    size_t tokenize(char* str, char delim, const char** tokens, size_t maxTokens);
+
+    // Lets the driver compile on its own threads if KHR_parallel_shader_compile is supported, returns false if not
+    bool enableParallelShaderCompile();
+    bool isParallelShaderCompileEnabled();
+    // Issues compile and link of a separable program with a single stage without waiting for the results, to be
+    // combined with others in a program pipeline
+    void beginStageBuild(GLenum stage, const char* code, ProgramBuild& build);
+    // Never blocks when parallel compilation is enabled, otherwise the build is always complete
+    bool isProgramBuildComplete(const ProgramBuild& build);
+    // Waits for the build if necessary and returns the linked program, or 0 with the compile/link log in errString
+    GLuint finishProgramBuild(ProgramBuild& build, std::string* errString);
+    void cancelProgramBuild(ProgramBuild& build);
+    // Inserts defines after the #version line of a shader, or in front of the code if it has none
+    std::string insertShaderDefines(const char* code, const char* defines);
+    bool writePng(const char* filename, unsigned int width, unsigned int height, const unsigned char* rgba, std::string* errString);
 }
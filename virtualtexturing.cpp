@@ -0,0 +1,978 @@
+#include "virtualtexturing.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "objloader.h"
+#include "util.h"
+#include "profiler.h"
+#include "framestats.h"
+#include "memorytracker.h"
+#include "texturecache.h"
+
+using namespace VirtualTexturing;
+
+namespace
+{
+    const uint32_t PagedFileMagic = 0x58455456; // "VTEX"
+    const uint32_t PagedFileVersion = 1;
+    const uint32_t FlagHasAlpha = 1;
+    constexpr uint32_t pageLevelSize(uint32_t level)
+    {
+        return (PageSize >> level) ? (PageSize >> level) : 1;
+    }
+
+    // Byte offset of a level in the page data, all levels are stored one after another
+    constexpr size_t pageLevelOffset(uint32_t level)
+    {
+        return level ? pageLevelOffset(level - 1) + (size_t)pageLevelSize(level - 1) * pageLevelSize(level - 1) * 4 : 0;
+    }
+
+    // Base level of a page as stored in the paged file, and all levels of a page as uploaded
+    const size_t TileBytes = (size_t)PageSize * PageSize * 4;
+    const size_t PageBytes = pageLevelOffset(PageLevels);
+    // Fewer unpinned pages than this would only thrash
+    const uint32_t MinFreePages = 16;
+    // Feedback stores the ids in 16 bits
+    const uint32_t MaxTextures = 0xFFFF;
+    const uint32_t ReadbackSlots = 3;
+    const uint32_t NoPage = 0xFFFFFFFF;
+
+    struct FileHeader
+    {
+        uint32_t m_magic;
+        uint32_t m_version;
+        // Size and modification time of the PNG file it was built from
+        uint64_t m_sourceSize;
+        uint64_t m_sourceTime;
+        uint32_t m_width;
+        uint32_t m_height;
+        uint32_t m_tileSize;
+        uint32_t m_tileBorder;
+        // Levels with tiles, the last one has a single tile
+        uint32_t m_levels;
+        uint32_t m_tileCount;
+        uint32_t m_flags;
+        uint32_t m_reserved;
+    };
+
+    struct Level
+    {
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        uint32_t m_tilesX = 0;
+        uint32_t m_tilesY = 0;
+        // Index of the level's first tile in the paged file and the page table, the tiles follow row by row
+        uint32_t m_firstTile = 0;
+    };
+
+    struct Texture
+    {
+        uint32_t m_id = 0;
+        std::string m_pagedFile;
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        float m_log2Size = 0.0f;
+        bool m_hasAlpha = false;
+        std::vector<Level> m_levels;
+        uint32_t m_tileCount = 0;
+        uint32_t m_pageTableOffset = 0;
+        // The page of solid textures, which have no paged file
+        std::vector<uint8_t> m_solidPage;
+        bool m_dirty = true;
+    };
+
+    struct Page
+    {
+        uint64_t m_key = 0;
+        // Feedback serial that last asked for the tile
+        uint64_t m_lastUsed = 0;
+        // Neighbors in the LRU list, pinned and free pages aren't in it
+        uint32_t m_prev = NoPage;
+        uint32_t m_next = NoPage;
+        bool m_resident = false;
+        bool m_pinned = false;
+    };
+
+    struct LoadRequest
+    {
+        uint64_t m_key = 0;
+        const Texture* m_texture = nullptr;
+        uint32_t m_tile = 0;
+    };
+
+    struct LoadedTile
+    {
+        uint64_t m_key = 0;
+        bool m_success = false;
+        std::vector<uint8_t> m_page;
+    };
+
+    struct Readback
+    {
+        GLuint m_buffer = 0;
+        size_t m_size = 0;
+        GLsync m_fence = nullptr;
+        int m_width = 0;
+        int m_height = 0;
+    };
+
+    bool s_enabled = false;
+    std::string s_directory;
+    uint64_t s_budget = 0;
+    Statistics s_statistics;
+
+    // Indexed by id, 0 is unused
+    std::vector<std::unique_ptr<Texture>> s_textures;
+    std::unordered_map<std::string, uint32_t> s_textureIds;
+
+    GLuint s_pageTexture = 0;
+    std::vector<Page> s_pages;
+    std::vector<uint32_t> s_freePages;
+    // Most recently used first
+    uint32_t s_lruHead = NoPage;
+    uint32_t s_lruTail = NoPage;
+    std::unordered_map<uint64_t, uint32_t> s_residentTiles;
+    // Counts the processed feedbacks, pages asked for by the latest one are never evicted
+    uint64_t s_feedbackSerial = 0;
+
+    // Page table entries of all textures: the resident page covering the tile in the low 16 bits, its level above
+    std::vector<uint32_t> s_pageTable;
+    GLuint s_pageTableBuffer = 0;
+    GLuint s_infoBuffer = 0;
+    // Set when a texture was added, the buffers are reallocated and uploaded as a whole
+    bool s_tablesResized = true;
+
+    GLuint s_feedbackFramebuffer = 0;
+    GLuint s_feedbackColor = 0;
+    GLuint s_feedbackDepth = 0;
+    int s_feedbackWidth = 0;
+    int s_feedbackHeight = 0;
+    Readback s_readbacks[ReadbackSlots];
+    // Readbacks started and processed or skipped so far, the ones in between are in flight
+    uint64_t s_readbacksBegun = 0;
+    uint64_t s_readbacksResolved = 0;
+    std::unordered_set<uint64_t> s_requestedTiles;
+    std::unordered_set<uint64_t> s_neededTiles;
+
+    // The queue of the loader threads is sorted by priority
+    TextureCache::Loaders<LoadRequest, LoadedTile> s_loaders;
+    std::atomic<uint64_t> s_loadedBytes{ 0 };
+    // Only used on the GL thread: tiles queued, being loaded or loaded and waiting for their upload
+    std::unordered_set<uint64_t> s_pendingTiles;
+
+    uint64_t tileKey(uint32_t texture, uint32_t level, uint32_t x, uint32_t y)
+    {
+        return ((uint64_t)texture << 40) | ((uint64_t)level << 32) | ((uint64_t)y << 16) | x;
+    }
+
+    uint32_t keyTexture(uint64_t key) { return (uint32_t)(key >> 40); }
+    uint32_t keyLevel(uint64_t key) { return (uint32_t)(key >> 32) & 0xFF; }
+    uint32_t keyY(uint64_t key) { return (uint32_t)(key >> 16) & 0xFFFF; }
+    uint32_t keyX(uint64_t key) { return (uint32_t)key & 0xFFFF; }
+
+    uint32_t tileIndex(const Texture& texture, uint64_t key)
+    {
+        const Level& level = texture.m_levels[keyLevel(key)];
+        return level.m_firstTile + keyY(key) * level.m_tilesX + keyX(key);
+    }
+
+    // Levels down to the first one that fits into a single tile, the shader walks them the same way
+    uint32_t computeLevels(uint32_t width, uint32_t height, std::vector<Level>& levels)
+    {
+        levels.clear();
+        uint32_t tileCount = 0;
+        for (uint32_t i = 0; ; i++)
+        {
+            Level level;
+            level.m_width = std::max(1u, width >> i);
+            level.m_height = std::max(1u, height >> i);
+            level.m_tilesX = (level.m_width + TileSize - 1) / TileSize;
+            level.m_tilesY = (level.m_height + TileSize - 1) / TileSize;
+            level.m_firstTile = tileCount;
+            tileCount += level.m_tilesX * level.m_tilesY;
+            levels.push_back(level);
+            if (level.m_tilesX == 1 && level.m_tilesY == 1)
+                return tileCount;
+        }
+    }
+
+    bool seekFile(FILE* f, uint64_t offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+        return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+
+    bool readHeader(const std::string& pagedFile, FileHeader& header)
+    {
+        FILE* f = fopen(pagedFile.c_str(), "rb");
+        if (!f)
+            return false;
+        bool success = fread(&header, sizeof(header), 1, f) == 1;
+        fclose(f);
+        return success && header.m_magic == PagedFileMagic && header.m_version == PagedFileVersion &&
+            header.m_tileSize == TileSize && header.m_tileBorder == TileBorder;
+    }
+
+    // Copies the page of the tile at tileX, tileY with its border, texels outside the level wrap around
+    void cutTile(const std::vector<uint8_t>& level, const Level& size, uint32_t tileX, uint32_t tileY, uint8_t* page)
+    {
+        int64_t originX = (int64_t)tileX * TileSize - TileBorder;
+        int64_t originY = (int64_t)tileY * TileSize - TileBorder;
+        for (uint32_t y = 0; y < PageSize; y++)
+        {
+            int64_t sourceY = ((originY + y) % size.m_height + size.m_height) % size.m_height;
+            const uint8_t* row = &level[(size_t)sourceY * size.m_width * 4];
+            for (uint32_t x = 0; x < PageSize; x++)
+            {
+                int64_t sourceX = ((originX + x) % size.m_width + size.m_width) % size.m_width;
+                memcpy(page + ((size_t)y * PageSize + x) * 4, row + sourceX * 4, 4);
+            }
+        }
+    }
+
+    void buildPageLevels(uint8_t* page)
+    {
+        for (uint32_t level = 1; level < PageLevels; level++)
+        {
+            uint32_t size = pageLevelSize(level - 1);
+            TextureCache::downsample(page + pageLevelOffset(level - 1), size, size, page + pageLevelOffset(level), pageLevelSize(level), pageLevelSize(level));
+        }
+    }
+
+    // Reads one tile of a paged file into all levels of a page, runs on the loader threads
+    bool loadPage(const Texture& texture, uint32_t tile, std::vector<uint8_t>& page)
+    {
+        page.resize(PageBytes);
+        if (!texture.m_solidPage.empty())
+        {
+            memcpy(page.data(), texture.m_solidPage.data(), PageBytes);
+            return true;
+        }
+        FILE* f = fopen(texture.m_pagedFile.c_str(), "rb");
+        if (!f)
+            return false;
+        bool success = seekFile(f, sizeof(FileHeader) + (uint64_t)tile * TileBytes) && fread(page.data(), 1, TileBytes, f) == TileBytes;
+        fclose(f);
+        if (success)
+            buildPageLevels(page.data());
+        return success;
+    }
+
+    bool buildPagedFile(const char* pngFile, const std::string& pagedFile, uint64_t sourceSize, uint64_t sourceTime,
+        std::string* errString)
+    {
+        PROFILE_SCOPE("buildPagedFile");
+        ObjLoader::Image image;
+        if (!ObjLoader::loadPngImage(pngFile, image))
+            return TextureCache::fail(errString, std::string("Cannot decode texture ") + pngFile);
+
+        FileHeader header = {};
+        header.m_magic = PagedFileMagic;
+        header.m_version = PagedFileVersion;
+        header.m_sourceSize = sourceSize;
+        header.m_sourceTime = sourceTime;
+        header.m_width = image.m_width;
+        header.m_height = image.m_height;
+        header.m_tileSize = TileSize;
+        header.m_tileBorder = TileBorder;
+        std::vector<Level> levels;
+        header.m_tileCount = computeLevels(image.m_width, image.m_height, levels);
+        header.m_levels = (uint32_t)levels.size();
+        for (size_t i = 3; i < image.m_pixels.size(); i += 4)
+        {
+            if (image.m_pixels[i] != 0xFF)
+            {
+                header.m_flags |= FlagHasAlpha;
+                break;
+            }
+        }
+
+        return TextureCache::writeFile(pagedFile, [&header, &image, &levels](FILE* f)
+        {
+            bool success = fwrite(&header, sizeof(header), 1, f) == 1;
+            std::vector<uint8_t> level = std::move(image.m_pixels);
+            std::vector<uint8_t> next;
+            std::vector<uint8_t> tile(TileBytes);
+            for (size_t i = 0; i < levels.size() && success; i++)
+            {
+                for (uint32_t y = 0; y < levels[i].m_tilesY && success; y++)
+                {
+                    for (uint32_t x = 0; x < levels[i].m_tilesX && success; x++)
+                    {
+                        cutTile(level, levels[i], x, y, tile.data());
+                        success = fwrite(tile.data(), 1, TileBytes, f) == TileBytes;
+                    }
+                }
+                if (i + 1 < levels.size())
+                {
+                    next.resize((size_t)levels[i + 1].m_width * levels[i + 1].m_height * 4);
+                    TextureCache::downsample(level.data(), levels[i].m_width, levels[i].m_height, next.data(),
+                        levels[i + 1].m_width, levels[i + 1].m_height);
+                    level.swap(next);
+                }
+            }
+            return success;
+        }, errString);
+    }
+
+    void unlinkPage(uint32_t index)
+    {
+        Page& page = s_pages[index];
+        if (page.m_prev != NoPage)
+            s_pages[page.m_prev].m_next = page.m_next;
+        else
+            s_lruHead = page.m_next;
+        if (page.m_next != NoPage)
+            s_pages[page.m_next].m_prev = page.m_prev;
+        else
+            s_lruTail = page.m_prev;
+        page.m_prev = page.m_next = NoPage;
+    }
+
+    void linkPageFront(uint32_t index)
+    {
+        Page& page = s_pages[index];
+        page.m_prev = NoPage;
+        page.m_next = s_lruHead;
+        if (s_lruHead != NoPage)
+            s_pages[s_lruHead].m_prev = index;
+        s_lruHead = index;
+        if (s_lruTail == NoPage)
+            s_lruTail = index;
+    }
+
+    void touchPage(uint32_t index)
+    {
+        Page& page = s_pages[index];
+        page.m_lastUsed = s_feedbackSerial;
+        if (page.m_pinned || s_lruHead == index)
+            return;
+        unlinkPage(index);
+        linkPageFront(index);
+    }
+
+    // A free page, or the least recently used one if the latest feedback didn't ask for it. NoPage if neither.
+    uint32_t allocatePage()
+    {
+        if (!s_freePages.empty())
+        {
+            uint32_t index = s_freePages.back();
+            s_freePages.pop_back();
+            return index;
+        }
+        if (s_lruTail == NoPage || s_pages[s_lruTail].m_lastUsed >= s_feedbackSerial)
+            return NoPage;
+        uint32_t index = s_lruTail;
+        Page& page = s_pages[index];
+        unlinkPage(index);
+        s_residentTiles.erase(page.m_key);
+        s_textures[keyTexture(page.m_key)]->m_dirty = true;
+        page.m_resident = false;
+        s_statistics.m_evictions++;
+        s_statistics.m_totalEvictions++;
+        return index;
+    }
+
+    void uploadPage(uint32_t index, const uint8_t* data)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, s_pageTexture);
+        for (uint32_t level = 0; level < PageLevels; level++)
+        {
+            GLsizei size = (GLsizei)pageLevelSize(level);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, (GLint)index, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                data + pageLevelOffset(level));
+        }
+        FrameStats::add(FrameStats::Counter::TextureBytes, PageBytes);
+    }
+
+    void makeResident(uint32_t index, uint64_t key, bool pinned)
+    {
+        Page& page = s_pages[index];
+        page.m_key = key;
+        page.m_lastUsed = s_feedbackSerial;
+        page.m_resident = true;
+        page.m_pinned = pinned;
+        if (!pinned)
+            linkPageFront(index);
+        s_residentTiles[key] = index;
+        s_textures[keyTexture(key)]->m_dirty = true;
+    }
+
+    uint32_t pinnedPages()
+    {
+        return (uint32_t)s_textures.size() - 1;
+    }
+
+    // Loads the single tile of the last level, which is never evicted
+    bool pinTail(Texture& texture, std::string* errString)
+    {
+        const Level& tail = texture.m_levels.back();
+        uint64_t key = tileKey(texture.m_id, (uint32_t)texture.m_levels.size() - 1, 0, 0);
+        std::vector<uint8_t> page;
+        if (!loadPage(texture, tail.m_firstTile, page))
+            return TextureCache::fail(errString, "Cannot read " + texture.m_pagedFile);
+        uint32_t index = allocatePage();
+        if (index == NoPage)
+            return TextureCache::fail(errString, "No page left for the virtual texture");
+        uploadPage(index, page.data());
+        makeResident(index, key, true);
+        return true;
+    }
+
+    // Creates the physical cache for the budget and pins the tails of all textures, the other pages are dropped
+    void recreateCache()
+    {
+        PROFILE_SCOPE("VirtualTexturing::recreateCache");
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        uint32_t pageCount = (uint32_t)std::min<uint64_t>(s_budget / PageBytes, (uint64_t)maxLayers);
+        pageCount = std::max(pageCount, std::min(pinnedPages() + MinFreePages, (uint32_t)maxLayers));
+
+        MemoryTracker::untrackTexture(s_pageTexture);
+        glDeleteTextures(1, &s_pageTexture);
+        glGenTextures(1, &s_pageTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, s_pageTexture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, PageLevels, GL_RGBA8, PageSize, PageSize, pageCount);
+        MemoryTracker::trackTexture(s_pageTexture, MemoryTracker::Category::VirtualTextures, "Virtual texture pages",
+            GL_RGBA8, PageSize, PageSize, pageCount, PageLevels);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, PageLevels - 1);
+
+        s_pages.assign(pageCount, Page());
+        s_freePages.clear();
+        for (uint32_t i = pageCount; i > 0; i--)
+            s_freePages.push_back(i - 1);
+        s_lruHead = s_lruTail = NoPage;
+        s_residentTiles.clear();
+        s_statistics.m_capacityPages = pageCount;
+        s_statistics.m_capacityBytes = (uint64_t)pageCount * PageBytes;
+
+        std::string errString;
+        for (size_t i = 1; i < s_textures.size(); i++)
+        {
+            if (!pinTail(*s_textures[i], &errString))
+                fprintf(stderr, "Virtual texturing: %s\n", errString.c_str());
+        }
+    }
+
+    // Every tile points at its own page if it's resident, otherwise at the entry of the tile covering it one level up
+    void updatePageTable(Texture& texture)
+    {
+        for (size_t i = texture.m_levels.size(); i-- > 0; )
+        {
+            const Level& level = texture.m_levels[i];
+            for (uint32_t y = 0; y < level.m_tilesY; y++)
+            {
+                for (uint32_t x = 0; x < level.m_tilesX; x++)
+                {
+                    uint32_t& entry = s_pageTable[texture.m_pageTableOffset + level.m_firstTile + y * level.m_tilesX + x];
+                    std::unordered_map<uint64_t, uint32_t>::const_iterator page = s_residentTiles.find(tileKey(texture.m_id, (uint32_t)i, x, y));
+                    if (page != s_residentTiles.end())
+                    {
+                        entry = page->second | ((uint32_t)i << 16);
+                    }
+                    else if (i + 1 < texture.m_levels.size())
+                    {
+                        const Level& parent = texture.m_levels[i + 1];
+                        uint32_t parentX = std::min(x / 2, parent.m_tilesX - 1);
+                        uint32_t parentY = std::min(y / 2, parent.m_tilesY - 1);
+                        entry = s_pageTable[texture.m_pageTableOffset + parent.m_firstTile + parentY * parent.m_tilesX + parentX];
+                    }
+                    else
+                    {
+                        entry = 0;
+                    }
+                }
+            }
+        }
+        texture.m_dirty = false;
+    }
+
+    void updateTables()
+    {
+        bool resized = s_tablesResized;
+        for (size_t i = 1; i < s_textures.size(); i++)
+        {
+            Texture& texture = *s_textures[i];
+            if (!texture.m_dirty)
+                continue;
+            updatePageTable(texture);
+            if (resized)
+                continue;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_pageTableBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, texture.m_pageTableOffset * sizeof(uint32_t), texture.m_tileCount * sizeof(uint32_t),
+                &s_pageTable[texture.m_pageTableOffset]);
+            FrameStats::add(FrameStats::Counter::BufferBytes, texture.m_tileCount * sizeof(uint32_t));
+        }
+        if (!resized)
+            return;
+
+        // Width, height, last level and page table offset of every texture
+        std::vector<uint32_t> infos(s_textures.size() * 4, 0);
+        for (size_t i = 1; i < s_textures.size(); i++)
+        {
+            const Texture& texture = *s_textures[i];
+            infos[i * 4 + 0] = texture.m_width;
+            infos[i * 4 + 1] = texture.m_height;
+            infos[i * 4 + 2] = (uint32_t)texture.m_levels.size() - 1;
+            infos[i * 4 + 3] = texture.m_pageTableOffset;
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_infoBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, infos.size() * sizeof(uint32_t), infos.data(), GL_STATIC_DRAW);
+        MemoryTracker::trackBuffer(s_infoBuffer, MemoryTracker::Category::VirtualTextures, "Virtual texture infos",
+            infos.size() * sizeof(uint32_t));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_pageTableBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(s_pageTable.size(), 1) * sizeof(uint32_t), s_pageTable.data(), GL_DYNAMIC_DRAW);
+        MemoryTracker::trackBuffer(s_pageTableBuffer, MemoryTracker::Category::VirtualTextures, "Virtual texture page tables",
+            std::max<size_t>(s_pageTable.size(), 1) * sizeof(uint32_t));
+        FrameStats::add(FrameStats::Counter::BufferBytes, (infos.size() + s_pageTable.size()) * sizeof(uint32_t));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        s_tablesResized = false;
+    }
+
+    // Tile of the texture that a feedback pixel with the given uv and uv space level asks for
+    uint64_t feedbackTile(const Texture& texture, float u, float v, float uvLevel)
+    {
+        int maxLevel = (int)texture.m_levels.size() - 1;
+        uint32_t levelIndex = (uint32_t)std::min(std::max((int)floorf(uvLevel + texture.m_log2Size), 0), maxLevel);
+        const Level& level = texture.m_levels[levelIndex];
+        uint32_t x = std::min((uint32_t)(u * level.m_width) / TileSize, level.m_tilesX - 1);
+        uint32_t y = std::min((uint32_t)(v * level.m_height) / TileSize, level.m_tilesY - 1);
+        return tileKey(texture.m_id, levelIndex, x, y);
+    }
+
+    // Resident tiles move to the front of the LRU list, the others are added to missing
+    void requestTile(uint64_t key, bool counted, std::vector<uint64_t>& missing)
+    {
+        std::unordered_map<uint64_t, uint32_t>::const_iterator page = s_residentTiles.find(key);
+        if (page != s_residentTiles.end())
+        {
+            touchPage(page->second);
+            if (counted)
+                s_statistics.m_hits++;
+            return;
+        }
+        if (counted)
+            s_statistics.m_pageFaults++;
+        missing.push_back(key);
+    }
+
+    // Turns the feedback pixels into tile requests and replaces the load queue with the missing tiles
+    void processFeedback(const uint32_t* pixels, size_t pixelCount)
+    {
+        PROFILE_SCOPE("processFeedback");
+        s_requestedTiles.clear();
+        uint64_t lastKeys[4] = { ~0ull, ~0ull, ~0ull, ~0ull };
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            const uint32_t* pixel = pixels + i * 4;
+            if (!pixel[0] && !pixel[1])
+                continue;
+            // Two texture ids in each of r and g, the uv in b and the uv space level in 1/8 steps from -32 in a
+            uint32_t ids[4] = { pixel[0] & 0xFFFF, pixel[0] >> 16, pixel[1] & 0xFFFF, pixel[1] >> 16 };
+            float u = (pixel[2] & 0xFFFF) / 65535.0f;
+            float v = (pixel[2] >> 16) / 65535.0f;
+            float uvLevel = (pixel[3] & 0xFF) / 8.0f - 32.0f;
+            for (uint32_t slot = 0; slot < 4; slot++)
+            {
+                // Textures with a single tile are pinned, asking for them would only inflate the hit rate
+                if (!ids[slot] || ids[slot] >= s_textures.size() || s_textures[ids[slot]]->m_tileCount == 1)
+                    continue;
+                uint64_t key = feedbackTile(*s_textures[ids[slot]], u, v, uvLevel);
+                // Neighboring pixels mostly hit the same tile
+                if (key == lastKeys[slot])
+                    continue;
+                lastKeys[slot] = key;
+                s_requestedTiles.insert(key);
+            }
+        }
+
+        s_feedbackSerial++;
+        s_statistics.m_requestedTiles = (uint32_t)s_requestedTiles.size();
+        s_statistics.m_hits = 0;
+        s_statistics.m_pageFaults = 0;
+        std::vector<uint64_t> missing;
+        s_neededTiles.clear();
+        for (uint64_t key : s_requestedTiles)
+        {
+            requestTile(key, true, missing);
+            // The coarser tiles covering it are its fallbacks, they are kept and loaded too
+            const Texture& texture = *s_textures[keyTexture(key)];
+            uint32_t x = keyX(key), y = keyY(key);
+            for (uint32_t level = keyLevel(key) + 1; level < texture.m_levels.size(); level++)
+            {
+                x = std::min(x / 2, texture.m_levels[level].m_tilesX - 1);
+                y = std::min(y / 2, texture.m_levels[level].m_tilesY - 1);
+                uint64_t parent = tileKey(texture.m_id, level, x, y);
+                if (s_requestedTiles.count(parent) || !s_neededTiles.insert(parent).second)
+                    break;
+                requestTile(parent, false, missing);
+            }
+        }
+        s_statistics.m_hitRate = s_statistics.m_requestedTiles ? (double)s_statistics.m_hits / s_statistics.m_requestedTiles : 1.0;
+        s_statistics.m_totalRequests += s_statistics.m_requestedTiles;
+        s_statistics.m_totalHits += s_statistics.m_hits;
+        s_statistics.m_totalPageFaults += s_statistics.m_pageFaults;
+        FrameStats::add(FrameStats::Counter::VirtualTileRequests, s_statistics.m_requestedTiles);
+        FrameStats::add(FrameStats::Counter::VirtualPageFaults, s_statistics.m_pageFaults);
+
+        // Coarse levels are loaded first, they replace the blurriest fallbacks. The back is taken first.
+        std::sort(missing.begin(), missing.end(), [](uint64_t a, uint64_t b) { return keyLevel(a) < keyLevel(b); });
+        s_loaders.editQueue([&missing](std::vector<LoadRequest>& queue)
+        {
+            // Requests that weren't started yet are replaced, the next feedback knows better what is needed
+            for (const LoadRequest& request : queue)
+                s_pendingTiles.erase(request.m_key);
+            queue.clear();
+            for (uint64_t key : missing)
+            {
+                if (!s_pendingTiles.insert(key).second)
+                    continue;
+                LoadRequest request;
+                request.m_key = key;
+                request.m_texture = s_textures[keyTexture(key)].get();
+                request.m_tile = tileIndex(*request.m_texture, key);
+                queue.push_back(request);
+            }
+        });
+    }
+
+    // Processes the newest finished readback, older finished ones are skipped
+    void resolveReadbacks()
+    {
+        int ready = -1;
+        while (s_readbacksResolved != s_readbacksBegun)
+        {
+            Readback& readback = s_readbacks[s_readbacksResolved % ReadbackSlots];
+            GLenum result = glClientWaitSync(readback.m_fence, 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(readback.m_fence);
+            readback.m_fence = nullptr;
+            ready = (int)(s_readbacksResolved % ReadbackSlots);
+            s_readbacksResolved++;
+        }
+        if (ready < 0)
+            return;
+
+        Readback& readback = s_readbacks[ready];
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.m_buffer);
+        size_t pixelCount = (size_t)readback.m_width * readback.m_height;
+        const uint32_t* pixels = (const uint32_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixelCount * 16, GL_MAP_READ_BIT);
+        if (pixels)
+        {
+            processFeedback(pixels, pixelCount);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // Uploads tiles finished by the loader threads into free or evicted pages
+    void uploadLoadedTiles()
+    {
+        std::vector<LoadedTile> loaded;
+        s_loaders.takeResults(loaded, MaxUploadsPerFrame);
+        s_statistics.m_bytesRead = s_loadedBytes;
+        for (LoadedTile& tile : loaded)
+        {
+            s_pendingTiles.erase(tile.m_key);
+            if (!tile.m_success || s_residentTiles.count(tile.m_key))
+                continue;
+            uint32_t index = allocatePage();
+            if (index == NoPage)
+            {
+                s_statistics.m_droppedLoads++;
+                continue;
+            }
+            uploadPage(index, tile.m_page.data());
+            makeResident(index, tile.m_key, false);
+            s_statistics.m_uploads++;
+            s_statistics.m_totalUploads++;
+        }
+    }
+
+    void destroyFeedbackTargets()
+    {
+        MemoryTracker::untrackTexture(s_feedbackColor);
+        MemoryTracker::untrackRenderbuffer(s_feedbackDepth);
+        glDeleteTextures(1, &s_feedbackColor);
+        glDeleteRenderbuffers(1, &s_feedbackDepth);
+        s_feedbackColor = s_feedbackDepth = 0;
+        s_feedbackWidth = s_feedbackHeight = 0;
+    }
+}
+
+bool VirtualTexturing::init(const char* cacheDirectory, uint64_t budgetBytes, uint32_t loaderThreads, std::string* errString)
+{
+    destroy();
+    s_directory = cacheDirectory;
+    if (!Util::createDirectory(cacheDirectory))
+        return TextureCache::fail(errString, std::string("Cannot create the virtual texture cache ") + cacheDirectory);
+
+    s_statistics = Statistics();
+    s_budget = budgetBytes;
+    s_textures.resize(1);
+    glGenBuffers(1, &s_pageTableBuffer);
+    glGenBuffers(1, &s_infoBuffer);
+    glGenFramebuffers(1, &s_feedbackFramebuffer);
+    for (Readback& readback : s_readbacks)
+        glGenBuffers(1, &readback.m_buffer);
+    s_tablesResized = true;
+    recreateCache();
+
+    loaderThreads = std::max(loaderThreads, 1u);
+    s_loaders.start(loaderThreads, [](const LoadRequest& request, LoadedTile& loaded)
+    {
+        PROFILE_SCOPE("Load tile");
+        loaded.m_key = request.m_key;
+        loaded.m_success = loadPage(*request.m_texture, request.m_tile, loaded.m_page);
+        s_loadedBytes += TileBytes;
+    });
+    s_statistics.m_loaderThreads = loaderThreads;
+    s_enabled = true;
+    return true;
+}
+
+void VirtualTexturing::destroy()
+{
+    s_loaders.stop();
+    s_pendingTiles.clear();
+    if (!s_enabled)
+        return;
+    destroyFeedbackTargets();
+    for (Readback& readback : s_readbacks)
+    {
+        if (readback.m_fence)
+            glDeleteSync(readback.m_fence);
+        MemoryTracker::untrackBuffer(readback.m_buffer);
+        glDeleteBuffers(1, &readback.m_buffer);
+        readback = Readback();
+    }
+    s_readbacksBegun = s_readbacksResolved = 0;
+    glDeleteFramebuffers(1, &s_feedbackFramebuffer);
+    MemoryTracker::untrackBuffer(s_pageTableBuffer);
+    MemoryTracker::untrackBuffer(s_infoBuffer);
+    MemoryTracker::untrackTexture(s_pageTexture);
+    glDeleteBuffers(1, &s_pageTableBuffer);
+    glDeleteBuffers(1, &s_infoBuffer);
+    glDeleteTextures(1, &s_pageTexture);
+    s_feedbackFramebuffer = s_pageTableBuffer = s_infoBuffer = s_pageTexture = 0;
+    s_textures.clear();
+    s_textureIds.clear();
+    s_pages.clear();
+    s_freePages.clear();
+    s_residentTiles.clear();
+    s_pageTable.clear();
+    s_lruHead = s_lruTail = NoPage;
+    s_enabled = false;
+}
+
+bool VirtualTexturing::isEnabled()
+{
+    return s_enabled;
+}
+
+bool VirtualTexturing::preparePagedFile(const char* pngFile, std::string* errString)
+{
+    uint64_t sourceSize = 0, sourceTime = 0;
+    if (!TextureCache::sourceStamp(pngFile, sourceSize, sourceTime))
+        return TextureCache::fail(errString, std::string("Cannot find texture ") + pngFile);
+    std::string pagedFile = TextureCache::cacheFilePath(s_directory.c_str(), pngFile, ".vtex");
+    FileHeader header;
+    if (readHeader(pagedFile, header) && header.m_sourceSize == sourceSize && header.m_sourceTime == sourceTime)
+        return true;
+    return buildPagedFile(pngFile, pagedFile, sourceSize, sourceTime, errString);
+}
+
+uint32_t VirtualTexturing::addTexture(const char* pngFile, bool* hasAlpha, std::string* errString)
+{
+    std::unordered_map<std::string, uint32_t>::const_iterator existing = s_textureIds.find(pngFile);
+    if (existing != s_textureIds.end())
+    {
+        if (hasAlpha)
+            *hasAlpha = s_textures[existing->second]->m_hasAlpha;
+        return existing->second;
+    }
+    if (s_textures.size() > MaxTextures)
+    {
+        TextureCache::fail(errString, "Too many virtual textures");
+        return 0;
+    }
+    if (!preparePagedFile(pngFile, errString))
+        return 0;
+
+    std::unique_ptr<Texture> texture = std::make_unique<Texture>();
+    texture->m_pagedFile = TextureCache::cacheFilePath(s_directory.c_str(), pngFile, ".vtex");
+    FileHeader header;
+    if (!readHeader(texture->m_pagedFile, header))
+    {
+        TextureCache::fail(errString, "Cannot read " + texture->m_pagedFile);
+        return 0;
+    }
+    texture->m_id = (uint32_t)s_textures.size();
+    texture->m_width = header.m_width;
+    texture->m_height = header.m_height;
+    texture->m_log2Size = log2f((float)std::max(header.m_width, header.m_height));
+    texture->m_hasAlpha = (header.m_flags & FlagHasAlpha) != 0;
+    texture->m_tileCount = computeLevels(header.m_width, header.m_height, texture->m_levels);
+    texture->m_pageTableOffset = (uint32_t)s_pageTable.size();
+    if (texture->m_tileCount != header.m_tileCount)
+    {
+        TextureCache::fail(errString, "Corrupt paged file " + texture->m_pagedFile);
+        return 0;
+    }
+
+    Texture& added = *texture;
+    s_textures.push_back(std::move(texture));
+    s_pageTable.resize(s_pageTable.size() + added.m_tileCount, 0);
+    s_tablesResized = true;
+    // The cache grows if the pinned pages leave too few to page in
+    if ((s_freePages.size() < MinFreePages && s_pages.size() < pinnedPages() + MinFreePages) || !pinTail(added, errString))
+        recreateCache();
+    if (!s_residentTiles.count(tileKey(added.m_id, (uint32_t)added.m_levels.size() - 1, 0, 0)))
+    {
+        s_textures.pop_back();
+        s_pageTable.resize(added.m_pageTableOffset);
+        TextureCache::fail(errString, "No page left for the virtual texture");
+        return 0;
+    }
+    s_textureIds[pngFile] = added.m_id;
+    s_statistics.m_textures = pinnedPages();
+    if (hasAlpha)
+        *hasAlpha = added.m_hasAlpha;
+    return added.m_id;
+}
+
+uint32_t VirtualTexturing::addSolidTexture(uint32_t rgba)
+{
+    std::unique_ptr<Texture> texture = std::make_unique<Texture>();
+    texture->m_id = (uint32_t)s_textures.size();
+    texture->m_width = texture->m_height = 1;
+    texture->m_hasAlpha = (rgba >> 24) != 0xFF;
+    texture->m_tileCount = computeLevels(1, 1, texture->m_levels);
+    texture->m_pageTableOffset = (uint32_t)s_pageTable.size();
+    texture->m_solidPage.resize(PageBytes);
+    for (size_t i = 0; i < PageBytes; i += 4)
+        memcpy(&texture->m_solidPage[i], &rgba, 4);
+
+    Texture& added = *texture;
+    s_textures.push_back(std::move(texture));
+    s_pageTable.resize(s_pageTable.size() + added.m_tileCount, 0);
+    s_tablesResized = true;
+    if (!pinTail(added, nullptr))
+        recreateCache();
+    s_statistics.m_textures = pinnedPages();
+    return added.m_id;
+}
+
+void VirtualTexturing::setBudget(uint64_t budgetBytes)
+{
+    s_budget = budgetBytes;
+    if (s_enabled)
+        recreateCache();
+}
+
+uint64_t VirtualTexturing::budget()
+{
+    return s_budget;
+}
+
+void VirtualTexturing::update()
+{
+    if (!s_enabled)
+        return;
+    PROFILE_SCOPE("VirtualTexturing::update");
+    uint64_t startNs = Profiler::nowNs();
+    s_statistics.m_uploads = 0;
+    s_statistics.m_evictions = 0;
+    resolveReadbacks();
+    uploadLoadedTiles();
+    updateTables();
+
+    uint32_t pinned = 0;
+    for (const Page& page : s_pages)
+        pinned += page.m_pinned ? 1 : 0;
+    s_statistics.m_residentPages = (uint32_t)s_residentTiles.size();
+    s_statistics.m_pinnedPages = pinned;
+    s_statistics.m_pendingLoads = (uint32_t)s_pendingTiles.size();
+    s_statistics.m_updateMs = (Profiler::nowNs() - startNs) / 1000000.0;
+}
+
+void VirtualTexturing::bind()
+{
+    glActiveTexture(GL_TEXTURE0 + PageTextureUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, s_pageTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TextureInfoBinding, s_infoBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PageTableBinding, s_pageTableBuffer);
+}
+
+void VirtualTexturing::beginFeedbackPass(int viewportWidth, int viewportHeight)
+{
+    int width = std::max(1, (viewportWidth + (int)FeedbackDivisor - 1) / (int)FeedbackDivisor);
+    int height = std::max(1, (viewportHeight + (int)FeedbackDivisor - 1) / (int)FeedbackDivisor);
+    glBindFramebuffer(GL_FRAMEBUFFER, s_feedbackFramebuffer);
+    if (width != s_feedbackWidth || height != s_feedbackHeight)
+    {
+        destroyFeedbackTargets();
+        glGenTextures(1, &s_feedbackColor);
+        glBindTexture(GL_TEXTURE_2D, s_feedbackColor);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, width, height);
+        glGenRenderbuffers(1, &s_feedbackDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, s_feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        MemoryTracker::trackTexture(s_feedbackColor, MemoryTracker::Category::VirtualTextures, "Virtual texture feedback",
+            GL_RGBA32UI, width, height, 1, 1);
+        MemoryTracker::trackRenderbuffer(s_feedbackDepth, MemoryTracker::Category::VirtualTextures,
+            "Virtual texture feedback depth", GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s_feedbackColor, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, s_feedbackDepth);
+        s_feedbackWidth = width;
+        s_feedbackHeight = height;
+    }
+    glViewport(0, 0, width, height);
+    const GLuint noTextures[4] = { 0, 0, 0, 0 };
+    const GLfloat farDepth = 1.0f;
+    glClearBufferuiv(GL_COLOR, 0, noTextures);
+    glClearBufferfv(GL_DEPTH, 0, &farDepth);
+}
+
+void VirtualTexturing::endFeedbackPass()
+{
+    // Every slot still in flight, this frame's feedback is skipped
+    if (s_readbacksBegun - s_readbacksResolved == ReadbackSlots)
+        return;
+    Readback& readback = s_readbacks[s_readbacksBegun % ReadbackSlots];
+    size_t size = (size_t)s_feedbackWidth * s_feedbackHeight * 16;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.m_buffer);
+    if (readback.m_size != size)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        MemoryTracker::trackBuffer(readback.m_buffer, MemoryTracker::Category::VirtualTextures, "Virtual texture readback", size);
+        readback.m_size = size;
+    }
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, s_feedbackWidth, s_feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.m_width = s_feedbackWidth;
+    readback.m_height = s_feedbackHeight;
+    s_readbacksBegun++;
+}
+
+const Statistics& VirtualTexturing::statistics()
+{
+    return s_statistics;
+}
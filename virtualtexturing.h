@@ -0,0 +1,97 @@
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include "GL/glew.h"
+
+// Virtual texturing for the material textures. Every texture is converted once into a paged file in the cache
+// directory: its mip levels cut into TileSize x TileSize tiles with a border of TileBorder texels on each side, down to
+// the first level that fits into one tile. Only a physical cache of pages, one texture array layer each, lives on the
+// GPU; a page table per texture maps every tile to the resident page that covers it best, so a missing tile is drawn
+// from a coarser one. The coarsest tile of every texture is pinned, so there always is one.
+// A feedback pass renders the scene at 1/FeedbackDivisor of the viewport and writes the textures, uv and mip level of
+// every pixel. Its readback arrives a frame or two later and update() turns it into tile requests: resident tiles are
+// moved to the front of the LRU list, missing ones are page faults and queued for the loader threads, coarse levels
+// first. Loaded tiles are uploaded on the GL thread, evicting the least recently used pages when the budget is full.
+namespace VirtualTexturing
+{
+    const uint32_t TileSize = 128;
+    const uint32_t TileBorder = 4;
+    const uint32_t PageSize = TileSize + 2 * TileBorder;
+    // A page holds the full mip chain of its tile (136 down to 1), so a coarse fallback page still filters when the
+    // texture is minified below its last level
+    const uint32_t PageLevels = 8;
+    const uint32_t FeedbackDivisor = 8;
+    const uint32_t DefaultLoaderThreads = 2;
+    // Loaded tiles uploaded per update(), the rest waits for the next frame
+    const uint32_t MaxUploadsPerFrame = 32;
+
+    // After the material textures and the shadow maps
+    const GLuint PageTextureUnit = 7;
+    // After the clustered lights and the instance transforms
+    const GLuint TextureInfoBinding = 4;
+    const GLuint PageTableBinding = 5;
+
+    struct Statistics
+    {
+        uint32_t m_textures = 0;
+        uint32_t m_loaderThreads = 0;
+        // Physical pages of the budget and their size on the GPU
+        uint32_t m_capacityPages = 0;
+        uint64_t m_capacityBytes = 0;
+        uint32_t m_residentPages = 0;
+        uint32_t m_pinnedPages = 0;
+        // Tiles waiting for or being loaded by the loader threads
+        uint32_t m_pendingLoads = 0;
+        // Last processed feedback: distinct tiles it asked for, the resident ones and the page faults
+        uint32_t m_requestedTiles = 0;
+        uint32_t m_hits = 0;
+        uint32_t m_pageFaults = 0;
+        double m_hitRate = 1.0;
+        // Last update()
+        uint32_t m_uploads = 0;
+        uint32_t m_evictions = 0;
+        double m_updateMs = 0.0;
+        // Since init()
+        uint64_t m_totalRequests = 0;
+        uint64_t m_totalHits = 0;
+        uint64_t m_totalPageFaults = 0;
+        uint64_t m_totalUploads = 0;
+        uint64_t m_totalEvictions = 0;
+        // Loaded tiles that found no page to evict, they are requested again by a later feedback
+        uint64_t m_droppedLoads = 0;
+        uint64_t m_bytesRead = 0;
+    };
+
+    // Needs a current GL context. Starts the loader threads, the physical cache holds as many pages as fit into
+    // budgetBytes, at least the pinned ones plus a few.
+    bool init(const char* cacheDirectory, uint64_t budgetBytes, uint32_t loaderThreads, std::string* errString);
+    void destroy();
+    bool isEnabled();
+
+    // Builds the paged file of a PNG file unless it is up to date. Doesn't need GL, can run on any thread, but not
+    // twice for the same file at once.
+    bool preparePagedFile(const char* pngFile, std::string* errString);
+    // Registers a texture, preparing its paged file first. Returns its id, the same for the same file, or 0 on
+    // errors. hasAlpha is set if any texel isn't fully opaque.
+    uint32_t addTexture(const char* pngFile, bool* hasAlpha, std::string* errString);
+    // 1x1 texture of one RGBA8 color (0xAABBGGRR), kept in memory
+    uint32_t addSolidTexture(uint32_t rgba);
+
+    // Recreates the physical cache with the new budget, only the pinned pages are kept
+    void setBudget(uint64_t budgetBytes);
+    uint64_t budget();
+
+    // Call once per frame before drawing: reads back finished feedback, queues the page faults, uploads loaded
+    // tiles and updates the page tables
+    void update();
+    // Binds the physical pages and the page tables for the material shaders
+    void bind();
+
+    // Binds and clears the feedback framebuffer for a viewport of the given size and sets its viewport. The caller
+    // draws the scene with the FEEDBACK permutations and restores its framebuffer after endFeedbackPass().
+    void beginFeedbackPass(int viewportWidth, int viewportHeight);
+    // Starts the asynchronous readback of the feedback, update() picks it up once the GPU is done
+    void endFeedbackPass();
+
+    const Statistics& statistics();
+}
@@ -0,0 +1,411 @@
+#version 440 core
+
+// Pixel shader for all light types. The app compiles one permutation per combination of defines, inserted after
+// the #version line: one of LIGHT_AMBIENT, LIGHT_DIRECTIONAL, LIGHT_SPOT, LIGHT_POINT or LIGHT_CLUSTERED selects the
+// light type, ALPHA_TEST discards transparent texels, NORMAL_MAP applies normalTex, SPECULAR adds the specular term and
+// SHADOWS samples the shadow map of the directional, spot or point light.
+// Deferred shading uses two more: GBUFFER (instead of a light type) writes the surface to the G-buffer, and DEFERRED
+// lights a full-screen pass with the surfaces read back from it. DEPTH_ONLY (also instead of a light type) renders
+// shadow maps, it only runs the alpha test.
+// VIRTUAL_TEXTURE reads the material textures through the page tables of VirtualTexturing, and FEEDBACK (instead of a
+// light type, always with VIRTUAL_TEXTURE) writes the textures, uv and mip level every pixel needs for its page requests.
+
+uniform vec3 ambientColor;
+
+#ifdef DEFERRED
+uniform sampler2D gbufferAlbedoTex;
+uniform sampler2D gbufferNormalTex;
+uniform sampler2D gbufferDepthTex;
+uniform mat4 inverseViewProjection;
+#elif defined(VIRTUAL_TEXTURE)
+// Ids of the diffuse, normal, specular color and specular power textures
+uniform uvec4 virtualTextures;
+// The physical pages, one tile with its border per layer
+uniform sampler2DArray virtualPages;
+// Matches VirtualTexturing::TileSize and TileBorder
+const uint VirtualTileSize = 128u;
+const uint VirtualTileBorder = 4u;
+// log2 of VirtualTexturing::FeedbackDivisor, the feedback pass runs at a lower resolution than the main pass
+const float FeedbackLodBias = 3.0;
+
+layout (std430, binding = 4) readonly buffer VirtualTextureInfo
+{
+    // Width, height, last level and page table offset of every texture
+    uvec4 virtualTextureInfo[];
+};
+
+layout (std430, binding = 5) readonly buffer VirtualPageTable
+{
+    // Page of the best resident tile in the low 16 bits, its level above. The levels follow each other finest first.
+    uint virtualPageTable[];
+};
+#else
+uniform sampler2D diffuseTex;
+uniform sampler2D normalTex;
+uniform sampler2D specularColorTex;
+uniform sampler2D specularPowerTex;
+#endif
+
+#if !defined(LIGHT_AMBIENT) && !defined(LIGHT_CLUSTERED) && !defined(GBUFFER) && !defined(DEPTH_ONLY)
+uniform vec3 lightColor;
+#endif
+#if defined(LIGHT_DIRECTIONAL) || defined(LIGHT_SPOT)
+uniform vec3 lightDir;
+#endif
+#if defined(LIGHT_SPOT) || defined(LIGHT_POINT)
+uniform vec3 lightPos;
+#endif
+#ifdef LIGHT_SPOT
+uniform float lightInnerCone;
+uniform float lightOuterCone;
+#endif
+#ifdef LIGHT_POINT
+uniform float lightOuterRadius;
+#endif
+#ifdef SHADOWS
+#if defined(LIGHT_DIRECTIONAL)
+// Matches ShadowMaps::CascadeCount
+const int ShadowCascadeCount = 4;
+// World to shadow texture space of every cascade
+uniform mat4 shadowMatrices[ShadowCascadeCount];
+uniform sampler2DArrayShadow shadowCascades;
+#elif defined(LIGHT_SPOT)
+uniform mat4 shadowMatrix;
+uniform sampler2DShadow spotShadowMap;
+#elif defined(LIGHT_POINT)
+uniform samplerCubeShadow pointShadowMap;
+// Near and far plane of the cube map faces
+uniform vec2 pointShadowRange;
+#endif
+#endif
+#ifdef LIGHT_CLUSTERED
+// Written by ClusteredLighting::update() every frame
+struct ClusterLight
+{
+    vec4 positionRadius;
+    vec4 colorKind;
+    vec4 directionOuterCone;
+    vec4 innerCone;
+};
+
+layout (std430, binding = 0) readonly buffer ClusterLights
+{
+    ClusterLight lights[];
+};
+
+layout (std430, binding = 1) readonly buffer ClusterLightIndices
+{
+    uint lightIndices[];
+};
+
+layout (std430, binding = 2) readonly buffer ClusterGrid
+{
+    // Cluster counts in x, y and depth, tile size in pixels
+    uvec4 gridSize;
+    // Near plane, far plane, and scale and bias that map the log of the view depth to a slice
+    vec4 depthParams;
+    // Offset into lightIndices and light count of every cluster
+    uvec2 clusters[];
+};
+#endif
+#if defined(SPECULAR) && !defined(GBUFFER) && !defined(DEPTH_ONLY)
+uniform float shininess;
+uniform float globalSpecMultiplier;
+uniform vec3 cameraPos;
+#endif
+
+#ifndef DEFERRED
+layout (location = 0) in vec4 v_worldPos;
+layout (location = 1) in vec3 v_normal;
+layout (location = 2) in vec2 v_texCoord;
+layout (location = 3) in vec4 v_tangent;
+#endif
+#ifdef GBUFFER
+// Albedo and specular power
+layout (location = 0) out vec4 gbufferAlbedo;
+// Octahedral normal with 12 bits per component spread over rgb, specular intensity
+layout (location = 1) out vec4 gbufferNormal;
+#elif defined(FEEDBACK)
+// Diffuse and normal id, specular color and power id, 16 bit uv, uv space mip level
+layout (location = 0) out uvec4 feedback;
+#elif !defined(DEPTH_ONLY)
+out vec4 fragColor;
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+uvec2 virtualLevelTiles(uvec2 levelSize)
+{
+    return (levelSize + VirtualTileSize - 1u) / VirtualTileSize;
+}
+
+// Samples texture id with the gradients of the unwrapped uv. Missing tiles fall back to the resident level the page
+// table points at, and the page is sampled with gradients of that level, so it is just blurrier.
+vec4 sampleVirtual(uint id, vec2 uv, vec2 uvDx, vec2 uvDy)
+{
+    uvec4 info = virtualTextureInfo[id];
+    vec2 size = vec2(info.xy);
+    vec2 texelDx = uvDx * size;
+    vec2 texelDy = uvDy * size;
+    float lod = 0.5 * log2(max(max(dot(texelDx, texelDx), dot(texelDy, texelDy)), 1e-8));
+    uint level = uint(clamp(lod, 0.0, float(info.z)));
+    uint offset = info.w;
+    for (uint i = 0u; i < level; i++)
+    {
+        uvec2 tiles = virtualLevelTiles(max(info.xy >> i, uvec2(1u)));
+        offset += tiles.x * tiles.y;
+    }
+
+    vec2 wrapped = fract(uv);
+    uvec2 levelSize = max(info.xy >> level, uvec2(1u));
+    uvec2 tiles = virtualLevelTiles(levelSize);
+    uvec2 tile = min(uvec2(wrapped * vec2(levelSize)) / VirtualTileSize, tiles - 1u);
+    uint entry = virtualPageTable[offset + tile.y * tiles.x + tile.x];
+
+    uint residentLevel = entry >> 16;
+    uvec2 residentSize = max(info.xy >> residentLevel, uvec2(1u));
+    vec2 texel = wrapped * vec2(residentSize);
+    vec2 residentTile = vec2(min(uvec2(texel) / VirtualTileSize, virtualLevelTiles(residentSize) - 1u));
+    float pageSize = float(VirtualTileSize + 2u * VirtualTileBorder);
+    vec2 pageUv = (texel - residentTile * float(VirtualTileSize) + float(VirtualTileBorder)) / pageSize;
+    vec2 scale = vec2(residentSize) / pageSize;
+    return textureGrad(virtualPages, vec3(pageUv, float(entry & 0xFFFFu)), uvDx * scale, uvDy * scale);
+}
+
+#define MATERIAL_TEXTURE(sampler, slot, dx, dy) sampleVirtual(virtualTextures[slot], v_texCoord, dx, dy)
+#else
+#define MATERIAL_TEXTURE(sampler, slot, dx, dy) texture(sampler, v_texCoord)
+#endif
+
+#ifdef FEEDBACK
+uvec4 virtualFeedback(vec2 uvDx, vec2 uvDy)
+{
+    // The level is resolved per texture on the CPU, it only needs the uv footprint at the main pass resolution
+    float uvLod = 0.5 * log2(max(max(dot(uvDx, uvDx), dot(uvDy, uvDy)), 1e-20)) - FeedbackLodBias;
+    uvec2 uv = uvec2(fract(v_texCoord) * 65535.0 + 0.5);
+    uint lod = uint(clamp((uvLod + 32.0) * 8.0, 0.0, 255.0));
+    return uvec4(virtualTextures.x | (virtualTextures.y << 16), virtualTextures.z | (virtualTextures.w << 16), uv.x | (uv.y << 16), lod);
+}
+#endif
+
+#if defined(GBUFFER) || defined(DEFERRED)
+vec2 octahedronWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+#endif
+
+#ifdef GBUFFER
+vec3 encodeNormal(vec3 normal)
+{
+    normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+    vec2 octahedron = normal.z >= 0.0 ? normal.xy : octahedronWrap(normal.xy);
+    uvec2 bits = uvec2(round(clamp(octahedron * 0.5 + 0.5, 0.0, 1.0) * 4095.0));
+    return vec3(uvec3(bits.x >> 4, ((bits.x & 15u) << 4) | (bits.y >> 8), bits.y & 255u)) / 255.0;
+}
+#endif
+
+#ifdef DEFERRED
+vec3 decodeNormal(vec3 encoded)
+{
+    uvec3 bytes = uvec3(round(encoded * 255.0));
+    vec2 octahedron = vec2(uvec2((bytes.x << 4) | (bytes.y >> 4), ((bytes.y & 15u) << 8) | bytes.z)) / 4095.0 * 2.0 - 1.0;
+    vec3 normal = vec3(octahedron, 1.0 - abs(octahedron.x) - abs(octahedron.y));
+    if (normal.z < 0.0)
+        normal.xy = octahedronWrap(normal.xy);
+    return normalize(normal);
+}
+#endif
+
+#if defined(SPECULAR) && !defined(GBUFFER) && !defined(DEPTH_ONLY)
+vec3 specular(vec3 lightToSurface, vec3 normal, vec3 worldPos, vec3 specularColor, float shiny, float specularPower)
+{
+    vec3 reflection = reflect(lightToSurface, normal);
+    vec3 viewDir = normalize(cameraPos - worldPos);
+    float RdotV = dot(reflection, viewDir);
+    return specularColor * pow(max(RdotV, 0), specularPower * shiny);
+}
+#endif
+
+#ifdef LIGHT_SPOT
+float attenuate(float value, float minimum, float maximum)
+{
+    return 1.0f - (clamp(value, minimum, maximum) - minimum) / (maximum - minimum);
+}
+#endif
+
+#ifdef LIGHT_POINT
+float attenuate(float value, float maximum)
+{
+    float clampedValue = min(value, maximum);
+    return 1.0 / (pow(5 * clampedValue / maximum, 2) + 1);
+}
+#endif
+
+#ifdef SHADOWS
+// Fraction of the light that reaches the surface, hardware filtered over 2x2 texels
+float shadow(vec3 worldPos)
+{
+#if defined(LIGHT_DIRECTIONAL)
+    // The cascades overlap, the first one that contains the position has the highest resolution
+    for (int i = 0; i < ShadowCascadeCount; i++)
+    {
+        vec3 coord = (shadowMatrices[i] * vec4(worldPos, 1.0)).xyz;
+        if (all(greaterThan(coord, vec3(0.0))) && all(lessThan(coord, vec3(1.0))))
+            return texture(shadowCascades, vec4(coord.xy, float(i), coord.z));
+    }
+    return 1.0;
+#elif defined(LIGHT_SPOT)
+    return textureProj(spotShadowMap, shadowMatrix * vec4(worldPos, 1.0));
+#else
+    // The faces store the window depth of a 90 degree projection along their axis, recomputed from the major axis
+    vec3 lightToSurface = worldPos - lightPos;
+    vec3 axisDistance = abs(lightToSurface);
+    float z = max(axisDistance.x, max(axisDistance.y, axisDistance.z));
+    float near = pointShadowRange.x;
+    float far = pointShadowRange.y;
+    float depth = (far + near) / (far - near) - 2.0 * far * near / ((far - near) * z);
+    return texture(pointShadowMap, vec4(lightToSurface, depth * 0.5 + 0.5));
+#endif
+}
+#endif
+
+#ifdef LIGHT_CLUSTERED
+// Same curve as the single point light, windowed to reach zero at the radius the light was culled with
+float attenuateClustered(float distance, float radius)
+{
+    float ratio = min(distance / radius, 1.0);
+    float window = 1.0 - ratio * ratio * ratio * ratio;
+    return window * window / (pow(5 * ratio, 2) + 1);
+}
+
+uint clusterIndex(float windowDepth)
+{
+    // View depth from the window depth of a perspective projection
+    float near = depthParams.x;
+    float far = depthParams.y;
+    float viewDepth = 2.0 * near * far / (far + near - (windowDepth * 2.0 - 1.0) * (far - near));
+    uint slice = uint(clamp(log(viewDepth) * depthParams.z + depthParams.w, 0.0, float(gridSize.z - 1)));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy) / gridSize.w, gridSize.xy - 1);
+    return (slice * gridSize.y + tile.y) * gridSize.x + tile.x;
+}
+
+// The specular textures are sampled by the caller, implicit derivatives are undefined in the non-uniform loop
+vec3 clusteredLights(vec3 worldPos, float windowDepth, vec3 normal, vec3 specularColor, float specularPower)
+{
+    vec3 result = vec3(0.0);
+    uvec2 cluster = clusters[clusterIndex(windowDepth)];
+    for (uint i = 0; i < cluster.y; i++)
+    {
+        ClusterLight light = lights[lightIndices[cluster.x + i]];
+        vec3 surfaceToLight = light.positionRadius.xyz - worldPos;
+        float distance = sqrt(dot(surfaceToLight, surfaceToLight));
+        if (distance >= light.positionRadius.w)
+            continue;
+        vec3 lightToSurface = -surfaceToLight / max(distance, 1e-4);
+        float gradient = attenuateClustered(distance, light.positionRadius.w);
+        // Spot lights
+        if (light.colorKind.w > 0.5)
+            gradient *= smoothstep(light.directionOuterCone.w, light.innerCone.x, dot(lightToSurface, light.directionOuterCone.xyz));
+
+        float NdotL = clamp(dot(normal, -lightToSurface), 0, 1);
+        result += light.colorKind.rgb * gradient * NdotL;
+#ifdef SPECULAR
+        result += light.colorKind.rgb * gradient * globalSpecMultiplier * specular(lightToSurface, normal, worldPos, specularColor, shininess, specularPower);
+#endif
+    }
+    return result;
+}
+#endif
+
+#ifdef NORMAL_MAP
+// The tangent frame of the vertices, generated at load like MikkTSpace does: the bitangent is rebuilt from the
+// interpolated normal and tangent, neither normalized, with the handedness in w
+vec3 perturbNormal(vec3 normal)
+{
+    vec3 bitangent = (v_tangent.w < 0.0 ? -1.0 : 1.0) * cross(v_normal, v_tangent.xyz);
+    vec3 mapNormal = MATERIAL_TEXTURE(normalTex, 1, dFdx(v_texCoord), dFdy(v_texCoord)).xyz * 2.0 - 1.0;
+    vec3 perturbed = mapNormal.x * v_tangent.xyz + mapNormal.y * bitangent + mapNormal.z * v_normal;
+    return dot(perturbed, perturbed) > 0.0 ? normalize(perturbed) : normal;
+}
+#endif
+
+void main()
+{
+#ifdef VIRTUAL_TEXTURE
+    vec2 uvDx = dFdx(v_texCoord);
+    vec2 uvDy = dFdy(v_texCoord);
+#endif
+#if defined(FEEDBACK)
+    feedback = virtualFeedback(uvDx, uvDy);
+#elif defined(DEFERRED)
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float windowDepth = texelFetch(gbufferDepthTex, pixel, 0).r;
+    // Nothing was drawn here, keeps the clear color
+    if (windowDepth == 1.0)
+        discard;
+    vec4 albedoPower = texelFetch(gbufferAlbedoTex, pixel, 0);
+    vec4 normalIntensity = texelFetch(gbufferNormalTex, pixel, 0);
+    vec4 diffuse = vec4(albedoPower.rgb, 1.0);
+    vec4 clipPos = vec4(gl_FragCoord.xy / vec2(textureSize(gbufferDepthTex, 0)), windowDepth, 1.0) * 2.0 - 1.0;
+    vec4 worldPosW = inverseViewProjection * clipPos;
+    vec3 worldPos = worldPosW.xyz / worldPosW.w;
+    vec3 normal = decodeNormal(normalIntensity.xyz);
+    vec3 specularColor = vec3(normalIntensity.w);
+    float specularPower = albedoPower.w;
+#else
+    vec4 diffuse = MATERIAL_TEXTURE(diffuseTex, 0, uvDx, uvDy);
+#ifdef ALPHA_TEST
+    if (diffuse.a < 0.1f)
+        discard;
+#endif
+    vec3 worldPos = v_worldPos.xyz;
+    float windowDepth = gl_FragCoord.z;
+    vec3 normal = normalize(v_normal);
+#ifdef NORMAL_MAP
+    normal = perturbNormal(normal);
+#endif
+#ifdef SPECULAR
+    vec3 specularColor = MATERIAL_TEXTURE(specularColorTex, 2, uvDx, uvDy).rgb;
+    float specularPower = MATERIAL_TEXTURE(specularPowerTex, 3, uvDx, uvDy).r;
+#else
+    vec3 specularColor = vec3(0.0);
+    float specularPower = 0.0;
+#endif
+#endif
+
+#if defined(DEPTH_ONLY) || defined(FEEDBACK)
+    // Only the alpha test above, or the feedback
+#elif defined(GBUFFER)
+    // The specular color is stored as its luminance, the specular maps are grey scale
+    gbufferAlbedo = vec4(diffuse.rgb, specularPower);
+    gbufferNormal = vec4(encodeNormal(normal), dot(specularColor, vec3(0.2126, 0.7152, 0.0722)));
+#elif defined(LIGHT_AMBIENT)
+    fragColor = vec4(ambientColor * diffuse.xyz, diffuse.a);
+#elif defined(LIGHT_CLUSTERED)
+    fragColor = vec4((ambientColor + clusteredLights(worldPos, windowDepth, normal, specularColor, specularPower)) * diffuse.xyz, diffuse.a);
+#else
+#if defined(LIGHT_DIRECTIONAL)
+    vec3 lightToSurface = lightDir;
+    float gradient = 1.0f;
+#elif defined(LIGHT_SPOT)
+    vec3 lightToSurface = lightDir;
+    float angle = abs(acos(dot(normalize(worldPos - lightPos), lightDir)));
+    float gradient = attenuate(angle, lightInnerCone, lightOuterCone);
+#else
+    // Point lights are omni directional, so the light direction is the direction from the light to the surface
+    vec3 surfaceToLight = lightPos - worldPos;
+    vec3 lightToSurface = -normalize(surfaceToLight);
+    float gradient = attenuate(sqrt(dot(surfaceToLight, surfaceToLight)), lightOuterRadius);
+#endif
+#ifdef SHADOWS
+    gradient *= shadow(worldPos);
+#endif
+
+    float NdotL = clamp(dot(normal, -lightToSurface), 0, 1);
+    vec3 lightContrib = lightColor * gradient * vec3(NdotL) + ambientColor;
+#ifdef SPECULAR
+    lightContrib += gradient * globalSpecMultiplier * specular(lightToSurface, normal, worldPos, specularColor, shininess, specularPower);
+#endif
+    fragColor = vec4(lightContrib * diffuse.xyz, diffuse.a);
+#endif
+}
@@ -1,18 +1,43 @@
 #version 440 core
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+#ifdef FULLSCREEN
+// One triangle covering the viewport, drawn without vertex buffers by the deferred lighting pass
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+#else
 uniform mat4 worldViewProjection;
 uniform mat4 world;
+// One transform per copy of the model, applied before the world transform
+layout (std430, binding = 3) readonly buffer InstanceTransforms
+{
+    mat4 instanceTransforms[];
+};
 layout (location = 0) in vec4 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texCoord;
+// Tangent and handedness, only set for normal-mapped materials
+layout (location = 3) in vec4 tangent;
 
-out vec4 v_worldPos;
-out vec3 v_normal;
-out vec2 v_texCoord;
+layout (location = 0) out vec4 v_worldPos;
+layout (location = 1) out vec3 v_normal;
+layout (location = 2) out vec2 v_texCoord;
+layout (location = 3) out vec4 v_tangent;
 
 void main()
 {
-    gl_Position = worldViewProjection * position;
-    v_worldPos = world * position;
-    v_normal = mat3(world) * normal;
+    mat4 instanceTransform = instanceTransforms[gl_InstanceID];
+    vec4 instancePosition = instanceTransform * position;
+    gl_Position = worldViewProjection * instancePosition;
+    v_worldPos = world * instancePosition;
+    v_normal = mat3(world) * (mat3(instanceTransform) * normal);
     v_texCoord = texCoord;
-}
\ No newline at end of file
+    v_tangent = vec4(mat3(world) * (mat3(instanceTransform) * tangent.xyz), tangent.w);
+}
+#endif